@@ -0,0 +1,18 @@
+# Copyright (c) 2012-2014 Microsoft Mobile.
+#
+# Measures the loopback round trip time of small messages with each latency
+# profile of the plug-in, see SocketOptions.
+
+TEMPLATE = app
+TARGET = latency
+QT += network
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+PLUGIN_SRC = ../../connectivityplugin/src
+INCLUDEPATH += $$PLUGIN_SRC
+
+HEADERS += $$PLUGIN_SRC/socketoptions.h
+SOURCES += main.cpp \
+    $$PLUGIN_SRC/socketoptions.cpp
@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+
+#include "socketoptions.h"
+
+/*
+  Round trips small messages over loopback with each latency profile.
+  Every message is written as a 4 byte header and a payload in two
+  writes, the way the plug-in frames its messages, which is the pattern
+  where Nagle's algorithm and delayed acknowledgements add tens of
+  milliseconds.
+
+  Usage: latency [rounds] [payload size]
+*/
+
+namespace
+{
+
+//Constants
+const int DefaultRounds(1000);
+const int DefaultPayloadSize(64);
+const int HeaderSize(4);
+const int Timeout(5000); //Milliseconds
+
+bool readFully(QTcpSocket *socket, int size, QByteArray *data)
+{
+    data->clear();
+
+    while (data->size() < size) {
+        if (!socket->bytesAvailable() && !socket->waitForReadyRead(Timeout)) {
+            return false;
+        }
+
+        data->append(socket->read(size - data->size()));
+    }
+
+    return true;
+}
+
+void writeMessage(QTcpSocket *socket, const QByteArray &header, const QByteArray &payload)
+{
+    socket->write(header);
+    socket->flush();
+    socket->write(payload);
+    socket->flush();
+}
+
+/*
+  Echoes every message back to the client, in two writes as well.
+*/
+class EchoServer : public QThread
+{
+public:
+    EchoServer(const SocketOptions &options, int rounds, int payloadSize) :
+        mOptions(options),
+        mRounds(rounds),
+        mPayloadSize(payloadSize),
+        mPort(0)
+    {
+        mServer.listen(QHostAddress::LocalHost);
+        mPort = mServer.serverPort();
+        mServer.moveToThread(this);
+    }
+
+    quint16 port() const { return mPort; }
+
+protected:
+    void run()
+    {
+        if (!mServer.waitForNewConnection(Timeout)) {
+            return;
+        }
+
+        QTcpSocket *socket = mServer.nextPendingConnection();
+        mOptions.apply(socket);
+        QByteArray message;
+
+        for (int i = 0; i < mRounds; ++i) {
+            if (!readFully(socket, HeaderSize + mPayloadSize, &message)) {
+                break;
+            }
+
+            writeMessage(socket, message.left(HeaderSize), message.mid(HeaderSize));
+        }
+
+        socket->waitForBytesWritten(Timeout);
+        delete socket;
+        mServer.close();
+    }
+
+private:
+    QTcpServer mServer;
+    SocketOptions mOptions;
+    int mRounds;
+    int mPayloadSize;
+    quint16 mPort;
+};
+
+/*
+  Returns the average round trip time in microseconds with \a options,
+  or -1 if the round trips failed.
+*/
+qint64 measure(const SocketOptions &options, int rounds, int payloadSize)
+{
+    EchoServer server(options, rounds, payloadSize);
+    server.start();
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.port());
+
+    if (!socket.waitForConnected(Timeout)) {
+        server.wait();
+        return -1;
+    }
+
+    options.apply(&socket);
+
+    QByteArray header(HeaderSize, '\0');
+    QByteArray payload(payloadSize, 'x');
+    QByteArray reply;
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < rounds; ++i) {
+        writeMessage(&socket, header, payload);
+
+        if (!readFully(&socket, HeaderSize + payloadSize, &reply)) {
+            server.wait();
+            return -1;
+        }
+    }
+
+    qint64 elapsed = timer.elapsed();
+    socket.close();
+    server.wait();
+
+    return elapsed * 1000 / rounds;
+}
+
+} //anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int rounds = args.value(1).toInt();
+    int payloadSize = args.value(2).toInt();
+
+    if (rounds <= 0) {
+        rounds = DefaultRounds;
+    }
+
+    if (payloadSize <= 0) {
+        payloadSize = DefaultPayloadSize;
+    }
+
+    QTextStream out(stdout);
+    out << "Loopback round trips: " << rounds << ", payload: " << payloadSize
+        << " bytes" << endl;
+
+    QList<QPair<QString, SocketOptions> > profiles;
+    profiles << qMakePair(QString("Interactive"), SocketOptions(SocketOptions::Interactive))
+             << qMakePair(QString("Bulk"), SocketOptions(SocketOptions::Bulk))
+             << qMakePair(QString("System default"), SocketOptions(SocketOptions::SystemDefault));
+
+    for (int i = 0; i < profiles.size(); ++i) {
+        qint64 rtt = measure(profiles.at(i).second, rounds, payloadSize);
+        out << profiles.at(i).first << ": ";
+
+        if (rtt < 0) {
+            out << "failed" << endl;
+        } else {
+            out << "average RTT " << rtt << " us" << endl;
+        }
+    }
+
+    return 0;
+}
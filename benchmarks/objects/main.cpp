@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QScriptEngine>
+#include <QScriptValue>
+#include <QStringList>
+#include <QTextStream>
+#include <QVariantMap>
+
+#include "objectcodec.h"
+
+/*
+  Encodes and decodes a small object, e.g. the state of a player, with
+  ObjectCodec with and without a schema, and with the JSON round trip the
+  applications used before it: JSON.stringify() into a string sent as
+  UTF-8 and JSON.parse() on the other end.
+
+  Usage: objects [rounds]
+*/
+
+namespace
+{
+
+//Constants
+const int DefaultRounds(100000);
+const int SchemaId(1);
+
+/*
+  Returns the time of an encode and decode in nanoseconds with \a codec,
+  or -1 if decoding failed. \a size is set to the size of the encoding.
+*/
+qint64 measureCodec(const ObjectCodec &codec, const QVariantMap &object, int schemaId,
+                    int rounds, int *size)
+{
+    QVariantMap decoded;
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < rounds; ++i) {
+        QByteArray bytes = codec.encode(object, schemaId);
+
+        if (!codec.decode(bytes, &decoded) || decoded.size() != object.size()) {
+            return -1;
+        }
+
+        *size = bytes.size();
+    }
+
+    return timer.elapsed() * 1000000 / rounds;
+}
+
+/*
+  Like above, with the JSON round trip in \a engine.
+*/
+qint64 measureJson(QScriptEngine *engine, const QVariantMap &object, int rounds, int *size)
+{
+    QScriptValue json = engine->globalObject().property("JSON");
+    QScriptValue stringify = json.property("stringify");
+    QScriptValue parse = json.property("parse");
+    QVariantMap decoded;
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < rounds; ++i) {
+        QScriptValue value = engine->toScriptValue(object);
+        QByteArray bytes = stringify.call(json, QScriptValueList() << value).toString().toUtf8();
+        QScriptValue parsed = parse.call(json, QScriptValueList() << QString::fromUtf8(bytes));
+        decoded = parsed.toVariant().toMap();
+
+        if (decoded.size() != object.size()) {
+            return -1;
+        }
+
+        *size = bytes.size();
+    }
+
+    return timer.elapsed() * 1000000 / rounds;
+}
+
+void report(QTextStream &out, const QString &name, qint64 time, int size)
+{
+    out << name << ": ";
+
+    if (time < 0) {
+        out << "failed" << endl;
+    } else {
+        out << time << " ns per round trip, " << size << " bytes" << endl;
+    }
+}
+
+} //anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    int rounds = app.arguments().value(1).toInt();
+
+    if (rounds <= 0) {
+        rounds = DefaultRounds;
+    }
+
+    QVariantMap object;
+    object.insert("id", 42);
+    object.insert("x", 10.0);
+    object.insert("y", 20.5);
+    object.insert("pressed", true);
+    object.insert("name", QString("player1"));
+
+    ObjectCodec codec;
+    codec.addSchema(SchemaId, QStringList() << "id:int32" << "x:float" << "y:float"
+                                            << "pressed:bool" << "name:string");
+
+    QScriptEngine engine;
+
+    QTextStream out(stdout);
+    out << "Encode and decode rounds: " << rounds << endl;
+
+    int size = 0;
+    qint64 time = measureCodec(codec, object, -1, rounds, &size);
+    report(out, "Binary", time, size);
+
+    time = measureCodec(codec, object, SchemaId, rounds, &size);
+    report(out, "Binary with a schema", time, size);
+
+    time = measureJson(&engine, object, rounds, &size);
+    report(out, "JSON", time, size);
+
+    return 0;
+}
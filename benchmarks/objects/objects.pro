@@ -0,0 +1,22 @@
+# Copyright (c) 2012-2014 Microsoft Mobile.
+#
+# Compares the binary encoding of objects, see ObjectCodec, with the JSON
+# round trip the applications used before it.
+
+TEMPLATE = app
+TARGET = objects
+QT += script
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+PLUGIN_SRC = ../../connectivityplugin/src
+INCLUDEPATH += $$PLUGIN_SRC
+
+HEADERS += $$PLUGIN_SRC/common.h \
+    $$PLUGIN_SRC/objectcodec.h \
+    $$PLUGIN_SRC/objectschema.h
+SOURCES += main.cpp \
+    $$PLUGIN_SRC/common.cpp \
+    $$PLUGIN_SRC/objectcodec.cpp \
+    $$PLUGIN_SRC/objectschema.cpp
@@ -19,8 +19,30 @@ HEADERS += \
     $$PWD/src/wlanclient.h \
     $$PWD/src/wlandiscoverymgr.h \
     $$PWD/src/networkserverinfo.h \
+    $$PWD/src/reconnectpolicy.h \
     $$PWD/src/wlannetworkmgr.h \
-    $$PWD/src/common.h
+    $$PWD/src/common.h \
+    $$PWD/src/servercache.h \
+    $$PWD/src/outbox.h \
+    $$PWD/src/socketoptions.h \
+    $$PWD/src/heartbeat.h \
+    $$PWD/src/relayrouter.h \
+    $$PWD/src/admissioncontrol.h \
+    $$PWD/src/iothread.h \
+    $$PWD/src/compressionpool.h \
+    $$PWD/src/compressionpolicy.h \
+    $$PWD/src/compressiondictionary.h \
+    $$PWD/src/handshake.h \
+    $$PWD/src/channelmux.h \
+    $$PWD/src/channel.h \
+    $$PWD/src/sendqueue.h \
+    $$PWD/src/deltacodec.h \
+    $$PWD/src/rpcmessage.h \
+    $$PWD/src/rpccall.h \
+    $$PWD/src/topicindex.h \
+    $$PWD/src/objectcodec.h \
+    $$PWD/src/objectschema.h \
+    $$PWD/src/serverprotocol.h
 
 SOURCES += \
     $$PWD/src/bluetoothclient.cpp \
@@ -35,14 +57,43 @@ SOURCES += \
     $$PWD/src/wlanclient.cpp \
     $$PWD/src/wlandiscoverymgr.cpp \
     $$PWD/src/networkserverinfo.cpp \
+    $$PWD/src/reconnectpolicy.cpp \
     $$PWD/src/wlannetworkmgr.cpp \
-    $$PWD/src/common.cpp
+    $$PWD/src/common.cpp \
+    $$PWD/src/servercache.cpp \
+    $$PWD/src/outbox.cpp \
+    $$PWD/src/socketoptions.cpp \
+    $$PWD/src/heartbeat.cpp \
+    $$PWD/src/relayrouter.cpp \
+    $$PWD/src/admissioncontrol.cpp \
+    $$PWD/src/iothread.cpp \
+    $$PWD/src/compressionpool.cpp \
+    $$PWD/src/compressionpolicy.cpp \
+    $$PWD/src/compressiondictionary.cpp \
+    $$PWD/src/handshake.cpp \
+    $$PWD/src/channelmux.cpp \
+    $$PWD/src/channel.cpp \
+    $$PWD/src/sendqueue.cpp \
+    $$PWD/src/deltacodec.cpp \
+    $$PWD/src/rpcmessage.cpp \
+    $$PWD/src/rpccall.cpp \
+    $$PWD/src/topicindex.cpp \
+    $$PWD/src/objectcodec.cpp \
+    $$PWD/src/objectschema.cpp \
+    $$PWD/src/serverprotocol.cpp
 
 qmldir.files += $$PWD/src/qmldir
 qmldir.path +=  $$[QT_INSTALL_IMPORTS]/$$TARGETPATH
 
 INSTALLS += qmldir
 
+win32: LIBS += -lws2_32
+
+# zlib for the preset compression dictionaries, QtCore bundles it on Windows
+symbian: LIBS += -llibz
+else:win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+else: LIBS += -lz
+
 simulator|win32|macx|unix:isEmpty(MEEGO_VERSION_MAJOR):!symbian {
     HEADERS += $$PWD/src/bluetoothstubs.h
     DEFINES += DISABLE_BLUETOOTH
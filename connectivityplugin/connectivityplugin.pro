@@ -19,8 +19,30 @@ HEADERS += \
     src/wlanclient.h \
     src/wlandiscoverymgr.h \
     src/networkserverinfo.h \
+    src/reconnectpolicy.h \
     src/wlannetworkmgr.h \
-    src/common.h
+    src/common.h \
+    src/servercache.h \
+    src/outbox.h \
+    src/socketoptions.h \
+    src/heartbeat.h \
+    src/relayrouter.h \
+    src/admissioncontrol.h \
+    src/iothread.h \
+    src/compressionpool.h \
+    src/compressionpolicy.h \
+    src/compressiondictionary.h \
+    src/handshake.h \
+    src/channelmux.h \
+    src/channel.h \
+    src/sendqueue.h \
+    src/deltacodec.h \
+    src/rpcmessage.h \
+    src/rpccall.h \
+    src/topicindex.h \
+    src/objectcodec.h \
+    src/objectschema.h \
+    src/serverprotocol.h
 
 SOURCES += \
     src/bluetoothclient.cpp \
@@ -35,14 +57,43 @@ SOURCES += \
     src/wlanclient.cpp \
     src/wlandiscoverymgr.cpp \
     src/networkserverinfo.cpp \
+    src/reconnectpolicy.cpp \
     src/wlannetworkmgr.cpp \
-    src/common.cpp
+    src/common.cpp \
+    src/servercache.cpp \
+    src/outbox.cpp \
+    src/socketoptions.cpp \
+    src/heartbeat.cpp \
+    src/relayrouter.cpp \
+    src/admissioncontrol.cpp \
+    src/iothread.cpp \
+    src/compressionpool.cpp \
+    src/compressionpolicy.cpp \
+    src/compressiondictionary.cpp \
+    src/handshake.cpp \
+    src/channelmux.cpp \
+    src/channel.cpp \
+    src/sendqueue.cpp \
+    src/deltacodec.cpp \
+    src/rpcmessage.cpp \
+    src/rpccall.cpp \
+    src/topicindex.cpp \
+    src/objectcodec.cpp \
+    src/objectschema.cpp \
+    src/serverprotocol.cpp
 
 qmldir.files += src/qmldir
 qmldir.path +=  $$[QT_INSTALL_IMPORTS]/$$TARGETPATH
 
 INSTALLS += qmldir
 
+win32: LIBS += -lws2_32
+
+# zlib for the preset compression dictionaries, QtCore bundles it on Windows
+symbian: LIBS += -llibz
+else:win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+else: LIBS += -lz
+
 simulator|win32|macx|unix:isEmpty(MEEGO_VERSION_MAJOR):!symbian {
     HEADERS += src/bluetoothstubs.h
     DEFINES += DISABLE_BLUETOOTH
@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "admissioncontrol.h"
+
+#include <qmath.h>
+
+/*!
+  \class AdmissionControl
+  \brief Limits the rate at which a server accepts new connections.
+
+  A token bucket holding up to \c burst tokens is refilled with \c rate tokens
+  per second and each accepted connection takes one token. Connections
+  arriving while the bucket is empty wait, up to \c backlog of them, and the
+  rest are turned away with a hint to retry after \c retryAfter() milliseconds.
+*/
+
+/*!
+  Constructor. The rate is unlimited by default.
+*/
+AdmissionControl::AdmissionControl() :
+    mRate(0),
+    mBurst(10),
+    mBacklog(32),
+    mRetryDelay(1000),
+    mTokens(10)
+{
+}
+
+/*!
+  Sets the number of connections accepted per second to \a rate. 0 means unlimited.
+*/
+void AdmissionControl::setRate(int rate)
+{
+    mRate = qMax(0, rate);
+}
+
+/*!
+  Sets the number of connections that can be accepted back to back to \a burst.
+*/
+void AdmissionControl::setBurst(int burst)
+{
+    mBurst = qMax(1, burst);
+    mTokens = qMin(mTokens, qreal(mBurst));
+}
+
+/*!
+  Sets the number of connections waiting to be accepted to \a backlog.
+  0 means that the connections are turned away right when the bucket is empty.
+*/
+void AdmissionControl::setBacklog(int backlog)
+{
+    mBacklog = qMax(0, backlog);
+}
+
+/*!
+  Sets the shortest delay in milliseconds a turned away client is asked to wait to \a delay.
+*/
+void AdmissionControl::setRetryDelay(int delay)
+{
+    mRetryDelay = qMax(0, delay);
+}
+
+/*!
+  Takes a token for a new connection. Returns false if the bucket is empty
+  and the connection has to wait.
+*/
+bool AdmissionControl::tryAcquire()
+{
+    if (!isEnabled()) {
+        return true;
+    }
+
+    refill();
+
+    if (mTokens < 1.0) {
+        return false;
+    }
+
+    mTokens -= 1.0;
+    return true;
+}
+
+/*!
+  Returns the time in milliseconds until the next token is available.
+*/
+int AdmissionControl::nextTokenIn()
+{
+    if (!isEnabled()) {
+        return 0;
+    }
+
+    refill();
+
+    if (mTokens >= 1.0) {
+        return 0;
+    }
+
+    return qCeil((1.0 - mTokens) * 1000 / mRate);
+}
+
+/*!
+  Returns the time in milliseconds a client turned away while \a queued
+  connections are waiting should wait before trying again, i.e. the time it
+  takes to accept the waiting ones, but at least \c retryDelay.
+*/
+int AdmissionControl::retryAfter(int queued) const
+{
+    if (!isEnabled()) {
+        return mRetryDelay;
+    }
+
+    return qMax(mRetryDelay, (queued + 1) * 1000 / mRate);
+}
+
+/*!
+  Adds the tokens gained since the last refill.
+*/
+void AdmissionControl::refill()
+{
+    if (!mClock.isValid()) {
+        mClock.start();
+        mTokens = mBurst;
+        return;
+    }
+
+    qint64 elapsed = mClock.restart();
+    mTokens = qMin(qreal(mBurst), mTokens + qreal(elapsed) * mRate / 1000);
+}
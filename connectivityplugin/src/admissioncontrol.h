@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+class AdmissionControl
+{
+public:
+    AdmissionControl();
+
+    int rate() const { return mRate; }
+    int burst() const { return mBurst; }
+    int backlog() const { return mBacklog; }
+    int retryDelay() const { return mRetryDelay; }
+    bool isEnabled() const { return mRate > 0; }
+
+    void setRate(int rate);
+    void setBurst(int burst);
+    void setBacklog(int backlog);
+    void setRetryDelay(int delay);
+
+    bool tryAcquire();
+    int nextTokenIn();
+    int retryAfter(int queued) const;
+
+private:
+    void refill();
+
+private:
+    int mRate; // Accepted connections per second, 0 means unlimited
+    int mBurst; // Connections accepted back to back
+    int mBacklog; // Connections waiting for a token
+    int mRetryDelay; // Milliseconds
+    qreal mTokens;
+    QElapsedTimer mClock;
+};
+
+#endif // ADMISSIONCONTROL_H
@@ -18,10 +18,6 @@
 #include <qbluetoothdeviceinfo.h>
 #endif
 
-// Constants
-const int NumberOfRetries(3);
-const int RetryInterval(500); // Milliseconds
-
 
 /*!
   \class BluetoothClient
@@ -34,9 +30,22 @@ const int RetryInterval(500); // Milliseconds
 BluetoothClient::BluetoothClient(QObject *parent)
     : QObject(parent),
       mSocket(0),
-      mRetries(0),
+      mRetryTimer(this),
+      mHeartbeat(this),
+      mDecoder(this),
+      mQueue(this),
+      mMux(this),
+      mAttempts(0),
+      mClientStarted(false),
+      mConnected(false),
+      mHello(false),
       mLastErrorString("")
 {
+    mRetryTimer.setSingleShot(true);
+    connect(&mRetryTimer, SIGNAL(timeout()), this, SLOT(connectToService()));
+
+    connect(&mHeartbeat, SIGNAL(timedOut(QIODevice*)), this, SLOT(onHeartbeatTimeout(QIODevice*)));
+    connect(&mDecoder, SIGNAL(finished(int,QByteArray,QVariant)), this, SLOT(onDecoded(int,QByteArray,QVariant)));
 }
 
 /*!
@@ -52,22 +61,71 @@ QString BluetoothClient::errorString() const
     return mLastErrorString;
 }
 
+/*!
+  Sets the \a policy used for retrying and reconnecting.
+*/
+void BluetoothClient::setReconnectPolicy(const ReconnectPolicy &policy)
+{
+    mPolicy = policy;
+}
+
+/*!
+  Sets the \a options applied to the connected socket. Only the kernel buffer
+  sizes apply to Bluetooth sockets.
+*/
+void BluetoothClient::setSocketOptions(const SocketOptions &options)
+{
+    mSocketOptions = options;
+
+    if (mSocket && mConnected) {
+        mSocketOptions.applyToDescriptor(mSocket->socketDescriptor());
+    }
+}
+
+/*!
+  Sends a heartbeat after \a interval milliseconds without other traffic and
+  drops the connection if nothing is received from the server in \a timeout
+  milliseconds. 0 \a interval disables the heartbeats.
+*/
+void BluetoothClient::setHeartbeat(int interval, int timeout)
+{
+    mHeartbeat.setInterval(interval);
+    mHeartbeat.setTimeout(timeout);
+}
+
+/*!
+  Sets whether a HELLO is sent to the server when connected to \a enabled.
+  Servers from before the handshake don't understand it.
+*/
+void BluetoothClient::setHandshake(bool enabled)
+{
+    mHello = enabled;
+}
+
+/*!
+  Sets the preset \a dictionary used for uncompressing the received messages.
+*/
+void BluetoothClient::setCompressionDictionary(const CompressionDictionary &dictionary)
+{
+    mDecoder.setDictionary(dictionary);
+}
+
 /*!
   Initializes the client and connects to \a remoteService.
 */
 void BluetoothClient::startClient(const QBluetoothServiceInfo &remoteService)
 {
-    if (mSocket || mRetries) {
+    if (mSocket) {
         qDebug() << "BluetoothClient::startClient(): Already running!";
         return;
     }
 
     mService = remoteService;
-    mRetries = NumberOfRetries;
+    mAttempts = 0;
+    mClientStarted = true;
+    mConnected = false;
     mLastErrorString = "";
 
-    Common::resetBuffer();
-
     QBluetoothAddress address = mService.device().address();
     qDebug() << "BluetoothClient::startClient(): Bluetooth address: " << address.toString();
 
@@ -81,7 +139,7 @@ void BluetoothClient::startClient(const QBluetoothServiceInfo &remoteService)
     // mSocket->connectToService() call may block the UI thread. Thus, use the
     // the timer to delay the call in case we want to show some note for the
     // user.
-    QTimer::singleShot(RetryInterval, this, SLOT(connectToService()));
+    mRetryTimer.start(mPolicy.initialDelay());
 }
 
 
@@ -90,11 +148,21 @@ void BluetoothClient::startClient(const QBluetoothServiceInfo &remoteService)
 */
 void BluetoothClient::stopClient()
 {
+    mRetryTimer.stop();
+
     if (mSocket) {
         qDebug() << "BluetoothClient::stopClient(): Disconnecting...";
+        mClientStarted = false;
+        mHeartbeat.remove(mSocket);
+        mMux.remove(mSocket);
+        mQueue.remove(mSocket);
+        mDecoder.clear();
+        mDeltaDecoder.clear();
         mSocket->disconnectFromService();
+        Common::resetBuffer(mSocket);
         delete mSocket;
         mSocket = 0;
+        mConnected = false;
     }
     else {
         qDebug() << "BluetoothClient::stopClient(): Not connected!";
@@ -107,20 +175,115 @@ void BluetoothClient::stopClient()
   if failed to write any data.
 */
 qint64 BluetoothClient::write(const QByteArray &data)
+{
+    return write(data, SendQueue::NormalPriority, 0);
+}
+
+/*!
+  Writes \a data with \a priority. With a send queue the message is queued
+  and dropped if not sent by \a expires, in milliseconds since epoch, 0
+  meaning never. A message with \a key replaces the one with the same key
+  still queued, and with \a delta is sent as a delta to the previous one,
+  see SendQueue::write(). Returns the number of bytes written or queued, or
+  -1 if failed to write any data.
+*/
+qint64 BluetoothClient::write(const QByteArray &data, int priority, qint64 expires,
+                               const QString &key, bool delta)
 {
     if (mSocket) {
-        return mSocket->write(data);
+        mHeartbeat.sent(mSocket);
+        return mQueue.write(mSocket, data, priority, expires, key, delta);
     }
 
     return -1;
 }
 
 
+/*!
+  Writes \a message on \a channel, compressed as a whole if \a compressed
+  is set. The message is queued and interleaved with the other channels,
+  see ChannelMux. A server that doesn't support channels gets it as an
+  ordinary message. Returns the size of \a message or -1 if not connected.
+*/
+qint64 BluetoothClient::write(const ChannelInfo &channel, const QByteArray &message,
+                              bool compressed)
+{
+    if (!mSocket) {
+        return -1;
+    }
+
+    mHeartbeat.sent(mSocket);
+
+    //Behind the messages already queued for the server
+    if (!mMux.contains(mSocket)) {
+        return mQueue.write(mSocket, compressed ? Common::toCompressedMessage(message)
+                                                : Common::toMessage(message));
+    }
+
+    mMux.send(mSocket, channel, message, compressed);
+    return message.size();
+}
+
+
+/*!
+  Returns the number of bytes waiting to be written to the server,
+  including the messages queued on channels.
+*/
+qint64 BluetoothClient::bytesToWrite() const
+{
+    return mSocket ? mSocket->bytesToWrite() + mMux.bytesQueued(mSocket)
+                     + mQueue.bytesQueued(mSocket) : 0;
+}
+
+/*!
+  Sets the \a mode of the send queue, see SendQueue.
+*/
+void BluetoothClient::setQueueMode(int mode)
+{
+    mQueue.setMode(static_cast<SendQueue::Mode>(mode));
+}
+
+/*!
+  Subscribes to the messages published on \a subscriptions, replacing the
+  earlier ones, see TopicIndex. They are sent to the server if it supports
+  topics, now and after each reconnection.
+*/
+void BluetoothClient::setSubscriptions(const QStringList &subscriptions)
+{
+    mSubscriptions = subscriptions;
+
+    if (mSocket && mHandshake.hasFeature(Handshake::TopicsFeature)) {
+        write(Common::toControlMessage(TopicIndex::toSubscribe(mSubscriptions)));
+    }
+}
+
+/*!
+  Returns the statistics of the send queue per priority class.
+*/
+QList<SendQueue::Statistics> BluetoothClient::queueStatistics() const
+{
+    return mQueue.statistics();
+}
+
+/*!
+  Returns the protocol settings agreed with the server. The handshake is
+  invalid until the server has sent a HELLO, and stays invalid with older
+  servers.
+*/
+Handshake BluetoothClient::handshake() const
+{
+    return mHandshake;
+}
+
 /*!
   Tries to connect to the set service. Returns the socket state after.
 */
 int BluetoothClient::connectToService()
 {
+    if (!mSocket) {
+        return -1;
+    }
+
     qDebug() << "BluetoothClient::connectToService(): Trying to connect to service"
              << mService.device().name();
              //<< mSocket->peerName();
@@ -136,19 +299,146 @@ void BluetoothClient::onConnected()
 {
     qDebug() << "BluetoothClient::onConnected(): Connected to"
              << mSocket->peerName() << "; Socket state is" << mSocket->state();
-    mRetries = 0;
+    mSocketOptions.applyToDescriptor(mSocket->socketDescriptor());
+    mAttempts = 0;
+    mConnected = true;
+
+    mHandshake = Handshake();
+
+    if (mHello) {
+        Handshake hello = Handshake::local(mDecoder.dictionary(), mHeartbeat.interval() > 0);
+        write(Common::toControlMessage(hello.toControl()));
+    }
+
     emit connectedToService(mSocket->peerName());
 }
 
 
 /*!
-  Disconnected from the server.
+  Disconnected from the server. If the policy allows it we'll reconnect to the
+  same service by ourselves.
 */
 void BluetoothClient::onDisconnected()
 {
     qDebug() << "BluetoothClient::onDisconnected():" << mSocket->state();
+    connectionLost();
+}
+
+/*!
+  The server hasn't sent anything, not even heartbeats, in time. The
+  connection is considered lost.
+*/
+void BluetoothClient::onHeartbeatTimeout(QIODevice *device)
+{
+    if (!mSocket || device != mSocket) {
+        return;
+    }
+
+    qDebug() << "BluetoothClient::onHeartbeatTimeout(): Server is not responding";
+
+    mSocket->blockSignals(true);
+    mSocket->abort();
+    mSocket->blockSignals(false);
 
-    if (!mRetries) {
+    connectionLost();
+}
+
+/*!
+  A message from the server has been decoded. \a channel is the name of the
+  channel the message was sent on, if any.
+*/
+void BluetoothClient::onDecoded(int stream, const QByteArray &message, const QVariant &channel)
+{
+    Q_UNUSED(stream);
+
+    if (channel.type() == QVariant::Bool) {
+        emit objectRead(message);
+    } else if (channel.type() == QVariant::List) {
+        emit topicRead(channel.toList().value(0).toString(), message);
+    } else if (channel.isValid()) {
+        emit channelRead(channel.toString(), message);
+    } else {
+        emit read(message);
+    }
+}
+
+/*!
+  Agrees on the protocol settings with the server that sent the \a hello
+  control message.
+*/
+void BluetoothClient::completeHandshake(const QByteArray &hello)
+{
+    Handshake local = Handshake::local(mDecoder.dictionary(), mHeartbeat.interval() > 0);
+    Handshake agreed = local.agree(Handshake::fromControl(hello));
+
+    if (!agreed.isValid()) {
+        qDebug() << "BluetoothClient::completeHandshake(): Invalid HELLO";
+        return;
+    }
+
+    qDebug() << "BluetoothClient::completeHandshake():" << agreed.toControl();
+    mHandshake = agreed;
+
+    if (mHandshake.hasFeature(Handshake::HeartbeatFeature)) {
+        mHeartbeat.add(mSocket);
+    }
+
+    if (mHandshake.hasFeature(Handshake::ChannelsFeature)) {
+        mMux.add(mSocket, mHandshake.maxFrameSize());
+    }
+
+    mQueue.setDeltaEncoding(mSocket, mHandshake.hasFeature(Handshake::DeltaFeature));
+
+    if (mHandshake.hasFeature(Handshake::TopicsFeature) && !mSubscriptions.isEmpty()) {
+        write(Common::toControlMessage(TopicIndex::toSubscribe(mSubscriptions)));
+    }
+
+    emit handshakeCompleted(mHandshake.toVariantMap());
+}
+
+/*!
+  Decodes the delta \a frame received from the server. If the message it
+  was made against is missing, the server is asked for a snapshot.
+*/
+void BluetoothClient::readDelta(const Common::Frame &frame)
+{
+    QString key;
+    QByteArray message;
+
+    switch (mDeltaDecoder.decode(frame, &key, &message)) {
+    case DeltaCodec::Decoded:
+        mDecoder.submit(0, message, CompressionPool::Pass, QVariant());
+        break;
+    case DeltaCodec::Gap:
+        write(Common::toControlMessage(DeltaCodec::toResync(key)));
+        break;
+    default:
+        break;
+    }
+}
+
+/*!
+  Handles the lost connection to the server.
+*/
+void BluetoothClient::connectionLost()
+{
+    mHeartbeat.remove(mSocket);
+    mMux.remove(mSocket);
+    mQueue.remove(mSocket);
+    mDeltaDecoder.clear();
+
+    bool wasConnected = mConnected;
+    mConnected = false;
+
+    if (wasConnected && mClientStarted && mPolicy.autoReconnect()
+        && mPolicy.canRetry(mAttempts))
+    {
+        Common::resetBuffer(mSocket);
+        scheduleRetry();
+        return;
+    }
+
+    if (!mRetryTimer.isActive()) {
         emit disconnectedFromServer();
     }
 }
@@ -165,8 +455,40 @@ void BluetoothClient::onReadyRead()
     }
 
     qDebug() << "BluetoothClient::onReadyRead(): =>";
-    Common::readFromSocket(mSocket, this, "read",
-                           "BluetoothClient::onReadyRead():");
+    mHeartbeat.received(mSocket);
+
+    foreach (const Common::Frame &frame,
+             Common::readFrames(mSocket, "BluetoothClient::onReadyRead():")) {
+        if (frame.channel >= 0) {
+            QString channel;
+            QByteArray message;
+
+            if (mMux.receive(mSocket, frame, &channel, &message)) {
+                mDecoder.submit(0, message, frame.compressed ? CompressionPool::Uncompress
+                                                             : CompressionPool::Pass, channel);
+            }
+        } else if (frame.delta) {
+            readDelta(frame);
+        } else if (frame.rpc) {
+            emit rpcRead(frame.payload());
+        } else if (!frame.topic.isEmpty()) {
+            mDecoder.submit(0, frame.payload(), frame.compressed ? CompressionPool::Uncompress
+                                                                 : CompressionPool::Pass,
+                            QVariantList() << frame.topic);
+        } else if (frame.object) {
+            //The route tells onDecoded() that the message is an object
+            mDecoder.submit(0, frame.payload(), CompressionPool::Pass, QVariant(true));
+        } else if (!frame.control) {
+            mDecoder.decode(0, frame);
+        } else if (Handshake::isHello(frame.message())) {
+            completeHandshake(frame.message());
+        } else if (ChannelMux::isAnnouncement(frame.message())) {
+            mMux.announced(mSocket, frame.message());
+        } else if (DeltaCodec::isResync(frame.message())) {
+            mQueue.resync(mSocket, DeltaCodec::resyncKey(frame.message()));
+        }
+    }
+
     qDebug() << "BluetoothClient::onReadyRead(): <=";
 }
 
@@ -178,13 +500,36 @@ void BluetoothClient::onSocketError(QBluetoothSocket::SocketError error)
 {
     qDebug() << "BluetoothClient::onSocketError():" << error;
 
-    if (mRetries > 0) {
-        mRetries--;
-        qDebug() << "BluetoothClient::onSocketError(): Will try" << mRetries << "more time(s).";
-        QTimer::singleShot(RetryInterval, this, SLOT(connectToService()));
+    if (mRetryTimer.isActive()) {
+        return;
+    }
+
+    // A dropped connection is handled in onDisconnected()
+    if (mConnected && mPolicy.autoReconnect()) {
+        return;
+    }
+
+    if (!mConnected && mPolicy.canRetry(mAttempts)) {
+        scheduleRetry();
     } else {
         mLastErrorString = mSocket->errorString();
         emit socketError((int) error);
     }
 }
 
+
+/*!
+  Schedules the next connection attempt according to the reconnect policy.
+*/
+void BluetoothClient::scheduleRetry()
+{
+    int delay = mPolicy.delay(mAttempts);
+    ++mAttempts;
+
+    qDebug() << "BluetoothClient::scheduleRetry(): Attempt" << mAttempts
+             << "in" << delay << "ms";
+
+    mRetryTimer.start(delay);
+    emit reconnecting(mAttempts, delay);
+}
+
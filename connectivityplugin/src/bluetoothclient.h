@@ -12,6 +12,17 @@
 #include <QByteArray>
 #include <QObject>
 #include <QVariant>
+#include <QTimer>
+
+#include "channelmux.h"
+#include "compressionpool.h"
+#include "deltacodec.h"
+#include "handshake.h"
+#include "heartbeat.h"
+#include "reconnectpolicy.h"
+#include "sendqueue.h"
+#include "socketoptions.h"
+#include "topicindex.h"
 
 #if defined(Q_WS_SIMULATOR) || defined(DISABLE_BLUETOOTH)
 #include "bluetoothstubs.h"
@@ -36,10 +47,24 @@ public:
     ~BluetoothClient();    
 
     QString errorString() const;
+    qint64 bytesToWrite() const;
+    Handshake handshake() const;
+    QList<SendQueue::Statistics> queueStatistics() const;
+    void setReconnectPolicy(const ReconnectPolicy &policy);
+    void setSocketOptions(const SocketOptions &options);
+    void setHeartbeat(int interval, int timeout);
+    void setHandshake(bool enabled);
+    void setCompressionDictionary(const CompressionDictionary &dictionary);
+    void setQueueMode(int mode);
+    void setSubscriptions(const QStringList &subscriptions);
+
 public slots:
     void startClient(const QBluetoothServiceInfo &remoteService);
     void stopClient();
     qint64 write(const QByteArray &data);
+    qint64 write(const QByteArray &data, int priority, qint64 expires,
+                 const QString &key = QString(), bool delta = false);
+    qint64 write(const ChannelInfo &channel, const QByteArray &message, bool compressed);
 
 private slots:
     int connectToService();
@@ -47,17 +72,44 @@ private slots:
     void onDisconnected();
     void onReadyRead();
     void onSocketError(QBluetoothSocket::SocketError error);
+    void onHeartbeatTimeout(QIODevice *device);
+    void onDecoded(int stream, const QByteArray &message, const QVariant &channel);
+
+private:
+    void connectionLost();
+    void scheduleRetry();
+    void completeHandshake(const QByteArray &hello);
+    void readDelta(const Common::Frame &frame);
 
 signals:
     void connectedToService(const QString &name);
     void disconnectedFromServer();
     void read(const QByteArray &data);
+    void channelRead(const QString &channel, const QByteArray &data);
+    void rpcRead(const QByteArray &data);
+    void topicRead(const QString &topic, const QByteArray &data);
+    void objectRead(const QByteArray &data);
     void socketError(int error);
+    void reconnecting(int attempt, int delay);
+    void handshakeCompleted(const QVariantMap &protocol);
 
 private:
     QBluetoothSocket *mSocket; // Owned
     QBluetoothServiceInfo mService;
-    int mRetries;
+    ReconnectPolicy mPolicy;
+    SocketOptions mSocketOptions;
+    Handshake mHandshake; //Agreed with the server, invalid until it sends a HELLO
+    QTimer mRetryTimer;
+    Heartbeat mHeartbeat;
+    CompressionPool mDecoder;
+    SendQueue mQueue;
+    ChannelMux mMux;
+    DeltaCodec mDeltaDecoder;
+    QStringList mSubscriptions; //Sent to the server after each handshake
+    int mAttempts;
+    bool mClientStarted;
+    bool mConnected;
+    bool mHello; //Send a HELLO when connected
     QString mLastErrorString;
 };
 
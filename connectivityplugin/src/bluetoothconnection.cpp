@@ -13,6 +13,7 @@
 #include "bluetoothclient.h"
 #include "bluetoothdiscoverymgr.h"
 #include "bluetoothserver.h"
+#include "sendqueue.h"
 
 /*!
   \class BluetoothConnection
@@ -142,6 +143,149 @@ void BluetoothConnection::setMaxConnections(int max)
     }
 }
 
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setDuplicatePolicy(DuplicatePolicy policy)
+{
+    ConnectionIf::setDuplicatePolicy(policy);
+
+    if (mServer) {
+        mServer->setDuplicatePolicy(policy);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setReconnectPolicy(const ReconnectPolicy &policy)
+{
+    ConnectionIf::setReconnectPolicy(policy);
+
+    if (mClient) {
+        mClient->setReconnectPolicy(policy);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setHeartbeat(int interval, int timeout)
+{
+    ConnectionIf::setHeartbeat(interval, timeout);
+
+    if (mServer) {
+        mServer->setHeartbeat(interval, timeout);
+    }
+
+    if (mClient) {
+        mClient->setHeartbeat(interval, timeout);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setHandshake(bool enabled)
+{
+    ConnectionIf::setHandshake(enabled);
+
+    if (mClient) {
+        mClient->setHandshake(enabled);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setCompressionDictionary(const CompressionDictionary &dictionary)
+{
+    ConnectionIf::setCompressionDictionary(dictionary);
+
+    if (mServer) {
+        mServer->setCompressionDictionary(dictionary);
+    }
+
+    if (mClient) {
+        mClient->setCompressionDictionary(dictionary);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setQueueMode(int mode)
+{
+    ConnectionIf::setQueueMode(mode);
+
+    if (mServer) {
+        mServer->setQueueMode(mode);
+    }
+
+    if (mClient) {
+        mClient->setQueueMode(mode);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setSubscriptions(const QStringList &subscriptions)
+{
+    ConnectionIf::setSubscriptions(subscriptions);
+
+    if (mClient) {
+        mClient->setSubscriptions(subscriptions);
+    }
+}
+
+/*!
+  Returns the statistics of the send queues of the server and the client
+  added up, see SendQueue::toVariantList().
+*/
+QVariantList BluetoothConnection::queueStatistics() const
+{
+    QList<SendQueue::Statistics> statistics;
+
+    if (mServer) {
+        SendQueue::addStatistics(statistics, mServer->queueStatistics());
+    }
+
+    if (mClient) {
+        SendQueue::addStatistics(statistics, mClient->queueStatistics());
+    }
+
+    return SendQueue::toVariantList(statistics);
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setRelayRouter(const RelayRouter &router)
+{
+    ConnectionIf::setRelayRouter(router);
+
+    if (mServer) {
+        mServer->setRelayRouter(router);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void BluetoothConnection::setSocketOptions(const SocketOptions &options)
+{
+    ConnectionIf::setSocketOptions(options);
+
+    if (mServer) {
+        mServer->setSocketOptions(options);
+    }
+
+    if (mClient) {
+        mClient->setSocketOptions(options);
+    }
+}
+
 /*!
   Starts connection.
 */
@@ -158,6 +302,12 @@ bool BluetoothConnection::connect()
 
     if (mConnectAs == Server && mServer) {
         mServer->setMaxConnections(mMaxConnections);
+        mServer->setDuplicatePolicy(mDuplicatePolicy);
+        mServer->setSocketOptions(mSocketOptions);
+        mServer->setHeartbeat(mHeartbeatInterval, mHeartbeatTimeout);
+        mServer->setCompressionDictionary(mCompressionDictionary);
+        mServer->setQueueMode(mQueueMode);
+        mServer->setRelayRouter(mRelayRouter);
         if (mServer->startServer()) {
             setStatus(Connecting);
             return true;
@@ -219,6 +369,47 @@ void BluetoothConnection::disconnect()
 }
 
 
+/*!
+  Returns the ids of the clients connected to the server.
+*/
+QList<int> BluetoothConnection::clients() const
+{
+    return mServer ? mServer->clientIds() : QList<int>();
+}
+
+/*!
+  Returns the name of the client with \a clientId.
+*/
+QString BluetoothConnection::clientName(int clientId) const
+{
+    return mServer ? mServer->peerName(clientId) : QString();
+}
+
+/*!
+  Returns the number of bytes waiting to be written to the peers.
+*/
+qint64 BluetoothConnection::bytesToWrite() const
+{
+    if (mClient) {
+        return mClient->bytesToWrite();
+    }
+
+    return mServer ? mServer->bytesToWrite() : 0;
+}
+
+/*!
+  Sends \a message only to the client with \a clientId.
+  Returns true if successful, false otherwise.
+*/
+bool BluetoothConnection::sendTo(int clientId, const QByteArray &message)
+{
+    if (mServer) {
+        return mServer->write(clientId, message) > 0;
+    }
+
+    return false;
+}
+
 /*!
   Sends \a message. Returns true if successful, false otherwise.
 */
@@ -235,6 +426,115 @@ bool BluetoothConnection::send(const QByteArray &message)
     return false;
 }
 
+/*!
+  Sends \a message with \a priority, dropping it if it is still queued at
+  \a expires, in milliseconds since epoch. Returns true if successful,
+  false otherwise.
+*/
+bool BluetoothConnection::sendWithPriority(const QByteArray &message, int priority, qint64 expires)
+{
+    return sendQueued(message, priority, expires, QString());
+}
+
+/*!
+  Sends \a message with \a priority, replacing the message with the same
+  \a key still queued for a peer. Returns true if successful, false
+  otherwise.
+*/
+bool BluetoothConnection::sendLatest(const QByteArray &message, const QString &key, int priority)
+{
+    return sendQueued(message, priority, 0, key);
+}
+
+/*!
+  Sends \a message, not yet framed, with \a priority as the latest
+  value of \a key like sendLatest(), and as a delta to the previous
+  message with \a key for the peers that agreed on deltas. Returns true if
+  successful, false otherwise.
+*/
+bool BluetoothConnection::sendDelta(const QByteArray &message, const QString &key, int priority)
+{
+    return sendQueued(message, priority, 0, key, true);
+}
+
+/*!
+  Publishes \a message, a frame made with Common::toTopicMessage(), on
+  \a topic. A server sends it to the clients subscribed to \a topic, a
+  client to the server if it supports topics, which passes it on to its
+  subscribers. Returns true if successful, false otherwise.
+*/
+bool BluetoothConnection::publish(const QByteArray &message, const QString &topic)
+{
+    //An older server would take the frame for an ordinary message
+    if (mClient) {
+        return mClient->handshake().hasFeature(Handshake::TopicsFeature)
+               && mClient->write(message) > 0;
+    }
+
+    if (mServer) {
+        mServer->publish(message, topic);
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+  Sends \a message, a frame made with Common::toObjectMessage(), to the
+  server or the clients that agreed on objects in the handshake. Returns
+  true if successful, false otherwise.
+*/
+bool BluetoothConnection::sendObject(const QByteArray &message)
+{
+    //An older server would take the frame for an ordinary message
+    if (mClient) {
+        return mClient->handshake().hasFeature(Handshake::ObjectsFeature)
+               && mClient->write(message) > 0;
+    }
+
+    if (mServer) {
+        return mServer->writeObject(message) >= 0;
+    }
+
+    return false;
+}
+
+/*!
+  Queues \a message for the server or the clients with \a priority,
+  \a expires, \a key and \a delta as in SendQueue::write().
+*/
+bool BluetoothConnection::sendQueued(const QByteArray &message, int priority, qint64 expires,
+                                     const QString &key, bool delta)
+{
+    if (mClient) {
+        return mClient->write(message, priority, expires, key, delta) > 0;
+    }
+
+    if (mServer) {
+        return mServer->write(message, priority, expires, key, delta) > 0;
+    }
+
+    return false;
+}
+
+/*!
+  Sends \a message on \a channel, compressed as a whole if \a compressed
+  is set. Returns true if successful, false otherwise.
+*/
+bool BluetoothConnection::sendOnChannel(const ChannelInfo &channel, const QByteArray &message,
+                                        bool compressed)
+{
+    if (mClient) {
+        return mClient->write(channel, message, compressed) >= 0;
+    }
+
+    if (mServer) {
+        return mServer->write(channel, message, compressed) >= 0;
+    }
+
+    return false;
+}
+
 
 /*!
 */
@@ -289,7 +589,79 @@ void BluetoothConnection::onClientDisconnected(int remainingClients)
 void BluetoothConnection::onRead(const QByteArray &data)
 {
     qDebug() << "BluetoothConnection::onRead():" << data.size() << "bytes";
-    emit received(QString(data));
+    QString origin;
+
+    if (mClient && sender() == mClient) {
+        origin = mConnectedTo;
+    }
+
+    emit received(QString(data), 0, origin);
+}
+
+/*!
+  Forwards the data read from the client with \a clientId.
+*/
+void BluetoothConnection::onClientRead(const QByteArray &data, int clientId)
+{
+    qDebug() << "BluetoothConnection::onClientRead():" << data.size() << "bytes from" << clientId;
+    emit received(QString(data), clientId, QString());
+}
+
+/*!
+  Forwards the message read from the server on \a channel. The server is
+  reported as client 0.
+*/
+void BluetoothConnection::onChannelRead(const QString &channel, const QByteArray &data)
+{
+    qDebug() << "BluetoothConnection::onChannelRead():" << data.size() << "bytes on" << channel;
+    emit receivedOnChannel(channel, QString(data), 0);
+}
+
+/*!
+  Forwards the message read on \a channel from the client with \a clientId.
+*/
+void BluetoothConnection::onClientChannelRead(const QString &channel, const QByteArray &data,
+                                              int clientId)
+{
+    qDebug() << "BluetoothConnection::onClientChannelRead():" << data.size() << "bytes on" << channel
+             << "from" << clientId;
+    emit receivedOnChannel(channel, QString(data), clientId);
+}
+
+/*!
+  Forwards the remote procedure call or reply read from the server.
+*/
+void BluetoothConnection::onRpcRead(const QByteArray &data)
+{
+    emit receivedRpc(data, 0);
+}
+
+/*!
+  Forwards the message published on \a topic read from the server.
+*/
+void BluetoothConnection::onTopicRead(const QString &topic, const QByteArray &data)
+{
+    qDebug() << "BluetoothConnection::onTopicRead():" << data.size() << "bytes on" << topic;
+    emit receivedOnTopic(topic, QString(data), 0);
+}
+
+/*!
+  Forwards the message published on \a topic by the client with \a clientId.
+*/
+void BluetoothConnection::onClientTopicRead(const QString &topic, const QByteArray &data,
+                                            int clientId)
+{
+    qDebug() << "BluetoothConnection::onClientTopicRead():" << data.size() << "bytes on" << topic
+             << "from" << clientId;
+    emit receivedOnTopic(topic, QString(data), clientId);
+}
+
+/*!
+  Forwards the object read from the server.
+*/
+void BluetoothConnection::onObjectRead(const QByteArray &data)
+{
+    emit receivedObject(data, 0);
 }
 
 void BluetoothConnection::onSocketError(int error)
@@ -308,6 +680,31 @@ void BluetoothConnection::onSocketError(int error)
     emit errorOccured(error);
 }
 
+/*!
+  Called when the client is about to retry connecting to the service,
+  either after a failed attempt or after the connection was dropped.
+*/
+void BluetoothConnection::onReconnecting(int attempt, int delay)
+{
+    qDebug() << "BluetoothConnection::onReconnecting(): Attempt" << attempt << "in" << delay << "ms";
+
+    if (mStatus == Connected) {
+        mConnectedTo = "";
+        setStatus(Connecting);
+    }
+
+    emit reconnecting(attempt, delay);
+}
+
+/*!
+  The protocol settings have been agreed with the server. The server is
+  reported as client 0.
+*/
+void BluetoothConnection::onServerHandshake(const QVariantMap &protocol)
+{
+    emit handshakeCompleted(0, protocol);
+}
+
 /*!
   Starts the client if one isn't started already.
 */
@@ -315,6 +712,13 @@ void BluetoothConnection::startClient()
 {
     if (!mClient) {
         mClient = new BluetoothClient(this);
+        mClient->setReconnectPolicy(mReconnectPolicy);
+        mClient->setSocketOptions(mSocketOptions);
+        mClient->setHeartbeat(mHeartbeatInterval, mHeartbeatTimeout);
+        mClient->setHandshake(mHandshake);
+        mClient->setCompressionDictionary(mCompressionDictionary);
+        mClient->setQueueMode(mQueueMode);
+        mClient->setSubscriptions(mSubscriptions);
         QObject::connect(mClient, SIGNAL(connectedToService(QString)),
                          this, SLOT(onConnected(QString)));
 
@@ -324,8 +728,22 @@ void BluetoothConnection::startClient()
         QObject::connect(mClient, SIGNAL(read(QByteArray)),
                          this, SLOT(onRead(QByteArray)));
 
+        QObject::connect(mClient, SIGNAL(channelRead(QString,QByteArray)),
+                         this, SLOT(onChannelRead(QString,QByteArray)));
+        QObject::connect(mClient, SIGNAL(rpcRead(QByteArray)),
+                         this, SLOT(onRpcRead(QByteArray)));
+        QObject::connect(mClient, SIGNAL(topicRead(QString,QByteArray)),
+                         this, SLOT(onTopicRead(QString,QByteArray)));
+        QObject::connect(mClient, SIGNAL(objectRead(QByteArray)),
+                         this, SLOT(onObjectRead(QByteArray)));
+
         QObject::connect(mClient, SIGNAL(socketError(int)),
                          this, SLOT(onSocketError(int)));
+
+        QObject::connect(mClient, SIGNAL(reconnecting(int,int)),
+                         this, SLOT(onReconnecting(int,int)));
+        QObject::connect(mClient, SIGNAL(handshakeCompleted(QVariantMap)),
+                         this, SLOT(onServerHandshake(QVariantMap)));
     }
 }
 
@@ -343,8 +761,22 @@ void BluetoothConnection::startServer()
         QObject::connect(mServer, SIGNAL(clientDisconnected(int)),
                          this, SLOT(onClientDisconnected(int)));
 
-        QObject::connect(mServer, SIGNAL(read(QByteArray)),
-                         this, SLOT(onRead(QByteArray)));
+        QObject::connect(mServer, SIGNAL(read(QByteArray,int)),
+                         this, SLOT(onClientRead(QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(channelRead(QString,QByteArray,int)),
+                         this, SLOT(onClientChannelRead(QString,QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(rpcRead(QByteArray,int)),
+                         this, SIGNAL(receivedRpc(QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(topicRead(QString,QByteArray,int)),
+                         this, SLOT(onClientTopicRead(QString,QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(objectRead(QByteArray,int)),
+                         this, SIGNAL(receivedObject(QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(clientAdded(int,QString)),
+                         this, SIGNAL(clientConnected(int,QString)));
+        QObject::connect(mServer, SIGNAL(clientRemoved(int)),
+                         this, SIGNAL(clientDisconnected(int)));
+        QObject::connect(mServer, SIGNAL(handshakeCompleted(int,QVariantMap)),
+                         this, SIGNAL(handshakeCompleted(int,QVariantMap)));
 
         QObject::connect(mServer, SIGNAL(socketError(int)),
                          this, SLOT(onSocketError(int)));
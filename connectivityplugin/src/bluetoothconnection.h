@@ -39,12 +39,32 @@ public:
     ConnectionType type() const;
 
     void setMaxConnections(int max);
+    void setDuplicatePolicy(DuplicatePolicy policy);
+    void setReconnectPolicy(const ReconnectPolicy &policy);
+    void setSocketOptions(const SocketOptions &options);
+    void setHeartbeat(int interval, int timeout);
+    void setHandshake(bool enabled);
+    void setRelayRouter(const RelayRouter &router);
+    void setCompressionDictionary(const CompressionDictionary &dictionary);
+    void setQueueMode(int mode);
+    void setSubscriptions(const QStringList &subscriptions);
+    QVariantList queueStatistics() const;
+    QList<int> clients() const;
+    QString clientName(int clientId) const;
+    qint64 bytesToWrite() const;
 
 public slots:
     bool connect();
     bool connectToService(const QString &name);
     void disconnect();
     bool send(const QByteArray &message);
+    bool sendTo(int clientId, const QByteArray &message);
+    bool sendOnChannel(const ChannelInfo &channel, const QByteArray &message, bool compressed);
+    bool sendWithPriority(const QByteArray &message, int priority, qint64 expires);
+    bool sendLatest(const QByteArray &message, const QString &key, int priority);
+    bool sendDelta(const QByteArray &message, const QString &key, int priority);
+    bool publish(const QByteArray &message, const QString &topic);
+    bool sendObject(const QByteArray &message);
 
 private slots:
     void onDeviceDiscovered(int index, const QString &name);
@@ -52,8 +72,17 @@ private slots:
     void onDisconnected();
     void onClientDisconnected(int remainingClients);
     void onRead(const QByteArray &data);
+    void onClientRead(const QByteArray &data, int clientId);
+    void onChannelRead(const QString &channel, const QByteArray &data);
+    void onClientChannelRead(const QString &channel, const QByteArray &data, int clientId);
+    void onRpcRead(const QByteArray &data);
+    void onTopicRead(const QString &topic, const QByteArray &data);
+    void onClientTopicRead(const QString &topic, const QByteArray &data, int clientId);
+    void onObjectRead(const QByteArray &data);
 
     void onSocketError(int error);
+    void onReconnecting(int attempt, int delay);
+    void onServerHandshake(const QVariantMap &protocol);
 
     void startClient();
     void startServer();
@@ -67,6 +96,10 @@ private slots:
 signals:
     void discovered(const QString &deviceName);
 
+private:
+    bool sendQueued(const QByteArray &message, int priority, qint64 expires,
+                    const QString &key, bool delta = false);
+
 private: // Data
     BluetoothClient *mClient; // Owned
     BluetoothServer *mServer; // Owned
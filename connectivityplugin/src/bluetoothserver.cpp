@@ -19,6 +19,7 @@
 #endif
 
 #include "common.h"
+#include "connectionif.h"
 
 /*!
   \class BluetoothServer
@@ -31,10 +32,24 @@
 BluetoothServer::BluetoothServer(QObject *parent)
     : QObject(parent),
       mRfcommServer(0),
+      mDuplicatePolicy(ConnectionIf::RejectDuplicates),
+      mNextClientId(1),
       mServiceUuid(0),
       mMaxConnections(0),
+      mProtocol(this),
       mLastErrorString("")
 {
+    connect(&mProtocol, SIGNAL(read(QByteArray,int)), this, SIGNAL(read(QByteArray,int)));
+    connect(&mProtocol, SIGNAL(channelRead(QString,QByteArray,int)),
+            this, SIGNAL(channelRead(QString,QByteArray,int)));
+    connect(&mProtocol, SIGNAL(rpcRead(QByteArray,int)), this, SIGNAL(rpcRead(QByteArray,int)));
+    connect(&mProtocol, SIGNAL(topicRead(QString,QByteArray,int)),
+            this, SIGNAL(topicRead(QString,QByteArray,int)));
+    connect(&mProtocol, SIGNAL(objectRead(QByteArray,int)),
+            this, SIGNAL(objectRead(QByteArray,int)));
+    connect(&mProtocol, SIGNAL(handshakeCompleted(int,QVariantMap)),
+            this, SIGNAL(handshakeCompleted(int,QVariantMap)));
+    connect(&mProtocol, SIGNAL(timedOut(int)), this, SLOT(onTimedOut(int)));
 }
 
 
@@ -55,6 +70,29 @@ QString BluetoothServer::clientName(int index) const
     return "";
 }
 
+/*!
+  Returns the name of the client with \a clientId.
+*/
+QString BluetoothServer::peerName(int clientId) const
+{
+    QBluetoothSocket *socket = mClientSockets.value(clientId);
+    return socket ? socket->peerName() : QString();
+}
+
+/*!
+  Returns the ids of the connected clients in the order they connected.
+*/
+QList<int> BluetoothServer::clientIds() const
+{
+    QList<int> ids;
+
+    foreach (QBluetoothSocket *socket, mSockets) {
+        ids.append(mClientIds.value(socket));
+    }
+
+    return ids;
+}
+
 QString BluetoothServer::errorString() const
 {
     return mLastErrorString;
@@ -109,8 +147,6 @@ bool BluetoothServer::startServer()
     mSockets.clear();
     mLastErrorString = "";
 
-    Common::resetBuffer();
-
     qDebug() << "Bluetoothserver::startServer(): Creating a server";
     // Create the server
     mRfcommServer = new QRfcommServer(this);
@@ -206,11 +242,17 @@ void BluetoothServer::stopServer()
     foreach (QBluetoothSocket* socket, mSockets) {                 
         qDebug() << "BluetoothServer::stopServer(): Deleting socket" << socket->peerName();
         socket->disconnectFromService();
+        Common::resetBuffer(socket);
         delete socket;
         socket = 0;
     }
 
     mSockets.clear();
+    mClientIds.clear();
+    mClientSockets.clear();
+    mPeers.clear();
+    mPeerKeys.clear();
+    mProtocol.clear();
 
     // Close the server
     delete mRfcommServer;
@@ -228,17 +270,103 @@ void BluetoothServer::stopServer()
   if failed to write any data.
 */
 qint64 BluetoothServer::write(const QByteArray &data)
+{
+    return write(data, SendQueue::NormalPriority, 0);
+}
+
+/*!
+  Writes \a data to all the clients with \a priority. With a send queue
+  the message is queued and dropped if not sent by \a expires, in
+  milliseconds since epoch, 0 meaning never. A message with \a key
+  replaces the one with the same key still queued for the client, and
+  with \a delta is sent as a delta, see SendQueue::write(). Returns
+  the number of bytes written or queued, or -1 if failed to write any data.
+*/
+qint64 BluetoothServer::write(const QByteArray &data, int priority, qint64 expires,
+                               const QString &key, bool delta)
+{
+    return mProtocol.write(data, priority, expires, key, delta);
+}
+
+/*!
+  Returns the number of bytes waiting to be written to the clients.
+*/
+qint64 BluetoothServer::bytesToWrite() const
 {
     qint64 bytes = 0;
 
-    foreach (QBluetoothSocket* socket, mSockets) {
-        bytes = socket->write(data);
-        if (bytes <= 0) {
-            return -1;
-        }
+    foreach (QBluetoothSocket *socket, mSockets) {
+        bytes += socket->bytesToWrite();
     }
 
-    return bytes;
+    return bytes + mProtocol.bytesQueued();
+}
+
+/*!
+  Sets the \a mode of the send queue, see SendQueue.
+*/
+void BluetoothServer::setQueueMode(int mode)
+{
+    mProtocol.setQueueMode(mode);
+}
+
+/*!
+  Returns the statistics of the send queue per priority class.
+*/
+QList<SendQueue::Statistics> BluetoothServer::queueStatistics() const
+{
+    return mProtocol.queueStatistics();
+}
+
+/*!
+  Returns the protocol settings agreed with the client \a clientId. The
+  handshake is invalid if the client hasn't sent a HELLO, i.e. it's an
+  older version.
+*/
+Handshake BluetoothServer::handshake(int clientId) const
+{
+    return mProtocol.handshake(clientId);
+}
+
+/*!
+  Writes \a data only to the client with \a clientId. Returns the number of
+  bytes written or -1 if the client wasn't found or writing failed.
+*/
+qint64 BluetoothServer::write(int clientId, const QByteArray &data)
+{
+    return mProtocol.write(clientId, data);
+}
+
+/*!
+  Writes \a message on \a channel to all the clients, compressed as a whole
+  if \a compressed is set. The message is queued and interleaved with the
+  other channels, see ChannelMux. Clients that don't support channels get
+  it as an ordinary message. Returns the size of \a message or -1 if
+  writing failed.
+*/
+qint64 BluetoothServer::write(const ChannelInfo &channel, const QByteArray &message, bool compressed)
+{
+    return mProtocol.write(channel, message, compressed);
+}
+
+/*!
+  Writes \a data, a message published on \a topic, to the clients
+  subscribed to \a topic other than \a fromClientId, see TopicIndex.
+  Returns the number of clients it was written to.
+*/
+int BluetoothServer::publish(const QByteArray &data, const QString &topic, int fromClientId)
+{
+    return mProtocol.publish(data, topic, fromClientId);
+}
+
+/*!
+  Writes \a data, an object frame, to the clients that agreed on objects
+  in the handshake. Returns the number of last bytes written or -1 if
+  failed to write any data.
+*/
+qint64 BluetoothServer::writeObject(const QByteArray &data)
+{
+    return mProtocol.writeObject(data);
 }
 
 void BluetoothServer::setMaxConnections(int max)
@@ -247,6 +375,55 @@ void BluetoothServer::setMaxConnections(int max)
     mMaxConnections = max;
 }
 
+/*!
+  Sets how a second connection from an already connected peer is handled
+  to \a policy, see ConnectionIf::DuplicatePolicy.
+*/
+void BluetoothServer::setDuplicatePolicy(int policy)
+{
+    qDebug() << "BluetoothServer::setDuplicatePolicy():" << policy;
+    mDuplicatePolicy = policy;
+}
+
+/*!
+  Sets the \a options applied to the sockets of the connected clients.
+  Only the kernel buffer sizes apply to Bluetooth sockets.
+*/
+void BluetoothServer::setSocketOptions(const SocketOptions &options)
+{
+    mSocketOptions = options;
+
+    foreach (QBluetoothSocket *socket, mSockets) {
+        mSocketOptions.applyToDescriptor(socket->socketDescriptor());
+    }
+}
+
+/*!
+  Sets the \a router deciding which clients the messages from a client are
+  forwarded to.
+*/
+void BluetoothServer::setRelayRouter(const RelayRouter &router)
+{
+    mProtocol.setRelayRouter(router);
+}
+
+/*!
+  Sends a heartbeat to a client after \a interval milliseconds without other
+  traffic and drops a client that hasn't sent anything in \a timeout
+  milliseconds. 0 \a interval disables the heartbeats.
+*/
+void BluetoothServer::setHeartbeat(int interval, int timeout)
+{
+    mProtocol.setHeartbeat(interval, timeout);
+}
+
+/*!
+  Sets the preset \a dictionary used for uncompressing the received messages.
+*/
+void BluetoothServer::setCompressionDictionary(const CompressionDictionary &dictionary)
+{
+    mProtocol.setCompressionDictionary(dictionary);
+}
 
 /*!
   Handles the incoming connection from the client. Connects required signals
@@ -263,34 +440,60 @@ void BluetoothServer::onNewConnection()
         return;
     }
 
-    bool roomForMore = mMaxConnections > 0 && mSockets.size() < mMaxConnections;
-    bool maxOk = mMaxConnections <= 0;
-    bool hasPeer = hasPeerName(socket->peerName());
+    QString peerKey = socket->peerName();
+    QList<QBluetoothSocket*> duplicates = mPeers.values(peerKey);
 
-    if (!hasPeer && (maxOk || roomForMore)) {
-        connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
-        connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
-        connect(socket, SIGNAL(error(QBluetoothSocket::SocketError)),
-                this, SLOT(onSocketError(QBluetoothSocket::SocketError)));
-
-        qDebug() << "BluetoothServer::onNewConnection(): Client connected:"
-                 << socket->peerName();
+    if (!duplicates.isEmpty() && mDuplicatePolicy == ConnectionIf::RejectDuplicates) {
+        qDebug() << "BluetoothServer::onNewConnection():"
+                 << "Client already connected!";
+        socket->abort();
+        qDebug() << "BluetoothServer::onNewConnection(): <=";
+        return;
+    }
 
-        mSockets.append(socket);
+    if (mDuplicatePolicy != ConnectionIf::ReplaceDuplicates) {
+        duplicates.clear();
+    }
 
-        emit clientConnected(socket->peerName());
+    //Replaced connections make room for the new one
+    int clients = mSockets.size() - duplicates.size();
 
+    if (mMaxConnections > 0 && clients >= mMaxConnections) {
+        qDebug() << "BluetoothServer::onNewConnection(): Server is full.";
+        socket->abort();
         qDebug() << "BluetoothServer::onNewConnection(): <=";
         return;
     }
 
-    if (!roomForMore) {
-        qDebug() << "BluetoothServer::onNewConnection(): Server is full.";
-    } else if (hasPeer) {
-        qDebug() << "BluetoothServer::onNewConnection():"
-                 << "Client already connected!";
+    mSocketOptions.applyToDescriptor(socket->socketDescriptor());
+    connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+    connect(socket, SIGNAL(error(QBluetoothSocket::SocketError)),
+            this, SLOT(onSocketError(QBluetoothSocket::SocketError)));
+
+    qDebug() << "BluetoothServer::onNewConnection(): Client connected:"
+             << peerKey;
+
+    int clientId = mNextClientId++;
+    mSockets.append(socket);
+    mClientIds.insert(socket, clientId);
+    mClientSockets.insert(clientId, socket);
+    mPeers.insert(peerKey, socket);
+    mPeerKeys.insert(socket, peerKey);
+    mProtocol.addClient(clientId, socket);
+
+    emit clientAdded(clientId, peerKey);
+    emit clientConnected(peerKey);
+
+    //The old connections are closed only after the new one has been accepted
+    //so that the server never appears to have lost all of its clients
+    foreach (QBluetoothSocket *duplicate, duplicates) {
+        duplicate->blockSignals(true);
+        duplicate->abort();
+        duplicate->blockSignals(false);
+        removeSocket(duplicate);
     }
-    socket->abort();
+
     qDebug() << "BluetoothServer::onNewConnection(): <=";
 }
 
@@ -307,13 +510,47 @@ void BluetoothServer::onDisconnected()
         return;
     }
 
-    mSockets.removeOne(socket);
-    socket->deleteLater();
-    emit clientDisconnected(mSockets.size());
+    removeSocket(socket);
 
     qDebug() << "BluetoothServer::onDisconnected(): <=";
 }
 
+/*!
+  A client hasn't sent anything, not even heartbeats, in time and is
+  considered gone.
+*/
+void BluetoothServer::onTimedOut(int clientId)
+{
+    QBluetoothSocket *socket = mClientSockets.value(clientId);
+
+    if (!socket) {
+        return;
+    }
+
+    qDebug() << "BluetoothServer::onTimedOut(): Client is not responding:"
+             << socket->peerName();
+
+    socket->blockSignals(true);
+    socket->abort();
+    socket->blockSignals(false);
+
+    removeSocket(socket);
+}
+
+/*!
+  Removes the disconnected client \a socket.
+*/
+void BluetoothServer::removeSocket(QBluetoothSocket *socket)
+{
+    int clientId = mClientIds.take(socket);
+    mClientSockets.remove(clientId);
+    mPeers.remove(mPeerKeys.take(socket), socket);
+    mSockets.removeOne(socket);
+    mProtocol.removeClient(clientId);
+    socket->deleteLater();
+    emit clientRemoved(clientId);
+    emit clientDisconnected(mSockets.size());
+}
 
 /*!
   Receives data from the socket.
@@ -327,20 +564,14 @@ void BluetoothServer::onReadyRead()
         return;
     }
 
-    Common::readFromSocket(socket, this, "read",
-                           "BluetoothServer::onReadyRead():");
+    mProtocol.receive(mClientIds.value(socket));
 
     qDebug() << "BluetoothServer::onReadyRead(): <=";
 }
 
 bool BluetoothServer::hasPeerName(const QString &name)
 {
-    foreach (QBluetoothSocket* socket, mSockets) {
-        if (socket && socket->peerName() == name) {
-            return true;
-        }
-    }
-    return false;
+    return mPeers.contains(name);
 }
 
 void BluetoothServer::onSocketError(QBluetoothSocket::SocketError error)
@@ -11,8 +11,11 @@
 
 #include <QObject>
 #include <QtCore/QList>
+#include <QHash>
 #include <QByteArray>
 
+#include "serverprotocol.h"
+#include "socketoptions.h"
 
 #if defined(Q_WS_SIMULATOR) || defined(DISABLE_BLUETOOTH)
 #include "bluetoothstubs.h"
@@ -37,7 +40,12 @@ public:
     ~BluetoothServer();
 
     QString clientName(int index) const;
+    QString peerName(int clientId) const;
+    QList<int> clientIds() const;
     QString errorString() const;
+    qint64 bytesToWrite() const;
+    Handshake handshake(int clientId) const;
+    QList<SendQueue::Statistics> queueStatistics() const;
 
 public slots:
     void setServiceInfo(const QString &serviceName,
@@ -46,7 +54,19 @@ public slots:
     bool startServer();
     void stopServer();
     qint64 write(const QByteArray &data);
+    qint64 write(const QByteArray &data, int priority, qint64 expires,
+                 const QString &key = QString(), bool delta = false);
+    qint64 write(int clientId, const QByteArray &data);
+    qint64 write(const ChannelInfo &channel, const QByteArray &message, bool compressed);
+    int publish(const QByteArray &data, const QString &topic, int fromClientId = 0);
+    qint64 writeObject(const QByteArray &data);
     void setMaxConnections(int max);
+    void setDuplicatePolicy(int policy);
+    void setSocketOptions(const SocketOptions &options);
+    void setHeartbeat(int interval, int timeout);
+    void setCompressionDictionary(const CompressionDictionary &dictionary);
+    void setQueueMode(int mode);
+    void setRelayRouter(const RelayRouter &router);
 
 private slots:
     void onNewConnection();
@@ -54,19 +74,38 @@ private slots:
     void onReadyRead();
     bool hasPeerName(const QString &name);
     void onSocketError(QBluetoothSocket::SocketError error);
+    void onTimedOut(int clientId);
+
+private:
+    void removeSocket(QBluetoothSocket *socket);
 
 signals:
     void clientConnected(const QString &name);
     void clientDisconnected(int remainingClients);
-    void read(const QByteArray &data);
+    void clientAdded(int clientId, const QString &name);
+    void clientRemoved(int clientId);
+    void handshakeCompleted(int clientId, const QVariantMap &protocol);
+    void read(const QByteArray &data, int clientId);
+    void channelRead(const QString &channel, const QByteArray &data, int clientId);
+    void rpcRead(const QByteArray &data, int clientId);
+    void topicRead(const QString &topic, const QByteArray &data, int clientId);
+    void objectRead(const QByteArray &data, int clientId);
     void socketError(int error);
 
 private: // Data
     QRfcommServer *mRfcommServer; // Owned
     QList<QBluetoothSocket*> mSockets; //Owned
+    QHash<QBluetoothSocket*, int> mClientIds; //Stable ids of the connected clients
+    QHash<int, QBluetoothSocket*> mClientSockets;
+    QMultiHash<QString, QBluetoothSocket*> mPeers; //Connected clients by peer name
+    QHash<QBluetoothSocket*, QString> mPeerKeys;
+    int mDuplicatePolicy;
+    int mNextClientId;
     QBluetoothServiceInfo mServiceInfo;
     quint32 mServiceUuid;
     int mMaxConnections;
+    SocketOptions mSocketOptions;
+    ServerProtocol mProtocol;
     QString mLastErrorString;
 };
 
@@ -140,6 +140,7 @@ public:
     QString peerName() const { return "StubPeerName"; }
     QByteArray readLine() { return QByteArray(); }
     SocketState state() const { return UnconnectedState; }
+    int socketDescriptor() const { return -1; }
     qint64 write(QByteArray) { return 0; }
 };
 
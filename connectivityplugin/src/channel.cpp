@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "channel.h"
+
+#include "connectionmanager.h"
+
+/*!
+  \class Channel
+  \brief A logical channel sharing the connection of a ConnectionManager.
+
+  Channels are opened with ConnectionManager::openChannel(). The messages
+  sent on different channels are interleaved in fragments, so a large
+  message on one channel doesn't hold back the messages on the others.
+  The channels share the link in proportion to their \a priority. The
+  peer receives the messages on the channel it has opened with the same
+  name.
+*/
+
+/*!
+  \property Channel::name
+  This property holds the name of the channel, the same on both peers.
+*/
+
+/*!
+  \property Channel::priority
+  This property holds the share of the link the channel gets relative to
+  the other channels, from 1 to 100. A channel with priority 10 sends ten
+  times as much as a channel with priority 1 while both have messages queued.
+*/
+
+/*!
+  \fn void Channel::received(const QString &message, int clientId)
+  \a message was received on the channel from the client \a clientId, or
+  from the server if \a clientId is 0.
+*/
+
+/*!
+  Constructor. Only needed for registering the type, channels are created
+  by ConnectionManager::openChannel().
+*/
+Channel::Channel(QObject *parent) :
+    QObject(parent),
+    mManager(0)
+{
+}
+
+/*!
+  Constructor. Creates the channel \a id called \a name with \a priority
+  for \a manager.
+*/
+Channel::Channel(int id, const QString &name, int priority, ConnectionManager *manager) :
+    QObject(manager),
+    mManager(manager),
+    mInfo(id, name, qBound(1, priority, ChannelMux::maxPriority()))
+{
+}
+
+/*!
+  Sets the \a priority of the channel. Applies to the messages sent after
+  the change.
+*/
+void Channel::setPriority(int priority)
+{
+    priority = qBound(1, priority, ChannelMux::maxPriority());
+
+    if (mInfo.priority != priority) {
+        mInfo.priority = priority;
+        emit priorityChanged(mInfo.priority);
+    }
+}
+
+/*!
+  Delivers \a message received from the client \a clientId to the application.
+*/
+void Channel::receive(const QString &message, int clientId)
+{
+    emit received(message, clientId);
+}
+
+/*!
+  Sends \a message on the channel, compressed if \a compression is set as
+  in ConnectionManager::send(). Peers that don't support channels receive
+  the message as an ordinary message.
+  Returns true if successful, false otherwise.
+*/
+bool Channel::send(const QString &message, bool compression /*= false*/)
+{
+    if (!mManager) {
+        return false;
+    }
+
+    return mManager->sendOnChannel(this, message, compression);
+}
@@ -0,0 +1,49 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <QObject>
+#include <QString>
+
+#include "channelmux.h"
+
+//Forward declarations
+class ConnectionManager;
+
+class Channel : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QString name READ name CONSTANT)
+    Q_PROPERTY(int priority READ priority WRITE setPriority NOTIFY priorityChanged)
+
+public:
+    explicit Channel(QObject *parent = 0);
+    Channel(int id, const QString &name, int priority, ConnectionManager *manager);
+
+    int id() const { return mInfo.id; }
+    QString name() const { return mInfo.name; }
+    int priority() const { return mInfo.priority; }
+    void setPriority(int priority);
+    ChannelInfo info() const { return mInfo; }
+    void receive(const QString &message, int clientId);
+
+public slots:
+    bool send(const QString &message, bool compression = false);
+
+signals:
+    void priorityChanged(int priority);
+    void received(const QString &message, int clientId);
+
+private: // Data
+    ConnectionManager *mManager; // Not owned, the parent
+    ChannelInfo mInfo;
+};
+
+#endif // CHANNEL_H
@@ -0,0 +1,336 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "channelmux.h"
+
+#include <QDebug>
+#include <QIODevice>
+#include <QList>
+
+//Constants
+const int DefaultFragmentSize(8 * 1024);
+const int MinFragmentSize(256);
+const int WatermarkFragments(2); //Fragments let into the socket buffer at a time
+const int MaxPriority(100);
+const int MaxChannelId(0xffff);
+const QByteArray ChannelTag("CHANNEL");
+
+/*!
+  \class ChannelMux
+  \brief Interleaves the messages of logical channels sharing a connection.
+
+  Messages sent on a channel are split into fragments and queued per
+  channel instead of being written to the socket right away. Only a couple
+  of fragments are let into the socket buffer at a time, so a message sent
+  on another channel, or without a channel, never waits behind more than
+  that no matter how much is queued.
+
+  The queued channels share the link in proportion to their priority using
+  stride scheduling: every channel has a virtual time that advances by the
+  size of each fragment sent divided by the priority, and the channel
+  furthest behind sends next. A channel that has been idle starts from the
+  current virtual time so it can't claim the time it didn't use.
+
+  Before the first fragment of a channel the name of the channel is
+  announced to the peer with a control message, and the peer delivers the
+  messages put together from the fragments by that name. Channels are used
+  only on devices added with add(), i.e. with peers that agreed on them in
+  the handshake.
+*/
+
+/*!
+  Constructor.
+*/
+ChannelMux::ChannelMux(QObject *parent) :
+    QObject(parent)
+{
+}
+
+/*!
+  Returns the highest channel priority. Priorities are clamped to 1..maxPriority().
+*/
+int ChannelMux::maxPriority()
+{
+    return MaxPriority;
+}
+
+/*!
+  Returns the number of bytes queued on the channels of \a device and not
+  yet written to it.
+*/
+qint64 ChannelMux::bytesQueued(QIODevice *device) const
+{
+    return mDevices.contains(device) ? mDevices.value(device).queued : 0;
+}
+
+/*!
+  Returns the number of bytes queued for all the devices.
+*/
+qint64 ChannelMux::bytesQueued() const
+{
+    qint64 bytes = 0;
+
+    foreach (const Device &state, mDevices) {
+        bytes += state.queued;
+    }
+
+    return bytes;
+}
+
+/*!
+  Starts multiplexing channels on \a device. The fragments are kept below
+  \a maxFrameSize agreed with the peer, and so are the messages received
+  from it.
+*/
+void ChannelMux::add(QIODevice *device, int maxFrameSize)
+{
+    if (!device || mDevices.contains(device)) {
+        return;
+    }
+
+    Device state;
+    state.fragmentSize = qBound(MinFragmentSize, maxFrameSize, DefaultFragmentSize);
+    state.maxMessageSize = qMax(maxFrameSize, DefaultFragmentSize);
+    state.clock = 0;
+    state.queued = 0;
+    mDevices.insert(device, state);
+
+    connect(device, SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten()));
+}
+
+/*!
+  Stops multiplexing on \a device and drops everything queued for it.
+*/
+void ChannelMux::remove(QIODevice *device)
+{
+    if (mDevices.remove(device) > 0) {
+        device->disconnect(this);
+    }
+}
+
+/*!
+  Stops multiplexing on all the devices.
+*/
+void ChannelMux::clear()
+{
+    foreach (QIODevice *device, mDevices.keys()) {
+        device->disconnect(this);
+    }
+
+    mDevices.clear();
+}
+
+/*!
+  Queues \a message on \a channel of \a device and writes as much as the
+  device takes. \a compressed tells whether the message is compressed as
+  a whole.
+*/
+void ChannelMux::send(QIODevice *device, const ChannelInfo &channel, const QByteArray &message,
+                      bool compressed)
+{
+    QHash<QIODevice*, Device>::iterator it = mDevices.find(device);
+
+    if (it == mDevices.end() || channel.id < 0 || channel.id > MaxChannelId) {
+        return;
+    }
+
+    Device &state = *it;
+    bool opened = !state.outbound.contains(channel.id);
+    Outbound &outbound = state.outbound[channel.id];
+
+    if (opened) {
+        outbound.pass = state.clock;
+        outbound.announced = false;
+    }
+
+    outbound.name = channel.name;
+    outbound.priority = qBound(1, channel.priority, MaxPriority);
+
+    //An idle channel catches up with the others instead of claiming a burst
+    if (outbound.messages.isEmpty()) {
+        outbound.pass = qMax(outbound.pass, state.clock);
+    }
+
+    if (!outbound.announced) {
+        Message announcement;
+        announcement.data = ChannelTag + ' ' + QByteArray::number(channel.id) + ' '
+                            + channel.name.toUtf8();
+        announcement.offset = 0;
+        announcement.compressed = false;
+        announcement.announcement = true;
+        outbound.messages.enqueue(announcement);
+        outbound.announced = true;
+    }
+
+    Message queued;
+    queued.data = message;
+    queued.offset = 0;
+    queued.compressed = compressed;
+    queued.announcement = false;
+    outbound.messages.enqueue(queued);
+    state.queued += message.size();
+
+    pump(device);
+}
+
+/*!
+  Returns true if \a control is a channel announcement.
+*/
+bool ChannelMux::isAnnouncement(const QByteArray &control)
+{
+    return control.startsWith(ChannelTag + ' ');
+}
+
+/*!
+  Handles the channel announcement \a control received from \a device.
+  Returns false if it isn't a valid announcement.
+*/
+bool ChannelMux::announced(QIODevice *device, const QByteArray &control)
+{
+    QHash<QIODevice*, Device>::iterator it = mDevices.find(device);
+
+    if (it == mDevices.end() || !isAnnouncement(control)) {
+        return false;
+    }
+
+    int idStart = ChannelTag.size() + 1;
+    int nameStart = control.indexOf(' ', idStart) + 1;
+    bool ok = false;
+    int id = control.mid(idStart, nameStart - idStart - 1).toInt(&ok);
+
+    if (!ok || nameStart <= 0 || id < 0 || id > MaxChannelId) {
+        qDebug() << "ChannelMux::announced(): Invalid announcement" << control;
+        return false;
+    }
+
+    Inbound inbound;
+    inbound.name = QString::fromUtf8(control.mid(nameStart));
+    inbound.discarding = false;
+    it->inbound.insert(id, inbound);
+
+    qDebug() << "ChannelMux::announced(): Channel" << id << inbound.name;
+    return true;
+}
+
+/*!
+  Adds the fragment \a frame received from \a device to its channel. Once
+  the last fragment has arrived returns true, the name of the channel in
+  \a name and the message put together in \a message, still compressed if
+  the frame is. A message that grows over the agreed maximum frame size is
+  dropped, along with its remaining fragments.
+*/
+bool ChannelMux::receive(QIODevice *device, const Common::Frame &frame, QString *name,
+                         QByteArray *message)
+{
+    QHash<QIODevice*, Device>::iterator it = mDevices.find(device);
+
+    if (it == mDevices.end() || !it->inbound.contains(frame.channel)) {
+        qDebug() << "ChannelMux::receive(): Fragment on unknown channel" << frame.channel;
+        return false;
+    }
+
+    Inbound &inbound = it->inbound[frame.channel];
+    QByteArray payload = frame.payload();
+
+    if (!inbound.discarding && payload.size() > it->maxMessageSize - inbound.buffer.size()) {
+        qDebug() << "ChannelMux::receive(): Message too large on channel" << inbound.name
+                 << ", message dropped.";
+        inbound.buffer.clear();
+        inbound.discarding = true;
+    }
+
+    if (inbound.discarding) {
+        inbound.discarding = !frame.last;
+        return false;
+    }
+
+    inbound.buffer.append(payload);
+
+    if (!frame.last) {
+        return false;
+    }
+
+    *name = inbound.name;
+    *message = inbound.buffer;
+    inbound.buffer.clear();
+    return true;
+}
+
+/*!
+  The device has written some of its buffer, there's room for more fragments.
+*/
+void ChannelMux::onBytesWritten()
+{
+    QIODevice *device = qobject_cast<QIODevice*>(sender());
+
+    if (device) {
+        pump(device);
+    }
+}
+
+/*!
+  Writes fragments to \a device, the channel with the lowest virtual time
+  first, until the socket buffer holds a couple of fragments.
+*/
+void ChannelMux::pump(QIODevice *device)
+{
+    QHash<QIODevice*, Device>::iterator it = mDevices.find(device);
+
+    if (it == mDevices.end()) {
+        return;
+    }
+
+    Device &state = *it;
+    qint64 watermark = qint64(state.fragmentSize) * WatermarkFragments;
+
+    while (device->bytesToWrite() < watermark) {
+        QMap<int, Outbound>::iterator next = state.outbound.end();
+
+        for (QMap<int, Outbound>::iterator channel = state.outbound.begin();
+             channel != state.outbound.end(); ++channel) {
+            if (!channel->messages.isEmpty()
+                && (next == state.outbound.end() || channel->pass < next->pass))
+            {
+                next = channel;
+            }
+        }
+
+        if (next == state.outbound.end()) {
+            break;
+        }
+
+        Message &message = next->messages.head();
+        QByteArray frame;
+        int sent = 0;
+
+        if (message.announcement) {
+            frame = Common::toControlMessage(message.data);
+            next->messages.dequeue();
+        } else {
+            QByteArray fragment = message.data.mid(message.offset, state.fragmentSize);
+            sent = fragment.size();
+            message.offset += sent;
+
+            bool last = message.offset >= message.data.size();
+            frame = Common::toChannelMessage(next.key(), fragment, last, message.compressed);
+
+            if (last) {
+                next->messages.dequeue();
+            }
+        }
+
+        if (device->write(frame) < 0) {
+            qDebug() << "ChannelMux::pump(): Failed to write on channel" << next.key();
+            break;
+        }
+
+        state.queued -= sent;
+        state.clock = next->pass;
+        next->pass += qint64(frame.size()) * MaxPriority / next->priority;
+    }
+}
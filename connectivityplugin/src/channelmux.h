@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef CHANNELMUX_H
+#define CHANNELMUX_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QQueue>
+#include <QString>
+
+#include "common.h"
+
+class QIODevice;
+
+/*!
+  A logical channel as passed from the application to the transports.
+*/
+struct ChannelInfo
+{
+    ChannelInfo() : id(-1), priority(1) {}
+    ChannelInfo(int id, const QString &name, int priority) :
+        id(id), name(name), priority(priority) {}
+
+    int id; //Chosen by the sender, announced to the peer with the name
+    QString name; //Both peers open the channel with the same name
+    int priority; //Share of the link relative to the other channels
+};
+
+class ChannelMux : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ChannelMux(QObject *parent = 0);
+
+    static int maxPriority();
+
+    bool contains(QIODevice *device) const { return mDevices.contains(device); }
+    qint64 bytesQueued(QIODevice *device) const;
+    qint64 bytesQueued() const;
+
+    void add(QIODevice *device, int maxFrameSize);
+    void remove(QIODevice *device);
+    void clear();
+
+    void send(QIODevice *device, const ChannelInfo &channel, const QByteArray &message,
+              bool compressed);
+    bool announced(QIODevice *device, const QByteArray &control);
+    bool receive(QIODevice *device, const Common::Frame &frame, QString *name,
+                 QByteArray *message);
+
+    static bool isAnnouncement(const QByteArray &control);
+
+private slots:
+    void onBytesWritten();
+
+private:
+    void pump(QIODevice *device);
+
+private: //Data
+    struct Message {
+        QByteArray data;
+        int offset; //Bytes already sent
+        bool compressed;
+        bool announcement; //A control message naming the channel
+    };
+
+    struct Outbound {
+        QString name;
+        int priority;
+        qint64 pass; //Virtual time of the next fragment, see pump()
+        bool announced;
+        QQueue<Message> messages;
+    };
+
+    struct Inbound {
+        QString name;
+        QByteArray buffer; //Fragments of the message received so far
+        bool discarding; //Skipping the rest of a message that was too large
+    };
+
+    struct Device {
+        int fragmentSize;
+        int maxMessageSize; //Of a message put together from fragments
+        qint64 clock; //Virtual time of the fragment sent last
+        qint64 queued; //Bytes not yet written to the device
+        QMap<int, Outbound> outbound; //By channel id
+        QHash<int, Inbound> inbound; //By the channel id of the peer
+    };
+
+    QHash<QIODevice*, Device> mDevices; //Not owned
+};
+
+#endif // CHANNELMUX_H
@@ -12,13 +12,15 @@
 #include <QDebug>
 #include <QStringList>
 #include <QBitArray>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
 
 namespace
 {
 
 int endian();
 int bitsToInt(const QBitArray &bits);
-QBitArray readHeader(QByteArray &message);
 QBitArray bytesToBits(const QByteArray &bytes);
 QBitArray numberToBits(const int &number);
 QByteArray bitsToBytes(const QBitArray &bits);
@@ -37,26 +39,6 @@ int endian()
         return 1; //BIG_ENDIAN
 }
 
-/*!
-  Reads the header from \a message.
-  Header is the first 4 bytes, indexed from 0 to 3, 4th byte is ":" if header exists.
-  Returns the header in bits if exists, otherwise empty QBitArray.
-*/
-QBitArray readHeader(QByteArray &message)
-{
-    int index = message.indexOf(":");
-    if (index == -1 || index != 4) {
-        return QBitArray();
-    }
-
-    //First 4 bytes contain the header information
-    QByteArray headerBytes = message.mid(0, 4);
-
-    message = message.mid(index + 1);
-
-    return ::bytesToBits(headerBytes);
-}
-
 int bitsToInt(const QBitArray &bits)
 {
     int number = 0;
@@ -114,9 +96,46 @@ QBitArray numberToBits(const int &number)
 }
 
 
-bool gCompressionEnabled = false; //Used to determine whether or not compression is enabled for the incoming data.
-int gExpectedSize = -1; //Expected size in bytes, -1 means that we accept all data
-QByteArray gBuffer = QByteArray(); //Buffer to store data
+/*!
+  Read state of a single socket.
+*/
+struct ReadState
+{
+    ReadState() : compressed(false), control(false), channel(false), delta(false),
+                  rpc(false), topic(false), object(false), expectedSize(-1), discard(0) {}
+
+    bool compressed; //Whether or not compression is enabled for the incoming data.
+    bool control; //Whether or not the incoming frame is a control frame
+    bool channel; //Whether or not the incoming frame is a fragment on a channel
+    bool delta; //Whether or not the incoming frame is a delta to a previous message
+    bool rpc; //Whether or not the incoming frame is a remote procedure call or a reply
+    bool topic; //Whether or not the incoming frame is a message published on a topic
+    bool object; //Whether or not the incoming frame is an object
+    int expectedSize; //Expected size in bytes, -1 means that we are waiting for a header
+    int discard; //Bytes of a frame larger than Common::MaxFrameSize still to be skipped
+    QByteArray buffer; //Buffer to store data
+};
+
+const int HeaderSize(5); //4 bytes of header followed by ':'
+const int ChannelHeaderSize(3); //Channel id and flags in front of a fragment
+const char LastFragment(0x01);
+
+QHash<QIODevice*, ReadState*> gReadStates; //Buffered data per socket, owned
+QMutex gReadStatesMutex; //Guards gReadStates, the sockets may be read in different threads
+
+/*!
+  Returns whether a payload of \a size bytes fits in a frame. \a callee is
+  used only for debugging purposes.
+*/
+bool fitsInFrame(int size, const char *callee)
+{
+    if (size > Common::MaxFrameSize) {
+        qDebug() << callee << "Payload too large:" << size << "bytes";
+        return false;
+    }
+
+    return true;
+}
 
 } //anonymous namespace
 
@@ -124,103 +143,286 @@ namespace Common
 {
 
 /*!
-  Used to reset buffer and related variables.
+  Used to reset all the buffers and related variables.
 */
-
 void resetBuffer()
 {
-    ::gCompressionEnabled = false;
-    ::gExpectedSize = -1;
-    ::gBuffer.clear();
+    QMutexLocker locker(&::gReadStatesMutex);
+    qDeleteAll(::gReadStates);
+    ::gReadStates.clear();
 }
 
 /*!
-  A helper function to help reading data from \a socket into \a buffer. \a expectedSize
-  is used to compare size of the buffer to the size of data that should be recieved.
-  \a caller is used in combination with \a finishedSignal as parameters to
-  QMetaObject::invokeMethod to emit a signal when \c buffer.size() == \a expectedSize.
-  \a callee is used only for debugging purposes to output debug information containing
-  the name of the calling function.
+  Used to reset the buffer of \a socket. Should be called when the socket is
+  closed so that the buffered data is released.
 */
-void readFromSocket(QIODevice *socket, QObject *caller,
-                    const QString &finishedSignal, const QString &callee)
+void resetBuffer(QIODevice *socket)
+{
+    QMutexLocker locker(&::gReadStatesMutex);
+    delete ::gReadStates.take(socket);
+}
+
+/*!
+  Returns the payload of the frame as it was received.
+*/
+QByteArray Frame::payload() const
+{
+    return offset > 0 ? data.mid(offset) : data;
+}
+
+/*!
+  Returns the payload of the frame, uncompressed if needed.
+*/
+QByteArray Frame::message() const
+{
+    return compressed ? qUncompress(payload()) : payload();
+}
+
+/*!
+  Reads the available data from \a socket and returns the complete frames
+  received so far without decoding them. Incomplete data is kept in a buffer
+  of the socket until the rest of it arrives, and a single read may return
+  several frames. Data without a header is returned as a single frame.
+  Empty frames, i.e. heartbeats, are skipped, and so are frames larger than
+  MaxFrameSize, without buffering them. \a callee is used only for
+  debugging purposes to output debug information containing the name of the
+  calling function.
+*/
+QList<Frame> readFrames(QIODevice *socket, const QString &callee)
 {
 #define PRINT_DEBUG(dbgMessage) \
     if (!callee.isEmpty()) { \
         qDebug() << callee.toLocal8Bit().data() << dbgMessage;\
     }\
 
-    qint64 bytes = socket->bytesAvailable();
+    QList<Frame> frames;
 
-    QByteArray byteArray;
-    byteArray.resize(bytes);
+    QByteArray bytes = socket->readAll();
 
-    PRINT_DEBUG("Bytes available" << bytes);
+    PRINT_DEBUG("Bytes available" << bytes.size());
 
-    qint64 read = socket->read(byteArray.data(), bytes);
+    if (bytes.isEmpty()) {
+        return frames;
+    }
 
-    if (read == -1) {
-        PRINT_DEBUG("Error reading data");
-    }   
+    //A socket is read only in its own thread, so its state is parsed unlocked
+    ReadState *state = 0;
 
-    QBitArray header = ::readHeader(byteArray);
+    {
+        QMutexLocker locker(&::gReadStatesMutex);
+        state = ::gReadStates.value(socket);
 
-    if (!header.isEmpty()) {
-        ::gCompressionEnabled = header.testBit(0); //set compression
-        header.setBit(0, false); //Reset first bit
-        ::gExpectedSize = ::bitsToInt(header);
+        if (!state) {
+            state = new ReadState;
+            ::gReadStates.insert(socket, state);
+        }
+    }
 
-        PRINT_DEBUG("Expecting" << ::gExpectedSize << "bytes");
+    if (state->buffer.isEmpty()) {
+        state->buffer = bytes;
+    } else {
+        state->buffer.append(bytes);
     }
 
-    if (!byteArray.isEmpty()) {
-        int totalSize = ::gBuffer.size() + byteArray.size();
+    int pos = 0;
+    int size = state->buffer.size();
 
-        if (::gExpectedSize == -1 || totalSize <= ::gExpectedSize) {
-            ::gBuffer.append(byteArray);
-        } else {
-            //If we have unexpected elements we'll add as much as we can and discard the rest.
-            unsigned int roomFor = ::gExpectedSize - ::gBuffer.size();
-            QByteArray temp = byteArray.mid(0, roomFor);
-            ::gBuffer.append(temp);
+    while (pos < size) {
+        if (state->discard > 0) {
+            int skipped = qMin(state->discard, size - pos);
+            pos += skipped;
+            state->discard -= skipped;
+            continue;
         }
-    }
 
-    if ((::gBuffer.size() == ::gExpectedSize && ::gExpectedSize > 0) || ::gExpectedSize == -1) {        
+        if (state->expectedSize == -1) {
+            if (size - pos >= HeaderSize && state->buffer.at(pos + HeaderSize - 1) == ':') {
+                //First 4 bytes contain the header information
+                QBitArray header = ::bytesToBits(state->buffer.mid(pos, 4));
+                state->compressed = header.testBit(0); //set compression
+                state->control = header.testBit(1);
+                state->channel = header.testBit(2);
+                state->delta = header.testBit(3);
+                state->rpc = header.testBit(4);
+                state->topic = header.testBit(5);
+                state->object = header.testBit(6);
+                header.setBit(0, false); //Reset first bit
+                header.setBit(1, false);
+                header.setBit(2, false);
+                header.setBit(3, false);
+                header.setBit(4, false);
+                header.setBit(5, false);
+                header.setBit(6, false);
+                state->expectedSize = ::bitsToInt(header);
+
+                PRINT_DEBUG("Expecting" << state->expectedSize << "bytes");
+
+                if (state->expectedSize > MaxFrameSize) {
+                    PRINT_DEBUG("Frame too large, dropped");
+                    state->discard = state->expectedSize;
+                    state->expectedSize = -1;
+                    pos += HeaderSize;
+                    continue;
+                }
+            } else {
+                //No header, everything received so far is a single frame
+                Frame frame;
+                frame.data = pos > 0 ? state->buffer.mid(pos) : state->buffer;
+                frames.append(frame);
+                pos = size;
+                break;
+            }
+        }
 
-        PRINT_DEBUG("Received" << ::gBuffer.size() << "bytes");
-        if (::gBuffer.size() > 5) {
-            PRINT_DEBUG("Ends with" << ::gBuffer.mid(::gBuffer.size() - 5));
+        if (size - pos - HeaderSize < state->expectedSize) {
+            PRINT_DEBUG("Waiting for:" << state->expectedSize - (size - pos - HeaderSize) << "bytes");
+            break;
         }
 
-        if (::gCompressionEnabled) {
-            PRINT_DEBUG("Data was compressed");
-            ::gBuffer = qUncompress(::gBuffer);
+        int frameSize = HeaderSize + state->expectedSize;
+
+        if (state->expectedSize > 0) {
+            Frame frame;
+            frame.data = state->buffer.mid(pos, frameSize);
+            frame.offset = HeaderSize;
+            frame.compressed = state->compressed;
+            frame.control = state->control;
+            frame.delta = state->delta;
+            frame.rpc = state->rpc;
+            frame.object = state->object;
+
+            if (state->channel && state->expectedSize >= ChannelHeaderSize) {
+                const uchar *channelHeader =
+                    reinterpret_cast<const uchar*>(frame.data.constData() + HeaderSize);
+                frame.channel = channelHeader[0] << 8 | channelHeader[1];
+                frame.last = channelHeader[2] & LastFragment;
+                frame.offset += ChannelHeaderSize;
+            }
+
+            if (state->topic) {
+                int topicSize = uchar(frame.data.at(HeaderSize));
+
+                if (topicSize > 0 && topicSize < state->expectedSize) {
+                    frame.topic = QString::fromUtf8(frame.data.constData() + HeaderSize + 1,
+                                                    topicSize);
+                    frame.offset += 1 + topicSize;
+                }
+            }
+
+            if (state->channel && frame.channel < 0) {
+                PRINT_DEBUG("Invalid channel fragment dropped");
+            } else if (state->topic && frame.topic.isEmpty()) {
+                PRINT_DEBUG("Invalid topic message dropped");
+            } else {
+                frames.append(frame);
+            }
+
+            PRINT_DEBUG("Received" << state->expectedSize << "bytes"
+                        << (state->compressed ? "compressed" : ""));
         }
 
-        QMetaObject::invokeMethod(caller, finishedSignal.toAscii(), Q_ARG(QByteArray, ::gBuffer));
+        pos += frameSize;
+        state->expectedSize = -1;
+        state->compressed = false;
+        state->control = false;
+        state->channel = false;
+        state->delta = false;
+        state->rpc = false;
+        state->topic = false;
+        state->object = false;
+    }
 
-        Common::resetBuffer();
+    if (pos >= size) {
+        state->buffer.clear();
+    } else if (pos > 0) {
+        state->buffer = state->buffer.mid(pos);
+    }
 
-    } else {
-        PRINT_DEBUG("Waiting for:" << ::gExpectedSize - ::gBuffer.size() << "bytes");
+    if (state->expectedSize == -1 && state->discard == 0 && state->buffer.isEmpty()) {
+        QMutexLocker locker(&::gReadStatesMutex);
+        delete ::gReadStates.take(socket);
     }
 
+    return frames;
+
 #undef PRINT_DEBUG
 }
 
 /*!
-  Creates and returns a new bytearray from \a message, compressed if \a compression was set.
+  Reads the available data from \a socket and returns the complete messages
+  received so far, decoded. Control frames, channel fragments, deltas,
+  remote procedure calls, messages published on topics and objects are
+  skipped. See readFrames().
+*/
+QList<QByteArray> readMessages(QIODevice *socket, const QString &callee)
+{
+    QList<QByteArray> messages;
+
+    foreach (const Frame &frame, readFrames(socket, callee)) {
+        if (frame.control || frame.channel >= 0 || frame.delta || frame.rpc
+            || !frame.topic.isEmpty() || frame.object)
+        {
+            continue;
+        }
+
+        messages.append(frame.message());
+    }
+
+    return messages;
+}
+
+/*!
+  A helper function to help reading data from \a socket.
+  \a caller is used in combination with \a finishedSignal as parameters to
+  QMetaObject::invokeMethod to emit a signal for every complete message received.
+  \a callee is used only for debugging purposes to output debug information containing
+  the name of the calling function.
+*/
+void readFromSocket(QIODevice *socket, QObject *caller,
+                    const QString &finishedSignal, const QString &callee)
+{
+    QList<QByteArray> messages = readMessages(socket, callee);
+
+    foreach (QByteArray message, messages) {
+        QMetaObject::invokeMethod(caller, finishedSignal.toAscii(), Q_ARG(QByteArray, message));
+    }
+}
+
+/*!
+  Creates and returns a new bytearray from \a message, compressed with zlib
+  \a level if \a compression was set, -1 being the zlib default.
   Adds a 4 byte header to the message indicating the size and compression status.
+  Returns an empty bytearray if the message doesn't fit in a frame, see
+  MaxFrameSize; the same goes for the other frames below.
+*/
+QByteArray toMessage(const QByteArray &message, bool compression, int level)
+{
+    if (compression) {
+        return toCompressedMessage(qCompress(message, level));
+    }
+
+    if (!::fitsInFrame(message.size(), "Common::toMessage():")) {
+        return QByteArray();
+    }
+
+    QBitArray header = ::numberToBits(message.size());
+    return ::bitsToBytes(header) + ":" + message;
+}
+
+/*!
+  Creates a message of \a compressed data, already compressed in the
+  qCompress() format. Adds the header marking the message compressed.
 */
-QByteArray toMessage(const QByteArray &message, bool compression )
+QByteArray toCompressedMessage(const QByteArray &compressed)
 {
-    QByteArray compressed = (compression ? qCompress(message) : message);
+    if (!::fitsInFrame(compressed.size(), "Common::toCompressedMessage():")) {
+        return QByteArray();
+    }
+
     QBitArray header = ::numberToBits(compressed.size());
     //First bit is used to indicate compression
-    header.setBit(0, compression);
-    QByteArray msg = ::bitsToBytes(header) + ":" + compressed;
-    return msg;
+    header.setBit(0, true);
+    return ::bitsToBytes(header) + ":" + compressed;
 }
 
 /*!
@@ -232,4 +434,167 @@ QByteArray toMessage(const QString &message, bool compression)
     return toMessage(message.toAscii(), compression);
 }
 
+/*!
+  Creates a control frame carrying \a control. Control frames are exchanged
+  between the plugins and never delivered to the application. The second bit
+  of the header marks them; since the sizes are far below 1 GB it is never
+  set in a message frame.
+*/
+QByteArray toControlMessage(const QByteArray &control)
+{
+    if (!::fitsInFrame(control.size(), "Common::toControlMessage():")) {
+        return QByteArray();
+    }
+
+    QBitArray header = ::numberToBits(control.size());
+    header.setBit(1, true);
+    return ::bitsToBytes(header) + ":" + control;
+}
+
+/*!
+  Creates a frame carrying a \a fragment of a message sent on \a channel.
+  \a last marks the fragment ending the message and \a compressed tells
+  that the whole message, once put together, is compressed. The third bit
+  of the header marks the fragments; the channel id and the flags follow
+  the ':'. Fragments are sent only to peers that agreed on channels in the
+  handshake, older peers would take the bit as a part of the size.
+*/
+QByteArray toChannelMessage(int channel, const QByteArray &fragment, bool last, bool compressed)
+{
+    if (!::fitsInFrame(ChannelHeaderSize + fragment.size(), "Common::toChannelMessage():")) {
+        return QByteArray();
+    }
+
+    QBitArray header = ::numberToBits(ChannelHeaderSize + fragment.size());
+    header.setBit(0, compressed);
+    header.setBit(2, true);
+
+    QByteArray channelHeader;
+    channelHeader.append(char((channel >> 8) & 0xff));
+    channelHeader.append(char(channel & 0xff));
+    channelHeader.append(last ? LastFragment : char(0));
+
+    return ::bitsToBytes(header) + ":" + channelHeader + fragment;
+}
+
+/*!
+  Creates a frame carrying \a delta, a message encoded by DeltaCodec. The
+  fourth bit of the header marks them. Like the fragments they are sent
+  only to peers that agreed on them in the handshake.
+*/
+QByteArray toDeltaMessage(const QByteArray &delta)
+{
+    if (!::fitsInFrame(delta.size(), "Common::toDeltaMessage():")) {
+        return QByteArray();
+    }
+
+    QBitArray header = ::numberToBits(delta.size());
+    header.setBit(3, true);
+    return ::bitsToBytes(header) + ":" + delta;
+}
+
+/*!
+  Creates a frame carrying \a rpc, a remote procedure call or its reply
+  encoded by RpcMessage. The fifth bit of the header marks them. They are
+  sent only to peers that agreed on them in the handshake.
+*/
+QByteArray toRpcMessage(const QByteArray &rpc)
+{
+    if (!::fitsInFrame(rpc.size(), "Common::toRpcMessage():")) {
+        return QByteArray();
+    }
+
+    QBitArray header = ::numberToBits(rpc.size());
+    header.setBit(4, true);
+    return ::bitsToBytes(header) + ":" + rpc;
+}
+
+/*!
+  Creates a frame carrying \a message published on \a topic, compressed if
+  \a compressed is set. The sixth bit of the header marks them; the size
+  of the topic in UTF-8 and the topic follow the ':'. They are sent only to
+  peers that agreed on topics in the handshake, see TopicIndex.
+*/
+QByteArray toTopicMessage(const QString &topic, const QByteArray &message, bool compressed)
+{
+    QByteArray topicBytes = topic.toUtf8();
+
+    if (!::fitsInFrame(1 + topicBytes.size() + message.size(), "Common::toTopicMessage():")) {
+        return QByteArray();
+    }
+
+    QBitArray header = ::numberToBits(1 + topicBytes.size() + message.size());
+    header.setBit(0, compressed);
+    header.setBit(5, true);
+
+    return ::bitsToBytes(header) + ":" + char(topicBytes.size()) + topicBytes + message;
+}
+
+/*!
+  Creates a frame carrying \a object, encoded by ObjectCodec. The seventh
+  bit of the header marks them. They are sent only to peers that agreed on
+  them in the handshake.
+*/
+QByteArray toObjectMessage(const QByteArray &object)
+{
+    if (!::fitsInFrame(object.size(), "Common::toObjectMessage():")) {
+        return QByteArray();
+    }
+
+    QBitArray header = ::numberToBits(object.size());
+    header.setBit(6, true);
+    return ::bitsToBytes(header) + ":" + object;
+}
+
+/*!
+  Appends \a number to \a bytes as a variable length integer, 7 bits per
+  byte with the highest bit set on all but the last byte.
+*/
+void appendNumber(QByteArray &bytes, quint64 number)
+{
+    while (number >= 0x80) {
+        bytes.append(char((number & 0x7f) | 0x80));
+        number >>= 7;
+    }
+
+    bytes.append(char(number));
+}
+
+/*!
+  Reads the variable length integer at \a pos of \a bytes into \a number
+  and moves \a pos past it. Returns false if \a bytes ends before it.
+*/
+bool readNumber(const QByteArray &bytes, int *pos, quint64 *number)
+{
+    quint64 value = 0;
+
+    for (int shift = 0; shift < 64 && *pos < bytes.size(); shift += 7) {
+        uchar byte = bytes.at((*pos)++);
+        value |= quint64(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) {
+            *number = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+  Reads a variable length integer like above into \a number. Returns false
+  also if it doesn't fit in an int.
+*/
+bool readNumber(const QByteArray &bytes, int *pos, int *number)
+{
+    quint64 value = 0;
+
+    if (!readNumber(bytes, pos, &value) || value > quint64(0x7fffffff)) {
+        return false;
+    }
+
+    *number = int(value);
+    return true;
+}
+
 } //namespace Common
@@ -11,17 +11,58 @@
 
 #include <QIODevice>
 #include <QByteArray>
+#include <QList>
 #include <QObject>
 #include <QString>
 
 namespace Common
 {
+//Largest payload of a frame, advertised in the handshake. The header leaves
+//25 bits for the size next to the flags, so this must stay below 32 MB.
+const int MaxFrameSize(16 * 1024 * 1024);
+
+/*!
+  A frame as it was received, so it can be forwarded without decoding.
+*/
+struct Frame
+{
+    Frame() : offset(0), compressed(false), control(false), channel(-1), last(true),
+              delta(false), rpc(false), object(false) {}
+    QByteArray payload() const;
+    QByteArray message() const;
+
+    QByteArray data; //The frame including the header
+    int offset; //Start of the payload in data
+    bool compressed;
+    bool control; //Meant for the plugin itself, not for the application
+    int channel; //Logical channel of a fragment, -1 for a whole message
+    bool last; //Whether the fragment ends the message of the channel
+    bool delta; //Encoded with DeltaCodec against the previous message with a key
+    bool rpc; //A remote procedure call or its reply, see RpcMessage
+    QString topic; //Topic the message was published on, empty for the others
+    bool object; //An object encoded by ObjectCodec instead of a string
+};
+
 void resetBuffer();
+void resetBuffer(QIODevice *socket);
+QList<Frame> readFrames(QIODevice *socket, const QString &callee = QString());
+QList<QByteArray> readMessages(QIODevice *socket, const QString &callee = QString());
 void readFromSocket(QIODevice *socket, QObject *caller,
                     const QString &finishedSignal, const QString &callee);
 
 QByteArray toMessage(const QString &message, bool compression = false);
-QByteArray toMessage(const QByteArray &message, bool compression = false);
+QByteArray toMessage(const QByteArray &message, bool compression = false, int level = -1);
+QByteArray toCompressedMessage(const QByteArray &compressed);
+QByteArray toControlMessage(const QByteArray &control);
+QByteArray toChannelMessage(int channel, const QByteArray &fragment, bool last, bool compressed);
+QByteArray toDeltaMessage(const QByteArray &delta);
+QByteArray toRpcMessage(const QByteArray &rpc);
+QByteArray toTopicMessage(const QString &topic, const QByteArray &message, bool compressed);
+QByteArray toObjectMessage(const QByteArray &object);
+
+void appendNumber(QByteArray &bytes, quint64 number);
+bool readNumber(const QByteArray &bytes, int *pos, quint64 *number);
+bool readNumber(const QByteArray &bytes, int *pos, int *number);
 }
 
 #endif // COMMON_H
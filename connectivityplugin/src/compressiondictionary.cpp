@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "compressiondictionary.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QtEndian>
+
+#include <string.h>
+#include <zlib.h>
+
+//Constants
+const int SizePrefix(4); //Uncompressed size in front of the zlib stream, as with qCompress()
+const int ZlibHeaderSize(2);
+const int MaxInflateRatio(1032); //The best deflate can do
+
+/*!
+  \class CompressionDictionary
+  \brief Compresses short messages with a preset zlib dictionary.
+
+  Messages of a few dozen bytes compress poorly on their own, since deflate
+  has nothing to refer back to. With a dictionary holding the keys and
+  phrases the messages usually contain, even short messages refer to it and
+  shrink several times. Both peers must use the same dictionary.
+
+  The output has the same layout as qCompress(), an uncompressed size
+  followed by a zlib stream, and the stream carries the id of the dictionary
+  so that a peer with a different dictionary refuses it instead of
+  producing garbage.
+*/
+
+/*!
+  Constructor. Creates an empty dictionary.
+*/
+CompressionDictionary::CompressionDictionary() :
+    mId(0)
+{
+}
+
+/*!
+  Constructor. Creates a dictionary of \a data. The strings most likely to
+  appear in the messages should be at the end.
+*/
+CompressionDictionary::CompressionDictionary(const QByteArray &data) :
+    mData(data),
+    mId(0)
+{
+    if (!mData.isEmpty()) {
+        mId = adler32(adler32(0L, Z_NULL, 0),
+                      reinterpret_cast<const Bytef*>(mData.constData()), mData.size());
+    }
+}
+
+/*!
+  Replaces the dictionary with the contents of \a fileName. Empty
+  \a fileName clears the dictionary. Returns false if the file can't be read.
+*/
+bool CompressionDictionary::load(const QString &fileName)
+{
+    if (fileName.isEmpty()) {
+        *this = CompressionDictionary();
+        return true;
+    }
+
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "CompressionDictionary::load(): Failed to open" << fileName
+                 << file.errorString();
+        return false;
+    }
+
+    *this = CompressionDictionary(file.readAll());
+    qDebug() << "CompressionDictionary::load():" << mData.size() << "bytes, id" << mId;
+    return true;
+}
+
+/*!
+  Returns \a data compressed with zlib \a level using the dictionary, -1
+  being the zlib default. Returns an empty array if compressing failed.
+*/
+QByteArray CompressionDictionary::compress(const QByteArray &data, int level) const
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (deflateInit(&stream, qBound(-1, level, 9)) != Z_OK) {
+        return QByteArray();
+    }
+
+    if (!mData.isEmpty()
+        && deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(mData.constData()),
+                                mData.size()) != Z_OK)
+    {
+        deflateEnd(&stream);
+        return QByteArray();
+    }
+
+    uLong bound = deflateBound(&stream, data.size());
+    QByteArray result;
+    result.resize(SizePrefix + int(bound));
+    qToBigEndian<quint32>(data.size(), reinterpret_cast<uchar*>(result.data()));
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef*>(result.data() + SizePrefix);
+    stream.avail_out = bound;
+
+    int status = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if (status != Z_STREAM_END) {
+        qDebug() << "CompressionDictionary::compress(): Failed:" << status;
+        return QByteArray();
+    }
+
+    result.resize(SizePrefix + int(stream.total_out));
+    return result;
+}
+
+/*!
+  Returns \a data, compressed with compress() on this or another dictionary,
+  uncompressed. Returns an empty array if the data is corrupt or was
+  compressed with a different dictionary.
+*/
+QByteArray CompressionDictionary::uncompress(const QByteArray &data) const
+{
+    if (data.size() <= SizePrefix + ZlibHeaderSize) {
+        return QByteArray();
+    }
+
+    quint32 expected = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data.constData()));
+    quint32 id = dictionaryId(data);
+
+    if (id != mId) {
+        qDebug() << "CompressionDictionary::uncompress(): Compressed with dictionary" << id
+                 << "instead of" << mId;
+        return QByteArray();
+    }
+
+    //Don't trust a corrupt size to allocate the buffer
+    if (expected > quint32(data.size() - SizePrefix) * MaxInflateRatio) {
+        qDebug() << "CompressionDictionary::uncompress(): Invalid size" << expected;
+        return QByteArray();
+    }
+
+    QByteArray result;
+    result.resize(int(expected));
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (inflateInit(&stream) != Z_OK) {
+        return QByteArray();
+    }
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData() + SizePrefix));
+    stream.avail_in = data.size() - SizePrefix;
+    stream.next_out = reinterpret_cast<Bytef*>(result.data());
+    stream.avail_out = expected;
+
+    int status = inflate(&stream, Z_FINISH);
+
+    if (status == Z_NEED_DICT) {
+        inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(mData.constData()),
+                             mData.size());
+        status = inflate(&stream, Z_FINISH);
+    }
+
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END) {
+        qDebug() << "CompressionDictionary::uncompress(): Failed:" << status;
+        return QByteArray();
+    }
+
+    result.resize(int(stream.total_out));
+    return result;
+}
+
+/*!
+  Returns the id of the dictionary the \a compressed data needs, or 0 if it
+  was compressed without a dictionary, e.g. with qCompress().
+*/
+quint32 CompressionDictionary::dictionaryId(const QByteArray &compressed)
+{
+    const int DictIdSize(4);
+
+    if (compressed.size() < SizePrefix + ZlibHeaderSize + DictIdSize) {
+        return 0;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar*>(compressed.constData() + SizePrefix);
+    bool valid = (header[0] & 0x0f) == Z_DEFLATED && (header[0] * 256 + header[1]) % 31 == 0;
+    bool preset = header[1] & 0x20; //FDICT
+
+    if (!valid || !preset) {
+        return 0;
+    }
+
+    return qFromBigEndian<quint32>(header + ZlibHeaderSize);
+}
@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef COMPRESSIONDICTIONARY_H
+#define COMPRESSIONDICTIONARY_H
+
+#include <QByteArray>
+#include <QString>
+
+class CompressionDictionary
+{
+public:
+    CompressionDictionary();
+    explicit CompressionDictionary(const QByteArray &data);
+
+    QByteArray data() const { return mData; }
+    quint32 id() const { return mId; }
+    bool isEmpty() const { return mData.isEmpty(); }
+
+    bool load(const QString &fileName);
+    QByteArray compress(const QByteArray &data, int level = -1) const;
+    QByteArray uncompress(const QByteArray &data) const;
+
+    static quint32 dictionaryId(const QByteArray &compressed);
+
+private:
+    QByteArray mData;
+    quint32 mId; // Adler-32 of the data as stored by zlib, 0 if empty
+};
+
+#endif // COMPRESSIONDICTIONARY_H
@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "compressionpolicy.h"
+
+//Constants
+const int DefaultMinSize(256);
+const qreal DefaultMaxRatio(0.9);
+const int DefaultLevel(6);
+const int MinLevel(1);
+const int MaxLevel(9);
+const int ProbeInterval(16); //Skipped messages between two probes
+const qreal SampleWeight(0.25); //Weight of the latest message in the ratio
+const int MinCpuTime(20); //Milliseconds measured before the efficiency is updated
+const int LinkSampleInterval(1000); //Milliseconds
+
+/*!
+  \class CompressionPolicy
+  \brief Decides which messages are worth compressing and how hard.
+
+  Messages smaller than \c minSize are never compressed. The ratio of the
+  recently compressed messages is followed and while it stays above
+  \c maxRatio, i.e. the payloads don't compress, only every 16th message is
+  compressed to notice when they do again.
+
+  The zlib level is tuned to the link: the bytes compressed per CPU
+  millisecond are compared with the rate at which the sockets drain. The
+  level is lowered when the compression can barely keep up with the link,
+  and raised when the link is the bottleneck and there is CPU to spare.
+*/
+
+/*!
+  Constructor.
+*/
+CompressionPolicy::CompressionPolicy() :
+    mMinSize(DefaultMinSize),
+    mMaxRatio(DefaultMaxRatio),
+    mLevel(DefaultLevel),
+    mRatio(0),
+    mSkipped(0),
+    mCpuBytes(0),
+    mCpuTime(0),
+    mEfficiency(0),
+    mSent(0),
+    mPending(0),
+    mLinkThroughput(0)
+{
+}
+
+/*!
+  Sets the size in bytes below which messages are not compressed to \a size.
+*/
+void CompressionPolicy::setMinSize(int size)
+{
+    mMinSize = qMax(0, size);
+}
+
+/*!
+  Sets the compressed to original size \a ratio above which compression is
+  considered useless.
+*/
+void CompressionPolicy::setMaxRatio(qreal ratio)
+{
+    mMaxRatio = qBound(qreal(0), ratio, qreal(1));
+}
+
+/*!
+  Returns true if a message of \a size bytes should be compressed.
+*/
+bool CompressionPolicy::shouldCompress(int size)
+{
+    if (size < mMinSize) {
+        return false;
+    }
+
+    if (mRatio <= mMaxRatio) {
+        return true;
+    }
+
+    //Probe now and then whether the payloads have become compressible
+    if (++mSkipped >= ProbeInterval) {
+        mSkipped = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+  Adds a message of \a size bytes that was compressed to \a compressedSize
+  bytes in \a elapsed milliseconds.
+*/
+void CompressionPolicy::addSample(int size, int compressedSize, int elapsed)
+{
+    if (size <= 0) {
+        return;
+    }
+
+    qreal ratio = qreal(compressedSize) / size;
+    mRatio = mRatio > 0 ? (1 - SampleWeight) * mRatio + SampleWeight * ratio : ratio;
+
+    if (mRatio <= mMaxRatio) {
+        mSkipped = 0;
+    }
+
+    //Single messages take mostly less than a millisecond, so the time is
+    //summed up until it can be measured
+    mCpuBytes += size;
+    mCpuTime += elapsed;
+
+    if (mCpuTime >= MinCpuTime) {
+        mEfficiency = qreal(mCpuBytes) / mCpuTime;
+        mCpuBytes = 0;
+        mCpuTime = 0;
+    }
+}
+
+/*!
+  Records that \a size bytes were handed to the connection.
+*/
+void CompressionPolicy::sent(int size)
+{
+    mSent += size;
+}
+
+/*!
+  Returns true if it's time to measure the link with addLinkSample().
+*/
+bool CompressionPolicy::needsLinkSample() const
+{
+    return !mLinkClock.isValid() || mLinkClock.elapsed() >= LinkSampleInterval;
+}
+
+/*!
+  Measures the link throughput from the bytes sent since the last sample and
+  the \a pending bytes still waiting in the sockets, and tunes the level.
+*/
+void CompressionPolicy::addLinkSample(qint64 pending)
+{
+    if (!mLinkClock.isValid()) {
+        mLinkClock.start();
+        mSent = 0;
+        mPending = pending;
+        return;
+    }
+
+    qint64 elapsed = mLinkClock.restart();
+    qint64 drained = qMax(qint64(0), mSent - (pending - mPending));
+    bool saturated = pending > 0 && pending >= mPending;
+
+    if (elapsed > 0) {
+        mLinkThroughput = qreal(drained) * 1000 / elapsed;
+    }
+
+    mSent = 0;
+    mPending = pending;
+
+    tuneLevel(saturated);
+}
+
+/*!
+  Forgets the measurements and restores the default level.
+*/
+void CompressionPolicy::reset()
+{
+    mLevel = DefaultLevel;
+    mRatio = 0;
+    mSkipped = 0;
+    mCpuBytes = 0;
+    mCpuTime = 0;
+    mEfficiency = 0;
+    mSent = 0;
+    mPending = 0;
+    mLinkThroughput = 0;
+    mLinkClock.invalidate();
+}
+
+/*!
+  Lowers the level if compressing takes close to as long as sending, and
+  raises it if the link is \a saturated while compressing is much faster.
+*/
+void CompressionPolicy::tuneLevel(bool saturated)
+{
+    if (mEfficiency <= 0 || mRatio <= 0) {
+        return;
+    }
+
+    //Bytes per second to compress to keep the link busy
+    qreal needed = mLinkThroughput / mRatio;
+    qreal speed = mEfficiency * 1000;
+
+    if (speed < 2 * needed) {
+        mLevel = qMax(MinLevel, mLevel - 1);
+    } else if (saturated && speed > 4 * needed) {
+        mLevel = qMin(MaxLevel, mLevel + 1);
+    }
+}
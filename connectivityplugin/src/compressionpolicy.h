@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef COMPRESSIONPOLICY_H
+#define COMPRESSIONPOLICY_H
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+class CompressionPolicy
+{
+public:
+    CompressionPolicy();
+
+    int minSize() const { return mMinSize; }
+    qreal maxRatio() const { return mMaxRatio; }
+    int level() const { return mLevel; }
+    qreal ratio() const { return mRatio; }
+    qreal efficiency() const { return mEfficiency; }
+    qreal linkThroughput() const { return mLinkThroughput; }
+
+    void setMinSize(int size);
+    void setMaxRatio(qreal ratio);
+
+    bool shouldCompress(int size);
+    void addSample(int size, int compressedSize, int elapsed);
+    void sent(int size);
+    bool needsLinkSample() const;
+    void addLinkSample(qint64 pending);
+    void reset();
+
+private:
+    void tuneLevel(bool saturated);
+
+private:
+    int mMinSize; // Bytes, smaller messages are never compressed
+    qreal mMaxRatio; // Compressed to original size above which compression is skipped
+    int mLevel; // zlib level used for the next messages
+    qreal mRatio; // Recent compressed to original size, 0 until sampled
+    int mSkipped; // Messages not compressed since the last probe
+    qint64 mCpuBytes; // Bytes compressed since the last efficiency update
+    qint64 mCpuTime; // Milliseconds spent on them
+    qreal mEfficiency; // Bytes compressed per CPU millisecond, 0 until measured
+    qint64 mSent; // Bytes handed to the connection since the last link sample
+    qint64 mPending; // Bytes waiting in the sockets at the last link sample
+    qreal mLinkThroughput; // Bytes per second, 0 until measured
+    QElapsedTimer mLinkClock;
+};
+
+#endif // COMPRESSIONPOLICY_H
@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "compressionpool.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QRunnable>
+
+//Constants
+const int InlineSize(4096); //Smaller payloads are not worth a thread switch
+
+namespace
+{
+
+/*!
+  Runs a single operation in the thread pool and hands the result back to
+  the thread of the pool object.
+*/
+class CompressionTask : public QRunnable
+{
+public:
+    CompressionTask(QObject *pool, int stream, int sequence,
+                    const QByteArray &data, CompressionPool::Operation operation,
+                    int level, const CompressionDictionary &dictionary) :
+        mPool(pool),
+        mStream(stream),
+        mSequence(sequence),
+        mData(data),
+        mOperation(operation),
+        mLevel(level),
+        mDictionary(dictionary)
+    {
+    }
+
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        QByteArray result = CompressionPool::process(mData, mOperation, mLevel, mDictionary);
+        int elapsed = timer.elapsed();
+
+        QMetaObject::invokeMethod(mPool, "onTaskFinished", Qt::QueuedConnection,
+                                  Q_ARG(int, mStream), Q_ARG(int, mSequence),
+                                  Q_ARG(QByteArray, result), Q_ARG(int, elapsed));
+    }
+
+private:
+    QObject *mPool; //Not owned
+    int mStream;
+    int mSequence;
+    QByteArray mData;
+    CompressionPool::Operation mOperation;
+    int mLevel;
+    CompressionDictionary mDictionary;
+};
+
+} //anonymous namespace
+
+/*!
+  \class CompressionPool
+  \brief Compresses and uncompresses payloads in a pool of worker threads.
+
+  The payloads are submitted to numbered streams and the results of each
+  stream are delivered with finished() in the order they were submitted,
+  while different streams, and consecutive large payloads of the same stream,
+  are processed in parallel. Small payloads and payloads that need no
+  processing are handled right away, but still wait for their turn.
+
+  The size and the time taken of each processed payload are reported with
+  processed() as soon as it's done.
+
+  With a dictionary set, payloads are compressed with it, and payloads
+  compressed with a dictionary are uncompressed with it.
+*/
+
+/*!
+  Constructor.
+*/
+CompressionPool::CompressionPool(QObject *parent) :
+    QObject(parent),
+    mThreadPool(this),
+    mNextSequence(0)
+{
+}
+
+/*!
+  Destructor. Waits for the running operations to finish.
+*/
+CompressionPool::~CompressionPool()
+{
+    mThreadPool.waitForDone();
+}
+
+/*!
+  Sets the preset \a dictionary used for compressing and uncompressing.
+  An empty dictionary means plain zlib compression.
+*/
+void CompressionPool::setDictionary(const CompressionDictionary &dictionary)
+{
+    mDictionary = dictionary;
+}
+
+/*!
+  Returns true if nothing is waiting to be delivered on \a stream.
+*/
+bool CompressionPool::isIdle(int stream) const
+{
+    return !mStreams.contains(stream);
+}
+
+/*!
+  Applies \a operation to \a data and delivers the result on \a stream along
+  with \a context once everything submitted before it has been delivered.
+  \a level is the zlib level used by the compressing operations, -1 being
+  the zlib default. The result may be delivered before this function returns.
+*/
+void CompressionPool::submit(int stream, const QByteArray &data, Operation operation,
+                             const QVariant &context, int level)
+{
+    Job job;
+    job.sequence = mNextSequence++;
+    job.operation = operation;
+    job.size = data.size();
+    job.done = false;
+    job.context = context;
+
+    if (operation == Pass || data.size() < InlineSize) {
+        QElapsedTimer timer;
+        timer.start();
+        job.data = process(data, operation, level, mDictionary);
+        job.done = true;
+
+        if (operation != Pass) {
+            emit processed(stream, operation, job.size, job.data.size(), timer.elapsed());
+        }
+    } else {
+        mThreadPool.start(new CompressionTask(this, stream, job.sequence, data,
+                                              operation, level, mDictionary));
+    }
+
+    mStreams[stream].append(job);
+    deliver(stream);
+}
+
+/*!
+  Delivers the message of the received \a frame on \a stream, uncompressed if needed.
+*/
+void CompressionPool::decode(int stream, const Common::Frame &frame)
+{
+    submit(stream, frame.payload(), frame.compressed ? Uncompress : Pass);
+}
+
+/*!
+  Drops everything not yet delivered on \a stream. Operations still running
+  finish, but their results are ignored.
+*/
+void CompressionPool::clear(int stream)
+{
+    mStreams.remove(stream);
+}
+
+/*!
+  Drops everything not yet delivered on all the streams.
+*/
+void CompressionPool::clear()
+{
+    mStreams.clear();
+}
+
+/*!
+  Returns \a data with \a operation applied, compressed with zlib \a level
+  and the preset \a dictionary unless it's empty. CompressFrame also adds
+  the header of a compressed message.
+*/
+QByteArray CompressionPool::process(const QByteArray &data, Operation operation, int level,
+                                    const CompressionDictionary &dictionary)
+{
+    switch (operation) {
+    case Compress:
+        return dictionary.isEmpty() ? qCompress(data, level) : dictionary.compress(data, level);
+    case CompressFrame:
+        if (dictionary.isEmpty()) {
+            return Common::toMessage(data, true, level);
+        }
+        return Common::toCompressedMessage(dictionary.compress(data, level));
+    case Uncompress:
+        if (CompressionDictionary::dictionaryId(data) != 0) {
+            return dictionary.uncompress(data);
+        }
+        return qUncompress(data);
+    default:
+        return data;
+    }
+}
+
+/*!
+  Stores the \a data produced in \a elapsed milliseconds for the job
+  \a sequence of \a stream and delivers the results that are now in turn.
+*/
+void CompressionPool::onTaskFinished(int stream, int sequence, const QByteArray &data,
+                                     int elapsed)
+{
+    QHash<int, QList<Job> >::iterator it = mStreams.find(stream);
+
+    if (it == mStreams.end()) {
+        return;
+    }
+
+    for (int i = 0; i < it->size(); ++i) {
+        if ((*it)[i].sequence == sequence) {
+            (*it)[i].data = data;
+            (*it)[i].done = true;
+            emit processed(stream, (*it)[i].operation, (*it)[i].size, data.size(), elapsed);
+            deliver(stream);
+            return;
+        }
+    }
+}
+
+/*!
+  Delivers the finished jobs at the head of \a stream.
+*/
+void CompressionPool::deliver(int stream)
+{
+    QHash<int, QList<Job> >::iterator it = mStreams.find(stream);
+
+    while (it != mStreams.end() && !it->isEmpty() && it->first().done) {
+        Job job = it->takeFirst();
+        emit finished(stream, job.data, job.context);
+
+        //The receivers may have submitted to or cleared the stream
+        it = mStreams.find(stream);
+    }
+
+    if (it != mStreams.end() && it->isEmpty()) {
+        mStreams.erase(it);
+    }
+}
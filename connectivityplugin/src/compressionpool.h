@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef COMPRESSIONPOOL_H
+#define COMPRESSIONPOOL_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QThreadPool>
+#include <QVariant>
+
+#include "common.h"
+#include "compressiondictionary.h"
+
+class CompressionPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Operation {
+        Pass = 0,
+        Compress,
+        CompressFrame,
+        Uncompress
+    };
+
+public:
+    explicit CompressionPool(QObject *parent = 0);
+    ~CompressionPool();
+
+    CompressionDictionary dictionary() const { return mDictionary; }
+    void setDictionary(const CompressionDictionary &dictionary);
+
+    bool isIdle(int stream) const;
+    void submit(int stream, const QByteArray &data, Operation operation,
+                const QVariant &context = QVariant(), int level = -1);
+    void decode(int stream, const Common::Frame &frame);
+    void clear(int stream);
+    void clear();
+
+    static QByteArray process(const QByteArray &data, Operation operation, int level = -1,
+                              const CompressionDictionary &dictionary = CompressionDictionary());
+
+private slots:
+    void onTaskFinished(int stream, int sequence, const QByteArray &data, int elapsed);
+
+private:
+    void deliver(int stream);
+
+signals:
+    void finished(int stream, const QByteArray &data, const QVariant &context);
+    void processed(int stream, int operation, int size, int processedSize, int elapsed);
+
+private: //Data
+    struct Job {
+        int sequence;
+        Operation operation;
+        int size; // Bytes submitted
+        bool done;
+        QByteArray data;
+        QVariant context;
+    };
+
+    QHash<int, QList<Job> > mStreams; //Jobs in submission order per stream
+    QThreadPool mThreadPool;
+    CompressionDictionary mDictionary;
+    int mNextSequence;
+};
+
+#endif // COMPRESSIONPOOL_H
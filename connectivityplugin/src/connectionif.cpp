@@ -29,7 +29,16 @@
                     services and a service to wait for clients to connect.
 */
 
+/*!
+  \enum ConnectionIf::DuplicatePolicy
+  \value RejectDuplicates   A second connection from a connected peer is refused.
+  \value ReplaceDuplicates  A second connection from a connected peer replaces the
+                            old connection.
+  \value AllowDuplicates    Any number of connections are accepted from the same peer.
+*/
+
 #include "connectionif.h"
+#include "common.h"
 
 #include <QDebug>
 
@@ -47,8 +56,50 @@ ConnectionIf::ConnectionIf(QObject *parent)
       mStatus(NotConnected),
       mConnectAs(Client),
       mError(0),
-      mMaxConnections(0)
+      mMaxConnections(0),
+      mDuplicatePolicy(RejectDuplicates),
+      mHeartbeatInterval(0),
+      mHeartbeatTimeout(0),
+      mHandshake(false),
+      mQueueMode(0)
+{
+}
+
+
+/*!
+  Sends \a messages queued in the outbox in order, stopping at the first
+  one that can't be sent. Emits outboxSent() with the messages left.
+*/
+void ConnectionIf::sendOutbox(const QList<QByteArray> &messages)
+{
+    int sent = 0;
+
+    while (sent < messages.size() && send(messages.at(sent))) {
+        ++sent;
+    }
+
+    qDebug() << "ConnectionIf::sendOutbox(): Sent" << sent << "of" << messages.size()
+             << "queued messages";
+    emit outboxSent(messages.mid(sent));
+}
+
+/*!
+  Emits queueStatisticsUpdated() with the current statistics.
+*/
+void ConnectionIf::updateQueueStatistics()
+{
+    emit queueStatisticsUpdated(queueStatistics());
+}
+
+
+/*!
+  Sends \a message, not yet framed, as the latest value of \a key with
+  \a priority, as a delta to the previous message with \a key for the
+  peers that decode deltas. This implementation sends it as a whole.
+*/
+bool ConnectionIf::sendDelta(const QByteArray &message, const QString &key, int priority)
 {
+    return sendLatest(Common::toMessage(message), key, priority);
 }
 
 
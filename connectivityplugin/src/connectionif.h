@@ -12,7 +12,15 @@
 #include <QObject>
 #include <QString>
 #include <QByteArray>
+#include <QList>
+#include <QStringList>
+#include <QVariantMap>
 
+#include "channelmux.h"
+#include "compressiondictionary.h"
+#include "reconnectpolicy.h"
+#include "relayrouter.h"
+#include "socketoptions.h"
 
 class ConnectionIf : public QObject
 {
@@ -38,6 +46,12 @@ public:
         DontCare
     };
 
+    enum DuplicatePolicy {
+        RejectDuplicates = 0,
+        ReplaceDuplicates,
+        AllowDuplicates
+    };
+
     enum NetworkStatus {
         NetworkNotConnected = 0,
         NetworkConnecting,
@@ -51,24 +65,72 @@ public:
 public:
     NetworkStatus networkStatus() const { return mNetworkStatus; }
     ConnectionStatus status() const { return mStatus; }
-    virtual void setConnectAs(ConnectAs connectAs) { mConnectAs = connectAs; }
-    virtual void setServiceInfo(const QString &serviceName,
-                                const QString &serviceProvider);
+    Q_INVOKABLE virtual void setConnectAs(ConnectAs connectAs) { mConnectAs = connectAs; }
+    Q_INVOKABLE virtual void setServiceInfo(const QString &serviceName,
+                                            const QString &serviceProvider);
 
-    virtual void setMaxConnections(int max) {mMaxConnections = max;}
+    Q_INVOKABLE virtual void setMaxConnections(int max) {mMaxConnections = max;}
     int maxConnections() const {return mMaxConnections;}
 
-    QString connectedTo() const {return mConnectedTo;}
-    QString localName() const {return mLocalName;}
+    Q_INVOKABLE virtual void setDuplicatePolicy(DuplicatePolicy policy) {mDuplicatePolicy = policy;}
+    DuplicatePolicy duplicatePolicy() const {return mDuplicatePolicy;}
+
+    Q_INVOKABLE virtual void setReconnectPolicy(const ReconnectPolicy &policy) {mReconnectPolicy = policy;}
+    ReconnectPolicy reconnectPolicy() const {return mReconnectPolicy;}
+
+    Q_INVOKABLE virtual void setSocketOptions(const SocketOptions &options) {mSocketOptions = options;}
+    SocketOptions socketOptions() const {return mSocketOptions;}
+
+    Q_INVOKABLE virtual void setHeartbeat(int interval, int timeout) {mHeartbeatInterval = interval; mHeartbeatTimeout = timeout;}
+    int heartbeatInterval() const {return mHeartbeatInterval;}
+    int heartbeatTimeout() const {return mHeartbeatTimeout;}
+
+    Q_INVOKABLE virtual void setHandshake(bool enabled) {mHandshake = enabled;}
+    bool handshake() const {return mHandshake;}
+
+    Q_INVOKABLE virtual void setRelayRouter(const RelayRouter &router) {mRelayRouter = router;}
+    RelayRouter relayRouter() const {return mRelayRouter;}
+
+    Q_INVOKABLE virtual void setCompressionDictionary(const CompressionDictionary &dictionary) {mCompressionDictionary = dictionary;}
+    CompressionDictionary compressionDictionary() const {return mCompressionDictionary;}
+
+    Q_INVOKABLE virtual void setQueueMode(int mode) {mQueueMode = mode;}
+    int queueMode() const {return mQueueMode;}
+    Q_INVOKABLE virtual QVariantList queueStatistics() const { return QVariantList(); }
+
+    Q_INVOKABLE virtual void setSubscriptions(const QStringList &subscriptions) {mSubscriptions = subscriptions;}
+    QStringList subscriptions() const {return mSubscriptions;}
+
+    Q_INVOKABLE QString connectedTo() const {return mConnectedTo;}
+    Q_INVOKABLE QString localName() const {return mLocalName;}
+
+    Q_INVOKABLE virtual QList<int> clients() const { return QList<int>(); }
+    Q_INVOKABLE virtual QString clientName(int clientId) const { Q_UNUSED(clientId); return QString(); }
+    Q_INVOKABLE virtual qint64 bytesToWrite() const { return 0; }
 
-    virtual int error() const { return mError; }
-    virtual QString errorString() const { return mErrorString; }
+    Q_INVOKABLE virtual int error() const { return mError; }
+    Q_INVOKABLE virtual QString errorString() const { return mErrorString; }
     virtual ConnectionType type() const = 0;
 
 public slots:
     virtual bool connect() = 0;
     virtual void disconnect() = 0;
     virtual bool send(const QByteArray &message) = 0;
+    void sendOutbox(const QList<QByteArray> &messages);
+    void updateQueueStatistics();
+    virtual bool sendTo(int clientId, const QByteArray &message)
+        { Q_UNUSED(clientId); Q_UNUSED(message); return false; }
+    virtual bool sendOnChannel(const ChannelInfo &channel, const QByteArray &message,
+                               bool compressed) = 0;
+    virtual bool sendWithPriority(const QByteArray &message, int priority, qint64 expires)
+        { Q_UNUSED(priority); Q_UNUSED(expires); return send(message); }
+    virtual bool sendLatest(const QByteArray &message, const QString &key, int priority)
+        { Q_UNUSED(key); return sendWithPriority(message, priority, 0); }
+    virtual bool sendDelta(const QByteArray &message, const QString &key, int priority);
+    virtual bool publish(const QByteArray &message, const QString &topic)
+        { Q_UNUSED(message); Q_UNUSED(topic); return false; }
+    virtual bool sendObject(const QByteArray &message)
+        { Q_UNUSED(message); return false; }
 
 protected slots:
     virtual void setStatus(ConnectionStatus status);
@@ -77,8 +139,18 @@ protected slots:
 signals:
     void networkStatusChanged(NetworkStatus status);
     void statusChanged(ConnectionStatus status);
-    void received(const QString &message);
+    void received(const QString &message, int clientId, const QString &origin);
+    void receivedOnChannel(const QString &channel, const QString &message, int clientId);
+    void receivedRpc(const QByteArray &message, int clientId);
+    void receivedOnTopic(const QString &topic, const QString &message, int clientId);
+    void receivedObject(const QByteArray &object, int clientId);
+    void clientConnected(int clientId, const QString &name);
+    void clientDisconnected(int clientId);
     void errorOccured(int error);
+    void reconnecting(int attempt, int delay);
+    void handshakeCompleted(int clientId, const QVariantMap &protocol);
+    void outboxSent(const QList<QByteArray> &unsent);
+    void queueStatisticsUpdated(const QVariantList &statistics);
 
 protected: // Data
     NetworkStatus mNetworkStatus;
@@ -91,6 +163,16 @@ protected: // Data
     QString mErrorString;
     int mError;
     int mMaxConnections;
+    DuplicatePolicy mDuplicatePolicy;
+    int mHeartbeatInterval; // Milliseconds, 0 means disabled
+    int mHeartbeatTimeout; // Milliseconds, 0 means three intervals
+    bool mHandshake; // Clients send a HELLO when connecting
+    ReconnectPolicy mReconnectPolicy;
+    SocketOptions mSocketOptions;
+    RelayRouter mRelayRouter;
+    CompressionDictionary mCompressionDictionary;
+    int mQueueMode; // SendQueue::Mode
+    QStringList mSubscriptions; // Topics and prefixes, see TopicIndex
 };
 
 #endif // CONNECTIONIF_H
@@ -9,12 +9,18 @@
 
 #include "connectionmanager.h"
 
+#include <QDateTime>
 #include <QDebug>
+#include <QDeclarativeEngine>
 
 #include "bluetoothconnection.h"
+#include "channel.h"
 #include "wlanconnection.h"
 
 #include "common.h"
+#include "handshake.h"
+#include "iothread.h"
+#include "rpcmessage.h"
 #include "wlannetworkmgr.h"
 
 /*!
@@ -40,6 +46,43 @@
                     services and a service to wait for clients to connect.
 */
 
+/*!
+  \enum ConnectionManager::LatencyProfile
+  \value SystemDefault  The socket options are left as the system sets them.
+  \value Interactive    Small messages are sent right away, Nagle's algorithm is disabled.
+  \value Bulk           Small writes are batched and larger kernel buffers are used
+                        for throughput.
+  \value Custom         The options set in \a socketOptions are used.
+*/
+
+/*!
+  \enum ConnectionManager::RelayMode
+  \value NoRelay        The server doesn't forward messages between clients.
+  \value RelayToOthers  A message from a client is forwarded to all the other clients.
+  \value RelayToGroup   A message from a client is forwarded to the other clients
+                        in the same group, see \a setClientGroup().
+*/
+
+/*!
+  \enum ConnectionManager::CompressionMode
+  \value ExplicitCompression  Messages are compressed when \a compression is set in
+                             \a send(), \a sendTo() or \a sendToServer().
+  \value AdaptiveCompression  Each message is compressed if it's likely to pay off,
+                             regardless of \a compression, see \a compressionMinSize
+                             and \a compressionMaxRatio. The zlib level follows
+                             the measured link throughput.
+*/
+
+/*!
+  \enum ConnectionManager::DuplicatePolicy
+  \value RejectDuplicates   A second connection from a connected peer is refused.
+  \value ReplaceDuplicates  A second connection from a connected peer replaces the
+                            old connection, e.g. when the peer reconnects before the
+                            server has noticed that the old connection is gone.
+  \value AllowDuplicates    Any number of connections are accepted from the same peer,
+                            e.g. several applications or emulators on one host.
+*/
+
 /*!
   \property ConnectionManager::status
   This property holds the status of the connection.
@@ -118,6 +161,374 @@
   Default is \a 13002.
 */
 
+/*!
+  \property ConnectionManager::duplicatePolicy
+  This property holds how the server handles a connection from a peer that
+  is already connected. Peers are identified by their address with \a LAN
+  connection and by their name with \a Bluetooth.
+
+  Default is \a RejectDuplicates.
+*/
+
+/*!
+  \property ConnectionManager::autoReconnect
+  This property holds whether a client reconnects by itself to the last
+  server after the connection has dropped.
+
+  Default is \a false.
+*/
+
+/*!
+  \property ConnectionManager::reconnectDelay
+  This property holds the delay in milliseconds before the first retry.
+  Each following retry waits \a reconnectMultiplier times longer.
+
+  Default is \a 500.
+*/
+
+/*!
+  \property ConnectionManager::reconnectMaxDelay
+  This property holds the upper limit in milliseconds for the delay between retries.
+
+  Default is \a 30000.
+*/
+
+/*!
+  \property ConnectionManager::reconnectMultiplier
+  This property holds the factor the retry delay grows by after each failed attempt.
+
+  Default is \a 1.0, which keeps the delay fixed.
+*/
+
+/*!
+  \property ConnectionManager::reconnectJitter
+  This property holds the fraction, from 0.0 to 1.0, by which each retry delay
+  is randomly shortened. Keeps clients that dropped at the same time from
+  retrying in lockstep.
+
+  Default is \a 0.0.
+*/
+
+/*!
+  \property ConnectionManager::reconnectRetries
+  This property holds the number of retries before giving up. -1 means unlimited.
+
+  Default is \a 3.
+*/
+
+/*!
+  \property ConnectionManager::raceCount
+  This property holds the number of servers a client races connection attempts to.
+  The server asked for is tried first, followed by the other addresses of the
+  same host and then other discovered servers. The first to connect is kept.
+  Only used with \a LAN connection.
+
+  Default is \a 1, which connects only to the server asked for.
+*/
+
+/*!
+  \property ConnectionManager::raceStagger
+  This property holds the delay in milliseconds between starting the raced
+  connection attempts. Only used with \a LAN connection.
+
+  Default is \a 250.
+*/
+
+/*!
+  \property ConnectionManager::fastReconnect
+  This property holds whether a client remembers the servers it has connected
+  to and, on \a connect(), tries them directly while discovery runs in parallel.
+  Only used with \a LAN connection.
+
+  Default is \a false.
+*/
+
+/*!
+  \property ConnectionManager::serverCacheSize
+  This property holds the number of most recently used servers remembered
+  for \a fastReconnect.
+
+  Default is \a 1.
+*/
+
+/*!
+  \property ConnectionManager::serverCacheFile
+  This property holds the file the servers for \a fastReconnect are stored in.
+  Empty means the default location for the user's settings.
+*/
+
+/*!
+  \property ConnectionManager::servers
+  This property holds the servers a client is connected to, the one given to
+  \a connect() and the ones added with \a addServer().
+  Only used with \a LAN connection.
+*/
+
+/*!
+  \property ConnectionManager::clients
+  This property holds the ids of the clients connected to the server, in the
+  order they connected. An id stays the same for as long as the client is
+  connected and is never reused.
+*/
+
+/*!
+  \property ConnectionManager::outboxSize
+  This property holds the number of messages queued by \a send() while
+  there is no connection. The queued messages are sent in order once
+  connected. When the outbox is full the oldest message is dropped.
+
+  Default is \a 0, which disables the outbox.
+*/
+
+/*!
+  \property ConnectionManager::outboxExpiry
+  This property holds the time in milliseconds a queued message is kept
+  before it is dropped unsent. Can be overridden per message in \a send().
+
+  Default is \a 0, which means the messages never expire.
+*/
+
+/*!
+  \property ConnectionManager::outboxFile
+  This property holds the file the queued messages are stored in so that
+  they survive a restart of the application.
+  Empty means the messages are kept only in memory.
+*/
+
+/*!
+  \property ConnectionManager::outboxCount
+  This property holds the number of messages waiting to be sent.
+*/
+
+/*!
+  \property ConnectionManager::latencyProfile
+  This property holds the socket tuning applied to every socket of the
+  connection. Setting \a socketOptions changes the profile to \a Custom.
+
+  Default is \a SystemDefault.
+*/
+
+/*!
+  \property ConnectionManager::socketOptions
+  This property holds the socket options in use. Keys are \c lowDelay,
+  \c keepAlive, \c sendBufferSize and \c receiveBufferSize for the kernel
+  buffers, and \c readBufferSize for the Qt read buffer, all in bytes where
+  0 means the default. Keys left out keep their current values.
+  With \a Bluetooth only the kernel buffer sizes are applied.
+*/
+
+/*!
+  \property ConnectionManager::heartbeatInterval
+  This property holds the time in milliseconds without outgoing traffic after
+  which a heartbeat is sent to the peer. Heartbeats are sent only when there
+  is no other traffic. They are used only with the peers that have them
+  enabled too and agree on them in the handshake, see \a handshake, and
+  a change applies to the next connection.
+
+  Default is \a 0, which disables the heartbeats and the dead peer detection.
+*/
+
+/*!
+  \property ConnectionManager::heartbeatTimeout
+  This property holds the time in milliseconds without any data from a peer
+  after which the peer is considered gone and disconnected.
+
+  Default is \a 0, which means three times \a heartbeatInterval.
+*/
+
+/*!
+  \property ConnectionManager::handshake
+  This property holds whether the client sends a HELLO to agree on the
+  protocol with the server when it connects. The server always answers a
+  HELLO with its own, and never sends one first. Channels, deltas, calls,
+  topics and objects are used only with the peers that agreed on them.
+  Peers from before the handshake don't understand the HELLO, so enable it
+  only when the servers are known to.
+
+  Default is \a false.
+*/
+
+/*!
+  \property ConnectionManager::relayMode
+  This property holds how the server forwards messages between clients.
+  The messages are forwarded as they were received, without decoding them
+  or passing them through QML. Routes set with \a setRoute() override the mode.
+
+  Default is \a NoRelay.
+*/
+
+/*!
+  \property ConnectionManager::relayLocalDelivery
+  This property holds whether the relayed messages are also received by
+  the server application.
+
+  Default is \a false.
+*/
+
+/*!
+  \property ConnectionManager::ioThread
+  This property holds whether the connection and its sockets run in a
+  dedicated I/O thread instead of the thread of the QML scene, so that
+  reading, decoding and socket handling don't compete with rendering.
+  The signals are delivered to QML in its own thread. Sending doesn't wait
+  for the I/O thread, so \a send() returns true once the message has been
+  handed over. Changing the property disconnects and recreates the connection.
+
+  Default is \a false.
+*/
+
+/*!
+  \property ConnectionManager::acceptRate
+  This property holds the number of new connections the server accepts per
+  second. Connections arriving faster wait for their turn, up to
+  \a acceptBacklog of them, and the rest are told to retry later.
+  Only used with \a LAN connection.
+
+  Default is \a 0, which means unlimited.
+*/
+
+/*!
+  \property ConnectionManager::acceptBurst
+  This property holds the number of connections accepted back to back
+  before \a acceptRate starts limiting them.
+
+  Default is \a 10.
+*/
+
+/*!
+  \property ConnectionManager::acceptBacklog
+  This property holds the number of connections waiting to be accepted when
+  \a acceptRate is exceeded.
+
+  Default is \a 32.
+*/
+
+/*!
+  \property ConnectionManager::busyRetryDelay
+  This property holds the shortest time in milliseconds a client turned away
+  by a busy server is asked to wait before retrying. The wait grows with the
+  number of waiting connections. Clients honour the wait even if their
+  reconnect policy would retry sooner.
+
+  Default is \a 1000.
+*/
+
+/*!
+  \property ConnectionManager::compressionMode
+  This property holds how it's decided whether a sent message is compressed.
+  The peers uncompress the messages regardless of the mode.
+
+  Default is \a ExplicitCompression.
+*/
+
+/*!
+  \property ConnectionManager::compressionMinSize
+  This property holds the size in bytes below which messages are not
+  compressed with \a AdaptiveCompression, as they would grow rather than shrink.
+
+  Default is \a 256.
+*/
+
+/*!
+  \property ConnectionManager::compressionMaxRatio
+  This property holds the ratio of compressed to original size above which
+  compressing is considered a waste of CPU with \a AdaptiveCompression, e.g.
+  for media that is already compressed. While the recent messages compress
+  worse than this, only every 16th message is compressed to notice a change.
+
+  Default is \a 0.9.
+*/
+
+/*!
+  \property ConnectionManager::compressionLevel
+  This property holds the zlib level currently used with \a AdaptiveCompression.
+  The level is lowered when compressing can barely keep up with the link and
+  raised when the link is saturated and there is CPU to spare.
+*/
+
+/*!
+  \property ConnectionManager::compressionEfficiency
+  This property holds the message bytes compressed per CPU millisecond, i.e.
+  the bytes per second fed to the link for each millisecond of CPU time spent
+  compressing per second. Measured with \a AdaptiveCompression, 0 until known.
+*/
+
+/*!
+  \property ConnectionManager::compressionDictionaryFile
+  This property holds the file of the preset dictionary the messages are
+  compressed with, e.g. a sample of typical messages with the most common
+  keys and values at the end. Short messages that barely compress on their
+  own shrink several times with a fitting dictionary. The dictionary is
+  used only when every connected peer announced the same dictionary in the
+  handshake, plain zlib is used otherwise. Consider lowering
+  \a compressionMinSize with \a AdaptiveCompression.
+
+  Default is empty, which means plain zlib compression.
+*/
+
+/*!
+  \property ConnectionManager::queueMode
+  This property holds how the messages waiting to be written are ordered.
+  With \a StrictPriorityQueue a message sent with a higher priority always
+  goes ahead of the queued ones of lower priority. With \a WeightedFairQueue
+  the priorities share the link, each getting twice the share of the one
+  below, so that a busy high priority can't starve the low ones. Messages
+  sent with \a send() have \a NormalPriority, see \a sendWithPriority().
+  Only the messages above the socket buffer are ordered, the buffer is
+  kept short so that an urgent message waits little.
+
+  Default is \a NoQueue, which writes the messages to the socket in the
+  order they are sent.
+*/
+
+/*!
+  \property ConnectionManager::deltaEncoding
+  This property holds whether the messages sent with \a sendLatest() are
+  sent as the bytes that changed since the previous message with the same
+  key, e.g. for large status documents that change a little at a time.
+  A message that changed too much is sent whole, as is the first one to
+  each peer and the next one after a peer lost track. Only used with the
+  peers that announced deltas in the handshake; the others get every
+  message whole. The messages sent as deltas aren't compressed.
+
+  Default is \a false.
+*/
+
+/*!
+  \property ConnectionManager::rpcTimeout
+  This property holds how long in milliseconds a call made with \a call()
+  waits for the reply before it fails with RpcCall::TimedOut, unless the
+  call is given a timeout of its own. 0 means the calls wait until the
+  peer disconnects.
+
+  Default is 30000.
+*/
+
+/*!
+  \property ConnectionManager::subscriptions
+  This property holds the topics whose messages are received with
+  \a receivedOnTopic(). A subscription ending with \c * is a prefix, e.g.
+  \c scores/* matches \c scores/game1, and a lone \c * matches every
+  topic. A client sends its subscriptions to the server, which sends it
+  only the messages published on the matching topics, see \a publish().
+  Servers that are older versions don't support topics.
+
+  Default is empty.
+*/
+
+/*!
+  \property ConnectionManager::batchInterval
+  This property holds how long in milliseconds the received messages are
+  collected before they are delivered at once with \a receivedBatch(),
+  e.g. 16 for once per frame. Handling thousands of messages per second
+  one signal at a time keeps the JavaScript engine busy, while a batch
+  takes a single call. While batching, \a received(), \a receivedFrom()
+  and \a receivedFromClient() are not emitted. 0 means each message is
+  delivered as it arrives.
+
+  Default is 0.
+*/
+
 /*!
   \fn void ConnectionManager::disconnected()
   Connection was lost either by manually disconnecting or when the connected peer becomes unavailable.
@@ -128,6 +539,46 @@
   A \a message was recieved.
 */
 
+/*!
+  \fn void ConnectionManager::receivedFrom(const QString &message, const QString &origin)
+  A \a message was received by a client from the server \a origin.
+  Emitted in addition to \a received().
+*/
+
+/*!
+  \fn void ConnectionManager::receivedFromClient(const QString &message, int clientId)
+  A \a message was received by the server from the client \a clientId.
+  Emitted in addition to \a received().
+*/
+
+/*!
+  \fn void ConnectionManager::receivedBatch(const QVariantList &messages)
+  The \a messages received during \a batchInterval, emitted instead of
+  \a received() and the others while batching.
+*/
+
+/*!
+  \fn void ConnectionManager::handshakeCompleted(int clientId, const QVariantMap &protocol)
+  The protocol settings have been agreed with the client \a clientId, or
+  with the server if \a clientId is 0. See \a peerProtocol().
+*/
+
+/*!
+  \fn void ConnectionManager::serverHandshakeCompleted(const QString &server, const QVariantMap &protocol)
+  The protocol settings have been agreed with \a server, one of the
+  servers added with \a addServer(). See \a serverProtocol().
+*/
+
+/*!
+  \fn void ConnectionManager::clientConnected(int clientId, const QString &name)
+  A client \a name connected to the server and was given \a clientId.
+*/
+
+/*!
+  \fn void ConnectionManager::clientDisconnected(int clientId)
+  The client \a clientId disconnected from the server.
+*/
+
 /*!
   \fn void ConnectionManager::discovered(const QString &name)
   A service was discovered. Service information is given in \a name.
@@ -139,9 +590,17 @@
   Used only for LAN connection so non-existant servers are not kept.
 */
 
+/*!
+  \fn void ConnectionManager::reconnecting(int attempt, int delay)
+  The client will retry connecting in \a delay milliseconds. \a attempt is
+  the number of the retry starting from 1.
+*/
+
 // Constants
 const QString DefaultServiceName("ConnectivityPlugin");
 const QString DefaultServiceProvider("Nokia");
+const int OutgoingStream(0); //All the messages sent share a single stream to keep their order
+const int MaxChannelId(0xffff); //Each channel has a stream of its own, numbered by the channel id
 
 
 /*!
@@ -168,11 +627,35 @@ ConnectionManager::ConnectionManager(QObject *parent)
       mConnectAs(ConnectionIf::Server),
       mConnectionTimeout(0),
       mMaxConnections(0),
+      mDuplicatePolicy(ConnectionIf::RejectDuplicates),
       mServerPort(13001),
-      mBroadcastPort(13002)
+      mBroadcastPort(13002),
+      mRaceCount(1),
+      mHeartbeatInterval(0),
+      mHeartbeatTimeout(0),
+      mHandshake(false),
+      mRaceStagger(250),
+      mFastReconnect(false),
+      mServerCacheSize(1),
+      mCompressionMode(ExplicitCompression),
+      mQueueMode(NoQueue),
+      mDeltaEncoding(false),
+      mNextChannelId(1),
+      mNextCallId(1),
+      mRpcTimeout(30000),
+      mBatchInterval(0),
+      mIoThread(0)
 {
     mTimeoutTimer.setSingleShot(true);
     QObject::connect(&mTimeoutTimer, SIGNAL(timeout()), this, SLOT(disconnect()));
+
+    mBatchTimer.setSingleShot(true);
+    QObject::connect(&mBatchTimer, SIGNAL(timeout()), this, SLOT(flushBatch()));
+
+    QObject::connect(&mCompressor, SIGNAL(finished(int,QByteArray,QVariant)),
+                     this, SLOT(onCompressed(int,QByteArray,QVariant)));
+    QObject::connect(&mCompressor, SIGNAL(processed(int,int,int,int,int)),
+                     this, SLOT(onCompressionMeasured(int,int,int,int,int)));
 }
 
 /*!
@@ -181,6 +664,13 @@ ConnectionManager::ConnectionManager(QObject *parent)
 ConnectionManager::~ConnectionManager()
 {
     disconnect();
+
+    if (mIoThread) {
+        deleteConnection();
+        delete mIoThread;
+        mIoThread = 0;
+    }
+
     //Release the network manager,
     //Workaround for issue where NetworkManager didn't get deleted until
     //after the application eventloop was already over.
@@ -222,14 +712,14 @@ void ConnectionManager::setConnectionType(int type)
 
     switch (type) {
     case Bluetooth:
-        delete mConnection;
-        mConnection = new BluetoothConnection(this);
+        deleteConnection();
+        mConnection = new BluetoothConnection(mIoThread ? 0 : this);
         mConnectionType = Bluetooth;
         emit connectionTypeChanged(mConnectionType);
         break;
     case LAN:
-        delete mConnection;
-        mConnection = new WlanConnection(this);
+        deleteConnection();
+        mConnection = new WlanConnection(mIoThread ? 0 : this);
         mConnectionType = LAN;
         emit connectionTypeChanged(mConnectionType);
         break;
@@ -237,6 +727,15 @@ void ConnectionManager::setConnectionType(int type)
         qDebug() << "ConnectionManager::setConnectionType(): Invalid type!";
     }
     mConnection->setMaxConnections(mMaxConnections);
+    mConnection->setDuplicatePolicy(mDuplicatePolicy);
+    mConnection->setReconnectPolicy(mReconnectPolicy);
+    mConnection->setSocketOptions(mSocketOptions);
+    mConnection->setHeartbeat(mHeartbeatInterval, mHeartbeatTimeout);
+    mConnection->setHandshake(mHandshake);
+    mConnection->setCompressionDictionary(mDictionary);
+    mConnection->setQueueMode(mQueueMode);
+    mConnection->setSubscriptions(subscriptions());
+    mConnection->setRelayRouter(mRelayRouter);
     mConnection->setConnectAs(mConnectAs);
     mNetworkStatus = (ConnectionManager::NetworkStatus)mConnection->networkStatus();
 
@@ -246,8 +745,35 @@ void ConnectionManager::setConnectionType(int type)
     QObject::connect(mConnection, SIGNAL(networkStatusChanged(NetworkStatus)),
                      this, SLOT(setNetworkStatus(NetworkStatus)));
 
-    QObject::connect(mConnection, SIGNAL(received(QString)),
-                     this, SIGNAL(received(QString)));
+    QObject::connect(mConnection, SIGNAL(received(QString,int,QString)),
+                     this, SLOT(onReceived(QString,int,QString)));
+
+    QObject::connect(mConnection, SIGNAL(receivedOnChannel(QString,QString,int)),
+                     this, SLOT(onReceivedOnChannel(QString,QString,int)));
+
+    QObject::connect(mConnection, SIGNAL(receivedRpc(QByteArray,int)),
+                     this, SLOT(onReceivedRpc(QByteArray,int)));
+
+    QObject::connect(mConnection, SIGNAL(receivedOnTopic(QString,QString,int)),
+                     this, SLOT(onReceivedOnTopic(QString,QString,int)));
+
+    QObject::connect(mConnection, SIGNAL(receivedObject(QByteArray,int)),
+                     this, SLOT(onReceivedObject(QByteArray,int)));
+
+    QObject::connect(mConnection, SIGNAL(clientConnected(int,QString)),
+                     this, SLOT(onClientAdded(int,QString)));
+
+    QObject::connect(mConnection, SIGNAL(clientDisconnected(int)),
+                     this, SLOT(onClientDisconnected(int)));
+
+    QObject::connect(mConnection, SIGNAL(outboxSent(QList<QByteArray>)),
+                     this, SLOT(onOutboxSent(QList<QByteArray>)));
+
+    QObject::connect(mConnection, SIGNAL(queueStatisticsUpdated(QVariantList)),
+                     this, SLOT(onQueueStatisticsUpdated(QVariantList)));
+
+    QObject::connect(mConnection, SIGNAL(handshakeCompleted(int,QVariantMap)),
+                     this, SLOT(onHandshakeCompleted(int,QVariantMap)));
 
     QObject::connect(mConnection, SIGNAL(discovered(QString)),
                      this, SIGNAL(discovered(QString)));
@@ -255,18 +781,41 @@ void ConnectionManager::setConnectionType(int type)
     QObject::connect(mConnection, SIGNAL(errorOccured(int)),
                      this, SIGNAL(errorChanged(int)));
 
+    QObject::connect(mConnection, SIGNAL(reconnecting(int,int)),
+                     this, SIGNAL(reconnecting(int,int)));
+
 
     if (mConnection->type() == ConnectionIf::LAN) {
         QObject::connect(mConnection, SIGNAL(removed(int)),
                          this, SIGNAL(removed(int)));      
 
+        QObject::connect(mConnection, SIGNAL(serversChanged(QStringList)),
+                         this, SLOT(onServersChanged(QStringList)));
+
+        QObject::connect(mConnection, SIGNAL(serverHandshakeCompleted(QString,QVariantMap)),
+                         this, SLOT(onServerHandshakeCompleted(QString,QVariantMap)));
+
+        QObject::connect(mConnection, SIGNAL(receivedServerRpc(QString,QByteArray)),
+                         this, SLOT(onReceivedServerRpc(QString,QByteArray)));
+
         WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
         if (lanConn) {
             lanConn->setBroadcastPort(mBroadcastPort);
             lanConn->setServerPort(mServerPort);
+            lanConn->setRaceCount(mRaceCount);
+            lanConn->setRaceStagger(mRaceStagger);
+            lanConn->setServerCacheFile(mServerCacheFile);
+            lanConn->setServerCacheSize(mServerCacheSize);
+            lanConn->setFastReconnect(mFastReconnect);
+            lanConn->setAdmissionControl(mAdmission);
         }
     }
 
+    //Everything above is done before the move, later calls go through the thread
+    if (mIoThread) {
+        mIoThread->adopt(mConnection);
+    }
+
     qDebug() << "ConnectionManager::setConnectionType(): <=";
 }
 
@@ -278,6 +827,40 @@ int ConnectionManager::connectAs() const
     return mConnectAs;
 }
 
+bool ConnectionManager::ioThread() const
+{
+    return mIoThread != 0;
+}
+
+/*!
+  Sets whether the connection runs in a dedicated I/O thread to \a enabled.
+*/
+void ConnectionManager::setIoThread(bool enabled)
+{
+    if (enabled == (mIoThread != 0)) {
+        return;
+    }
+
+    qDebug() << "ConnectionManager::setIoThread():" << enabled;
+
+    bool recreate = mConnection != 0;
+    disconnect();
+    deleteConnection();
+
+    if (enabled) {
+        mIoThread = new IoThread(this);
+    } else {
+        delete mIoThread;
+        mIoThread = 0;
+    }
+
+    if (recreate) {
+        setConnectionType(mConnectionType);
+    }
+
+    emit ioThreadChanged(enabled);
+}
+
 /*!
   Sets the connect as setting.
 */
@@ -285,7 +868,7 @@ void ConnectionManager::setConnectAs(int connectAs)
 {
     if (mStatus != NotConnected) {
         if (mConnection) {
-            mConnection->disconnect();
+            IoThread::call(mConnection, "disconnect");
             setStatus(NotConnected);
         }
     }
@@ -304,7 +887,8 @@ void ConnectionManager::setConnectAs(int connectAs)
         }
 
         if (mConnection) {
-            mConnection->setConnectAs(mConnectAs);
+            IoThread::call(mConnection, "setConnectAs",
+                           QArgument<ConnectionIf::ConnectAs>("ConnectAs", mConnectAs));
         }
 
         emit connectAsChanged(mConnectAs);
@@ -376,7 +960,9 @@ QString ConnectionManager::peerName() const
 int ConnectionManager::error() const
 {
     if (mConnection) {
-        return mConnection->error();
+        int error = 0;
+        IoThread::call(mConnection, "error", Q_RETURN_ARG(int, error));
+        return error;
     }
 
     return 0;
@@ -388,7 +974,9 @@ int ConnectionManager::error() const
 QString ConnectionManager::errorString() const
 {
     if (mConnection) {
-        return mConnection->errorString();
+        QString errorString;
+        IoThread::call(mConnection, "errorString", Q_RETURN_ARG(QString, errorString));
+        return errorString;
     }
 
     return QString("No error");
@@ -402,7 +990,9 @@ QString ConnectionManager::errorString() const
 QString ConnectionManager::localName() const
 {
     if (mConnection) {
-        return mConnection->localName();
+        QString localName;
+        IoThread::call(mConnection, "localName", Q_RETURN_ARG(QString, localName));
+        return localName;
     }
 
     return QString("Error: No connection");
@@ -416,7 +1006,9 @@ int ConnectionManager::serverPort() const
 {
     if (mConnection && mConnection->type() == ConnectionIf::LAN) {
         WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
-        return lanConn->serverPort();
+        int port = -1;
+        IoThread::call(lanConn, "serverPort", Q_RETURN_ARG(int, port));
+        return port;
     }
 
     return -1;
@@ -430,7 +1022,9 @@ int ConnectionManager::broadcastPort() const
 {
     if (mConnection && mConnection->type() == ConnectionIf::LAN) {
         WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
-        return lanConn->broadcastPort();
+        int port = -1;
+        IoThread::call(lanConn, "broadcastPort", Q_RETURN_ARG(int, port));
+        return port;
     }
 
     return -1;
@@ -441,6 +1035,11 @@ int ConnectionManager::maxConnections() const
     return mMaxConnections;
 }
 
+int ConnectionManager::duplicatePolicy() const
+{
+    return mDuplicatePolicy;
+}
+
 /*!
   Sets serverport to \a port.
 */
@@ -449,7 +1048,7 @@ void ConnectionManager::setServerPort(int port)
     mServerPort = port;
     if (mConnection && mConnection->type() == ConnectionIf::LAN) {
         WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
-        lanConn->setServerPort(mServerPort);
+        IoThread::call(lanConn, "setServerPort", Q_ARG(int, mServerPort));
         emit serverPortChanged(mServerPort);
     }
 }
@@ -462,7 +1061,7 @@ void ConnectionManager::setBroadcastPort(int port)
     mBroadcastPort = port;
     if (mConnection && mConnection->type() == ConnectionIf::LAN) {
         WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
-        lanConn->setBroadcastPort(mBroadcastPort);
+        IoThread::call(lanConn, "setBroadcastPort", Q_ARG(int, mBroadcastPort));
         emit broadcastPortChanged(mBroadcastPort);
     }
 }
@@ -471,147 +1070,1722 @@ void ConnectionManager::setMaxConnections(int max)
 {
     mMaxConnections = max;
     if (mConnection) {
-        mConnection->setMaxConnections(mMaxConnections);
+        IoThread::call(mConnection, "setMaxConnections", Q_ARG(int, mMaxConnections));
     }
     emit maxConnectionsChanged(mMaxConnections);
 }
 
 /*!
-  Starts connection. If \a to is given tries to connect to it.
+  Sets how a connection from an already connected peer is handled to \a policy.
 */
-void ConnectionManager::connect(const QString &to)
+void ConnectionManager::setDuplicatePolicy(int policy)
 {
-    qDebug() << "ConnectionManager::connect()";
+    switch (policy) {
+    case RejectDuplicates:
+    case ReplaceDuplicates:
+    case AllowDuplicates:
+        mDuplicatePolicy = (ConnectionIf::DuplicatePolicy)policy;
+        break;
+    default:
+        qDebug() << "ConnectionManager::setDuplicatePolicy(): Invalid policy!";
+        return;
+    }
 
-    //If we have not established a connection and to is given,
-    //try to establish a connection and then proceed
-    if (mStatus == NotConnected && !to.isEmpty()) {
-        if (!mConnection) {
-            setConnectionType(mConnectionType);
-        }
+    if (mConnection) {
+        IoThread::call(mConnection, "setDuplicatePolicy",
+                       QArgument<ConnectionIf::DuplicatePolicy>("DuplicatePolicy", mDuplicatePolicy));
+    }
+    emit duplicatePolicyChanged(mDuplicatePolicy);
+}
 
-        applySettings();
+bool ConnectionManager::autoReconnect() const
+{
+    return mReconnectPolicy.autoReconnect();
+}
 
-        if (!mConnection) {
-            qDebug() << "ConnectionManager::connect(): No Connection.";
-        }
+int ConnectionManager::reconnectDelay() const
+{
+    return mReconnectPolicy.initialDelay();
+}
 
-        if (!mConnection || !mConnection->connect()) {
+int ConnectionManager::reconnectMaxDelay() const
+{
+    return mReconnectPolicy.maxDelay();
+}
+
+qreal ConnectionManager::reconnectMultiplier() const
+{
+    return mReconnectPolicy.multiplier();
+}
+
+qreal ConnectionManager::reconnectJitter() const
+{
+    return mReconnectPolicy.jitter();
+}
+
+int ConnectionManager::reconnectRetries() const
+{
+    return mReconnectPolicy.maxRetries();
+}
+
+void ConnectionManager::setAutoReconnect(bool enabled)
+{
+    mReconnectPolicy.setAutoReconnect(enabled);
+    applyReconnectPolicy();
+    emit autoReconnectChanged(mReconnectPolicy.autoReconnect());
+}
+
+void ConnectionManager::setReconnectDelay(int delay)
+{
+    mReconnectPolicy.setInitialDelay(delay);
+    applyReconnectPolicy();
+    emit reconnectDelayChanged(mReconnectPolicy.initialDelay());
+}
+
+void ConnectionManager::setReconnectMaxDelay(int delay)
+{
+    mReconnectPolicy.setMaxDelay(delay);
+    applyReconnectPolicy();
+    emit reconnectMaxDelayChanged(mReconnectPolicy.maxDelay());
+}
+
+void ConnectionManager::setReconnectMultiplier(qreal multiplier)
+{
+    mReconnectPolicy.setMultiplier(multiplier);
+    applyReconnectPolicy();
+    emit reconnectMultiplierChanged(mReconnectPolicy.multiplier());
+}
+
+void ConnectionManager::setReconnectJitter(qreal jitter)
+{
+    mReconnectPolicy.setJitter(jitter);
+    applyReconnectPolicy();
+    emit reconnectJitterChanged(mReconnectPolicy.jitter());
+}
+
+void ConnectionManager::setReconnectRetries(int retries)
+{
+    mReconnectPolicy.setMaxRetries(retries);
+    applyReconnectPolicy();
+    emit reconnectRetriesChanged(mReconnectPolicy.maxRetries());
+}
+
+int ConnectionManager::raceCount() const
+{
+    return mRaceCount;
+}
+
+int ConnectionManager::raceStagger() const
+{
+    return mRaceStagger;
+}
+
+/*!
+  Sets the number of servers to race connection attempts to to \a count.
+*/
+void ConnectionManager::setRaceCount(int count)
+{
+    mRaceCount = qMax(1, count);
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        IoThread::call(lanConn, "setRaceCount", Q_ARG(int, mRaceCount));
+    }
+    emit raceCountChanged(mRaceCount);
+}
+
+/*!
+  Sets the delay between raced connection attempts to \a stagger milliseconds.
+*/
+void ConnectionManager::setRaceStagger(int stagger)
+{
+    mRaceStagger = qMax(0, stagger);
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        IoThread::call(lanConn, "setRaceStagger", Q_ARG(int, mRaceStagger));
+    }
+    emit raceStaggerChanged(mRaceStagger);
+}
+
+bool ConnectionManager::fastReconnect() const
+{
+    return mFastReconnect;
+}
+
+int ConnectionManager::serverCacheSize() const
+{
+    return mServerCacheSize;
+}
+
+QString ConnectionManager::serverCacheFile() const
+{
+    return mServerCacheFile;
+}
+
+/*!
+  Enables or disables connecting directly to the remembered servers.
+*/
+void ConnectionManager::setFastReconnect(bool enabled)
+{
+    mFastReconnect = enabled;
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        IoThread::call(lanConn, "setFastReconnect", Q_ARG(bool, mFastReconnect));
+    }
+    emit fastReconnectChanged(mFastReconnect);
+}
+
+/*!
+  Sets the number of remembered servers to \a size.
+*/
+void ConnectionManager::setServerCacheSize(int size)
+{
+    mServerCacheSize = qMax(0, size);
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        IoThread::call(lanConn, "setServerCacheSize", Q_ARG(int, mServerCacheSize));
+    }
+    emit serverCacheSizeChanged(mServerCacheSize);
+}
+
+/*!
+  Sets the file the remembered servers are stored in to \a fileName.
+*/
+void ConnectionManager::setServerCacheFile(const QString &fileName)
+{
+    mServerCacheFile = fileName;
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        IoThread::call(lanConn, "setServerCacheFile", Q_ARG(QString, mServerCacheFile));
+    }
+    emit serverCacheFileChanged(mServerCacheFile);
+}
+
+/*!
+  Returns the servers a client is connected to.
+*/
+QStringList ConnectionManager::servers() const
+{
+    return mServers;
+}
+
+int ConnectionManager::outboxSize() const
+{
+    return mOutbox.size();
+}
+
+int ConnectionManager::outboxExpiry() const
+{
+    return mOutbox.expiry();
+}
+
+QString ConnectionManager::outboxFile() const
+{
+    return mOutbox.fileName();
+}
+
+int ConnectionManager::outboxCount() const
+{
+    return mOutbox.count();
+}
+
+/*!
+  Sets the maximum number of queued messages to \a size.
+*/
+void ConnectionManager::setOutboxSize(int size)
+{
+    mOutbox.setSize(size);
+    emit outboxSizeChanged(mOutbox.size());
+    emit outboxCountChanged(mOutbox.count());
+}
+
+/*!
+  Sets the default lifetime of a queued message to \a expiry milliseconds.
+*/
+void ConnectionManager::setOutboxExpiry(int expiry)
+{
+    mOutbox.setExpiry(expiry);
+    emit outboxExpiryChanged(mOutbox.expiry());
+}
+
+/*!
+  Sets the file the queued messages are stored in to \a fileName.
+*/
+void ConnectionManager::setOutboxFile(const QString &fileName)
+{
+    mOutbox.setFileName(fileName);
+    emit outboxFileChanged(mOutbox.fileName());
+    emit outboxCountChanged(mOutbox.count());
+}
+
+int ConnectionManager::latencyProfile() const
+{
+    return mSocketOptions.profile();
+}
+
+QVariantMap ConnectionManager::socketOptions() const
+{
+    return mSocketOptions.toVariantMap();
+}
+
+/*!
+  Sets the socket tuning to \a profile.
+*/
+void ConnectionManager::setLatencyProfile(int profile)
+{
+    switch (profile) {
+    case SystemDefault:
+    case Interactive:
+    case Bulk:
+    case Custom:
+        mSocketOptions.setProfile((SocketOptions::Profile)profile);
+        break;
+    default:
+        qDebug() << "ConnectionManager::setLatencyProfile(): Invalid profile!";
+        return;
+    }
+
+    applySocketOptions();
+    emit latencyProfileChanged(mSocketOptions.profile());
+    emit socketOptionsChanged();
+}
+
+/*!
+  Sets the socket \a options and changes the profile to \a Custom.
+*/
+void ConnectionManager::setSocketOptions(const QVariantMap &options)
+{
+    mSocketOptions.setVariantMap(options);
+    mSocketOptions.setProfile(SocketOptions::Custom);
+    applySocketOptions();
+    emit latencyProfileChanged(mSocketOptions.profile());
+    emit socketOptionsChanged();
+}
+
+int ConnectionManager::heartbeatInterval() const
+{
+    return mHeartbeatInterval;
+}
+
+int ConnectionManager::heartbeatTimeout() const
+{
+    return mHeartbeatTimeout;
+}
+
+/*!
+  Sets the heartbeat interval to \a interval milliseconds.
+*/
+void ConnectionManager::setHeartbeatInterval(int interval)
+{
+    mHeartbeatInterval = qMax(0, interval);
+    if (mConnection) {
+        IoThread::call(mConnection, "setHeartbeat", Q_ARG(int, mHeartbeatInterval), Q_ARG(int, mHeartbeatTimeout));
+    }
+    emit heartbeatIntervalChanged(mHeartbeatInterval);
+}
+
+/*!
+  Sets the dead peer timeout to \a timeout milliseconds.
+*/
+void ConnectionManager::setHeartbeatTimeout(int timeout)
+{
+    mHeartbeatTimeout = qMax(0, timeout);
+    if (mConnection) {
+        IoThread::call(mConnection, "setHeartbeat", Q_ARG(int, mHeartbeatInterval), Q_ARG(int, mHeartbeatTimeout));
+    }
+    emit heartbeatTimeoutChanged(mHeartbeatTimeout);
+}
+
+bool ConnectionManager::handshake() const
+{
+    return mHandshake;
+}
+
+/*!
+  Sets whether the client sends a HELLO when it connects to \a enabled.
+  Applied on the next connection.
+*/
+void ConnectionManager::setHandshake(bool enabled)
+{
+    if (mHandshake != enabled) {
+        mHandshake = enabled;
+        if (mConnection) {
+            IoThread::call(mConnection, "setHandshake", Q_ARG(bool, mHandshake));
+        }
+        emit handshakeChanged(mHandshake);
+    }
+}
+
+int ConnectionManager::relayMode() const
+{
+    return mRelayRouter.mode();
+}
+
+bool ConnectionManager::relayLocalDelivery() const
+{
+    return mRelayRouter.localDelivery();
+}
+
+/*!
+  Sets how the server forwards messages between clients to \a mode.
+*/
+void ConnectionManager::setRelayMode(int mode)
+{
+    switch (mode) {
+    case NoRelay:
+    case RelayToOthers:
+    case RelayToGroup:
+        mRelayRouter.setMode((RelayRouter::Mode)mode);
+        break;
+    default:
+        qDebug() << "ConnectionManager::setRelayMode(): Invalid mode!";
+        return;
+    }
+
+    applyRelayRouter();
+    emit relayModeChanged(mRelayRouter.mode());
+}
+
+/*!
+  Sets whether the relayed messages are also received by the server.
+*/
+void ConnectionManager::setRelayLocalDelivery(bool enabled)
+{
+    mRelayRouter.setLocalDelivery(enabled);
+    applyRelayRouter();
+    emit relayLocalDeliveryChanged(enabled);
+}
+
+int ConnectionManager::acceptRate() const
+{
+    return mAdmission.rate();
+}
+
+int ConnectionManager::acceptBurst() const
+{
+    return mAdmission.burst();
+}
+
+int ConnectionManager::acceptBacklog() const
+{
+    return mAdmission.backlog();
+}
+
+int ConnectionManager::busyRetryDelay() const
+{
+    return mAdmission.retryDelay();
+}
+
+/*!
+  Sets the number of connections the server accepts per second to \a rate.
+*/
+void ConnectionManager::setAcceptRate(int rate)
+{
+    mAdmission.setRate(rate);
+    applyAdmissionControl();
+    emit acceptRateChanged(mAdmission.rate());
+}
+
+/*!
+  Sets the number of connections accepted back to back to \a burst.
+*/
+void ConnectionManager::setAcceptBurst(int burst)
+{
+    mAdmission.setBurst(burst);
+    applyAdmissionControl();
+    emit acceptBurstChanged(mAdmission.burst());
+}
+
+/*!
+  Sets the number of connections waiting to be accepted to \a backlog.
+*/
+void ConnectionManager::setAcceptBacklog(int backlog)
+{
+    mAdmission.setBacklog(backlog);
+    applyAdmissionControl();
+    emit acceptBacklogChanged(mAdmission.backlog());
+}
+
+/*!
+  Sets the shortest retry delay given to turned away clients to \a delay milliseconds.
+*/
+void ConnectionManager::setBusyRetryDelay(int delay)
+{
+    mAdmission.setRetryDelay(delay);
+    applyAdmissionControl();
+    emit busyRetryDelayChanged(mAdmission.retryDelay());
+}
+
+int ConnectionManager::compressionMode() const
+{
+    return mCompressionMode;
+}
+
+int ConnectionManager::compressionMinSize() const
+{
+    return mCompressionPolicy.minSize();
+}
+
+qreal ConnectionManager::compressionMaxRatio() const
+{
+    return mCompressionPolicy.maxRatio();
+}
+
+int ConnectionManager::compressionLevel() const
+{
+    return mCompressionPolicy.level();
+}
+
+qreal ConnectionManager::compressionEfficiency() const
+{
+    return mCompressionPolicy.efficiency();
+}
+
+/*!
+  Sets how it's decided whether a message is compressed to \a mode.
+*/
+void ConnectionManager::setCompressionMode(int mode)
+{
+    switch (mode) {
+    case ExplicitCompression:
+    case AdaptiveCompression:
+        break;
+    default:
+        qDebug() << "ConnectionManager::setCompressionMode(): Invalid mode!";
+        return;
+    }
+
+    if (mode == mCompressionMode) {
+        return;
+    }
+
+    mCompressionMode = (CompressionMode)mode;
+    mCompressionPolicy.reset();
+    emit compressionModeChanged(mCompressionMode);
+    emit compressionLevelChanged(mCompressionPolicy.level());
+    emit compressionEfficiencyChanged(mCompressionPolicy.efficiency());
+}
+
+/*!
+  Sets the size in bytes below which messages are not compressed to \a size.
+*/
+void ConnectionManager::setCompressionMinSize(int size)
+{
+    mCompressionPolicy.setMinSize(size);
+    emit compressionMinSizeChanged(mCompressionPolicy.minSize());
+}
+
+/*!
+  Sets the compressed to original size \a ratio above which messages are
+  not compressed.
+*/
+void ConnectionManager::setCompressionMaxRatio(qreal ratio)
+{
+    mCompressionPolicy.setMaxRatio(ratio);
+    emit compressionMaxRatioChanged(mCompressionPolicy.maxRatio());
+}
+
+QString ConnectionManager::compressionDictionaryFile() const
+{
+    return mCompressionDictionaryFile;
+}
+
+/*!
+  Loads the preset compression dictionary from \a fileName. Empty
+  \a fileName returns to plain zlib compression. The dictionary is kept as
+  it was if the file can't be read. The peers already connected agreed on
+  the previous dictionary, so plain zlib is used with them.
+*/
+void ConnectionManager::setCompressionDictionaryFile(const QString &fileName)
+{
+    CompressionDictionary dictionary;
+
+    if (!dictionary.load(fileName)) {
+        qDebug() << "ConnectionManager::setCompressionDictionaryFile(): Failed to load"
+                 << fileName;
+        return;
+    }
+
+    mCompressionDictionaryFile = fileName;
+    mDictionary = dictionary;
+    updateDictionaryUse();
+
+    if (mConnection) {
+        IoThread::call(mConnection, "setCompressionDictionary",
+                       Q_ARG(CompressionDictionary, dictionary));
+    }
+
+    emit compressionDictionaryFileChanged(mCompressionDictionaryFile);
+}
+
+int ConnectionManager::queueMode() const
+{
+    return mQueueMode;
+}
+
+/*!
+  Sets how the messages waiting to be written are ordered to \a mode.
+  Switching to \a NoQueue writes the waiting messages right away.
+*/
+void ConnectionManager::setQueueMode(int mode)
+{
+    switch (mode) {
+    case NoQueue:
+    case StrictPriorityQueue:
+    case WeightedFairQueue:
+        mQueueMode = (QueueMode)mode;
+        break;
+    default:
+        qDebug() << "ConnectionManager::setQueueMode(): Invalid mode!";
+        return;
+    }
+
+    if (mConnection) {
+        IoThread::call(mConnection, "setQueueMode", Q_ARG(int, mQueueMode));
+    }
+
+    emit queueModeChanged(mQueueMode);
+}
+
+bool ConnectionManager::deltaEncoding() const
+{
+    return mDeltaEncoding;
+}
+
+/*!
+  Sets whether the messages sent with \a sendLatest() are sent as deltas
+  to \a enabled.
+*/
+void ConnectionManager::setDeltaEncoding(bool enabled)
+{
+    if (mDeltaEncoding != enabled) {
+        mDeltaEncoding = enabled;
+        emit deltaEncodingChanged(mDeltaEncoding);
+    }
+}
+
+int ConnectionManager::rpcTimeout() const
+{
+    return mRpcTimeout;
+}
+
+/*!
+  Sets the time the calls wait for the reply to \a timeout milliseconds.
+  The calls already made keep their timeout.
+*/
+void ConnectionManager::setRpcTimeout(int timeout)
+{
+    if (timeout < 0) {
+        qDebug() << "ConnectionManager::setRpcTimeout(): Invalid timeout!";
+        return;
+    }
+
+    if (mRpcTimeout != timeout) {
+        mRpcTimeout = timeout;
+        emit rpcTimeoutChanged(mRpcTimeout);
+    }
+}
+
+QStringList ConnectionManager::subscriptions() const
+{
+    return mSubscriptions.subscriptions(0);
+}
+
+/*!
+  Sets the topics received to \a subscriptions. Empty topics and ones that
+  don't fit in a frame are ignored.
+*/
+void ConnectionManager::setSubscriptions(const QStringList &subscriptions)
+{
+    QStringList previous = this->subscriptions();
+    mSubscriptions.setSubscriptions(0, subscriptions);
+
+    if (this->subscriptions() == previous) {
+        return;
+    }
+
+    if (mConnection) {
+        IoThread::call(mConnection, "setSubscriptions", Q_ARG(QStringList, this->subscriptions()));
+    }
+
+    emit subscriptionsChanged();
+}
+
+int ConnectionManager::batchInterval() const
+{
+    return mBatchInterval;
+}
+
+/*!
+  Sets the time the received messages are collected to \a interval
+  milliseconds. The messages already collected are delivered when
+  batching is turned off.
+*/
+void ConnectionManager::setBatchInterval(int interval)
+{
+    if (interval < 0) {
+        qDebug() << "ConnectionManager::setBatchInterval(): Invalid interval!";
+        return;
+    }
+
+    if (mBatchInterval == interval) {
+        return;
+    }
+
+    mBatchInterval = interval;
+
+    if (!mBatchInterval) {
+        flushBatch();
+    }
+
+    emit batchIntervalChanged(mBatchInterval);
+}
+
+/*!
+  Returns the relay group of the client \a clientId.
+*/
+QString ConnectionManager::clientGroup(int clientId) const
+{
+    return mRelayRouter.group(clientId);
+}
+
+/*!
+  Adds the client \a clientId to \a group used with \a RelayToGroup.
+  Empty \a group removes the client from its group.
+*/
+void ConnectionManager::setClientGroup(int clientId, const QString &group)
+{
+    mRelayRouter.setGroup(clientId, group);
+    applyRelayRouter();
+}
+
+/*!
+  Forwards the messages from the client \a fromClientId only to the client
+  \a toClientId, regardless of \a relayMode. 0 \a toClientId removes the route.
+*/
+void ConnectionManager::setRoute(int fromClientId, int toClientId)
+{
+    mRelayRouter.setRoute(fromClientId, toClientId);
+    applyRelayRouter();
+}
+
+/*!
+  Removes all the routes set with \a setRoute().
+*/
+void ConnectionManager::clearRoutes()
+{
+    mRelayRouter.clearRoutes();
+    applyRelayRouter();
+}
+
+/*!
+  Drops all the messages waiting to be sent.
+*/
+void ConnectionManager::clearOutbox()
+{
+    mOutbox.clear();
+    emit outboxCountChanged(0);
+}
+
+/*!
+  Returns the ids of the clients connected to the server.
+*/
+QVariantList ConnectionManager::clients() const
+{
+    QVariantList clients;
+
+    foreach (int clientId, mClients.keys()) {
+        clients.append(clientId);
+    }
+
+    return clients;
+}
+
+/*!
+  Starts connection. If \a to is given tries to connect to it.
+*/
+void ConnectionManager::connect(const QString &to)
+{
+    qDebug() << "ConnectionManager::connect()";
+
+    //If we have not established a connection and to is given,
+    //try to establish a connection and then proceed
+    if (mStatus == NotConnected && !to.isEmpty()) {
+        if (!mConnection) {
+            setConnectionType(mConnectionType);
+        }
+
+        applySettings();
+
+        if (!mConnection) {
+            qDebug() << "ConnectionManager::connect(): No Connection.";
+        }
+
+        bool connected = false;
+
+        if (mConnection) {
+            IoThread::call(mConnection, "connect", Q_RETURN_ARG(bool, connected));
+        }
+
+        if (!connected) {
+            qDebug() << "ConnectionManager::connect(): Failed to connect!";
+        }
+    }
+
+    bool isClient = mConnectAs == ConnectionIf::Client;
+    bool isDontCare = mConnectAs == ConnectionIf::DontCare;
+    bool isDiscovering = mStatus == Discovering;
+    bool isLan = mConnectionType == LAN;
+    bool isBluetooth = mConnectionType == Bluetooth;
+
+    if (mStatus == NotConnected) {
+        if (!mConnection) {
+            setConnectionType(mConnectionType);
+        }
+
+        applySettings();
+
+        if (!mConnection) {
+            qDebug() << "ConnectionManager::connect(): No Connection.";
+        }
+
+        bool connected = false;
+
+        if (mConnection) {
+            IoThread::call(mConnection, "connect", Q_RETURN_ARG(bool, connected));
+        }
+
+        if (!connected) {
             qDebug() << "ConnectionManager::connect(): Failed to connect!";
         }
+    } else if (isDiscovering && isBluetooth && isClient && !to.isEmpty()) {
+        // Bluetooth client trying to connect to a discovered service/device
+        qDebug() << "ConnectionManager::connect(): Will try to connect to" << to;
+
+        if (mConnection && mConnection->type() == ConnectionIf::Bluetooth) {
+            BluetoothConnection *btConn = qobject_cast<BluetoothConnection*>(mConnection);
+
+            bool connected = false;
+            IoThread::call(btConn, "connectToService",
+                           Q_RETURN_ARG(bool, connected), Q_ARG(QString, to));
+
+            if (!connected) {
+                qDebug() << "ConnectionManager::connect():"
+                         << "Failed to connect to" << to;
+                disconnect();
+            }
+        }
+    } else if (isDiscovering && isLan && (isClient || isDontCare) && !to.isEmpty()) {
+        qDebug() << "ConnectionManager::connect(): Will try to connect to" << to;
+
+        if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+            WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+
+            bool connected = false;
+            IoThread::call(lanConn, "connectToServer",
+                           Q_RETURN_ARG(bool, connected), Q_ARG(QString, to));
+
+            if (!connected) {
+                qDebug() << "ConnectionManager::connect():"
+                         << "Failed to connect to" << to;
+                disconnect();
+            }
+        }
+
+    } else {
+        qDebug() << "ConnectionManager::connect():"
+                 << "Invalid status for connecting!"
+                 << "Try calling disconnect() first.";
+    }
+}
+
+/*!
+  Disconnects. If \a message is non-empty tries to broadcast it.
+*/
+void ConnectionManager::disconnect(const QString &message)
+{
+    qDebug() << "ConnectionManager::disconnect():" << message;
+
+    if (!message.isEmpty()) {
+        send(message);
+    }
+
+    //Messages still being compressed are dropped with the connection
+    mCompressor.clear();
+
+    if (mConnection) {
+        IoThread::call(mConnection, "disconnect");
+    }
+
+    mPeerName = "";
+    emit peerNameChanged(mPeerName);
+    setStatus(NotConnected);
+}
+
+/*!
+  Sends a \a message using the connection.
+  If \a header is enabled we add a header to the data that describes the size.
+  If \a compression is enabled data is compressed using default zlib compression.
+  With \a AdaptiveCompression \a compression is ignored, see \a compressionMode.
+  If not connected and \a outboxSize is set, the message is queued and sent
+  once connected. \a expiry overrides \a outboxExpiry for a queued message,
+  -1 uses the default.
+  Returns true if successful or queued, false otherwise, e.g. if \a message
+  is larger than the peers accept, at most 16 MB.
+*/
+bool ConnectionManager::send(const QString &message, bool header /*= true*/, bool compression /*= false*/,
+                             int expiry /*= -1*/)
+{
+    if (message.size() > maxFrameSize()) {
+        qDebug() << "ConnectionManager::send(): Message too large:" << message.size();
+        return false;
+    }
+
+    if (mStatus != Connected || !mConnection) {
+        if (mOutbox.size() > 0) {
+            bool queued = mOutbox.enqueue(toMessage(message, header,
+                                                    compressionFor(message, compression)),
+                                          expiry);
+            qDebug() << "ConnectionManager::send(): Not connected, message queued:" << queued;
+            emit outboxCountChanged(mOutbox.count());
+            return queued;
+        }
+
+        return false;
+    }
+
+    //Keep the order, the queued messages go first
+    flushOutbox();
+
+    if (compression) {
+        qDebug() << "ConnectionManager::send(): Original size:" << message.size();
+    }
+
+    return sendMessage(message, header, compression, QVariant());
+}
+
+/*!
+  Sends \a message to the same peers as \a send() with \a priority, one of
+  \a MessagePriority. If \a deadline in milliseconds is given and the
+  message is still waiting in the queue by then, it is dropped instead of
+  sent late. \a compression is used as in \a send(). The priority takes
+  effect only with \a queueMode, and the message isn't kept in the outbox
+  when not connected. Returns true if successful, false otherwise.
+*/
+bool ConnectionManager::sendWithPriority(const QString &message, int priority,
+                                         int deadline /*= 0*/, bool compression /*= false*/)
+{
+    if (mStatus != Connected || !mConnection) {
+        return false;
+    }
+
+    flushOutbox();
+
+    qint64 expires = deadline > 0 ? QDateTime::currentMSecsSinceEpoch() + deadline : 0;
+    QVariantList route;
+    route << qBound(int(LowPriority), priority, int(UrgentPriority)) << expires;
+    return sendMessage(message, true, compression, route);
+}
+
+/*!
+  Sends \a message, the latest value for \a key, to the same peers as
+  \a send() with \a priority. A message with the same \a key still
+  waiting to be written to a peer is replaced by this one, so that a peer
+  on a slow link gets the latest state of e.g. a position instead of a
+  backlog of stale ones. Messages with a key wait in the queue while the
+  socket is busy even with \a NoQueue. \a compression is used as in
+  \a send(), unless the message is sent as a delta, see \a deltaEncoding.
+  Returns true if successful, false otherwise.
+*/
+bool ConnectionManager::sendLatest(const QString &key, const QString &message,
+                                   int priority /*= NormalPriority*/,
+                                   bool compression /*= false*/)
+{
+    if (mStatus != Connected || !mConnection || key.isEmpty()) {
+        return false;
+    }
+
+    flushOutbox();
+
+    QVariantList route;
+    route << qBound(int(LowPriority), priority, int(UrgentPriority)) << qint64(0) << key;
+
+    if (mDeltaEncoding) {
+        //Framed by the connection, as a delta or whole depending on the peer
+        route << true;
+        return sendMessage(message, false, false, route);
+    }
+
+    return sendMessage(message, true, compression, route);
+}
+
+/*!
+  Returns the statistics of the send queues by priority, lowest first.
+  Each entry has the number of messages \c sent, \c dropped past their
+  deadline and \c queued at the moment, and the \c averageDelay and
+  \c maxDelay in milliseconds the sent messages waited in the queue, and
+  the number of messages \c conflated, i.e. replaced by a newer one with
+  the same key, see \a sendLatest(). With \a ioThread the statistics are
+  updated in the background and returned as of the previous call.
+*/
+QVariantList ConnectionManager::queueStatistics() const
+{
+    if (mConnection) {
+        IoThread::post(mConnection, "updateQueueStatistics");
+    }
+
+    return mQueueStatistics;
+}
+
+/*!
+  Publishes \a message on \a topic. A server sends it to the clients
+  subscribed to \a topic, and a client to the server, which passes it on
+  to the other subscribed clients. The publisher doesn't receive its own
+  message. \a compression is used as in \a send(). Returns false if not
+  connected, if \a topic is invalid, if \a message is too large or if the
+  server is an older version that doesn't support topics, see
+  \a subscriptions.
+*/
+bool ConnectionManager::publish(const QString &topic, const QString &message,
+                                bool compression /*= false*/)
+{
+    if (mStatus != Connected || !mConnection || !TopicIndex::isValidTopic(topic)) {
+        return false;
+    }
+
+    if (message.size() > maxFrameSize()) {
+        qDebug() << "ConnectionManager::publish(): Message too large:" << message.size();
+        return false;
+    }
+
+    if (mConnectAs == ConnectionIf::Client && !peerHasFeature(0, Handshake::TopicsFeature)) {
+        qDebug() << "ConnectionManager::publish(): The server doesn't support topics";
+        return false;
+    }
+
+    flushOutbox();
+
+    //Framed by deliver() once compressed, the topic goes in front of the payload
+    compression = compressionFor(message, compression);
+    QVariantMap route;
+    route.insert("topic", topic);
+    route.insert("compressed", compression);
+
+    if (!compression && mCompressor.isIdle(OutgoingStream)) {
+        return deliver(message.toAscii(), route);
+    }
+
+    int level = mCompressionMode == AdaptiveCompression ? mCompressionPolicy.level() : -1;
+    mCompressor.submit(OutgoingStream, message.toAscii(),
+                       compression ? CompressionPool::Compress : CompressionPool::Pass,
+                       route, level);
+    return true;
+}
+
+/*!
+  Sends \a object to all the peers like \a send(), in a compact binary
+  encoding instead of text, e.g. sendObject({"x": 10, "y": 20.5}). The peers
+  receive it with \a receivedObject(). Numbers, booleans, strings, dates,
+  lists and nested objects keep their types, other values are sent as
+  strings. With \a schema, the id of a schema registered with
+  \a registerSchema(), only the fields of the schema are sent, packed
+  without their names. Returns false if not connected, if \a schema is
+  not registered, if the encoded object is too large or if the server is
+  an older version that doesn't support objects.
+*/
+bool ConnectionManager::sendObject(const QVariantMap &object, int schema /*= -1*/)
+{
+    if (mStatus != Connected || !mConnection) {
+        return false;
+    }
+
+    if (schema >= 0 && !mObjects.hasSchema(schema)) {
+        qDebug() << "ConnectionManager::sendObject(): Unknown schema" << schema;
+        return false;
+    }
+
+    if (mConnectAs == ConnectionIf::Client && !peerHasFeature(0, Handshake::ObjectsFeature)) {
+        qDebug() << "ConnectionManager::sendObject(): The server doesn't support objects";
+        return false;
+    }
+
+    flushOutbox();
+
+    QByteArray encoded = mObjects.encode(object, schema);
+    QByteArray frame = Common::toObjectMessage(encoded);
+
+    if (frame.isEmpty() || encoded.size() > maxFrameSize()) {
+        qDebug() << "ConnectionManager::sendObject(): Object too large";
+        return false;
     }
 
-    bool isClient = mConnectAs == ConnectionIf::Client;
-    bool isDontCare = mConnectAs == ConnectionIf::DontCare;
-    bool isDiscovering = mStatus == Discovering;
-    bool isLan = mConnectionType == LAN;
-    bool isBluetooth = mConnectionType == Bluetooth;
+    QVariantMap route;
+    route.insert("object", true);
 
-    if (mStatus == NotConnected) {
-        if (!mConnection) {
-            setConnectionType(mConnectionType);
+    //Queued behind the messages still being compressed to keep the order
+    if (mCompressor.isIdle(OutgoingStream)) {
+        return deliver(frame, route);
+    }
+
+    mCompressor.submit(OutgoingStream, frame, CompressionPool::Pass, route);
+    return true;
+}
+
+/*!
+  Registers \a fields as the schema \a id for \a sendObject(), e.g.
+  registerSchema(1, ["x:float", "y:float", "pressed:bool"]). Each field is
+  a name and one of the types bool, int8, int16, int32 (or int), int64,
+  float, double, string and bytes. The schema is compiled once, which
+  makes sending and receiving its objects cheap. The peers must register
+  the same schemas with the same ids, objects with a schema the receiver
+  doesn't know are dropped. Returns false if \a id is negative or
+  \a fields is not valid.
+*/
+bool ConnectionManager::registerSchema(int id, const QStringList &fields)
+{
+    if (!mObjects.addSchema(id, fields)) {
+        qDebug() << "ConnectionManager::registerSchema(): Invalid schema" << id << fields;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+  Removes the schema \a id.
+*/
+void ConnectionManager::unregisterSchema(int id)
+{
+    mObjects.removeSchema(id);
+}
+
+/*!
+  Adds \a topic to \a subscriptions. Returns false if \a topic is invalid.
+*/
+bool ConnectionManager::subscribe(const QString &topic)
+{
+    if (!TopicIndex::isValidTopic(topic)) {
+        return false;
+    }
+
+    setSubscriptions(subscriptions() << topic);
+    return true;
+}
+
+/*!
+  Removes \a topic from \a subscriptions.
+*/
+void ConnectionManager::unsubscribe(const QString &topic)
+{
+    QStringList topics = subscriptions();
+    topics.removeAll(topic);
+    setSubscriptions(topics);
+}
+
+/*!
+  Connects to \a server in addition to the server the client is connected to.
+  Only used with \a LAN connection when \a connectAs is \a Client.
+  Returns true if the connection was started, false otherwise.
+*/
+bool ConnectionManager::addServer(const QString &server)
+{
+    if (mStatus == Connected && mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        bool added = false;
+        IoThread::call(lanConn, "addServer", Q_RETURN_ARG(bool, added), Q_ARG(QString, server));
+        return added;
+    }
+
+    return false;
+}
+
+/*!
+  Disconnects from \a server added with \a addServer().
+  Returns true if the server was found, false otherwise.
+*/
+bool ConnectionManager::removeServer(const QString &server)
+{
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        bool removed = false;
+        IoThread::call(lanConn, "removeServer", Q_RETURN_ARG(bool, removed), Q_ARG(QString, server));
+
+        if (removed) {
+            mServerProtocols.remove(server);
         }
 
-        applySettings();
+        return removed;
+    }
 
-        if (!mConnection) {
-            qDebug() << "ConnectionManager::connect(): No Connection.";
+    return false;
+}
+
+/*!
+  Sends \a message only to \a server, one of \a servers. \a header and
+  \a compression are used as in \a send().
+  Returns true if successful, false otherwise.
+*/
+bool ConnectionManager::sendToServer(const QString &server, const QString &message,
+                                     bool header /*= true*/, bool compression /*= false*/)
+{
+    if (mStatus == Connected && mConnection && mConnection->type() == ConnectionIf::LAN) {
+        return sendMessage(message, header, compression, server);
+    }
+
+    return false;
+}
+
+/*!
+  Sends \a message only to the client \a clientId instead of all the clients.
+  \a header and \a compression are used as in \a send().
+  Returns true if successful, false otherwise.
+*/
+bool ConnectionManager::sendTo(int clientId, const QString &message,
+                               bool header /*= true*/, bool compression /*= false*/)
+{
+    if (mStatus == Connected && mConnection) {
+        return sendMessage(message, header, compression, clientId);
+    }
+
+    return false;
+}
+
+/*!
+  Returns the name of the client \a clientId, empty if not connected.
+*/
+QString ConnectionManager::clientName(int clientId) const
+{
+    return mClients.value(clientId);
+}
+
+/*!
+  Returns the protocol settings agreed with the client \a clientId, or with
+  the server if \a clientId is 0: \c version, \c maxFrameSize, \c codecs and
+  \c features. Empty if the peer is an older version that doesn't take part
+  in the handshake, or if it hasn't completed yet.
+*/
+QVariantMap ConnectionManager::peerProtocol(int clientId /*= 0*/) const
+{
+    return mPeerProtocols.value(clientId);
+}
+
+/*!
+  Returns the protocol settings agreed with \a server, one of the servers
+  added with \a addServer(), like \a peerProtocol() for the server
+  connected to first.
+*/
+QVariantMap ConnectionManager::serverProtocol(const QString &server) const
+{
+    return mServerProtocols.value(server);
+}
+
+/*!
+  Opens the logical channel called \a name with \a priority, or returns the
+  channel already opened with that name. Messages sent on the channel are
+  interleaved with the other channels so that a large transfer doesn't
+  hold back the rest, and the channels share the link in proportion to
+  their priority. Messages sent with \a send() go ahead of the channels.
+  The peer receives the messages only if it has opened a channel with the
+  same name. Returns 0 if \a name is empty or there are no channel ids left.
+*/
+Channel *ConnectionManager::openChannel(const QString &name, int priority /*= 1*/)
+{
+    Channel *channel = mChannels.value(name);
+
+    if (channel) {
+        channel->setPriority(priority);
+        return channel;
+    }
+
+    if (name.isEmpty() || mNextChannelId > MaxChannelId) {
+        qDebug() << "ConnectionManager::openChannel(): Can't open channel" << name;
+        return 0;
+    }
+
+    channel = new Channel(mNextChannelId++, name, priority, this);
+    mChannels.insert(name, channel);
+
+    //Returned to QML, which would otherwise garbage collect it
+    QDeclarativeEngine::setObjectOwnership(channel, QDeclarativeEngine::CppOwnership);
+
+    qDebug() << "ConnectionManager::openChannel():" << name << "id" << channel->id()
+             << "priority" << channel->priority();
+    return channel;
+}
+
+/*!
+  Closes the channel called \a name. The messages still being compressed
+  for it are dropped, and the messages received on it are ignored.
+*/
+void ConnectionManager::closeChannel(const QString &name)
+{
+    Channel *channel = mChannels.take(name);
+
+    if (channel) {
+        mCompressor.clear(channel->id());
+        channel->deleteLater();
+    }
+}
+
+/*!
+  Calls \a method with \a args on the client \a clientId, or on the server
+  if \a clientId is 0, not on the additional servers, where it is handled by the handler registered with
+  \a registerMethod(). Returns the call right away, which emits
+  RpcCall::finished() with the result once the reply arrives, or
+  RpcCall::failed() if the peer replies with an error, disconnects or
+  doesn't reply in \a timeout milliseconds. A negative \a timeout means
+  \a rpcTimeout. Any number of calls can wait for their replies at the
+  same time. Returns 0 if not connected or if the peer is an older
+  version that doesn't take calls.
+*/
+RpcCall *ConnectionManager::call(const QString &method, const QVariantList &args /*= QVariantList()*/,
+                                 int timeout /*= -1*/, int clientId /*= 0*/)
+{
+    if (mStatus != Connected || !mConnection || method.isEmpty()) {
+        return 0;
+    }
+
+    if (!peerHasFeature(clientId, Handshake::RpcFeature)) {
+        qDebug() << "ConnectionManager::call(): Peer" << clientId << "doesn't take calls";
+        return 0;
+    }
+
+    quint32 id = mNextCallId++;
+    RpcCall *call = new RpcCall(id, method, clientId, timeout < 0 ? mRpcTimeout : timeout, this);
+
+    if (!deliver(RpcMessage(RpcMessage::Request, id, args, method).toFrame(),
+                 peerRoute(clientId)))
+    {
+        delete call;
+        return 0;
+    }
+
+    mCalls.insert(id, call);
+    QObject::connect(call, SIGNAL(statusChanged(int)), this, SLOT(onCallStatusChanged()));
+
+    //Returned to QML, which would otherwise garbage collect it
+    QDeclarativeEngine::setObjectOwnership(call, QDeclarativeEngine::CppOwnership);
+
+    qDebug() << "ConnectionManager::call():" << method << "id" << id << "to" << clientId;
+    return call;
+}
+
+/*!
+  Handles the calls of \a method from the peers with \a member of
+  \a handler, a slot or a QML function taking the arguments as a list and
+  returning the result, e.g. \c {function add(args) { return args[0] + args[1] }}.
+  Replaces the handler registered earlier for \a method. Returns false if
+  \a handler has no such \a member.
+*/
+bool ConnectionManager::registerMethod(const QString &method, QObject *handler,
+                                       const QString &member)
+{
+    QByteArray name = member.toAscii();
+    QByteArray signature = QMetaObject::normalizedSignature(name + "(QVariant)");
+
+    if (method.isEmpty() || !handler || handler->metaObject()->indexOfMethod(signature) < 0) {
+        qDebug() << "ConnectionManager::registerMethod(): Can't handle" << method << "with" << member;
+        return false;
+    }
+
+    mMethods.insert(method, qMakePair(QPointer<QObject>(handler), name));
+    return true;
+}
+
+/*!
+  Stops handling the calls of \a method, they are replied to with an error.
+*/
+void ConnectionManager::unregisterMethod(const QString &method)
+{
+    mMethods.remove(method);
+}
+
+/*!
+  Sends \a message on \a channel, see Channel::send(). Compressed messages
+  are compressed in the worker pool, each channel keeping the order of its
+  own messages. Returns false if not connected or if \a message is larger
+  than the peers take.
+*/
+bool ConnectionManager::sendOnChannel(Channel *channel, const QString &message, bool compression)
+{
+    if (mStatus != Connected || !mConnection || mChannels.value(channel->name()) != channel) {
+        return false;
+    }
+
+    if (message.size() > Common::MaxFrameSize) {
+        qDebug() << "ConnectionManager::sendOnChannel(): Message too large:" << message.size();
+        return false;
+    }
+
+    compression = compressionFor(message, compression);
+    int stream = channel->id();
+
+    if (!compression && mCompressor.isIdle(stream)) {
+        return deliverOnChannel(stream, message.toAscii(), false);
+    }
+
+    int level = mCompressionMode == AdaptiveCompression ? mCompressionPolicy.level() : -1;
+    mCompressor.submit(stream, message.toAscii(),
+                       compression ? CompressionPool::Compress : CompressionPool::Pass,
+                       compression, level);
+    return true;
+}
+
+/*!
+  Creates the bytes sent for \a message with or without a \a header and
+  \a compression.
+*/
+QByteArray ConnectionManager::toMessage(const QString &message, bool header, bool compression) const
+{
+    if (compression) {
+        return CompressionPool::process(message.toAscii(),
+                                        header ? CompressionPool::CompressFrame : CompressionPool::Compress,
+                                        -1, mCompressor.dictionary());
+    }
+
+    if (header) {
+        return Common::toMessage(message);
+    }
+
+    return message.toAscii();
+}
+
+/*!
+  Returns whether \a message is compressed when \a compression was requested
+  for it, according to \a compressionMode.
+*/
+bool ConnectionManager::compressionFor(const QString &message, bool compression)
+{
+    if (mCompressionMode == AdaptiveCompression) {
+        return mCompressionPolicy.shouldCompress(message.size());
+    }
+
+    return compression;
+}
+
+/*!
+  Sends \a message to \a route, see deliver(). A compressed message is
+  compressed in the worker pool and sent once ready, and the messages sent
+  after it wait for their turn so that the order is kept. Returns false only
+  if \a message doesn't fit in a frame or if a message sent right away could
+  not be sent.
+*/
+bool ConnectionManager::sendMessage(const QString &message, bool header, bool compression,
+                                    const QVariant &route)
+{
+    if (message.size() > maxFrameSize()) {
+        qDebug() << "ConnectionManager::sendMessage(): Message too large:" << message.size();
+        return false;
+    }
+
+    compression = compressionFor(message, compression);
+
+    if (!compression && mCompressor.isIdle(OutgoingStream)) {
+        return deliver(toMessage(message, header, false), route);
+    }
+
+    if (compression) {
+        int level = mCompressionMode == AdaptiveCompression ? mCompressionPolicy.level() : -1;
+        mCompressor.submit(OutgoingStream, message.toAscii(),
+                           header ? CompressionPool::CompressFrame : CompressionPool::Compress,
+                           route, level);
+    } else {
+        mCompressor.submit(OutgoingStream, toMessage(message, header, false),
+                           CompressionPool::Pass, route);
+    }
+
+    return true;
+}
+
+/*!
+  Hands the encoded \a message over to the connection. \a route is either
+  empty for all the peers, a client id for a single client, the name of
+  one of the servers, an empty name meaning the server connected to with
+  connect(), the priority, expiry time, optional key and delta encoding
+  of a message for all the peers, the topic a message is published on
+  and whether it is compressed, or an object frame.
+*/
+bool ConnectionManager::deliver(const QByteArray &message, const QVariant &route)
+{
+    bool sent = true;
+
+    if (route.type() == QVariant::Int) {
+        qDebug() << "ConnectionManager::deliver(): To client" << route.toInt()
+                 << "Message size:" << message.size();
+        IoThread::post(mConnection, "sendTo", Q_RETURN_ARG(bool, sent),
+                       Q_ARG(int, route.toInt()), Q_ARG(QByteArray, message));
+    } else if (route.type() == QVariant::String) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+
+        if (!lanConn) {
+            return false;
         }
 
-        if (!mConnection || !mConnection->connect()) {
-            qDebug() << "ConnectionManager::connect(): Failed to connect!";
+        qDebug() << "ConnectionManager::deliver(): To server" << route.toString()
+                 << "Message size:" << message.size();
+        IoThread::post(lanConn, "sendToServer", Q_RETURN_ARG(bool, sent),
+                       Q_ARG(QString, route.toString()), Q_ARG(QByteArray, message));
+    } else if (route.type() == QVariant::Map && route.toMap().contains("object")) {
+        qDebug() << "ConnectionManager::deliver(): Object size:" << message.size();
+        IoThread::post(mConnection, "sendObject", Q_RETURN_ARG(bool, sent),
+                       Q_ARG(QByteArray, message));
+    } else if (route.type() == QVariant::Map) {
+        QString topic = route.toMap().value("topic").toString();
+        QByteArray frame = Common::toTopicMessage(topic, message,
+                                                  route.toMap().value("compressed").toBool());
+        qDebug() << "ConnectionManager::deliver(): On topic" << topic
+                 << "Message size:" << message.size();
+        IoThread::post(mConnection, "publish", Q_RETURN_ARG(bool, sent),
+                       Q_ARG(QByteArray, frame), Q_ARG(QString, topic));
+    } else if (route.type() == QVariant::List) {
+        QVariantList priority = route.toList();
+        QString key = priority.value(2).toString();
+        qDebug() << "ConnectionManager::deliver(): Priority" << priority.value(0).toInt()
+                 << "Key" << key << "Message size:" << message.size();
+
+        if (key.isEmpty()) {
+            IoThread::post(mConnection, "sendWithPriority", Q_RETURN_ARG(bool, sent),
+                           Q_ARG(QByteArray, message), Q_ARG(int, priority.value(0).toInt()),
+                           Q_ARG(qint64, priority.value(1).toLongLong()));
+        } else if (priority.value(3).toBool()) {
+            IoThread::post(mConnection, "sendDelta", Q_RETURN_ARG(bool, sent),
+                           Q_ARG(QByteArray, message), Q_ARG(QString, key),
+                           Q_ARG(int, priority.value(0).toInt()));
+        } else {
+            IoThread::post(mConnection, "sendLatest", Q_RETURN_ARG(bool, sent),
+                           Q_ARG(QByteArray, message), Q_ARG(QString, key),
+                           Q_ARG(int, priority.value(0).toInt()));
         }
-    } else if (isDiscovering && isBluetooth && isClient && !to.isEmpty()) {
-        // Bluetooth client trying to connect to a discovered service/device
-        qDebug() << "ConnectionManager::connect(): Will try to connect to" << to;
+    } else {
+        qDebug() << "ConnectionManager::deliver(): Message size:" << message.size();
+        IoThread::post(mConnection, "send", Q_RETURN_ARG(bool, sent), Q_ARG(QByteArray, message));
+    }
 
-        if (mConnection && mConnection->type() == ConnectionIf::Bluetooth) {
-            BluetoothConnection *btConn = qobject_cast<BluetoothConnection*>(mConnection);
+    if (sent) {
+        measureLink(message.size());
+    }
 
-            if (!btConn->connectToService(to)) {
-                qDebug() << "ConnectionManager::connect():"
-                         << "Failed to connect to" << to;
-                disconnect();
-            }
+    return sent;
+}
+
+/*!
+  Hands \a message, \a compressed as a whole or not, over to the connection
+  to be sent on the channel \a channelId.
+*/
+bool ConnectionManager::deliverOnChannel(int channelId, const QByteArray &message, bool compressed)
+{
+    Channel *channel = 0;
+
+    foreach (Channel *open, mChannels) {
+        if (open->id() == channelId) {
+            channel = open;
+            break;
         }
-    } else if (isDiscovering && isLan && (isClient || isDontCare) && !to.isEmpty()) {
-        qDebug() << "ConnectionManager::connect(): Will try to connect to" << to;
+    }
+
+    if (!channel) {
+        qDebug() << "ConnectionManager::deliverOnChannel(): Channel" << channelId << "closed";
+        return false;
+    }
+
+    qDebug() << "ConnectionManager::deliverOnChannel():" << channel->name()
+             << "Message size:" << message.size();
+
+    bool sent = true;
+    IoThread::post(mConnection, "sendOnChannel", Q_RETURN_ARG(bool, sent),
+                   Q_ARG(ChannelInfo, channel->info()), Q_ARG(QByteArray, message),
+                   Q_ARG(bool, compressed));
+
+    if (sent) {
+        measureLink(message.size());
+    }
+
+    return sent;
+}
+
+/*!
+  Accounts the \a sent bytes to the link throughput and, once in a while,
+  checks how much is still waiting in the sockets to tune the compression
+  level. Only used with \a AdaptiveCompression.
+*/
+void ConnectionManager::measureLink(int sent)
+{
+    if (mCompressionMode != AdaptiveCompression) {
+        return;
+    }
+
+    mCompressionPolicy.sent(sent);
+
+    if (!mCompressionPolicy.needsLinkSample()) {
+        return;
+    }
+
+    qint64 pending = 0;
+    IoThread::call(mConnection, "bytesToWrite", Q_RETURN_ARG(qint64, pending));
+
+    int level = mCompressionPolicy.level();
+    mCompressionPolicy.addLinkSample(pending);
+
+    if (level != mCompressionPolicy.level()) {
+        qDebug() << "ConnectionManager::measureLink(): Link" << mCompressionPolicy.linkThroughput()
+                 << "B/s, compression level" << level << "->" << mCompressionPolicy.level();
+        emit compressionLevelChanged(mCompressionPolicy.level());
+    }
+}
+
+/*!
+  Propagates the current settings to connection instance.
+*/
+void ConnectionManager::applySettings()
+{
+    if (mConnection) {
+        IoThread::call(mConnection, "setServiceInfo",
+                       Q_ARG(QString, mServiceName), Q_ARG(QString, mServiceProvider));
+    }
+}
+
+/*!
+  Compresses with the preset dictionary only if every connected peer, the
+  additional servers included, agreed on it in the handshake, and with
+  plain zlib otherwise. The messages are sent to all the peers, so a
+  single peer without the dictionary is enough to fall back.
+*/
+void ConnectionManager::updateDictionaryUse()
+{
+    bool agreed = !mDictionary.isEmpty() && !mPeerProtocols.isEmpty();
+    QString codec = Handshake::dictionaryCodec(mDictionary.id());
+
+    foreach (const QVariantMap &protocol, mPeerProtocols) {
+        agreed = agreed && protocol.value("codecs").toStringList().contains(codec);
+    }
+
+    foreach (const QVariantMap &protocol, mServerProtocols) {
+        agreed = agreed && protocol.value("codecs").toStringList().contains(codec);
+    }
+
+    mCompressor.setDictionary(agreed ? mDictionary : CompressionDictionary());
+}
+
+/*!
+  Returns true if the client \a clientId, or the server if \a clientId is
+  0, announced \a feature in the handshake.
+*/
+bool ConnectionManager::peerHasFeature(int clientId, const char *feature) const
+{
+    return mPeerProtocols.value(clientId).value("features").toStringList().contains(feature);
+}
 
-        if (mConnection && mConnection->type() == ConnectionIf::LAN) {
-            WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+/*!
+  Returns the size of the largest message every connected peer accepts,
+  the smallest frame size agreed in the handshakes. Older peers accept
+  anything that fits in a frame.
+*/
+int ConnectionManager::maxFrameSize() const
+{
+    int size = Common::MaxFrameSize;
 
-            if (!lanConn->connectToServer(to)) {
-                qDebug() << "ConnectionManager::connect():"
-                         << "Failed to connect to" << to;
-                disconnect();
-            }
-        }
+    foreach (const QVariantMap &protocol, mPeerProtocols) {
+        size = qMin(size, protocol.value("maxFrameSize", size).toInt());
+    }
 
-    } else {
-        qDebug() << "ConnectionManager::connect():"
-                 << "Invalid status for connecting!"
-                 << "Try calling disconnect() first.";
+    foreach (const QVariantMap &protocol, mServerProtocols) {
+        size = qMin(size, protocol.value("maxFrameSize", size).toInt());
     }
+
+    return size;
 }
 
 /*!
-  Disconnects. If \a message is non-empty tries to broadcast it.
+  Sends the queued messages in order with a single call, ahead of the
+  messages sent after this. The ones that can't be sent are put back into
+  the outbox, see onOutboxSent().
 */
-void ConnectionManager::disconnect(const QString &message)
+void ConnectionManager::flushOutbox()
 {
-    qDebug() << "ConnectionManager::disconnect():" << message;
+    if (!mConnection || mOutbox.size() == 0) {
+        return;
+    }
 
-    if (!message.isEmpty()) {
-        send(message);
+    QList<QByteArray> messages = mOutbox.take();
+
+    if (messages.isEmpty()) {
+        return;
     }
 
+    qDebug() << "ConnectionManager::flushOutbox():" << messages.size() << "queued messages";
+    IoThread::post(mConnection, "sendOutbox", Q_ARG(QList<QByteArray>, messages));
+    emit outboxCountChanged(mOutbox.count());
+}
+
+/*!
+  Propagates the relay rules to connection instance.
+*/
+void ConnectionManager::applyRelayRouter()
+{
     if (mConnection) {
-        mConnection->disconnect();
+        IoThread::call(mConnection, "setRelayRouter", Q_ARG(RelayRouter, mRelayRouter));
     }
-
-    mPeerName = "";
-    emit peerNameChanged(mPeerName);
-    setStatus(NotConnected);
 }
 
 /*!
-  Sends a \a message using the connection.
-  If \a header is enabled we add a header to the data that describes the size.
-  If \a compression is enabled data is compressed using default zlib compression.
-  Returns true if successful, false otherwise.
+  Deletes the connection instance. A connection living in the I/O thread is
+  deleted there once the calls already posted to it have run.
 */
-bool ConnectionManager::send(const QString &message, bool header /*= true*/, bool compression /*= false*/)
+void ConnectionManager::deleteConnection()
 {
-    if (mStatus == Connected && mConnection) {
-        QByteArray msg;
-        if (header) {
-            msg = Common::toMessage(message, compression);
-        } else {
-            if (compression) {
-                msg = qCompress(message.toAscii());
-            } else {
-                msg = message.toAscii();
-            }
-        }
+    if (!mConnection) {
+        return;
+    }
 
-        if (compression) {
-            qDebug() << "ConnectionManager::send(): Original size:" << message.size();
-        }
-        qDebug() << "ConnectionManager::send(): Message size:" << msg.size();
+    if (mIoThread && mConnection->thread() == mIoThread) {
+        //Signals already on their way from the old connection are dropped
+        QObject::disconnect(mConnection, 0, this, 0);
+        mIoThread->release(mConnection);
+    } else {
+        delete mConnection;
+    }
 
-        return mConnection->send(msg);
+    mConnection = 0;
+    mQueueStatistics.clear();
+
+    if (!mServers.isEmpty()) {
+        mServers.clear();
+        emit serversChanged();
     }
 
-    return false;
+    if (!mClients.isEmpty()) {
+        mClients.clear();
+        emit clientsChanged();
+    }
 }
 
 /*!
-  Propagates the current settings to connection instance.
+  Propagates the admission limits to connection instance.
 */
-void ConnectionManager::applySettings()
+void ConnectionManager::applyAdmissionControl()
+{
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        WlanConnection *lanConn = qobject_cast<WlanConnection*>(mConnection);
+        IoThread::call(lanConn, "setAdmissionControl", Q_ARG(AdmissionControl, mAdmission));
+    }
+}
+
+/*!
+  Propagates the socket options to connection instance.
+*/
+void ConnectionManager::applySocketOptions()
+{
+    if (mConnection) {
+        IoThread::call(mConnection, "setSocketOptions", Q_ARG(SocketOptions, mSocketOptions));
+    }
+}
+
+/*!
+  Propagates the reconnect policy to connection instance.
+*/
+void ConnectionManager::applyReconnectPolicy()
 {
     if (mConnection) {
-        mConnection->setServiceInfo(mServiceName, mServiceProvider);
+        IoThread::call(mConnection, "setReconnectPolicy", Q_ARG(ReconnectPolicy, mReconnectPolicy));
     }
 }
 
@@ -652,6 +2826,17 @@ void ConnectionManager::onConnectionIfStatusChanged(ConnectionStatus status)
             emit disconnected();
         }
 
+        mPeerProtocols.clear();
+        mServerProtocols.clear();
+        updateDictionaryUse();
+        failCalls(-1, "Disconnected");
+
+        //The server doesn't report the clients it drops when it stops
+        if (!mClients.isEmpty()) {
+            mClients.clear();
+            emit clientsChanged();
+        }
+
         mPeerName = "";
         emit peerNameChanged(mPeerName);
         setStatus(NotConnected);
@@ -669,7 +2854,7 @@ void ConnectionManager::onConnectionIfStatusChanged(ConnectionStatus status)
         if (mConnectAs == ConnectionIf::Server ||
             mConnectAs == ConnectionIf::DontCare)
         {
-            mPeerName = mConnection->connectedTo();
+            IoThread::call(mConnection, "connectedTo", Q_RETURN_ARG(QString, mPeerName));
             emit peerNameChanged(mPeerName);
         }
 
@@ -680,8 +2865,17 @@ void ConnectionManager::onConnectionIfStatusChanged(ConnectionStatus status)
             mTimeoutTimer.stop();
         }
 
-        mPeerName = mConnection->connectedTo();
+        IoThread::call(mConnection, "connectedTo", Q_RETURN_ARG(QString, mPeerName));
         emit peerNameChanged(mPeerName);
+
+        //The server counts as an older peer until it sends a HELLO
+        if (mConnectAs == ConnectionIf::Client) {
+            onClientConnected(0);
+        }
+
+        //Flush before announcing the connection so that the queued messages
+        //go out before anything sent from the status handlers
+        flushOutbox();
         setStatus(Connected);
         break;
     case ConnectionIf::Disconnecting:
@@ -690,3 +2884,373 @@ void ConnectionManager::onConnectionIfStatusChanged(ConnectionStatus status)
     }
 }
 
+/*!
+  The client \a clientId with \a name has connected to the server.
+*/
+void ConnectionManager::onClientAdded(int clientId, const QString &name)
+{
+    mClients.insert(clientId, name);
+    onClientConnected(clientId);
+    emit clientConnected(clientId, name);
+    emit clientsChanged();
+}
+
+/*!
+  Counts the new client \a clientId as an older peer until it sends a HELLO.
+*/
+void ConnectionManager::onClientConnected(int clientId)
+{
+    if (!mPeerProtocols.contains(clientId)) {
+        mPeerProtocols.insert(clientId, QVariantMap());
+        updateDictionaryUse();
+    }
+}
+
+/*!
+  Forgets the relay rules and the protocol of the disconnected client \a clientId.
+*/
+void ConnectionManager::onClientDisconnected(int clientId)
+{
+    mRelayRouter.removeClient(clientId);
+    applyRelayRouter();
+
+    mPeerProtocols.remove(clientId);
+    updateDictionaryUse();
+    failCalls(clientId, "Disconnected");
+
+    mClients.remove(clientId);
+    emit clientDisconnected(clientId);
+    emit clientsChanged();
+}
+
+/*!
+  The connection is connected to \a servers now.
+*/
+void ConnectionManager::onServersChanged(const QStringList &servers)
+{
+    mServers = servers;
+    emit serversChanged();
+}
+
+/*!
+  The queued messages sent with flushOutbox() have been handed to the
+  connection, except \a unsent which are put back into the outbox.
+*/
+void ConnectionManager::onOutboxSent(const QList<QByteArray> &unsent)
+{
+    if (!unsent.isEmpty()) {
+        mOutbox.putBack(unsent);
+        emit outboxCountChanged(mOutbox.count());
+    }
+}
+
+/*!
+  The connection reported the \a statistics of its send queues.
+*/
+void ConnectionManager::onQueueStatisticsUpdated(const QVariantList &statistics)
+{
+    mQueueStatistics = statistics;
+}
+
+/*!
+  The \a protocol settings have been agreed with the peer \a clientId.
+*/
+void ConnectionManager::onHandshakeCompleted(int clientId, const QVariantMap &protocol)
+{
+    qDebug() << "ConnectionManager::onHandshakeCompleted():" << clientId << protocol;
+    mPeerProtocols.insert(clientId, protocol);
+    updateDictionaryUse();
+    emit handshakeCompleted(clientId, protocol);
+}
+
+/*!
+  The protocol settings have been agreed with the additional \a server.
+*/
+void ConnectionManager::onServerHandshakeCompleted(const QString &server,
+                                                   const QVariantMap &protocol)
+{
+    qDebug() << "ConnectionManager::onServerHandshakeCompleted():" << server << protocol;
+    mServerProtocols.insert(server, protocol);
+    emit serverHandshakeCompleted(server, protocol);
+}
+
+/*!
+  A compressed \a message for \a route is ready and in turn to be sent.
+  On the stream of a channel \a route tells whether the message is
+  compressed.
+*/
+void ConnectionManager::onCompressed(int stream, const QByteArray &message, const QVariant &route)
+{
+    if (mStatus != Connected || !mConnection) {
+        qDebug() << "ConnectionManager::onCompressed(): Not connected, message dropped.";
+        return;
+    }
+
+    if (stream != OutgoingStream) {
+        deliverOnChannel(stream, message, route.toBool());
+        return;
+    }
+
+    deliver(message, route);
+}
+
+/*!
+  \a message was received on \a channel from the client \a clientId, or
+  from the server if \a clientId is 0.
+*/
+void ConnectionManager::onReceivedOnChannel(const QString &channel, const QString &message,
+                                            int clientId)
+{
+    Channel *open = mChannels.value(channel);
+
+    if (!open) {
+        qDebug() << "ConnectionManager::onReceivedOnChannel(): Channel" << channel
+                 << "not open, message dropped.";
+        return;
+    }
+
+    open->receive(message, clientId);
+}
+
+/*!
+  The remote procedure call or reply \a message was received from the
+  client \a clientId, or from the server if \a clientId is 0.
+*/
+void ConnectionManager::onReceivedRpc(const QByteArray &message, int clientId)
+{
+    RpcMessage rpc;
+
+    if (!RpcMessage::fromPayload(message, &rpc)) {
+        return;
+    }
+
+    if (rpc.type == RpcMessage::Request) {
+        dispatchCall(rpc, clientId);
+        return;
+    }
+
+    RpcCall *call = mCalls.value(rpc.id);
+
+    if (!call || call->clientId() != clientId) {
+        qDebug() << "ConnectionManager::onReceivedRpc(): No call" << rpc.id
+                 << "to" << clientId << ", reply dropped.";
+        return;
+    }
+
+    if (rpc.type == RpcMessage::Response) {
+        call->finish(rpc.value);
+    } else {
+        call->fail(RpcCall::Failed, rpc.value.toString());
+    }
+}
+
+/*!
+  The remote procedure call or reply \a message was received from the
+  additional \a server. Calls are only made to the server connected to
+  with connect(), so the replies are dropped.
+*/
+void ConnectionManager::onReceivedServerRpc(const QString &server, const QByteArray &message)
+{
+    RpcMessage rpc;
+
+    if (!RpcMessage::fromPayload(message, &rpc)) {
+        return;
+    }
+
+    if (rpc.type == RpcMessage::Request) {
+        dispatchCall(rpc, 0, server);
+        return;
+    }
+
+    qDebug() << "ConnectionManager::onReceivedServerRpc(): No call" << rpc.id
+             << "to" << server << ", reply dropped.";
+}
+
+/*!
+  \a message was published on \a topic by the client \a clientId, or by
+  the server if \a clientId is 0. Received only if subscribed to \a topic.
+*/
+void ConnectionManager::onReceivedOnTopic(const QString &topic, const QString &message,
+                                          int clientId)
+{
+    if (!mSubscriptions.isSubscribed(0, topic)) {
+        qDebug() << "ConnectionManager::onReceivedOnTopic(): Not subscribed to" << topic
+                 << ", message dropped.";
+        return;
+    }
+
+    emit receivedOnTopic(topic, message, clientId);
+}
+
+/*!
+  \a message was received from the client \a clientId, or from the server
+  \a origin if \a clientId is 0; \a origin is empty if the connection
+  doesn't tell. Collected into the batch if \a batchInterval is set.
+*/
+void ConnectionManager::onReceived(const QString &message, int clientId, const QString &origin)
+{
+    if (!mBatchInterval) {
+        emit received(message);
+
+        if (clientId > 0) {
+            emit receivedFromClient(message, clientId);
+        } else if (!origin.isEmpty()) {
+            emit receivedFrom(message, origin);
+        }
+
+        return;
+    }
+
+    QVariantMap item;
+    item.insert("message", message);
+    item.insert("clientId", clientId);
+
+    if (!origin.isEmpty()) {
+        item.insert("origin", origin);
+    }
+
+    mBatch.append(item);
+
+    if (!mBatchTimer.isActive()) {
+        mBatchTimer.start(mBatchInterval);
+    }
+}
+
+/*!
+  Delivers the collected messages with \a receivedBatch(), each a map of
+  the \c message, the \c clientId it came from, 0 for a server, and the
+  \c origin of a message from a server.
+*/
+void ConnectionManager::flushBatch()
+{
+    mBatchTimer.stop();
+
+    if (mBatch.isEmpty()) {
+        return;
+    }
+
+    QVariantList batch = mBatch;
+    mBatch.clear();
+
+    qDebug() << "ConnectionManager::flushBatch():" << batch.size() << "messages";
+    emit receivedBatch(batch);
+}
+
+/*!
+  The object \a data was sent by the client \a clientId, or by the server
+  if \a clientId is 0.
+*/
+void ConnectionManager::onReceivedObject(const QByteArray &data, int clientId)
+{
+    QVariantMap object;
+
+    if (!mObjects.decode(data, &object)) {
+        qDebug() << "ConnectionManager::onReceivedObject(): Invalid object from" << clientId;
+        return;
+    }
+
+    emit receivedObject(object, clientId);
+}
+
+/*!
+  A call has been replied to, failed or timed out.
+*/
+void ConnectionManager::onCallStatusChanged()
+{
+    RpcCall *call = qobject_cast<RpcCall*>(sender());
+
+    if (call && call->status() != RpcCall::Pending) {
+        mCalls.remove(call->id());
+    }
+}
+
+/*!
+  Calls the handler registered for the method of \a request and sends
+  the result, or the reason the method couldn't be called, back to the
+  client \a clientId, or to the server if \a clientId is 0. A call from
+  one of the additional servers is replied to that \a server only.
+*/
+void ConnectionManager::dispatchCall(const RpcMessage &request, int clientId,
+                                     const QString &server)
+{
+    QPair<QPointer<QObject>, QByteArray> handler = mMethods.value(request.method);
+    RpcMessage reply(RpcMessage::Response, request.id, QVariant());
+    QVariant result;
+
+    if (!handler.first) {
+        reply.type = RpcMessage::Error;
+        reply.value = QString("Unknown method %1").arg(request.method);
+    } else if (!QMetaObject::invokeMethod(handler.first, handler.second.constData(),
+                                          Q_RETURN_ARG(QVariant, result),
+                                          Q_ARG(QVariant, request.value)))
+    {
+        reply.type = RpcMessage::Error;
+        reply.value = QString("Can't call %1").arg(request.method);
+    } else {
+        reply.value = result;
+    }
+
+    qDebug() << "ConnectionManager::dispatchCall():" << request.method << "id" << request.id
+             << "from" << clientId << server
+             << (reply.type == RpcMessage::Error ? "failed" : "returned");
+
+    //The handler may have disconnected
+    if (mStatus == Connected && mConnection) {
+        deliver(reply.toFrame(), server.isEmpty() ? peerRoute(clientId) : QVariant(server));
+    }
+}
+
+/*!
+  Returns the route of a message only to the client \a clientId, or only
+  to the server connected to with connect() if \a clientId is 0, see
+  deliver(). The additional servers get the messages sent to all the peers.
+*/
+QVariant ConnectionManager::peerRoute(int clientId) const
+{
+    if (clientId > 0) {
+        return QVariant(clientId);
+    }
+
+    //An empty server name means the server connected to with connect()
+    if (mConnection && mConnection->type() == ConnectionIf::LAN) {
+        return QVariant(QString());
+    }
+
+    return QVariant();
+}
+
+/*!
+  Fails the calls waiting for a reply from the client \a clientId, or all
+  of them if \a clientId is negative, with \a error.
+*/
+void ConnectionManager::failCalls(int clientId, const QString &error)
+{
+    //Failing a call removes it from mCalls
+    foreach (RpcCall *call, mCalls) {
+        if (clientId < 0 || call->clientId() == clientId) {
+            call->fail(RpcCall::Failed, error);
+        }
+    }
+}
+
+/*!
+  A message of \a size bytes sent on \a stream was compressed to
+  \a compressedSize bytes in \a elapsed milliseconds with \a operation.
+*/
+void ConnectionManager::onCompressionMeasured(int stream, int operation, int size,
+                                              int compressedSize, int elapsed)
+{
+    Q_UNUSED(stream);
+
+    //Every stream is outgoing, the channels have one of their own
+    if (operation == CompressionPool::Uncompress || mCompressionMode != AdaptiveCompression) {
+        return;
+    }
+
+    qreal efficiency = mCompressionPolicy.efficiency();
+    mCompressionPolicy.addSample(size, compressedSize, elapsed);
+
+    if (efficiency != mCompressionPolicy.efficiency()) {
+        emit compressionEfficiencyChanged(mCompressionPolicy.efficiency());
+    }
+}
@@ -9,11 +9,31 @@
 #ifndef CONNECTIONMANAGER_H
 #define CONNECTIONMANAGER_H
 
+#include <QHash>
+#include <QMap>
 #include <QObject>
+#include <QPair>
+#include <QPointer>
 #include <QString>
+#include <QStringList>
 #include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
 
+#include "admissioncontrol.h"
+#include "compressionpool.h"
+#include "compressionpolicy.h"
 #include "connectionif.h"
+#include "objectcodec.h"
+#include "outbox.h"
+#include "rpccall.h"
+#include "sendqueue.h"
+#include "topicindex.h"
+
+//Forward declarations
+class Channel;
+class IoThread;
+struct RpcMessage;
 
 class ConnectionManager : public QObject
 {
@@ -32,11 +52,58 @@ class ConnectionManager : public QObject
     Q_PROPERTY(int serverPort READ serverPort WRITE setServerPort NOTIFY serverPortChanged)
     Q_PROPERTY(int broadcastPort READ broadcastPort WRITE setBroadcastPort NOTIFY broadcastPortChanged)
     Q_PROPERTY(int maxConnections READ maxConnections WRITE setMaxConnections NOTIFY maxConnectionsChanged)
+    Q_PROPERTY(int duplicatePolicy READ duplicatePolicy WRITE setDuplicatePolicy NOTIFY duplicatePolicyChanged)
+    Q_PROPERTY(bool autoReconnect READ autoReconnect WRITE setAutoReconnect NOTIFY autoReconnectChanged)
+    Q_PROPERTY(int reconnectDelay READ reconnectDelay WRITE setReconnectDelay NOTIFY reconnectDelayChanged)
+    Q_PROPERTY(int reconnectMaxDelay READ reconnectMaxDelay WRITE setReconnectMaxDelay NOTIFY reconnectMaxDelayChanged)
+    Q_PROPERTY(qreal reconnectMultiplier READ reconnectMultiplier WRITE setReconnectMultiplier NOTIFY reconnectMultiplierChanged)
+    Q_PROPERTY(qreal reconnectJitter READ reconnectJitter WRITE setReconnectJitter NOTIFY reconnectJitterChanged)
+    Q_PROPERTY(int reconnectRetries READ reconnectRetries WRITE setReconnectRetries NOTIFY reconnectRetriesChanged)
+    Q_PROPERTY(int raceCount READ raceCount WRITE setRaceCount NOTIFY raceCountChanged)
+    Q_PROPERTY(int raceStagger READ raceStagger WRITE setRaceStagger NOTIFY raceStaggerChanged)
+    Q_PROPERTY(bool fastReconnect READ fastReconnect WRITE setFastReconnect NOTIFY fastReconnectChanged)
+    Q_PROPERTY(int serverCacheSize READ serverCacheSize WRITE setServerCacheSize NOTIFY serverCacheSizeChanged)
+    Q_PROPERTY(QString serverCacheFile READ serverCacheFile WRITE setServerCacheFile NOTIFY serverCacheFileChanged)
+    Q_PROPERTY(QStringList servers READ servers NOTIFY serversChanged)
+    Q_PROPERTY(QVariantList clients READ clients NOTIFY clientsChanged)
+    Q_PROPERTY(int outboxSize READ outboxSize WRITE setOutboxSize NOTIFY outboxSizeChanged)
+    Q_PROPERTY(int outboxExpiry READ outboxExpiry WRITE setOutboxExpiry NOTIFY outboxExpiryChanged)
+    Q_PROPERTY(QString outboxFile READ outboxFile WRITE setOutboxFile NOTIFY outboxFileChanged)
+    Q_PROPERTY(int outboxCount READ outboxCount NOTIFY outboxCountChanged)
+    Q_PROPERTY(int latencyProfile READ latencyProfile WRITE setLatencyProfile NOTIFY latencyProfileChanged)
+    Q_PROPERTY(QVariantMap socketOptions READ socketOptions WRITE setSocketOptions NOTIFY socketOptionsChanged)
+    Q_PROPERTY(int heartbeatInterval READ heartbeatInterval WRITE setHeartbeatInterval NOTIFY heartbeatIntervalChanged)
+    Q_PROPERTY(int heartbeatTimeout READ heartbeatTimeout WRITE setHeartbeatTimeout NOTIFY heartbeatTimeoutChanged)
+    Q_PROPERTY(bool handshake READ handshake WRITE setHandshake NOTIFY handshakeChanged)
+    Q_PROPERTY(int relayMode READ relayMode WRITE setRelayMode NOTIFY relayModeChanged)
+    Q_PROPERTY(bool relayLocalDelivery READ relayLocalDelivery WRITE setRelayLocalDelivery NOTIFY relayLocalDeliveryChanged)
+    Q_PROPERTY(bool ioThread READ ioThread WRITE setIoThread NOTIFY ioThreadChanged)
+    Q_PROPERTY(int acceptRate READ acceptRate WRITE setAcceptRate NOTIFY acceptRateChanged)
+    Q_PROPERTY(int acceptBurst READ acceptBurst WRITE setAcceptBurst NOTIFY acceptBurstChanged)
+    Q_PROPERTY(int acceptBacklog READ acceptBacklog WRITE setAcceptBacklog NOTIFY acceptBacklogChanged)
+    Q_PROPERTY(int busyRetryDelay READ busyRetryDelay WRITE setBusyRetryDelay NOTIFY busyRetryDelayChanged)
+    Q_PROPERTY(int compressionMode READ compressionMode WRITE setCompressionMode NOTIFY compressionModeChanged)
+    Q_PROPERTY(int compressionMinSize READ compressionMinSize WRITE setCompressionMinSize NOTIFY compressionMinSizeChanged)
+    Q_PROPERTY(qreal compressionMaxRatio READ compressionMaxRatio WRITE setCompressionMaxRatio NOTIFY compressionMaxRatioChanged)
+    Q_PROPERTY(int compressionLevel READ compressionLevel NOTIFY compressionLevelChanged)
+    Q_PROPERTY(qreal compressionEfficiency READ compressionEfficiency NOTIFY compressionEfficiencyChanged)
+    Q_PROPERTY(QString compressionDictionaryFile READ compressionDictionaryFile WRITE setCompressionDictionaryFile NOTIFY compressionDictionaryFileChanged)
+    Q_PROPERTY(int queueMode READ queueMode WRITE setQueueMode NOTIFY queueModeChanged)
+    Q_PROPERTY(bool deltaEncoding READ deltaEncoding WRITE setDeltaEncoding NOTIFY deltaEncodingChanged)
+    Q_PROPERTY(int rpcTimeout READ rpcTimeout WRITE setRpcTimeout NOTIFY rpcTimeoutChanged)
+    Q_PROPERTY(QStringList subscriptions READ subscriptions WRITE setSubscriptions NOTIFY subscriptionsChanged)
+    Q_PROPERTY(int batchInterval READ batchInterval WRITE setBatchInterval NOTIFY batchIntervalChanged)
 
     Q_ENUMS(ConnectionStatus)
     Q_ENUMS(ConnectionType)
     Q_ENUMS(ConnectAs)
     Q_ENUMS(NetworkStatus)
+    Q_ENUMS(DuplicatePolicy)
+    Q_ENUMS(LatencyProfile)
+    Q_ENUMS(RelayMode)
+    Q_ENUMS(CompressionMode)
+    Q_ENUMS(QueueMode)
+    Q_ENUMS(MessagePriority)
 
 public: // Data types
 
@@ -66,6 +133,43 @@ public: // Data types
         DontCare = ConnectionIf::DontCare
     };
 
+    enum DuplicatePolicy {
+        RejectDuplicates = ConnectionIf::RejectDuplicates,
+        ReplaceDuplicates = ConnectionIf::ReplaceDuplicates,
+        AllowDuplicates = ConnectionIf::AllowDuplicates
+    };
+
+    enum LatencyProfile {
+        SystemDefault = SocketOptions::SystemDefault,
+        Interactive = SocketOptions::Interactive,
+        Bulk = SocketOptions::Bulk,
+        Custom = SocketOptions::Custom
+    };
+
+    enum RelayMode {
+        NoRelay = RelayRouter::NoRelay,
+        RelayToOthers = RelayRouter::RelayToOthers,
+        RelayToGroup = RelayRouter::RelayToGroup
+    };
+
+    enum CompressionMode {
+        ExplicitCompression = 0,
+        AdaptiveCompression
+    };
+
+    enum QueueMode {
+        NoQueue = SendQueue::NoQueue,
+        StrictPriorityQueue = SendQueue::StrictPriority,
+        WeightedFairQueue = SendQueue::WeightedFair
+    };
+
+    enum MessagePriority {
+        LowPriority = SendQueue::LowPriority,
+        NormalPriority = SendQueue::NormalPriority,
+        HighPriority = SendQueue::HighPriority,
+        UrgentPriority = SendQueue::UrgentPriority
+    };
+
 public:
     ConnectionManager(QObject *parent = 0);
     ~ConnectionManager();
@@ -77,6 +181,8 @@ public:
     void setConnectionType(int type);
     int connectAs() const;
     void setConnectAs(int connectAs);
+    bool ioThread() const;
+    void setIoThread(bool enabled);
     int connectionTimeout() const;
     void setConnectionTimeout(int timeout);
     QString serviceName() const;
@@ -91,23 +197,197 @@ public:
     int serverPort() const;
     int broadcastPort() const;
     int maxConnections() const;
+    int duplicatePolicy() const;
 
     void setServerPort(int port);
     void setBroadcastPort(int port);
     void setMaxConnections(int max);
+    void setDuplicatePolicy(int policy);
+
+    bool autoReconnect() const;
+    int reconnectDelay() const;
+    int reconnectMaxDelay() const;
+    qreal reconnectMultiplier() const;
+    qreal reconnectJitter() const;
+    int reconnectRetries() const;
+
+    void setAutoReconnect(bool enabled);
+    void setReconnectDelay(int delay);
+    void setReconnectMaxDelay(int delay);
+    void setReconnectMultiplier(qreal multiplier);
+    void setReconnectJitter(qreal jitter);
+    void setReconnectRetries(int retries);
+
+    int raceCount() const;
+    int raceStagger() const;
+
+    void setRaceCount(int count);
+    void setRaceStagger(int stagger);
+
+    bool fastReconnect() const;
+    int serverCacheSize() const;
+    QString serverCacheFile() const;
+
+    void setFastReconnect(bool enabled);
+    void setServerCacheSize(int size);
+    void setServerCacheFile(const QString &fileName);
+
+    QStringList servers() const;
+    QVariantList clients() const;
+
+    int outboxSize() const;
+    int outboxExpiry() const;
+    QString outboxFile() const;
+    int outboxCount() const;
+
+    void setOutboxSize(int size);
+    void setOutboxExpiry(int expiry);
+    void setOutboxFile(const QString &fileName);
+
+    int latencyProfile() const;
+    QVariantMap socketOptions() const;
+
+    void setLatencyProfile(int profile);
+    void setSocketOptions(const QVariantMap &options);
+
+    int heartbeatInterval() const;
+    int heartbeatTimeout() const;
+
+    void setHeartbeatInterval(int interval);
+    void setHeartbeatTimeout(int timeout);
+
+    bool handshake() const;
+    void setHandshake(bool enabled);
+
+    int relayMode() const;
+    bool relayLocalDelivery() const;
+
+    void setRelayMode(int mode);
+    void setRelayLocalDelivery(bool enabled);
+
+    int acceptRate() const;
+    int acceptBurst() const;
+    int acceptBacklog() const;
+    int busyRetryDelay() const;
+
+    void setAcceptRate(int rate);
+    void setAcceptBurst(int burst);
+    void setAcceptBacklog(int backlog);
+    void setBusyRetryDelay(int delay);
+
+    int compressionMode() const;
+    int compressionMinSize() const;
+    qreal compressionMaxRatio() const;
+    int compressionLevel() const;
+    qreal compressionEfficiency() const;
+
+    void setCompressionMode(int mode);
+    void setCompressionMinSize(int size);
+    void setCompressionMaxRatio(qreal ratio);
+
+    QString compressionDictionaryFile() const;
+    void setCompressionDictionaryFile(const QString &fileName);
+
+    int queueMode() const;
+    void setQueueMode(int mode);
+
+    bool deltaEncoding() const;
+    void setDeltaEncoding(bool enabled);
+
+    int rpcTimeout() const;
+    void setRpcTimeout(int timeout);
+
+    QStringList subscriptions() const;
+    void setSubscriptions(const QStringList &subscriptions);
+
+    int batchInterval() const;
+    void setBatchInterval(int interval);
+
+    bool sendOnChannel(Channel *channel, const QString &message, bool compression);
 
 public slots:
     void connect(const QString &to = QString());
     void disconnect(const QString &message = QString());
-    bool send(const QString &message, bool header = true, bool compression = false);
+    bool send(const QString &message, bool header = true, bool compression = false,
+              int expiry = -1);
+    bool sendWithPriority(const QString &message, int priority, int deadline = 0,
+                          bool compression = false);
+    bool sendLatest(const QString &key, const QString &message,
+                    int priority = NormalPriority, bool compression = false);
+    QVariantList queueStatistics() const;
+    bool publish(const QString &topic, const QString &message, bool compression = false);
+    bool sendObject(const QVariantMap &object, int schema = -1);
+    bool registerSchema(int id, const QStringList &fields);
+    void unregisterSchema(int id);
+    bool subscribe(const QString &topic);
+    void unsubscribe(const QString &topic);
+    void clearOutbox();
+    bool addServer(const QString &server);
+    bool removeServer(const QString &server);
+    bool sendToServer(const QString &server, const QString &message,
+                      bool header = true, bool compression = false);
+    bool sendTo(int clientId, const QString &message,
+                bool header = true, bool compression = false);
+    QString clientName(int clientId) const;
+    QString clientGroup(int clientId) const;
+    void setClientGroup(int clientId, const QString &group);
+    void setRoute(int fromClientId, int toClientId);
+    void clearRoutes();
+    QVariantMap peerProtocol(int clientId = 0) const;
+    QVariantMap serverProtocol(const QString &server) const;
+    Channel *openChannel(const QString &name, int priority = 1);
+    void closeChannel(const QString &name);
+    RpcCall *call(const QString &method, const QVariantList &args = QVariantList(),
+                  int timeout = -1, int clientId = 0);
+    bool registerMethod(const QString &method, QObject *handler, const QString &member);
+    void unregisterMethod(const QString &method);
 
 private:
+    QByteArray toMessage(const QString &message, bool header, bool compression) const;
+    bool compressionFor(const QString &message, bool compression);
+    bool sendMessage(const QString &message, bool header, bool compression,
+                     const QVariant &route);
+    bool deliver(const QByteArray &message, const QVariant &route);
+    bool deliverOnChannel(int channelId, const QByteArray &message, bool compressed);
+    void measureLink(int sent);
     void applySettings();
+    void deleteConnection();
+    void applyReconnectPolicy();
+    void flushOutbox();
+    void applySocketOptions();
+    void applyRelayRouter();
+    void applyAdmissionControl();
+    void updateDictionaryUse();
+    bool peerHasFeature(int clientId, const char *feature) const;
+    int maxFrameSize() const;
+    void failCalls(int clientId, const QString &error);
+    void dispatchCall(const RpcMessage &request, int clientId,
+                      const QString &server = QString());
+    QVariant peerRoute(int clientId) const;
 
 private slots:
     void setStatus(ConnectionStatus status);
     void onConnectionIfStatusChanged(ConnectionStatus status);
     void setNetworkStatus(NetworkStatus status);
+    void onClientAdded(int clientId, const QString &name);
+    void onClientConnected(int clientId);
+    void onClientDisconnected(int clientId);
+    void onServersChanged(const QStringList &servers);
+    void onOutboxSent(const QList<QByteArray> &unsent);
+    void onQueueStatisticsUpdated(const QVariantList &statistics);
+    void onHandshakeCompleted(int clientId, const QVariantMap &protocol);
+    void onServerHandshakeCompleted(const QString &server, const QVariantMap &protocol);
+    void onReceivedOnChannel(const QString &channel, const QString &message, int clientId);
+    void onReceivedRpc(const QByteArray &message, int clientId);
+    void onReceivedServerRpc(const QString &server, const QByteArray &message);
+    void onReceivedOnTopic(const QString &topic, const QString &message, int clientId);
+    void onReceivedObject(const QByteArray &data, int clientId);
+    void onReceived(const QString &message, int clientId, const QString &origin);
+    void flushBatch();
+    void onCallStatusChanged();
+    void onCompressed(int stream, const QByteArray &message, const QVariant &route);
+    void onCompressionMeasured(int stream, int operation, int size, int compressedSize,
+                               int elapsed);
 
 signals:
     // Property signals
@@ -115,6 +395,7 @@ signals:
     void networkStatusChanged(int status);
     void connectionTypeChanged(int type);
     void connectAsChanged(int connectAs);
+    void ioThreadChanged(bool enabled);
     void connectionTimeoutChanged(int timeout);
     void serviceNameChanged(const QString &name);
     void serviceProviderChanged(const QString &provider);
@@ -123,12 +404,62 @@ signals:
     void serverPortChanged(int port);
     void broadcastPortChanged(int port);
     void maxConnectionsChanged(int max);
+    void duplicatePolicyChanged(int policy);
+    void autoReconnectChanged(bool enabled);
+    void reconnectDelayChanged(int delay);
+    void reconnectMaxDelayChanged(int delay);
+    void reconnectMultiplierChanged(qreal multiplier);
+    void reconnectJitterChanged(qreal jitter);
+    void reconnectRetriesChanged(int retries);
+    void raceCountChanged(int count);
+    void raceStaggerChanged(int stagger);
+    void fastReconnectChanged(bool enabled);
+    void serverCacheSizeChanged(int size);
+    void serverCacheFileChanged(const QString &fileName);
+    void serversChanged();
+    void clientsChanged();
+    void outboxSizeChanged(int size);
+    void outboxExpiryChanged(int expiry);
+    void outboxFileChanged(const QString &fileName);
+    void outboxCountChanged(int count);
+    void latencyProfileChanged(int profile);
+    void socketOptionsChanged();
+    void heartbeatIntervalChanged(int interval);
+    void heartbeatTimeoutChanged(int timeout);
+    void handshakeChanged(bool enabled);
+    void relayModeChanged(int mode);
+    void relayLocalDeliveryChanged(bool enabled);
+    void acceptRateChanged(int rate);
+    void acceptBurstChanged(int burst);
+    void acceptBacklogChanged(int backlog);
+    void busyRetryDelayChanged(int delay);
+    void compressionModeChanged(int mode);
+    void compressionMinSizeChanged(int size);
+    void compressionMaxRatioChanged(qreal ratio);
+    void compressionLevelChanged(int level);
+    void compressionEfficiencyChanged(qreal efficiency);
+    void compressionDictionaryFileChanged(const QString &fileName);
+    void queueModeChanged(int mode);
+    void deltaEncodingChanged(bool enabled);
+    void rpcTimeoutChanged(int timeout);
+    void subscriptionsChanged();
+    void batchIntervalChanged(int interval);
 
     // Other signals
     void disconnected();
     void received(const QString &message);
+    void receivedFrom(const QString &message, const QString &origin);
+    void receivedFromClient(const QString &message, int clientId);
+    void receivedOnTopic(const QString &topic, const QString &message, int clientId);
+    void receivedObject(const QVariantMap &object, int clientId);
+    void receivedBatch(const QVariantList &messages);
+    void clientConnected(int clientId, const QString &name);
+    void clientDisconnected(int clientId);
     void discovered(const QString &name);
     void removed(int index);
+    void reconnecting(int attempt, int delay);
+    void handshakeCompleted(int clientId, const QVariantMap &protocol);
+    void serverHandshakeCompleted(const QString &server, const QVariantMap &protocol);
 
 private: // Data
     ConnectionIf *mConnection; // Owned
@@ -142,8 +473,46 @@ private: // Data
     ConnectionIf::ConnectAs mConnectAs;
     int mConnectionTimeout; // In seconds
     int mMaxConnections; //Max connections, 0 means accepting all.
+    ConnectionIf::DuplicatePolicy mDuplicatePolicy;
     int mServerPort;
     int mBroadcastPort;
+    int mRaceCount;
+    int mHeartbeatInterval;
+    int mHeartbeatTimeout;
+    bool mHandshake;
+    int mRaceStagger;
+    bool mFastReconnect;
+    int mServerCacheSize;
+    QString mServerCacheFile;
+    ReconnectPolicy mReconnectPolicy;
+    Outbox mOutbox;
+    CompressionPool mCompressor;
+    CompressionMode mCompressionMode;
+    CompressionPolicy mCompressionPolicy;
+    QString mCompressionDictionaryFile;
+    CompressionDictionary mDictionary;
+    QueueMode mQueueMode;
+    bool mDeltaEncoding;
+    QHash<int, QVariantMap> mPeerProtocols; //Agreed with the connected peers, empty for older peers
+    QHash<QString, QVariantMap> mServerProtocols; //Agreed with the additional servers
+    QStringList mServers; //As the connection last reported them
+    QMap<int, QString> mClients; //Names of the connected clients, by id
+    QVariantList mQueueStatistics; //As the connection last reported them
+    QHash<QString, Channel*> mChannels; //Owned, by name
+    int mNextChannelId;
+    QHash<quint32, RpcCall*> mCalls; //Waiting for a reply, by id, delete themselves
+    quint32 mNextCallId;
+    QHash<QString, QPair<QPointer<QObject>, QByteArray> > mMethods; //Handler and member, by method
+    int mRpcTimeout; //Milliseconds, 0 means calls don't time out
+    TopicIndex mSubscriptions; //Our own, as the only client
+    ObjectCodec mObjects;
+    int mBatchInterval; //Milliseconds, 0 means messages are not batched
+    QVariantList mBatch; //Received, waiting for mBatchTimer
+    QTimer mBatchTimer;
+    SocketOptions mSocketOptions;
+    RelayRouter mRelayRouter;
+    AdmissionControl mAdmission;
+    IoThread *mIoThread; // Owned, 0 unless ioThread is set
 };
 
 #endif // CONNECTIONMANAGER_H
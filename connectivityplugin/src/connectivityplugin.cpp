@@ -7,7 +7,9 @@
  */
 
 #include "connectivityplugin.h"
+#include "channel.h"
 #include "connectionmanager.h"
+#include "rpccall.h"
 #include <QDeclarativeEngine>
 #include <QDeclarativeItem>
 
@@ -31,6 +33,8 @@ void ConnectivityPlugin::registerTypes(const char *uri)
 {
     // @uri ConnectivityPlugin 1.0
     qmlRegisterType<ConnectionManager>(uri, 1, 0, "ConnectionManager");
+    qmlRegisterType<Channel>();
+    qmlRegisterType<RpcCall>();
 }
 
 Q_EXPORT_PLUGIN2(ConnectionManager, ConnectivityPlugin)
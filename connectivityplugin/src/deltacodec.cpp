@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "deltacodec.h"
+
+#include <QDebug>
+
+namespace
+{
+
+//Constants
+const char SnapshotFlag(0x01);
+const int DeltaHeaderSize(4); //Flags, sequence and the length of the key
+const int MaxKeySize(255); //Bytes of UTF-8
+const int MinGap(4); //Equal bytes that end a changed run, fewer are sent along
+const int MaxDeltaPercent(75); //Of the message size, a snapshot is sent above it
+const QByteArray ResyncTag("RESYNC");
+
+} //anonymous namespace
+
+/*!
+  \class DeltaCodec
+  \brief Sends a message as the difference to the previous one with the same key.
+
+  Periodic state, e.g. a status document sent every second, often differs
+  from the previous one by a few bytes only. The encoder keeps the latest
+  message sent with each key and sends a new one as the runs of bytes that
+  changed. The first message with a key, or one that changed too much, is
+  sent whole as a snapshot.
+
+  The messages with a key are numbered. The decoder keeps the latest
+  message received with each key and applies a delta only on the message
+  it was made against. If that is missing, e.g. because the decoder was
+  reset, decode() returns Gap once and the caller asks the sender for a
+  snapshot with a RESYNC control message. The deltas received until the
+  snapshot arrives are dropped.
+
+  A codec is used either for encoding the messages sent to a peer or for
+  decoding the ones received from it, and is reset with the connection so
+  that a new peer starts from a snapshot. The frames are sent only to
+  peers that agreed on the delta feature in the handshake.
+*/
+
+/*!
+  Constructor.
+*/
+DeltaCodec::DeltaCodec()
+{
+}
+
+/*!
+  Returns the frame sending \a message with \a key, as a delta to the
+  previous message with \a key if it is smaller.
+*/
+QByteArray DeltaCodec::encode(const QString &key, const QByteArray &message)
+{
+    QByteArray keyBytes = key.toUtf8();
+
+    if (keyBytes.isEmpty() || keyBytes.size() > MaxKeySize) {
+        return Common::toMessage(message);
+    }
+
+    QHash<QString, State>::iterator it = mStates.find(key);
+    QByteArray body;
+    bool snapshot = true;
+
+    if (it == mStates.end()) {
+        it = mStates.insert(key, State());
+    } else {
+        body = diff(it->message, message);
+        snapshot = body.size() * 100 > message.size() * MaxDeltaPercent;
+        it->sequence++;
+    }
+
+    if (snapshot) {
+        body = message;
+    }
+
+    it->message = message;
+
+    QByteArray payload;
+    payload.reserve(DeltaHeaderSize + keyBytes.size() + body.size());
+    payload.append(snapshot ? SnapshotFlag : char(0));
+    payload.append(char((it->sequence >> 8) & 0xff));
+    payload.append(char(it->sequence & 0xff));
+    payload.append(char(keyBytes.size()));
+    payload.append(keyBytes);
+    payload.append(body);
+
+    return Common::toDeltaMessage(payload);
+}
+
+/*!
+  Decodes the delta \a frame. If the message could be put together returns
+  Decoded, the key in \a key and the message in \a message. Returns Gap if
+  the message the delta was made against is missing, in which case \a key
+  is the key to resync.
+*/
+DeltaCodec::Result DeltaCodec::decode(const Common::Frame &frame, QString *key,
+                                      QByteArray *message)
+{
+    QByteArray payload = frame.payload();
+
+    if (payload.size() < DeltaHeaderSize) {
+        qDebug() << "DeltaCodec::decode(): Invalid frame";
+        return Skipped;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar*>(payload.constData());
+    bool snapshot = header[0] & SnapshotFlag;
+    quint16 sequence = header[1] << 8 | header[2];
+    int keySize = header[3];
+
+    if (payload.size() < DeltaHeaderSize + keySize) {
+        qDebug() << "DeltaCodec::decode(): Invalid frame";
+        return Skipped;
+    }
+
+    *key = QString::fromUtf8(payload.constData() + DeltaHeaderSize, keySize);
+    QByteArray body = payload.mid(DeltaHeaderSize + keySize);
+
+    if (snapshot) {
+        State &state = mStates[*key];
+        state.sequence = sequence;
+        state.message = body;
+        mResyncing.remove(*key);
+        *message = body;
+        return Decoded;
+    }
+
+    QHash<QString, State>::iterator it = mStates.find(*key);
+
+    if (it != mStates.end() && it->sequence == quint16(sequence - 1)
+        && patch(it->message, body, message))
+    {
+        it->sequence = sequence;
+        it->message = *message;
+        return Decoded;
+    }
+
+    if (it != mStates.end()) {
+        mStates.erase(it);
+    }
+
+    if (mResyncing.contains(*key)) {
+        return Skipped;
+    }
+
+    qDebug() << "DeltaCodec::decode(): Gap on" << *key << "at" << sequence;
+    mResyncing.insert(*key);
+    return Gap;
+}
+
+/*!
+  Forgets the message sent with \a key so that the next one is a snapshot.
+*/
+void DeltaCodec::resync(const QString &key)
+{
+    mStates.remove(key);
+}
+
+/*!
+  Forgets all the messages, e.g. when the connection is closed.
+*/
+void DeltaCodec::clear()
+{
+    mStates.clear();
+    mResyncing.clear();
+}
+
+/*!
+  Returns the control message asking the sender for a snapshot of \a key.
+*/
+QByteArray DeltaCodec::toResync(const QString &key)
+{
+    return ResyncTag + ' ' + key.toUtf8();
+}
+
+/*!
+  Returns true if \a control asks for a snapshot.
+*/
+bool DeltaCodec::isResync(const QByteArray &control)
+{
+    return control.startsWith(ResyncTag + ' ');
+}
+
+/*!
+  Returns the key of the snapshot asked for with \a control.
+*/
+QString DeltaCodec::resyncKey(const QByteArray &control)
+{
+    return QString::fromUtf8(control.mid(ResyncTag.size() + 1));
+}
+
+/*!
+  Returns the delta turning \a base into \a message: the size of
+  \a message followed by the runs of bytes that changed, each as the
+  number of equal bytes before it, its length and its bytes. Runs closer
+  than a few bytes are merged as the numbers would take more room.
+*/
+QByteArray DeltaCodec::diff(const QByteArray &base, const QByteArray &message)
+{
+    QByteArray delta;
+    Common::appendNumber(delta, message.size());
+
+    const char *from = base.constData();
+    const char *to = message.constData();
+    int common = qMin(base.size(), message.size());
+    int size = message.size();
+    int pos = 0;
+    int previous = 0; //End of the previous run
+
+    while (pos < size) {
+        if (pos < common && from[pos] == to[pos]) {
+            ++pos;
+            continue;
+        }
+
+        int end = pos + 1;
+
+        for (int i = end; i < size && i - end < MinGap; ++i) {
+            if (i >= common || from[i] != to[i]) {
+                end = i + 1;
+            }
+        }
+
+        Common::appendNumber(delta, pos - previous);
+        Common::appendNumber(delta, end - pos);
+        delta.append(to + pos, end - pos);
+
+        previous = end;
+        pos = end;
+    }
+
+    return delta;
+}
+
+/*!
+  Applies \a delta made with diff() on \a base and returns the result in
+  \a message. Returns false if \a delta doesn't fit \a base.
+*/
+bool DeltaCodec::patch(const QByteArray &base, const QByteArray &delta, QByteArray *message)
+{
+    int pos = 0;
+    int size = 0;
+
+    //The size comes from the peer, a delta can't add more than its own bytes
+    if (!Common::readNumber(delta, &pos, &size) || size > base.size() + delta.size()) {
+        return false;
+    }
+
+    QByteArray result = base.left(size);
+
+    if (result.size() < size) {
+        result.append(QByteArray(size - result.size(), '\0'));
+    }
+
+    int offset = 0;
+
+    while (pos < delta.size()) {
+        int skip = 0;
+        int length = 0;
+
+        if (!Common::readNumber(delta, &pos, &skip)
+            || !Common::readNumber(delta, &pos, &length))
+        {
+            return false;
+        }
+
+        if (skip > size - offset || length > size - offset - skip
+            || length > delta.size() - pos)
+        {
+            return false;
+        }
+
+        offset += skip;
+
+        qMemCopy(result.data() + offset, delta.constData() + pos, length);
+        offset += length;
+        pos += length;
+    }
+
+    *message = result;
+    return true;
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef DELTACODEC_H
+#define DELTACODEC_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+#include "common.h"
+
+class DeltaCodec
+{
+public:
+    enum Result {
+        Decoded = 0,
+        Gap, //The base of the delta is missing, a snapshot has to be asked for
+        Skipped //Dropped while waiting for the snapshot
+    };
+
+public:
+    DeltaCodec();
+
+    QByteArray encode(const QString &key, const QByteArray &message);
+    Result decode(const Common::Frame &frame, QString *key, QByteArray *message);
+    void resync(const QString &key);
+    void clear();
+
+    static QByteArray toResync(const QString &key);
+    static bool isResync(const QByteArray &control);
+    static QString resyncKey(const QByteArray &control);
+
+private:
+    static QByteArray diff(const QByteArray &base, const QByteArray &message);
+    static bool patch(const QByteArray &base, const QByteArray &delta, QByteArray *message);
+
+private: //Data
+    struct State {
+        State() : sequence(0) {}
+
+        quint16 sequence; //Of the message, wraps around
+        QByteArray message; //Latest sent or received with the key
+    };
+
+    QHash<QString, State> mStates; //By key
+    QSet<QString> mResyncing; //Keys waiting for a snapshot after a gap
+};
+
+#endif // DELTACODEC_H
@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "handshake.h"
+#include "common.h"
+
+#include <QList>
+
+//Constants
+const int ProtocolVersion(1);
+const int DefaultMaxFrameSize(Common::MaxFrameSize);
+const QByteArray HelloTag("HELLO");
+const QByteArray EmptyList("-");
+
+const char * const Handshake::HeartbeatFeature("heartbeat");
+const char * const Handshake::ChannelsFeature("channels");
+const char * const Handshake::DeltaFeature("delta");
+const char * const Handshake::RpcFeature("rpc");
+const char * const Handshake::TopicsFeature("topics");
+const char * const Handshake::ObjectsFeature("objects");
+
+namespace
+{
+
+/*!
+  Returns the items of \a list that are also in \a other, in the order of \a list.
+*/
+QStringList intersect(const QStringList &list, const QStringList &other)
+{
+    QStringList common;
+
+    foreach (const QString &item, list) {
+        if (other.contains(item)) {
+            common.append(item);
+        }
+    }
+
+    return common;
+}
+
+/*!
+  Returns \a list as a comma separated field of a control message.
+*/
+QByteArray toField(const QStringList &list)
+{
+    return list.isEmpty() ? EmptyList : list.join(",").toAscii();
+}
+
+/*!
+  Returns the list in the comma separated \a field of a control message.
+*/
+QStringList fromField(const QByteArray &field)
+{
+    if (field.isEmpty() || field == EmptyList) {
+        return QStringList();
+    }
+
+    return QString::fromAscii(field).split(',', QString::SkipEmptyParts);
+}
+
+} //anonymous namespace
+
+/*!
+  \class Handshake
+  \brief The protocol version and capabilities a peer announces when connected.
+
+  If the handshake is enabled, the client sends a HELLO control frame right
+  after connecting and the server answers with its own. The HELLO carries
+  the protocol version, the largest frame the peer accepts, the codecs it
+  can decode and the optional features it supports:
+
+  \code
+  HELLO 1 16777216 dict:12345678,zlib heartbeat,channels,delta,rpc,topics,objects
+  \endcode
+
+  Each peer then agrees on the common settings with agree(). The server
+  never sends a HELLO first, since older clients can't read control
+  frames. Only the plain protocol is used with the peers that don't send
+  a HELLO.
+
+  Only what the peers act on is announced. Every client understands a
+  BUSY, and batching only changes how the received messages reach QML,
+  so neither is negotiated.
+*/
+
+/*!
+  Constructor. Creates the handshake of a peer that hasn't sent one.
+*/
+Handshake::Handshake() :
+    mVersion(0),
+    mMaxFrameSize(DefaultMaxFrameSize)
+{
+}
+
+/*!
+  Constructor.
+*/
+Handshake::Handshake(int version, int maxFrameSize, const QStringList &codecs,
+                     const QStringList &features) :
+    mVersion(version),
+    mMaxFrameSize(maxFrameSize),
+    mCodecs(codecs),
+    mFeatures(features)
+{
+}
+
+/*!
+  Returns the settings both this and the \a peer support: the lower version
+  and frame size, and the common codecs and features. The codecs keep the
+  order of preference of this handshake.
+*/
+Handshake Handshake::agree(const Handshake &peer) const
+{
+    if (!peer.isValid()) {
+        return Handshake();
+    }
+
+    return Handshake(qMin(mVersion, peer.mVersion),
+                     qMin(mMaxFrameSize, peer.mMaxFrameSize),
+                     intersect(mCodecs, peer.mCodecs),
+                     intersect(mFeatures, peer.mFeatures));
+}
+
+/*!
+  Returns the HELLO control message announcing this handshake.
+*/
+QByteArray Handshake::toControl() const
+{
+    QList<QByteArray> fields;
+    fields << HelloTag
+           << QByteArray::number(mVersion)
+           << QByteArray::number(mMaxFrameSize)
+           << toField(mCodecs)
+           << toField(mFeatures);
+
+    QByteArray control;
+
+    foreach (const QByteArray &field, fields) {
+        if (!control.isEmpty()) {
+            control.append(' ');
+        }
+        control.append(field);
+    }
+
+    return control;
+}
+
+/*!
+  Returns the handshake as a map for QML, with the keys \c version,
+  \c maxFrameSize, \c codecs and \c features.
+*/
+QVariantMap Handshake::toVariantMap() const
+{
+    QVariantMap map;
+    map.insert("version", mVersion);
+    map.insert("maxFrameSize", mMaxFrameSize);
+    map.insert("codecs", mCodecs);
+    map.insert("features", mFeatures);
+    return map;
+}
+
+/*!
+  Returns the handshake of this plugin. The preset \a dictionary, if any, is
+  announced as a codec. Heartbeats are announced if \a heartbeat is set,
+  so that they are used only when both peers send them.
+*/
+Handshake Handshake::local(const CompressionDictionary &dictionary, bool heartbeat)
+{
+    QStringList codecs;
+    codecs << "zlib";
+
+    if (!dictionary.isEmpty()) {
+        codecs.prepend(dictionaryCodec(dictionary.id()));
+    }
+
+    QStringList features;
+
+    if (heartbeat) {
+        features << HeartbeatFeature;
+    }
+
+    features << ChannelsFeature << DeltaFeature << RpcFeature
+             << TopicsFeature << ObjectsFeature;
+
+    return Handshake(ProtocolVersion, DefaultMaxFrameSize, codecs, features);
+}
+
+/*!
+  Returns true if the \a control message is a HELLO.
+*/
+bool Handshake::isHello(const QByteArray &control)
+{
+    return control.startsWith(HelloTag + ' ');
+}
+
+/*!
+  Parses the HELLO \a control message. Returns an invalid handshake if the
+  message is malformed.
+*/
+Handshake Handshake::fromControl(const QByteArray &control)
+{
+    QList<QByteArray> fields = control.split(' ');
+
+    if (fields.size() < 5 || fields.first() != HelloTag) {
+        return Handshake();
+    }
+
+    bool versionOk = false;
+    bool sizeOk = false;
+    int version = fields.at(1).toInt(&versionOk);
+    int maxFrameSize = fields.at(2).toInt(&sizeOk);
+
+    if (!versionOk || !sizeOk || version <= 0 || maxFrameSize <= 0) {
+        return Handshake();
+    }
+
+    return Handshake(version, maxFrameSize, fromField(fields.at(3)), fromField(fields.at(4)));
+}
+
+/*!
+  Returns the name of the codec compressing with the preset dictionary
+  \a dictionaryId, see CompressionDictionary::id().
+*/
+QString Handshake::dictionaryCodec(quint32 dictionaryId)
+{
+    return QString("dict:%1").arg(dictionaryId, 8, 16, QChar('0'));
+}
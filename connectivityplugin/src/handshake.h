@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+#include "compressiondictionary.h"
+
+class Handshake
+{
+public:
+    static const char * const HeartbeatFeature;
+    static const char * const ChannelsFeature;
+    static const char * const DeltaFeature;
+    static const char * const RpcFeature;
+    static const char * const TopicsFeature;
+    static const char * const ObjectsFeature;
+
+public:
+    Handshake();
+    Handshake(int version, int maxFrameSize, const QStringList &codecs,
+              const QStringList &features);
+
+    int version() const { return mVersion; }
+    int maxFrameSize() const { return mMaxFrameSize; }
+    QStringList codecs() const { return mCodecs; }
+    QStringList features() const { return mFeatures; }
+    bool isValid() const { return mVersion > 0; }
+    bool hasCodec(const QString &codec) const { return mCodecs.contains(codec); }
+    bool hasFeature(const QString &feature) const { return mFeatures.contains(feature); }
+
+    Handshake agree(const Handshake &peer) const;
+    QByteArray toControl() const;
+    QVariantMap toVariantMap() const;
+
+    static Handshake local(const CompressionDictionary &dictionary, bool heartbeat);
+    static bool isHello(const QByteArray &control);
+    static Handshake fromControl(const QByteArray &control);
+    static QString dictionaryCodec(quint32 dictionaryId);
+
+private:
+    int mVersion; // 0 means the peer hasn't told
+    int mMaxFrameSize; // Bytes
+    QStringList mCodecs; // In the order of preference
+    QStringList mFeatures;
+};
+
+#endif // HANDSHAKE_H
@@ -0,0 +1,185 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "heartbeat.h"
+
+#include <QDebug>
+#include <QIODevice>
+#include <QList>
+
+#include "common.h"
+
+//Constants
+const int MinCheckInterval(50); //In Milliseconds
+const int DefaultTimeoutIntervals(3);
+const QByteArray PingTag("PING");
+
+/*!
+  \class Heartbeat
+  \brief Keeps idle connections alive and detects peers that have vanished
+  without closing the connection.
+
+  A PING control frame is written to a device that hasn't sent anything for
+  an interval, so the heartbeats cost nothing while there is other traffic.
+  A device that hasn't received anything within the timeout is reported
+  with timedOut(). Only the devices of the peers that agreed on heartbeats
+  in the handshake are added, since the others neither send nor
+  understand them. The receivers skip the PING like any control message
+  they don't know.
+*/
+
+/*!
+  Constructor.
+*/
+Heartbeat::Heartbeat(QObject *parent) :
+    QObject(parent),
+    mTimer(this),
+    mInterval(0),
+    mTimeout(0)
+{
+    mClock.start();
+    mTimer.setSingleShot(false);
+    connect(&mTimer, SIGNAL(timeout()), this, SLOT(check()));
+}
+
+/*!
+  Returns the time in milliseconds after which a silent device is reported.
+*/
+int Heartbeat::timeout() const
+{
+    return mTimeout > 0 ? mTimeout : mInterval * DefaultTimeoutIntervals;
+}
+
+/*!
+  Sets the heartbeat interval to \a interval milliseconds. 0 disables the
+  heartbeats and the dead peer detection.
+*/
+void Heartbeat::setInterval(int interval)
+{
+    mInterval = qMax(0, interval);
+    updateTimer();
+}
+
+/*!
+  Sets the time without any received data after which the peer is
+  considered dead to \a timeout milliseconds. 0 means three intervals.
+*/
+void Heartbeat::setTimeout(int timeout)
+{
+    mTimeout = qMax(0, timeout);
+    updateTimer();
+}
+
+/*!
+  Starts watching \a device.
+*/
+void Heartbeat::add(QIODevice *device)
+{
+    if (!device) {
+        return;
+    }
+
+    Activity activity;
+    activity.received = mClock.elapsed();
+    activity.sent = activity.received;
+    mDevices.insert(device, activity);
+    updateTimer();
+}
+
+/*!
+  Stops watching \a device.
+*/
+void Heartbeat::remove(QIODevice *device)
+{
+    mDevices.remove(device);
+    updateTimer();
+}
+
+/*!
+  Stops watching all the devices.
+*/
+void Heartbeat::clear()
+{
+    mDevices.clear();
+    updateTimer();
+}
+
+/*!
+  Marks that data was received from \a device.
+*/
+void Heartbeat::received(QIODevice *device)
+{
+    QHash<QIODevice*, Activity>::iterator it = mDevices.find(device);
+
+    if (it != mDevices.end()) {
+        it->received = mClock.elapsed();
+    }
+}
+
+/*!
+  Marks that data was written to \a device.
+*/
+void Heartbeat::sent(QIODevice *device)
+{
+    QHash<QIODevice*, Activity>::iterator it = mDevices.find(device);
+
+    if (it != mDevices.end()) {
+        it->sent = mClock.elapsed();
+    }
+}
+
+/*!
+  Sends the heartbeats to the idle devices and reports the timed out ones.
+*/
+void Heartbeat::check()
+{
+    qint64 now = mClock.elapsed();
+    QList<QIODevice*> timedOutDevices;
+
+    QHash<QIODevice*, Activity>::iterator it = mDevices.begin();
+
+    while (it != mDevices.end()) {
+        if (now - it->received >= timeout()) {
+            timedOutDevices.append(it.key());
+            it = mDevices.erase(it);
+            continue;
+        }
+
+        if (now - it->sent >= mInterval) {
+            it.key()->write(Common::toControlMessage(PingTag));
+            it->sent = now;
+        }
+
+        ++it;
+    }
+
+    updateTimer();
+
+    //Reported last since the receivers may delete the devices
+    foreach (QIODevice *device, timedOutDevices) {
+        qDebug() << "Heartbeat::check(): No data received in" << timeout() << "ms";
+        emit timedOut(device);
+    }
+}
+
+/*!
+  Runs the timer only while it has something to do.
+*/
+void Heartbeat::updateTimer()
+{
+    if (mInterval == 0 || mDevices.isEmpty()) {
+        mTimer.stop();
+        return;
+    }
+
+    int checkInterval = qMax(MinCheckInterval, qMin(mInterval, timeout()) / 2);
+
+    if (!mTimer.isActive() || mTimer.interval() != checkInterval) {
+        mTimer.start(checkInterval);
+    }
+}
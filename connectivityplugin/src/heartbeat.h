@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
+
+class QIODevice;
+
+class Heartbeat : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Heartbeat(QObject *parent = 0);
+
+    int interval() const { return mInterval; }
+    int timeout() const;
+    void setInterval(int interval);
+    void setTimeout(int timeout);
+
+public slots:
+    void add(QIODevice *device);
+    void remove(QIODevice *device);
+    void clear();
+    void received(QIODevice *device);
+    void sent(QIODevice *device);
+
+private slots:
+    void check();
+
+private:
+    void updateTimer();
+
+signals:
+    void timedOut(QIODevice *device);
+
+private: //Data
+    struct Activity {
+        qint64 received; // Milliseconds on mClock
+        qint64 sent; // Milliseconds on mClock
+    };
+
+    QHash<QIODevice*, Activity> mDevices; //Not owned
+    QElapsedTimer mClock;
+    QTimer mTimer;
+    int mInterval; // Milliseconds, 0 means disabled
+    int mTimeout; // Milliseconds, 0 means three intervals
+};
+
+#endif // HEARTBEAT_H
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "iothread.h"
+
+#include <QDebug>
+#include <QMetaObject>
+#include <QMetaType>
+#include <QMutexLocker>
+#include <QNetworkSession>
+
+#include "admissioncontrol.h"
+#include "connectionif.h"
+
+namespace
+{
+
+/*!
+  Registers the types passed between the application and the I/O thread
+  in queued calls and signals.
+*/
+void registerTypes()
+{
+    static bool registered = false;
+
+    if (registered) {
+        return;
+    }
+
+    qRegisterMetaType<ConnectionIf::ConnectionStatus>("ConnectionStatus");
+    qRegisterMetaType<ConnectionIf::NetworkStatus>("NetworkStatus");
+    qRegisterMetaType<ConnectionIf::ConnectAs>("ConnectAs");
+    qRegisterMetaType<ConnectionIf::DuplicatePolicy>("DuplicatePolicy");
+    qRegisterMetaType<ReconnectPolicy>("ReconnectPolicy");
+    qRegisterMetaType<SocketOptions>("SocketOptions");
+    qRegisterMetaType<RelayRouter>("RelayRouter");
+    qRegisterMetaType<AdmissionControl>("AdmissionControl");
+    qRegisterMetaType<CompressionDictionary>("CompressionDictionary");
+    qRegisterMetaType<ChannelInfo>("ChannelInfo");
+    qRegisterMetaType<QList<int> >("QList<int>");
+    qRegisterMetaType<QList<QByteArray> >("QList<QByteArray>");
+    qRegisterMetaType<QNetworkSession::State>("QNetworkSession::State");
+
+    registered = true;
+}
+
+} //anonymous namespace
+
+/*!
+  \class IoThread
+  \brief A thread running the event loop of the connection and its sockets.
+
+  Objects handed to adopt() are moved to the thread and deleted in it, either
+  by release() or when the thread is stopped. The objects must be called
+  through call() or post() only, which run the given slot or invokable
+  method in the thread the object lives in.
+*/
+
+/*!
+  Constructor.
+*/
+IoThread::IoThread(QObject *parent) :
+    QThread(parent)
+{
+    registerTypes();
+}
+
+/*!
+  Destructor. Stops the thread and deletes the objects still in it.
+*/
+IoThread::~IoThread()
+{
+    quit();
+    wait();
+}
+
+/*!
+  Moves \a object, which must not have a parent, to the thread. The thread
+  is started if it isn't running yet.
+*/
+void IoThread::adopt(QObject *object)
+{
+    {
+        QMutexLocker locker(&mMutex);
+        mObjects.append(object);
+    }
+
+    //The objects are destroyed in this thread so the slot has to be called directly
+    connect(object, SIGNAL(destroyed(QObject*)),
+            this, SLOT(onObjectDestroyed(QObject*)), Qt::DirectConnection);
+
+    object->moveToThread(this);
+
+    if (!isRunning()) {
+        start();
+    }
+}
+
+/*!
+  Deletes \a object in the thread once the calls already posted to it have run.
+*/
+void IoThread::release(QObject *object)
+{
+    object->deleteLater();
+}
+
+/*!
+  Calls \a member of \a object with the given arguments and waits for it to
+  return. The value returned is stored in \a ret. Returns false if the call
+  could not be made.
+*/
+bool IoThread::call(QObject *object, const char *member,
+                    QGenericReturnArgument ret,
+                    QGenericArgument val0,
+                    QGenericArgument val1,
+                    QGenericArgument val2)
+{
+    Qt::ConnectionType type = object->thread() == QThread::currentThread() ?
+                Qt::DirectConnection : Qt::BlockingQueuedConnection;
+
+    if (!QMetaObject::invokeMethod(object, member, type, ret, val0, val1, val2)) {
+        qDebug() << "IoThread::call(): Failed to call" << member;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+  Calls \a member of \a object with the given arguments and waits for it to return.
+*/
+bool IoThread::call(QObject *object, const char *member,
+                    QGenericArgument val0,
+                    QGenericArgument val1,
+                    QGenericArgument val2)
+{
+    return call(object, member, QGenericReturnArgument(), val0, val1, val2);
+}
+
+/*!
+  Calls \a member of \a object with the given arguments without waiting for
+  it if the object lives in another thread. The arguments are copied. The
+  value returned is stored in \a ret only if the object lives in the calling
+  thread and the call is made directly. Returns false if the call could not
+  be made.
+*/
+bool IoThread::post(QObject *object, const char *member,
+                    QGenericReturnArgument ret,
+                    QGenericArgument val0,
+                    QGenericArgument val1,
+                    QGenericArgument val2)
+{
+    bool ok = false;
+
+    if (object->thread() == QThread::currentThread()) {
+        ok = QMetaObject::invokeMethod(object, member, Qt::DirectConnection,
+                                       ret, val0, val1, val2);
+    } else {
+        ok = QMetaObject::invokeMethod(object, member, Qt::QueuedConnection,
+                                       val0, val1, val2);
+    }
+
+    if (!ok) {
+        qDebug() << "IoThread::post(): Failed to call" << member;
+    }
+
+    return ok;
+}
+
+/*!
+  Calls \a member of \a object with the given arguments without waiting for
+  it if the object lives in another thread.
+*/
+bool IoThread::post(QObject *object, const char *member,
+                    QGenericArgument val0,
+                    QGenericArgument val1,
+                    QGenericArgument val2)
+{
+    return post(object, member, QGenericReturnArgument(), val0, val1, val2);
+}
+
+/*!
+  Runs the event loop. Once it exits, the objects still in the thread are
+  deleted here since they can't be deleted from any other thread.
+*/
+void IoThread::run()
+{
+    qDebug() << "IoThread::run(): =>";
+
+    exec();
+
+    QList<QObject*> objects;
+
+    {
+        QMutexLocker locker(&mMutex);
+        objects = mObjects;
+    }
+
+    qDeleteAll(objects);
+
+    qDebug() << "IoThread::run(): <=";
+}
+
+/*!
+  Forgets the deleted \a object.
+*/
+void IoThread::onObjectDestroyed(QObject *object)
+{
+    QMutexLocker locker(&mMutex);
+    mObjects.removeAll(object);
+}
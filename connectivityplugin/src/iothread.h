@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef IOTHREAD_H
+#define IOTHREAD_H
+
+#include <QThread>
+#include <QList>
+#include <QMutex>
+
+class IoThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit IoThread(QObject *parent = 0);
+    ~IoThread();
+
+    void adopt(QObject *object);
+    void release(QObject *object);
+
+    static bool call(QObject *object, const char *member,
+                     QGenericReturnArgument ret,
+                     QGenericArgument val0 = QGenericArgument(0),
+                     QGenericArgument val1 = QGenericArgument(0),
+                     QGenericArgument val2 = QGenericArgument(0));
+    static bool call(QObject *object, const char *member,
+                     QGenericArgument val0 = QGenericArgument(0),
+                     QGenericArgument val1 = QGenericArgument(0),
+                     QGenericArgument val2 = QGenericArgument(0));
+    static bool post(QObject *object, const char *member,
+                     QGenericReturnArgument ret,
+                     QGenericArgument val0 = QGenericArgument(0),
+                     QGenericArgument val1 = QGenericArgument(0),
+                     QGenericArgument val2 = QGenericArgument(0));
+    static bool post(QObject *object, const char *member,
+                     QGenericArgument val0 = QGenericArgument(0),
+                     QGenericArgument val1 = QGenericArgument(0),
+                     QGenericArgument val2 = QGenericArgument(0));
+
+protected:
+    void run();
+
+private slots:
+    void onObjectDestroyed(QObject *object);
+
+private: //Data
+    QMutex mMutex;
+    QList<QObject*> mObjects; //Owned
+};
+
+#endif // IOTHREAD_H
@@ -166,6 +166,35 @@ QHostAddress NetworkServerInfo::lookupHost(const QString &host)
     return QHostAddress(QHostAddress::Null);
 }
 
+/*!
+  Looks up all the addresses of the host using \a QHostInfo. IPv6 addresses
+  are listed before IPv4 addresses. Returns an empty list if the host name
+  can't be resolved. Note: This is a blocking function.
+*/
+QList<QHostAddress> NetworkServerInfo::hostAddresses() const
+{
+    QList<QHostAddress> ipv6;
+    QList<QHostAddress> ipv4;
+
+    if (mHostName.isEmpty()) {
+        return ipv6;
+    }
+
+    QHostInfo info = QHostInfo::fromName(mHostName.toLower() == "localhost" ?
+                                         QHostInfo::localHostName() :
+                                         mHostName.toLower());
+
+    foreach (QHostAddress address, info.addresses()) {
+        if (address.protocol() == QAbstractSocket::IPv6Protocol) {
+            ipv6.append(address);
+        } else {
+            ipv4.append(address);
+        }
+    }
+
+    return ipv6 + ipv4;
+}
+
 /*!
   Returns the server information in \c QString separated by \a separator.
 */
@@ -11,6 +11,7 @@
 
 #include <QObject>
 #include <QHostAddress>
+#include <QList>
 
 class NetworkServerInfo
 {
@@ -24,6 +25,7 @@ public:
     QString hostName() const;
     QHostAddress address() const;
     int port() const;
+    QList<QHostAddress> hostAddresses() const;
 
     void setHostname(const QString &name);
     void setAddress(const QHostAddress &address);
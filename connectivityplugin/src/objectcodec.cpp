@@ -0,0 +1,411 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "objectcodec.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QStringList>
+
+#include "common.h"
+
+namespace
+{
+
+//Constants
+const char MapFormat(0); //Self-describing values, the keys sent along
+const char SchemaFormat(1); //The id of a registered schema and its fields
+const int MaxDepth(32); //Of nested lists and maps
+const double MaxExactInteger(9007199254740992.0); //2^53, doubles are exact below it
+
+enum Tag {
+    NullTag = 0,
+    FalseTag,
+    TrueTag,
+    IntegerTag,
+    DoubleTag,
+    StringTag,
+    BytesTag,
+    ListTag,
+    MapTag,
+    DateTimeTag
+};
+
+//Small negative numbers take as few bytes as the positive ones
+void appendInteger(QByteArray &bytes, qint64 value)
+{
+    Common::appendNumber(bytes, (quint64(value) << 1) ^ quint64(value >> 63));
+}
+
+bool readInteger(const QByteArray &bytes, int *pos, qint64 *value)
+{
+    quint64 number = 0;
+
+    if (!Common::readNumber(bytes, pos, &number)) {
+        return false;
+    }
+
+    *value = qint64(number >> 1) ^ -qint64(number & 1);
+    return true;
+}
+
+void appendBytes(QByteArray &bytes, const QByteArray &value)
+{
+    Common::appendNumber(bytes, value.size());
+    bytes.append(value);
+}
+
+bool readBytes(const QByteArray &bytes, int *pos, QByteArray *value)
+{
+    quint64 size = 0;
+
+    if (!Common::readNumber(bytes, pos, &size) || size > quint64(bytes.size() - *pos)) {
+        return false;
+    }
+
+    *value = bytes.mid(*pos, size);
+    *pos += size;
+    return true;
+}
+
+} //anonymous namespace
+
+/*!
+  \class ObjectCodec
+  \brief Encodes the objects sent from QML in a compact binary format.
+
+  An object, i.e. a QVariantMap, is sent as a format byte followed by its
+  values, each a tag byte and the value: numbers as variable length
+  integers, or 8 bytes if they aren't whole, strings in UTF-8 preceded by
+  their size, and lists and maps by the number of their items. Whole
+  numbers, which JavaScript passes as doubles, are sent as integers.
+  Values of other types are sent as strings.
+
+  Objects sent at a high rate with the same fields can use a schema
+  registered with addSchema() instead. They are then sent as the id of
+  the schema followed by the packed fields, see ObjectSchema.
+*/
+
+/*!
+  Constructor.
+*/
+ObjectCodec::ObjectCodec()
+{
+}
+
+/*!
+  Compiles \a fields, see ObjectSchema, and registers them as the schema
+  \a id, replacing the one registered earlier. Returns false if \a id is
+  negative or \a fields is not valid.
+*/
+bool ObjectCodec::addSchema(int id, const QStringList &fields)
+{
+    ObjectSchema schema;
+
+    if (id < 0 || !ObjectSchema::compile(fields, &schema)) {
+        return false;
+    }
+
+    mSchemas.insert(id, schema);
+    return true;
+}
+
+/*!
+  Removes the schema \a id.
+*/
+void ObjectCodec::removeSchema(int id)
+{
+    mSchemas.remove(id);
+}
+
+/*!
+  Returns true if the schema \a id is registered.
+*/
+bool ObjectCodec::hasSchema(int id) const
+{
+    return mSchemas.contains(id);
+}
+
+/*!
+  Returns the payload of an object frame carrying \a object, with the
+  schema \a schemaId if it is registered.
+*/
+QByteArray ObjectCodec::encode(const QVariantMap &object, int schemaId /*= -1*/) const
+{
+    QByteArray payload;
+    QHash<int, ObjectSchema>::const_iterator it = mSchemas.constFind(schemaId);
+
+    if (it != mSchemas.constEnd()) {
+        payload.append(SchemaFormat);
+        Common::appendNumber(payload, schemaId);
+        it->encode(payload, object);
+        return payload;
+    }
+
+    payload.append(MapFormat);
+    encodeValue(payload, object);
+    return payload;
+}
+
+/*!
+  Decodes the object frame \a payload into \a object. Returns false if the
+  payload is not valid or its schema is not registered.
+*/
+bool ObjectCodec::decode(const QByteArray &payload, QVariantMap *object) const
+{
+    QVariant value;
+    int pos = 1;
+
+    if (!payload.isEmpty() && payload.at(0) == SchemaFormat) {
+        quint64 schemaId = 0;
+
+        if (!Common::readNumber(payload, &pos, &schemaId)) {
+            qDebug() << "ObjectCodec::decode(): Invalid payload";
+            return false;
+        }
+
+        QHash<int, ObjectSchema>::const_iterator it = mSchemas.constFind(int(schemaId));
+
+        if (quint64(int(schemaId)) != schemaId || it == mSchemas.constEnd()) {
+            qDebug() << "ObjectCodec::decode(): Unknown schema" << schemaId;
+            return false;
+        }
+
+        QVariantMap fields;
+
+        if (!it->decode(payload, pos, &fields)) {
+            qDebug() << "ObjectCodec::decode(): Invalid fields for schema" << schemaId;
+            return false;
+        }
+
+        *object = fields;
+        return true;
+    }
+
+    if (payload.isEmpty() || payload.at(0) != MapFormat
+        || !decodeValue(payload, &pos, 0, &value) || pos != payload.size()
+        || value.type() != QVariant::Map)
+    {
+        qDebug() << "ObjectCodec::decode(): Invalid payload";
+        return false;
+    }
+
+    *object = value.toMap();
+    return true;
+}
+
+/*!
+  Appends \a value with its tag to \a bytes.
+*/
+void ObjectCodec::encodeValue(QByteArray &bytes, const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::Invalid:
+        bytes.append(char(NullTag));
+        break;
+    case QVariant::Bool:
+        bytes.append(char(value.toBool() ? TrueTag : FalseTag));
+        break;
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+        bytes.append(char(IntegerTag));
+        appendInteger(bytes, value.toLongLong());
+        break;
+    case QVariant::Double: {
+        double number = value.toDouble();
+
+        if (qAbs(number) < MaxExactInteger && number == double(qint64(number))) {
+            bytes.append(char(IntegerTag));
+            appendInteger(bytes, qint64(number));
+            break;
+        }
+
+        quint64 bits = 0;
+        qMemCopy(&bits, &number, sizeof(bits));
+        bytes.append(char(DoubleTag));
+
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            bytes.append(char((bits >> shift) & 0xff));
+        }
+
+        break;
+    }
+    case QVariant::ByteArray:
+        bytes.append(char(BytesTag));
+        appendBytes(bytes, value.toByteArray());
+        break;
+    case QVariant::List:
+    case QVariant::StringList: {
+        QVariantList list = value.toList();
+        bytes.append(char(ListTag));
+        Common::appendNumber(bytes, list.size());
+
+        foreach (const QVariant &item, list) {
+            encodeValue(bytes, item);
+        }
+
+        break;
+    }
+    case QVariant::Map: {
+        QVariantMap map = value.toMap();
+        bytes.append(char(MapTag));
+        Common::appendNumber(bytes, map.size());
+
+        for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+            appendBytes(bytes, it.key().toUtf8());
+            encodeValue(bytes, it.value());
+        }
+
+        break;
+    }
+    case QVariant::Hash: {
+        QVariantHash hash = value.toHash();
+        bytes.append(char(MapTag));
+        Common::appendNumber(bytes, hash.size());
+
+        for (QVariantHash::const_iterator it = hash.constBegin(); it != hash.constEnd(); ++it) {
+            appendBytes(bytes, it.key().toUtf8());
+            encodeValue(bytes, it.value());
+        }
+
+        break;
+    }
+    case QVariant::Date:
+    case QVariant::DateTime:
+        bytes.append(char(DateTimeTag));
+        appendInteger(bytes, value.toDateTime().toMSecsSinceEpoch());
+        break;
+    default:
+        bytes.append(char(StringTag));
+        appendBytes(bytes, value.toString().toUtf8());
+        break;
+    }
+}
+
+/*!
+  Reads the value at \a pos of \a bytes into \a value and moves \a pos
+  past it. \a depth is the number of lists and maps the value is in.
+  Returns false if the value is not valid.
+*/
+bool ObjectCodec::decodeValue(const QByteArray &bytes, int *pos, int depth, QVariant *value)
+{
+    if (*pos >= bytes.size() || depth > MaxDepth) {
+        return false;
+    }
+
+    char tag = bytes.at((*pos)++);
+
+    switch (tag) {
+    case NullTag:
+        *value = QVariant();
+        return true;
+    case FalseTag:
+    case TrueTag:
+        *value = tag == TrueTag;
+        return true;
+    case IntegerTag: {
+        qint64 number = 0;
+
+        if (!readInteger(bytes, pos, &number)) {
+            return false;
+        }
+
+        //Fits in an int most of the time, which QML handles best
+        *value = number == int(number) ? QVariant(int(number)) : QVariant(number);
+        return true;
+    }
+    case DoubleTag: {
+        if (bytes.size() - *pos < 8) {
+            return false;
+        }
+
+        quint64 bits = 0;
+
+        for (int i = 0; i < 8; ++i) {
+            bits = bits << 8 | uchar(bytes.at((*pos)++));
+        }
+
+        double number = 0;
+        qMemCopy(&number, &bits, sizeof(number));
+        *value = number;
+        return true;
+    }
+    case StringTag:
+    case BytesTag: {
+        QByteArray data;
+
+        if (!readBytes(bytes, pos, &data)) {
+            return false;
+        }
+
+        *value = tag == StringTag ? QVariant(QString::fromUtf8(data)) : QVariant(data);
+        return true;
+    }
+    case ListTag: {
+        quint64 count = 0;
+
+        //Every item takes at least a byte
+        if (!Common::readNumber(bytes, pos, &count) || count > quint64(bytes.size() - *pos)) {
+            return false;
+        }
+
+        QVariantList list;
+        list.reserve(count);
+
+        for (quint64 i = 0; i < count; ++i) {
+            QVariant item;
+
+            if (!decodeValue(bytes, pos, depth + 1, &item)) {
+                return false;
+            }
+
+            list.append(item);
+        }
+
+        *value = list;
+        return true;
+    }
+    case MapTag: {
+        quint64 count = 0;
+
+        if (!Common::readNumber(bytes, pos, &count) || count > quint64(bytes.size() - *pos)) {
+            return false;
+        }
+
+        QVariantMap map;
+
+        for (quint64 i = 0; i < count; ++i) {
+            QByteArray key;
+            QVariant item;
+
+            if (!readBytes(bytes, pos, &key) || !decodeValue(bytes, pos, depth + 1, &item)) {
+                return false;
+            }
+
+            map.insert(QString::fromUtf8(key), item);
+        }
+
+        *value = map;
+        return true;
+    }
+    case DateTimeTag: {
+        qint64 msecs = 0;
+
+        if (!readInteger(bytes, pos, &msecs)) {
+            return false;
+        }
+
+        *value = QDateTime::fromMSecsSinceEpoch(msecs);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
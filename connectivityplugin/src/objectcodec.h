@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef OBJECTCODEC_H
+#define OBJECTCODEC_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include <QVariant>
+#include <QVariantMap>
+
+#include "objectschema.h"
+
+class ObjectCodec
+{
+public:
+    ObjectCodec();
+
+    bool addSchema(int id, const QStringList &fields);
+    void removeSchema(int id);
+    bool hasSchema(int id) const;
+
+    QByteArray encode(const QVariantMap &object, int schemaId = -1) const;
+    bool decode(const QByteArray &payload, QVariantMap *object) const;
+
+private:
+    static void encodeValue(QByteArray &bytes, const QVariant &value);
+    static bool decodeValue(const QByteArray &bytes, int *pos, int depth, QVariant *value);
+
+private: // Data
+    QHash<int, ObjectSchema> mSchemas; //Compiled, by id
+};
+
+#endif // OBJECTCODEC_H
@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "objectschema.h"
+
+#include <QDebug>
+#include <QSet>
+#include <QtEndian>
+
+#include "common.h"
+
+namespace
+{
+
+struct TypeInfo
+{
+    const char *name;
+    ObjectSchema::Type type;
+    int size; //Bytes in the fixed part, 0 for bools and the variable sized
+};
+
+//Constants
+const TypeInfo Types[] = {
+    { "bool", ObjectSchema::Bool, 0 },
+    { "int8", ObjectSchema::Int8, 1 },
+    { "int16", ObjectSchema::Int16, 2 },
+    { "int32", ObjectSchema::Int32, 4 },
+    { "int", ObjectSchema::Int32, 4 },
+    { "int64", ObjectSchema::Int64, 8 },
+    { "float", ObjectSchema::Float, 4 },
+    { "double", ObjectSchema::Double, 8 },
+    { "string", ObjectSchema::String, 0 },
+    { "bytes", ObjectSchema::Bytes, 0 }
+};
+const int TypeCount(sizeof(Types) / sizeof(Types[0]));
+const QChar TypeSeparator(':');
+
+} //anonymous namespace
+
+/*!
+  \class ObjectSchema
+  \brief The fields of the objects sent with a registered schema.
+
+  A schema lists the fields of an object as "name:type", e.g.
+  ["x:float", "y:float", "pressed:bool", "label:string"]. The types are
+  bool, int8, int16, int32 (or int), int64, float, double, string and
+  bytes.
+
+  The schema is compiled once into a table of the fields, which gives the
+  numbers a fixed offset and the bools a bit of their own. An object is
+  then sent as the numbers and the bools at their offsets, followed by the
+  strings and the bytes in the order of the fields, each preceded by its
+  size. The names of the fields are not sent, so both peers must register
+  the same schema.
+*/
+
+/*!
+  Constructor. Creates an empty schema.
+*/
+ObjectSchema::ObjectSchema() :
+    mFixedSize(0)
+{
+}
+
+/*!
+  Compiles \a fields into \a schema. Returns false if a field has no name,
+  an unknown type or the same name as another field.
+*/
+bool ObjectSchema::compile(const QStringList &fields, ObjectSchema *schema)
+{
+    QVector<Field> table;
+    QSet<QString> names;
+    int fixedSize = 0;
+    int bools = 0;
+
+    foreach (const QString &spec, fields) {
+        QString name = spec.section(TypeSeparator, 0, 0).trimmed();
+        QString type = spec.section(TypeSeparator, 1).trimmed();
+        int index = 0;
+
+        while (index < TypeCount && type != QLatin1String(Types[index].name)) {
+            ++index;
+        }
+
+        if (name.isEmpty() || index == TypeCount || names.contains(name)) {
+            qDebug() << "ObjectSchema::compile(): Invalid field" << spec;
+            return false;
+        }
+
+        Field field;
+        field.name = name;
+        field.type = Types[index].type;
+        field.offset = -1;
+        field.mask = 0;
+
+        if (Types[index].size > 0) {
+            field.offset = fixedSize;
+            fixedSize += Types[index].size;
+        } else if (field.type == Bool) {
+            //Placed after the numbers once their size is known
+            field.offset = bools / 8;
+            field.mask = uchar(1 << (bools % 8));
+            ++bools;
+        }
+
+        names.insert(name);
+        table.append(field);
+    }
+
+    for (int i = 0; i < table.size(); ++i) {
+        if (table[i].type == Bool) {
+            table[i].offset += fixedSize;
+        }
+    }
+
+    schema->mSpecs = fields;
+    schema->mFields = table;
+    schema->mFixedSize = fixedSize + (bools + 7) / 8;
+    return true;
+}
+
+/*!
+  Appends the fields of \a object to \a bytes. Fields missing from
+  \a object are sent as zero, false or empty, the other values of
+  \a object are not sent.
+*/
+void ObjectSchema::encode(QByteArray &bytes, const QVariantMap &object) const
+{
+    int start = bytes.size();
+    bytes.resize(start + mFixedSize);
+    qMemSet(bytes.data() + start, 0, mFixedSize);
+
+    for (int i = 0; i < mFields.size(); ++i) {
+        const Field &field = mFields.at(i);
+        QVariant value = object.value(field.name);
+        uchar *data = reinterpret_cast<uchar*>(bytes.data()) + start + field.offset;
+
+        switch (field.type) {
+        case Bool:
+            if (value.toBool()) {
+                *data |= field.mask;
+            }
+            break;
+        case Int8:
+            *data = uchar(value.toInt());
+            break;
+        case Int16:
+            qToBigEndian<quint16>(quint16(value.toInt()), data);
+            break;
+        case Int32:
+            qToBigEndian<quint32>(quint32(value.toInt()), data);
+            break;
+        case Int64:
+            qToBigEndian<quint64>(quint64(value.toLongLong()), data);
+            break;
+        case Float: {
+            float number = value.toFloat();
+            quint32 bits = 0;
+            qMemCopy(&bits, &number, sizeof(bits));
+            qToBigEndian<quint32>(bits, data);
+            break;
+        }
+        case Double: {
+            double number = value.toDouble();
+            quint64 bits = 0;
+            qMemCopy(&bits, &number, sizeof(bits));
+            qToBigEndian<quint64>(bits, data);
+            break;
+        }
+        case String:
+        case Bytes: {
+            QByteArray raw = field.type == String ? value.toString().toUtf8()
+                                                  : value.toByteArray();
+            Common::appendNumber(bytes, raw.size());
+            bytes.append(raw);
+            break;
+        }
+        }
+    }
+}
+
+/*!
+  Reads the fields at \a pos of \a bytes, which must end with them, into
+  \a object. Returns false if the fields don't fit the schema.
+*/
+bool ObjectSchema::decode(const QByteArray &bytes, int pos, QVariantMap *object) const
+{
+    if (bytes.size() - pos < mFixedSize) {
+        return false;
+    }
+
+    const uchar *fixed = reinterpret_cast<const uchar*>(bytes.constData()) + pos;
+    pos += mFixedSize;
+
+    for (int i = 0; i < mFields.size(); ++i) {
+        const Field &field = mFields.at(i);
+        const uchar *data = fixed + field.offset;
+        QVariant value;
+
+        switch (field.type) {
+        case Bool:
+            value = bool(*data & field.mask);
+            break;
+        case Int8:
+            value = int(qint8(*data));
+            break;
+        case Int16:
+            value = int(qFromBigEndian<qint16>(data));
+            break;
+        case Int32:
+            value = int(qFromBigEndian<qint32>(data));
+            break;
+        case Int64:
+            value = qFromBigEndian<qint64>(data);
+            break;
+        case Float: {
+            quint32 bits = qFromBigEndian<quint32>(data);
+            float number = 0;
+            qMemCopy(&number, &bits, sizeof(number));
+            value = double(number);
+            break;
+        }
+        case Double: {
+            quint64 bits = qFromBigEndian<quint64>(data);
+            double number = 0;
+            qMemCopy(&number, &bits, sizeof(number));
+            value = number;
+            break;
+        }
+        case String:
+        case Bytes: {
+            int size = 0;
+
+            if (!Common::readNumber(bytes, &pos, &size) || size > bytes.size() - pos) {
+                return false;
+            }
+
+            QByteArray raw = bytes.mid(pos, size);
+            pos += size;
+            value = field.type == String ? QVariant(QString::fromUtf8(raw)) : QVariant(raw);
+            break;
+        }
+        }
+
+        object->insert(field.name, value);
+    }
+
+    return pos == bytes.size();
+}
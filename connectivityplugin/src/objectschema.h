@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef OBJECTSCHEMA_H
+#define OBJECTSCHEMA_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+#include <QVector>
+
+class ObjectSchema
+{
+public:
+    enum Type {
+        Bool = 0,
+        Int8,
+        Int16,
+        Int32,
+        Int64,
+        Float,
+        Double,
+        String,
+        Bytes
+    };
+
+public:
+    ObjectSchema();
+
+    static bool compile(const QStringList &fields, ObjectSchema *schema);
+
+    QStringList fields() const { return mSpecs; }
+
+    void encode(QByteArray &bytes, const QVariantMap &object) const;
+    bool decode(const QByteArray &bytes, int pos, QVariantMap *object) const;
+
+private:
+    struct Field
+    {
+        QString name;
+        Type type;
+        int offset; //In the fixed part, -1 for strings and bytes
+        uchar mask; //The bit of a bool
+    };
+
+private: // Data
+    QStringList mSpecs; //As registered
+    QVector<Field> mFields; //In the order of registration
+    int mFixedSize; //Bytes taken by the numbers and bools
+};
+
+#endif // OBJECTSCHEMA_H
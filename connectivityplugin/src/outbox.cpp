@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "outbox.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+
+//Constants
+const quint32 OutboxMagic(0x43504f42); //"CPOB"
+const qint32 OutboxVersion(1);
+
+/*!
+  \class Outbox
+  \brief A bounded queue of outgoing messages used while there is no
+  connection. The messages are kept in memory, or also in a file when one
+  is given, so that they survive a restart of the application.
+  Every message can have its own expiry time.
+*/
+
+/*!
+  Constructor.
+*/
+Outbox::Outbox() :
+    mSize(0),
+    mExpiry(0)
+{
+}
+
+/*!
+  Sets the file to store the messages in to \a fileName and reads the
+  messages stored in it. Empty \a fileName keeps the messages only in
+  memory.
+*/
+void Outbox::setFileName(const QString &fileName)
+{
+    if (mFileName != fileName) {
+        mFileName = fileName;
+        load();
+    }
+}
+
+/*!
+  Sets the maximum number of queued messages to \a size. When the outbox is
+  full the oldest message is dropped. 0 disables the outbox.
+*/
+void Outbox::setSize(int size)
+{
+    mSize = qMax(0, size);
+
+    if (mEntries.size() > mSize) {
+        mEntries = mEntries.mid(mEntries.size() - mSize);
+        save();
+    }
+}
+
+/*!
+  Sets the default lifetime of a queued message to \a expiry milliseconds.
+  0 means the messages never expire.
+*/
+void Outbox::setExpiry(int expiry)
+{
+    mExpiry = qMax(0, expiry);
+}
+
+/*!
+  Returns the number of messages waiting to be sent, not counting the
+  expired ones still to be purged.
+*/
+int Outbox::count() const
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int count = 0;
+
+    foreach (const Entry &entry, mEntries) {
+        if (entry.expires == 0 || entry.expires > now) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+/*!
+  Queues \a message to be sent later. \a expiry is the lifetime of the
+  message in milliseconds, 0 means never and -1 uses the default expiry.
+  Returns false if the outbox is disabled.
+*/
+bool Outbox::enqueue(const QByteArray &message, int expiry)
+{
+    if (mSize == 0) {
+        return false;
+    }
+
+    purge();
+
+    if (expiry < 0) {
+        expiry = mExpiry;
+    }
+
+    Entry entry;
+    entry.message = message;
+    entry.expires = expiry > 0 ? QDateTime::currentMSecsSinceEpoch() + expiry : 0;
+    mEntries.append(entry);
+
+    while (mEntries.size() > mSize) {
+        qDebug() << "Outbox::enqueue(): Outbox full, dropping the oldest message";
+        mEntries.removeFirst();
+    }
+
+    save();
+    return true;
+}
+
+/*!
+  Returns the queued messages, the oldest first. Call purge() first to
+  leave out the expired ones. The messages stay in the outbox.
+*/
+QList<QByteArray> Outbox::messages() const
+{
+    QList<QByteArray> messages;
+
+    foreach (const Entry &entry, mEntries) {
+        messages.append(entry.message);
+    }
+
+    return messages;
+}
+
+/*!
+  Removes the messages that haven't expired from the outbox and returns
+  them, the oldest first, e.g. to be sent. See putBack().
+*/
+QList<QByteArray> Outbox::take()
+{
+    purge();
+    QList<QByteArray> messages = this->messages();
+
+    if (!mEntries.isEmpty()) {
+        mEntries.clear();
+        save();
+    }
+
+    return messages;
+}
+
+/*!
+  Queues \a messages taken with take() but not sent back in front of the
+  others, with the default expiry from now on.
+*/
+void Outbox::putBack(const QList<QByteArray> &messages)
+{
+    if (messages.isEmpty() || mSize == 0) {
+        return;
+    }
+
+    qint64 expires = mExpiry > 0 ? QDateTime::currentMSecsSinceEpoch() + mExpiry : 0;
+
+    for (int i = messages.size() - 1; i >= 0; --i) {
+        Entry entry;
+        entry.message = messages.at(i);
+        entry.expires = expires;
+        mEntries.prepend(entry);
+    }
+
+    while (mEntries.size() > mSize) {
+        mEntries.removeFirst();
+    }
+
+    save();
+}
+
+/*!
+  Removes all the queued messages.
+*/
+void Outbox::clear()
+{
+    mEntries.clear();
+    save();
+}
+
+/*!
+  Drops the expired messages.
+*/
+void Outbox::purge()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int count = mEntries.size();
+
+    for (int i = mEntries.size() - 1; i >= 0; --i) {
+        if (mEntries.at(i).expires > 0 && mEntries.at(i).expires <= now) {
+            mEntries.removeAt(i);
+        }
+    }
+
+    if (mEntries.size() != count) {
+        qDebug() << "Outbox::purge(): Dropped" << count - mEntries.size() << "expired messages";
+        save();
+    }
+}
+
+/*!
+  Reads the messages from the file.
+*/
+void Outbox::load()
+{
+    mEntries.clear();
+
+    if (mFileName.isEmpty()) {
+        return;
+    }
+
+    QFile file(mFileName);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_7);
+
+    quint32 magic;
+    qint32 version;
+    qint32 count;
+    stream >> magic >> version >> count;
+
+    if (magic != OutboxMagic || version != OutboxVersion) {
+        qDebug() << "Outbox::load(): Unknown file format in" << mFileName;
+        return;
+    }
+
+    for (int i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        Entry entry;
+        stream >> entry.expires >> entry.message;
+
+        if (stream.status() == QDataStream::Ok) {
+            mEntries.append(entry);
+        }
+    }
+
+    qDebug() << "Outbox::load(): Loaded" << mEntries.size() << "messages from" << mFileName;
+}
+
+/*!
+  Writes the messages to the file.
+*/
+void Outbox::save() const
+{
+    if (mFileName.isEmpty()) {
+        return;
+    }
+
+    if (mEntries.isEmpty()) {
+        QFile::remove(mFileName);
+        return;
+    }
+
+    QFile file(mFileName);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Outbox::save(): Failed to open" << mFileName << file.errorString();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_7);
+    stream << OutboxMagic << OutboxVersion << qint32(mEntries.size());
+
+    foreach (const Entry &entry, mEntries) {
+        stream << entry.expires << entry.message;
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+class Outbox
+{
+public:
+    Outbox();
+
+    QString fileName() const { return mFileName; }
+    int size() const { return mSize; }
+    int expiry() const { return mExpiry; }
+
+    void setFileName(const QString &fileName);
+    void setSize(int size);
+    void setExpiry(int expiry);
+
+    int count() const;
+    bool enqueue(const QByteArray &message, int expiry = -1);
+    QList<QByteArray> messages() const;
+    QList<QByteArray> take();
+    void putBack(const QList<QByteArray> &messages);
+    void purge();
+    void clear();
+
+private:
+    struct Entry {
+        QByteArray message;
+        qint64 expires; // Milliseconds since epoch, 0 means never
+    };
+
+    void load();
+    void save() const;
+
+    QString mFileName; // Empty means the messages are kept only in memory
+    int mSize; // 0 means the outbox is disabled
+    int mExpiry; // Default lifetime in milliseconds, 0 means never
+    QList<Entry> mEntries; // Oldest first
+};
+
+#endif // OUTBOX_H
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "reconnectpolicy.h"
+
+#include <QDateTime>
+#include <QThreadStorage>
+
+namespace
+{
+
+QThreadStorage<bool *> gSeeded; //qrand() is seeded per thread
+
+/*!
+  Returns a random number in range [0, 1]. The generator is seeded on first use
+  so that clients started at the same moment do not share the same sequence.
+*/
+qreal random(const void *salt)
+{
+    if (!gSeeded.hasLocalData()) {
+        gSeeded.setLocalData(new bool(true));
+        qsrand(uint(QDateTime::currentMSecsSinceEpoch()) ^ uint(quintptr(salt)));
+    }
+
+    return qreal(qrand()) / RAND_MAX;
+}
+
+} //anonymous namespace
+
+/*!
+  \class ReconnectPolicy
+  \brief Describes how clients retry a failed connection attempt and
+  whether they reconnect by themselves after the connection has dropped.
+
+  The delay before attempt \c n is \c initialDelay * \c multiplier ^ \c n,
+  capped to \c maxDelay. \c jitter randomly shortens each delay by up to the
+  given fraction so that clients dropped at the same time do not retry in lockstep.
+*/
+
+/*!
+  Constructor. The defaults match the fixed retry behaviour the clients used
+  to have: three retries, 500 milliseconds apart.
+*/
+ReconnectPolicy::ReconnectPolicy() :
+    mInitialDelay(500),
+    mMultiplier(1.0),
+    mMaxDelay(30000),
+    mJitter(0.0),
+    mMaxRetries(3),
+    mAutoReconnect(false)
+{
+}
+
+void ReconnectPolicy::setInitialDelay(int delay)
+{
+    mInitialDelay = qMax(0, delay);
+}
+
+void ReconnectPolicy::setMultiplier(qreal multiplier)
+{
+    mMultiplier = qMax(qreal(1.0), multiplier);
+}
+
+void ReconnectPolicy::setMaxDelay(int delay)
+{
+    mMaxDelay = qMax(0, delay);
+}
+
+void ReconnectPolicy::setJitter(qreal jitter)
+{
+    mJitter = qBound(qreal(0.0), jitter, qreal(1.0));
+}
+
+/*!
+  Sets the number of retries to \a retries. Negative value means unlimited retries.
+*/
+void ReconnectPolicy::setMaxRetries(int retries)
+{
+    mMaxRetries = retries < 0 ? -1 : retries;
+}
+
+void ReconnectPolicy::setAutoReconnect(bool enabled)
+{
+    mAutoReconnect = enabled;
+}
+
+/*!
+  Returns true if a retry with zero based index \a attempt is allowed.
+*/
+bool ReconnectPolicy::canRetry(int attempt) const
+{
+    return mMaxRetries < 0 || attempt < mMaxRetries;
+}
+
+/*!
+  Returns the delay in milliseconds to wait before retry \a attempt.
+*/
+int ReconnectPolicy::delay(int attempt) const
+{
+    qreal delay = mInitialDelay;
+
+    for (int i = 0; i < attempt && delay < mMaxDelay; ++i) {
+        delay *= mMultiplier;
+    }
+
+    delay = qMin(delay, qreal(mMaxDelay));
+    delay -= delay * mJitter * ::random(this);
+
+    return qRound(delay);
+}
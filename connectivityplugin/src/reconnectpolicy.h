@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef RECONNECTPOLICY_H
+#define RECONNECTPOLICY_H
+
+#include <QtGlobal>
+
+class ReconnectPolicy
+{
+public:
+    ReconnectPolicy();
+
+    int initialDelay() const { return mInitialDelay; }
+    qreal multiplier() const { return mMultiplier; }
+    int maxDelay() const { return mMaxDelay; }
+    qreal jitter() const { return mJitter; }
+    int maxRetries() const { return mMaxRetries; }
+    bool autoReconnect() const { return mAutoReconnect; }
+
+    void setInitialDelay(int delay);
+    void setMultiplier(qreal multiplier);
+    void setMaxDelay(int delay);
+    void setJitter(qreal jitter);
+    void setMaxRetries(int retries);
+    void setAutoReconnect(bool enabled);
+
+    bool canRetry(int attempt) const;
+    int delay(int attempt) const;
+
+private:
+    int mInitialDelay; // Milliseconds
+    qreal mMultiplier;
+    int mMaxDelay; // Milliseconds
+    qreal mJitter; // 0.0 - 1.0
+    int mMaxRetries; // -1 means unlimited
+    bool mAutoReconnect;
+};
+
+#endif // RECONNECTPOLICY_H
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "relayrouter.h"
+
+/*!
+  \class RelayRouter
+  \brief Decides which clients a server forwards a message from a client to.
+
+  With \a RelayToOthers a message goes to every other client, with
+  \a RelayToGroup to the other clients in the same group. A route set for a
+  client overrides the mode and sends its messages only to the given client.
+*/
+
+/*!
+  Constructor.
+*/
+RelayRouter::RelayRouter() :
+    mMode(NoRelay),
+    mLocalDelivery(false)
+{
+}
+
+/*!
+  Returns true if any messages are relayed.
+*/
+bool RelayRouter::isEnabled() const
+{
+    return mMode != NoRelay || !mRoutes.isEmpty();
+}
+
+void RelayRouter::setMode(Mode mode)
+{
+    mMode = mode;
+}
+
+/*!
+  Sets whether the relayed messages are also received by the server itself.
+  Messages are always received by the server when nothing is relayed.
+*/
+void RelayRouter::setLocalDelivery(bool enabled)
+{
+    mLocalDelivery = enabled;
+}
+
+QString RelayRouter::group(int clientId) const
+{
+    return mGroups.value(clientId);
+}
+
+/*!
+  Adds \a clientId to \a group. Empty \a group removes the client from its group.
+*/
+void RelayRouter::setGroup(int clientId, const QString &group)
+{
+    if (group.isEmpty()) {
+        mGroups.remove(clientId);
+    } else {
+        mGroups.insert(clientId, group);
+    }
+}
+
+/*!
+  Returns the client the messages of \a clientId are routed to, 0 if none.
+*/
+int RelayRouter::route(int clientId) const
+{
+    return mRoutes.value(clientId);
+}
+
+/*!
+  Routes the messages from \a fromClientId only to \a toClientId.
+  0 \a toClientId removes the route.
+*/
+void RelayRouter::setRoute(int fromClientId, int toClientId)
+{
+    if (toClientId <= 0) {
+        mRoutes.remove(fromClientId);
+    } else {
+        mRoutes.insert(fromClientId, toClientId);
+    }
+}
+
+void RelayRouter::clearRoutes()
+{
+    mRoutes.clear();
+}
+
+/*!
+  Forgets the group and the routes of the disconnected \a clientId.
+*/
+void RelayRouter::removeClient(int clientId)
+{
+    mGroups.remove(clientId);
+    mRoutes.remove(clientId);
+
+    QMutableHashIterator<int, int> it(mRoutes);
+
+    while (it.hasNext()) {
+        if (it.next().value() == clientId) {
+            it.remove();
+        }
+    }
+}
+
+/*!
+  Returns the clients among \a clients the message from \a fromClientId is
+  forwarded to.
+*/
+QList<int> RelayRouter::targets(int fromClientId, const QList<int> &clients) const
+{
+    QList<int> targets;
+
+    QHash<int, int>::const_iterator route = mRoutes.constFind(fromClientId);
+
+    if (route != mRoutes.constEnd()) {
+        if (clients.contains(route.value())) {
+            targets.append(route.value());
+        }
+        return targets;
+    }
+
+    if (mMode == NoRelay) {
+        return targets;
+    }
+
+    QString group = mGroups.value(fromClientId);
+
+    foreach (int clientId, clients) {
+        if (clientId == fromClientId) {
+            continue;
+        }
+
+        if (mMode == RelayToGroup && mGroups.value(clientId) != group) {
+            continue;
+        }
+
+        targets.append(clientId);
+    }
+
+    return targets;
+}
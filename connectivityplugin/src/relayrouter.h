@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef RELAYROUTER_H
+#define RELAYROUTER_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+class RelayRouter
+{
+public:
+    enum Mode {
+        NoRelay = 0,
+        RelayToOthers,
+        RelayToGroup
+    };
+
+public:
+    RelayRouter();
+
+    Mode mode() const { return mMode; }
+    bool localDelivery() const { return mLocalDelivery; }
+    bool isEnabled() const;
+
+    void setMode(Mode mode);
+    void setLocalDelivery(bool enabled);
+
+    QString group(int clientId) const;
+    void setGroup(int clientId, const QString &group);
+    int route(int clientId) const;
+    void setRoute(int fromClientId, int toClientId);
+    void clearRoutes();
+    void removeClient(int clientId);
+
+    QList<int> targets(int fromClientId, const QList<int> &clients) const;
+
+private:
+    Mode mMode;
+    bool mLocalDelivery; // Whether the relayed messages are also received by the server
+    QHash<int, QString> mGroups; // Client id to group, no entry means no group
+    QHash<int, int> mRoutes; // Client id to the only client its messages go to
+};
+
+#endif // RELAYROUTER_H
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "rpccall.h"
+
+#include <QDebug>
+
+/*!
+  \class RpcCall
+  \brief A remote procedure call waiting for its reply.
+
+  Calls are made with ConnectionManager::call(), which returns the call
+  right away. Any number of calls can be waiting at the same time; each
+  has its own id which the reply carries back. Once the reply arrives,
+  or the timeout passes without one, the call emits finished() or
+  failed() and is deleted.
+*/
+
+/*!
+  \enum RpcCall::Status
+  \value Pending    Waiting for the reply.
+  \value Finished   The reply arrived, see \a result.
+  \value Failed     The peer replied with an error or the connection was lost, see \a error.
+  \value TimedOut   No reply arrived in time.
+*/
+
+/*!
+  \property RpcCall::result
+  This property holds the value the method returned, once \a Finished.
+*/
+
+/*!
+  \property RpcCall::error
+  This property holds the reason the call failed.
+*/
+
+/*!
+  Constructor. Only needed for registering the type, calls are created by
+  ConnectionManager::call().
+*/
+RpcCall::RpcCall(QObject *parent) :
+    QObject(parent),
+    mId(0),
+    mClientId(0),
+    mStatus(Pending)
+{
+}
+
+/*!
+  Constructor. Creates the call \a id of \a method on the client
+  \a clientId, or on the server if 0, which times out after \a timeout
+  milliseconds unless it is 0.
+*/
+RpcCall::RpcCall(quint32 id, const QString &method, int clientId, int timeout,
+                 QObject *parent) :
+    QObject(parent),
+    mId(id),
+    mMethod(method),
+    mClientId(clientId),
+    mStatus(Pending)
+{
+    mTimer.setSingleShot(true);
+    connect(&mTimer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+
+    if (timeout > 0) {
+        mTimer.start(timeout);
+    }
+}
+
+/*!
+  The call returned \a result.
+*/
+void RpcCall::finish(const QVariant &result)
+{
+    if (mStatus != Pending) {
+        return;
+    }
+
+    mTimer.stop();
+    mStatus = Finished;
+    mResult = result;
+
+    emit statusChanged(mStatus);
+    emit finished(mResult);
+    deleteLater();
+}
+
+/*!
+  The call ended with \a status because of \a error.
+*/
+void RpcCall::fail(Status status, const QString &error)
+{
+    if (mStatus != Pending) {
+        return;
+    }
+
+    qDebug() << "RpcCall::fail():" << mMethod << mId << error;
+
+    mTimer.stop();
+    mStatus = status;
+    mError = error;
+
+    emit statusChanged(mStatus);
+    emit failed(mError);
+    deleteLater();
+}
+
+/*!
+  No reply arrived in time.
+*/
+void RpcCall::onTimeout()
+{
+    fail(TimedOut, "Timed out");
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef RPCCALL_H
+#define RPCCALL_H
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVariant>
+
+class RpcCall : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int id READ id CONSTANT)
+    Q_PROPERTY(QString method READ method CONSTANT)
+    Q_PROPERTY(int clientId READ clientId CONSTANT)
+    Q_PROPERTY(int status READ status NOTIFY statusChanged)
+    Q_PROPERTY(QVariant result READ result NOTIFY statusChanged)
+    Q_PROPERTY(QString error READ error NOTIFY statusChanged)
+    Q_ENUMS(Status)
+
+public:
+    enum Status {
+        Pending = 0,
+        Finished,
+        Failed,
+        TimedOut
+    };
+
+public:
+    explicit RpcCall(QObject *parent = 0);
+    RpcCall(quint32 id, const QString &method, int clientId, int timeout, QObject *parent);
+
+    int id() const { return mId; }
+    QString method() const { return mMethod; }
+    int clientId() const { return mClientId; }
+    int status() const { return mStatus; }
+    QVariant result() const { return mResult; }
+    QString error() const { return mError; }
+
+    void finish(const QVariant &result);
+    void fail(Status status, const QString &error);
+
+signals:
+    void statusChanged(int status);
+    void finished(const QVariant &result);
+    void failed(const QString &error);
+
+private slots:
+    void onTimeout();
+
+private: // Data
+    quint32 mId;
+    QString mMethod;
+    int mClientId; //The peer called, 0 for the server
+    Status mStatus;
+    QVariant mResult;
+    QString mError;
+    QTimer mTimer;
+};
+
+#endif // RPCCALL_H
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "rpcmessage.h"
+#include "common.h"
+
+#include <QDataStream>
+#include <QDebug>
+
+//Constants
+const int RpcHeaderSize(5); //Type and correlation id
+const QDataStream::Version StreamVersion(QDataStream::Qt_4_7);
+
+/*!
+  Returns the RPC frame carrying the message. The type and the correlation
+  id are sent in front of the payload, which is the method and the
+  arguments of a request, or the result or the error of a reply, in the
+  QDataStream format.
+*/
+QByteArray RpcMessage::toFrame() const
+{
+    QByteArray payload;
+    payload.append(char(type));
+    payload.append(char((id >> 24) & 0xff));
+    payload.append(char((id >> 16) & 0xff));
+    payload.append(char((id >> 8) & 0xff));
+    payload.append(char(id & 0xff));
+
+    QByteArray body;
+    QDataStream stream(&body, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+
+    if (type == Request) {
+        stream << method;
+    }
+
+    stream << value;
+    return Common::toRpcMessage(payload + body);
+}
+
+/*!
+  Reads the RPC frame \a payload into \a message. Returns false if the
+  payload is not valid.
+*/
+bool RpcMessage::fromPayload(const QByteArray &payload, RpcMessage *message)
+{
+    if (payload.size() < RpcHeaderSize || uchar(payload.at(0)) > Error) {
+        qDebug() << "RpcMessage::fromPayload(): Invalid header";
+        return false;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar*>(payload.constData());
+    message->type = Type(header[0]);
+    message->id = quint32(header[1]) << 24 | quint32(header[2]) << 16
+                  | quint32(header[3]) << 8 | header[4];
+
+    QDataStream stream(payload);
+    stream.setVersion(StreamVersion);
+    stream.skipRawData(RpcHeaderSize);
+
+    if (message->type == Request) {
+        stream >> message->method;
+    }
+
+    stream >> message->value;
+
+    if (stream.status() != QDataStream::Ok) {
+        qDebug() << "RpcMessage::fromPayload(): Invalid payload for" << message->id;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef RPCMESSAGE_H
+#define RPCMESSAGE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+
+/*!
+  A remote procedure call or its reply as sent in an RPC frame.
+*/
+struct RpcMessage
+{
+    enum Type {
+        Request = 0,
+        Response,
+        Error
+    };
+
+    RpcMessage() : type(Request), id(0) {}
+    RpcMessage(Type type, quint32 id, const QVariant &value, const QString &method = QString()) :
+        type(type), id(id), method(method), value(value) {}
+
+    QByteArray toFrame() const;
+    static bool fromPayload(const QByteArray &payload, RpcMessage *message);
+
+    Type type;
+    quint32 id; //Chosen by the caller, the reply carries the same id
+    QString method; //Requests only
+    QVariant value; //The arguments of a request, the result or the error string
+};
+
+#endif // RPCMESSAGE_H
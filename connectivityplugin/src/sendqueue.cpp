@@ -0,0 +1,509 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "sendqueue.h"
+#include "common.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QIODevice>
+#include <QVariantMap>
+
+//Constants
+const qint64 Watermark(16 * 1024); //Bytes let into the socket buffer at a time
+const int Quantum(4 * 1024); //Bytes per round for the lowest class in WeightedFair
+const int Weights[] = { 1, 2, 4, 8 }; //By priority
+
+/*!
+  \class SendQueue
+  \brief Sends the messages of higher priority ahead of the queued ones.
+
+  Messages are queued per priority class above the socket instead of being
+  written to it right away. Only a limited amount is let into the socket
+  buffer at a time, and once it drains the next message is chosen by
+  priority:
+
+  \list
+  \o StrictPriority: the highest class with messages goes first. Low
+     classes wait as long as there is anything else to send.
+  \o WeightedFair: the classes are served in turns with deficit round
+     robin, each class getting a share of the link doubling with every
+     step of priority. Low classes progress even under load.
+  \endlist
+
+  A message can have a deadline, past which it is dropped instead of sent.
+
+  A message can also have a key, e.g. for the latest position of an
+  object. A newer message with the same key replaces the one still
+  waiting in the queue, so on a slow link only the latest value is sent
+  instead of a backlog of stale ones. The replacing message takes the
+  place of the old one if they have the same priority, and goes to the
+  end of its own class otherwise.
+
+  Each class keeps statistics of the messages sent, dropped and replaced
+  and of the time they spent in the queue. With NoQueue everything is
+  written right away, as if there was no queue, except the messages with
+  a key which are queued while the socket buffer is full, and the ones
+  sent after them to keep the order.
+
+  A message with a key can also be sent as a delta to the previous message
+  with the key written to the device, see DeltaCodec. It is encoded only
+  when written, so that a replaced message is never used as the base.
+*/
+
+/*!
+  Constructor.
+*/
+SendQueue::SendQueue(QObject *parent) :
+    QObject(parent),
+    mMode(NoQueue)
+{
+    for (int i = 0; i < PriorityCount; ++i) {
+        mStatistics.append(Statistics());
+    }
+
+    mClock.start();
+}
+
+/*!
+  Sets the queueing \a mode. Switching to NoQueue writes everything queued
+  so far right away.
+*/
+void SendQueue::setMode(Mode mode)
+{
+    mMode = mode;
+
+    if (mMode == NoQueue) {
+        foreach (QIODevice *device, mDevices.keys()) {
+            pump(device, true);
+        }
+    }
+}
+
+/*!
+  Queues \a data for \a device with \a priority and writes as much as the
+  device takes. \a expires is the deadline in milliseconds since epoch,
+  0 meaning never. If \a key is given, the message replaces the one with
+  the same key still in the queue. If \a delta is set, \a data is the
+  message without a frame and is sent as a delta if the device has delta
+  encoding, see setDeltaEncoding(). Returns the number of bytes written or
+  queued, or -1 if writing failed.
+*/
+qint64 SendQueue::write(QIODevice *device, const QByteArray &data, int priority, qint64 expires,
+                        const QString &key, bool delta)
+{
+    if (!device) {
+        return -1;
+    }
+
+    priority = qBound(int(LowPriority), priority, int(UrgentPriority));
+
+    if (delta && key.isEmpty()) {
+        return write(device, Common::toMessage(data), priority, expires);
+    }
+
+    if (mMode == NoQueue && key.isEmpty() && bytesQueued(device) == 0) {
+        qint64 written = device->write(data);
+
+        if (written >= 0) {
+            mStatistics[priority].sent++;
+        }
+
+        return written;
+    }
+
+    add(device);
+
+    if (!key.isEmpty() && conflate(device, data, priority, expires, key, delta)) {
+        pump(device);
+        return data.size();
+    }
+
+    Entry entry;
+    entry.data = data;
+    entry.queuedAt = mClock.elapsed();
+    entry.expires = expires;
+    entry.key = key;
+    entry.delta = delta;
+
+    Device &state = mDevices[device];
+    entry.sequence = state.nextSequence++;
+    state.queues[priority].enqueue(entry);
+    state.queued += data.size();
+    mStatistics[priority].queued++;
+
+    if (!key.isEmpty()) {
+        state.keys.insert(key, priority);
+    }
+
+    pump(device);
+    return data.size();
+}
+
+/*!
+  Drops everything queued for \a device, e.g. when it has been closed.
+*/
+void SendQueue::remove(QIODevice *device)
+{
+    if (!mDevices.contains(device)) {
+        return;
+    }
+
+    Device state = mDevices.take(device);
+
+    for (int i = 0; i < PriorityCount; ++i) {
+        mStatistics[i].queued -= state.queues[i].size();
+    }
+
+    device->disconnect(this);
+}
+
+/*!
+  Sets whether the messages with a key are sent to \a device as deltas.
+  Enabled once the peer has agreed on deltas in the handshake.
+*/
+void SendQueue::setDeltaEncoding(QIODevice *device, bool enabled)
+{
+    if (device) {
+        add(device).deltaEncoding = enabled;
+    }
+}
+
+/*!
+  Sends the next message with \a key to \a device as a snapshot, as the
+  peer has lost the previous one.
+*/
+void SendQueue::resync(QIODevice *device, const QString &key)
+{
+    if (mDevices.contains(device)) {
+        mDevices[device].encoder.resync(key);
+    }
+}
+
+/*!
+  Drops everything queued for all the devices.
+*/
+void SendQueue::clear()
+{
+    foreach (QIODevice *device, mDevices.keys()) {
+        remove(device);
+    }
+}
+
+/*!
+  Returns the number of bytes queued for \a device.
+*/
+qint64 SendQueue::bytesQueued(QIODevice *device) const
+{
+    return mDevices.contains(device) ? mDevices.value(device).queued : 0;
+}
+
+/*!
+  Returns the number of bytes queued for all the devices.
+*/
+qint64 SendQueue::bytesQueued() const
+{
+    qint64 bytes = 0;
+
+    foreach (const Device &state, mDevices) {
+        bytes += state.queued;
+    }
+
+    return bytes;
+}
+
+/*!
+  Returns the statistics of each priority class, lowest first.
+*/
+QList<SendQueue::Statistics> SendQueue::statistics() const
+{
+    return mStatistics;
+}
+
+/*!
+  Adds \a statistics, e.g. of another connection, to \a total.
+*/
+void SendQueue::addStatistics(QList<Statistics> &total, const QList<Statistics> &statistics)
+{
+    while (total.size() < statistics.size()) {
+        total.append(Statistics());
+    }
+
+    for (int i = 0; i < statistics.size(); ++i) {
+        const Statistics &add = statistics.at(i);
+        Statistics &sum = total[i];
+        sum.sent += add.sent;
+        sum.dropped += add.dropped;
+        sum.conflated += add.conflated;
+        sum.queued += add.queued;
+        sum.totalDelay += add.totalDelay;
+        sum.maxDelay = qMax(sum.maxDelay, add.maxDelay);
+    }
+}
+
+/*!
+  Returns \a statistics as a list of maps for QML, one per priority class
+  lowest first, with the keys \c priority, \c sent, \c dropped,
+  \c conflated, \c queued, \c averageDelay and \c maxDelay. The delays
+  are in milliseconds.
+*/
+QVariantList SendQueue::toVariantList(const QList<Statistics> &statistics)
+{
+    QVariantList list;
+
+    for (int i = 0; i < statistics.size(); ++i) {
+        const Statistics &stats = statistics.at(i);
+        QVariantMap map;
+        map.insert("priority", i);
+        map.insert("sent", stats.sent);
+        map.insert("dropped", stats.dropped);
+        map.insert("conflated", stats.conflated);
+        map.insert("queued", stats.queued);
+        map.insert("averageDelay", stats.sent > 0 ? qreal(stats.totalDelay) / stats.sent : 0.0);
+        map.insert("maxDelay", stats.maxDelay);
+        list.append(map);
+    }
+
+    return list;
+}
+
+/*!
+  Returns the state of \a device, added if it has none yet.
+*/
+SendQueue::Device &SendQueue::add(QIODevice *device)
+{
+    QHash<QIODevice*, Device>::iterator it = mDevices.find(device);
+
+    if (it != mDevices.end()) {
+        return *it;
+    }
+
+    Device state;
+
+    for (int i = 0; i < PriorityCount; ++i) {
+        state.deficits[i] = 0;
+    }
+
+    state.current = 0;
+    state.queued = 0;
+    state.nextSequence = 0;
+    state.deltaEncoding = false;
+
+    connect(device, SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten()));
+    return *mDevices.insert(device, state);
+}
+
+/*!
+  The device has written some of its buffer, there's room for more.
+*/
+void SendQueue::onBytesWritten()
+{
+    QIODevice *device = qobject_cast<QIODevice*>(sender());
+
+    if (device) {
+        pump(device);
+    }
+}
+
+/*!
+  Writes the queued messages to \a device in the order of the mode until
+  the socket buffer is above the watermark. If \a flush is set everything
+  is written.
+*/
+void SendQueue::pump(QIODevice *device, bool flush)
+{
+    if (!mDevices.contains(device)) {
+        return;
+    }
+
+    dropExpired(device);
+
+    while (flush || device->bytesToWrite() < Watermark) {
+        int priority = nextPriority(device);
+
+        if (priority < 0) {
+            break;
+        }
+
+        Device &state = mDevices[device];
+        Entry entry = state.queues[priority].dequeue();
+        state.queued -= entry.data.size();
+
+        if (!entry.key.isEmpty()) {
+            state.keys.remove(entry.key);
+        }
+
+        if (mMode == WeightedFair) {
+            state.deficits[priority] -= entry.data.size();
+        }
+
+        Statistics &stats = mStatistics[priority];
+        stats.queued--;
+
+        QByteArray frame = entry.data;
+
+        if (entry.delta) {
+            frame = state.deltaEncoding ? state.encoder.encode(entry.key, entry.data)
+                                        : Common::toMessage(entry.data);
+        }
+
+        if (device->write(frame) < 0) {
+            qDebug() << "SendQueue::pump(): Failed to write, message dropped";
+            stats.dropped++;
+            continue;
+        }
+
+        qint64 delay = mClock.elapsed() - entry.queuedAt;
+        stats.sent++;
+        stats.totalDelay += delay;
+        stats.maxDelay = qMax(stats.maxDelay, delay);
+    }
+}
+
+/*!
+  Returns the priority class of \a device that sends next, or -1 if
+  nothing is queued. With NoQueue the messages go in the order they were
+  queued, whatever their priority.
+*/
+int SendQueue::nextPriority(QIODevice *device)
+{
+    Device &state = mDevices[device];
+    int highest = -1;
+
+    if (mMode == NoQueue) {
+        int oldest = -1;
+
+        for (int priority = LowPriority; priority <= UrgentPriority; ++priority) {
+            const QQueue<Entry> &queue = state.queues[priority];
+
+            if (!queue.isEmpty() && (oldest < 0 || queue.head().sequence
+                                     < state.queues[oldest].head().sequence)) {
+                oldest = priority;
+            }
+        }
+
+        return oldest;
+    }
+
+    for (int priority = UrgentPriority; priority >= LowPriority && highest < 0; --priority) {
+        if (!state.queues[priority].isEmpty()) {
+            highest = priority;
+        }
+    }
+
+    if (highest < 0 || mMode != WeightedFair) {
+        return highest;
+    }
+
+    //Deficit round robin: a class sends while its head fits in the deficit,
+    //then the next class gets its quantum
+    forever {
+        QQueue<Entry> &queue = state.queues[state.current];
+
+        if (!queue.isEmpty() && queue.head().data.size() <= state.deficits[state.current]) {
+            return state.current;
+        }
+
+        if (queue.isEmpty()) {
+            state.deficits[state.current] = 0;
+        }
+
+        state.current = (state.current + 1) % PriorityCount;
+
+        if (!state.queues[state.current].isEmpty()) {
+            state.deficits[state.current] += Quantum * Weights[state.current];
+        }
+    }
+}
+
+/*!
+  Drops the queued messages of \a device past their deadline.
+*/
+void SendQueue::dropExpired(QIODevice *device)
+{
+    Device &state = mDevices[device];
+    qint64 now = 0;
+
+    for (int priority = 0; priority < PriorityCount; ++priority) {
+        QQueue<Entry> &queue = state.queues[priority];
+
+        for (int i = 0; i < queue.size(); ) {
+            const Entry &entry = queue.at(i);
+
+            if (entry.expires <= 0) {
+                ++i;
+                continue;
+            }
+
+            if (now == 0) {
+                now = QDateTime::currentMSecsSinceEpoch();
+            }
+
+            if (entry.expires > now) {
+                ++i;
+                continue;
+            }
+
+            if (!entry.key.isEmpty()) {
+                state.keys.remove(entry.key);
+            }
+
+            state.queued -= entry.data.size();
+            mStatistics[priority].queued--;
+            mStatistics[priority].dropped++;
+            queue.removeAt(i);
+        }
+    }
+}
+
+/*!
+  Replaces the message with \a key queued for \a device with \a data.
+  With the same \a priority the new message takes the place of the old
+  one, otherwise the old one is removed and false returned so that the
+  new one is queued as usual. Returns false also if nothing with \a key
+  is queued.
+*/
+bool SendQueue::conflate(QIODevice *device, const QByteArray &data, int priority,
+                         qint64 expires, const QString &key, bool delta)
+{
+    Device &state = mDevices[device];
+    QHash<QString, int>::iterator it = state.keys.find(key);
+
+    if (it == state.keys.end()) {
+        return false;
+    }
+
+    int queuedPriority = it.value();
+    QQueue<Entry> &queue = state.queues[queuedPriority];
+    mStatistics[queuedPriority].conflated++;
+
+    for (int i = 0; i < queue.size(); ++i) {
+        Entry &entry = queue[i];
+
+        if (entry.key != key) {
+            continue;
+        }
+
+        if (queuedPriority == priority) {
+            state.queued += data.size() - entry.data.size();
+            entry.data = data;
+            entry.queuedAt = mClock.elapsed();
+            entry.expires = expires;
+            entry.delta = delta;
+            return true;
+        }
+
+        state.queued -= entry.data.size();
+        mStatistics[queuedPriority].queued--;
+        queue.removeAt(i);
+        break;
+    }
+
+    state.keys.erase(it);
+    return false;
+}
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QString>
+#include <QVariantList>
+
+#include "deltacodec.h"
+
+class QIODevice;
+
+class SendQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Mode {
+        NoQueue = 0,
+        StrictPriority,
+        WeightedFair
+    };
+
+    enum Priority {
+        LowPriority = 0,
+        NormalPriority,
+        HighPriority,
+        UrgentPriority
+    };
+
+    struct Statistics {
+        Statistics() : sent(0), dropped(0), conflated(0), queued(0), totalDelay(0), maxDelay(0) {}
+
+        int sent;
+        int dropped; //Past the deadline before they could be sent
+        int conflated; //Replaced by a newer message with the same key before sent
+        int queued; //Waiting at the moment
+        qint64 totalDelay; //Milliseconds spent in the queue by the sent messages
+        qint64 maxDelay; //Milliseconds
+    };
+
+public:
+    explicit SendQueue(QObject *parent = 0);
+
+    Mode mode() const { return mMode; }
+    void setMode(Mode mode);
+
+    qint64 write(QIODevice *device, const QByteArray &data, int priority = NormalPriority,
+                 qint64 expires = 0, const QString &key = QString(), bool delta = false);
+    void remove(QIODevice *device);
+    void setDeltaEncoding(QIODevice *device, bool enabled);
+    void resync(QIODevice *device, const QString &key);
+    void clear();
+
+    qint64 bytesQueued(QIODevice *device) const;
+    qint64 bytesQueued() const;
+    QList<Statistics> statistics() const;
+
+    static void addStatistics(QList<Statistics> &total, const QList<Statistics> &statistics);
+    static QVariantList toVariantList(const QList<Statistics> &statistics);
+
+private slots:
+    void onBytesWritten();
+
+private:
+    struct Device;
+    Device &add(QIODevice *device);
+    void pump(QIODevice *device, bool flush = false);
+    int nextPriority(QIODevice *device);
+    void dropExpired(QIODevice *device);
+    bool conflate(QIODevice *device, const QByteArray &data, int priority, qint64 expires,
+                  const QString &key, bool delta);
+
+private: //Data
+    struct Entry {
+        QByteArray data;
+        qint64 queuedAt; //Milliseconds on mClock
+        qint64 expires; //Milliseconds since epoch, 0 means never
+        QString key; //Empty if the message can't be replaced
+        bool delta; //The data is the message itself, framed when written
+        quint64 sequence; //Order in which the messages were queued
+    };
+
+    enum { PriorityCount = UrgentPriority + 1 };
+
+    struct Device {
+        QQueue<Entry> queues[PriorityCount];
+        int deficits[PriorityCount]; //Bytes each class may still send in this round
+        int current; //Class served in this round
+        qint64 queued; //Bytes
+        quint64 nextSequence;
+        QHash<QString, int> keys; //Priority of the queued message with the key
+        bool deltaEncoding; //Whether the peer decodes deltas
+        DeltaCodec encoder;
+    };
+
+    QHash<QIODevice*, Device> mDevices; //Not owned
+    QList<Statistics> mStatistics; //By priority
+    QElapsedTimer mClock;
+    Mode mMode;
+};
+
+#endif // SENDQUEUE_H
@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "servercache.h"
+
+#include <QDebug>
+#include <QSettings>
+#include <QScopedPointer>
+
+//Constants
+const QString SettingsOrganization("ConnectivityPlugin");
+const QString SettingsApplication("servers");
+const QString ServersKey("servers");
+
+namespace
+{
+
+/*!
+  Returns the settings stored in \a fileName, or in the default user scope
+  location if \a fileName is empty. Caller takes the ownership.
+*/
+QSettings *openSettings(const QString &fileName)
+{
+    if (fileName.isEmpty()) {
+        return new QSettings(QSettings::IniFormat, QSettings::UserScope,
+                             SettingsOrganization, SettingsApplication);
+    }
+
+    return new QSettings(fileName, QSettings::IniFormat);
+}
+
+} //anonymous namespace
+
+/*!
+  \class ServerCache
+  \brief Keeps a small most recently used list of servers that were
+  connected to successfully. The list is stored in a local file so that
+  a client can connect to a known server without waiting for discovery.
+*/
+
+/*!
+  Constructor.
+*/
+ServerCache::ServerCache() :
+    mSize(1),
+    mLoaded(false)
+{
+}
+
+/*!
+  Sets the file to store the servers in to \a fileName. Empty \a fileName
+  uses the default location.
+*/
+void ServerCache::setFileName(const QString &fileName)
+{
+    if (mFileName != fileName) {
+        mFileName = fileName;
+        mServers.clear();
+        mLoaded = false;
+    }
+}
+
+/*!
+  Sets the maximum number of servers kept to \a size.
+*/
+void ServerCache::setSize(int size)
+{
+    mSize = qMax(0, size);
+
+    if (mLoaded && mServers.size() > mSize) {
+        mServers = mServers.mid(0, mSize);
+        save();
+    }
+}
+
+/*!
+  Returns the cached servers, the most recently used first.
+*/
+QList<NetworkServerInfo> ServerCache::servers()
+{
+    load();
+    return mServers.mid(0, mSize);
+}
+
+/*!
+  Moves \a server to the front of the list and stores the list.
+*/
+void ServerCache::add(const NetworkServerInfo &server)
+{
+    if (!server.isValid() || mSize == 0) {
+        return;
+    }
+
+    load();
+
+    if (!mServers.isEmpty() && mServers.first() == server) {
+        return;
+    }
+
+    mServers.removeAll(server);
+    mServers.prepend(server);
+    mServers = mServers.mid(0, mSize);
+
+    save();
+}
+
+/*!
+  Removes all the cached servers.
+*/
+void ServerCache::clear()
+{
+    mServers.clear();
+    mLoaded = true;
+    save();
+}
+
+/*!
+  Reads the servers from the file unless already read.
+  The servers are stored as separate fields so that reading them doesn't need
+  the blocking host lookups of \c NetworkServerInfo string parsing.
+*/
+void ServerCache::load()
+{
+    if (mLoaded) {
+        return;
+    }
+
+    mLoaded = true;
+    mServers.clear();
+
+    QScopedPointer<QSettings> settings(::openSettings(mFileName));
+    int count = settings->beginReadArray(ServersKey);
+
+    for (int i = 0; i < count; ++i) {
+        settings->setArrayIndex(i);
+        NetworkServerInfo server(settings->value("host").toString(),
+                                 QHostAddress(settings->value("address").toString()),
+                                 settings->value("port", -1).toInt());
+        if (server.isValid()) {
+            mServers.append(server);
+        }
+    }
+
+    settings->endArray();
+
+    qDebug() << "ServerCache::load(): Loaded" << mServers.size() << "servers from"
+             << settings->fileName();
+}
+
+/*!
+  Writes the servers to the file.
+*/
+void ServerCache::save() const
+{
+    QScopedPointer<QSettings> settings(::openSettings(mFileName));
+    settings->remove(ServersKey);
+    settings->beginWriteArray(ServersKey, mServers.size());
+
+    for (int i = 0; i < mServers.size(); ++i) {
+        settings->setArrayIndex(i);
+        settings->setValue("host", mServers.at(i).hostName());
+        settings->setValue("address", mServers.at(i).address().toString());
+        settings->setValue("port", mServers.at(i).port());
+    }
+
+    settings->endArray();
+    settings->sync();
+}
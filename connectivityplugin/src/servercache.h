@@ -0,0 +1,42 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef SERVERCACHE_H
+#define SERVERCACHE_H
+
+#include <QList>
+#include <QString>
+
+#include "networkserverinfo.h"
+
+class ServerCache
+{
+public:
+    ServerCache();
+
+    QString fileName() const { return mFileName; }
+    int size() const { return mSize; }
+
+    void setFileName(const QString &fileName);
+    void setSize(int size);
+
+    QList<NetworkServerInfo> servers();
+    void add(const NetworkServerInfo &server);
+    void clear();
+
+private:
+    void load();
+    void save() const;
+
+    QString mFileName; // Empty means the default user scope location
+    int mSize;
+    bool mLoaded;
+    QList<NetworkServerInfo> mServers; // Most recently used first
+};
+
+#endif // SERVERCACHE_H
@@ -0,0 +1,550 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "serverprotocol.h"
+
+#include <QDebug>
+#include <QIODevice>
+
+#include "common.h"
+
+/*!
+  \class ServerProtocol
+  \brief Reads and writes the frames of the clients of a server.
+
+  Keeps the protocol state of each client: the handshake, the send queue,
+  the channels, the deltas, the topics and the heartbeats. WlanServer and
+  BluetoothServer only accept and drop the connections, and hand over the
+  socket of each client as a QIODevice. The frames received from a client
+  are dispatched by receive(), forwarded to the other clients as the relay
+  router tells and emitted for the application.
+*/
+
+/*!
+  Constructor.
+*/
+ServerProtocol::ServerProtocol(QObject *parent) :
+    QObject(parent),
+    mHeartbeat(this),
+    mDecoder(this),
+    mQueue(this),
+    mMux(this)
+{
+    connect(&mHeartbeat, SIGNAL(timedOut(QIODevice*)),
+            this, SLOT(onHeartbeatTimeout(QIODevice*)));
+
+    connect(&mDecoder, SIGNAL(finished(int,QByteArray,QVariant)),
+            this, SLOT(onDecoded(int,QByteArray,QVariant)));
+}
+
+/*!
+  Returns the protocol settings agreed with the client \a clientId. The
+  handshake is invalid if the client hasn't sent a HELLO, i.e. it's an
+  older version.
+*/
+Handshake ServerProtocol::handshake(int clientId) const
+{
+    return mHandshakes.value(clientId);
+}
+
+/*!
+  Returns the number of bytes queued for the clients and not yet handed to
+  their sockets.
+*/
+qint64 ServerProtocol::bytesQueued() const
+{
+    return mMux.bytesQueued() + mQueue.bytesQueued();
+}
+
+/*!
+  Returns the statistics of the send queue per priority class.
+*/
+QList<SendQueue::Statistics> ServerProtocol::queueStatistics() const
+{
+    return mQueue.statistics();
+}
+
+/*!
+  Starts serving the client \a clientId connected through \a device.
+*/
+void ServerProtocol::addClient(int clientId, QIODevice *device)
+{
+    mClients.append(clientId);
+    mDevices.insert(clientId, device);
+    mClientIds.insert(device, clientId);
+}
+
+/*!
+  Forgets the disconnected client \a clientId. Its socket is left to the
+  server.
+*/
+void ServerProtocol::removeClient(int clientId)
+{
+    QIODevice *device = mDevices.take(clientId);
+
+    mClients.removeOne(clientId);
+    mClientIds.remove(device);
+    mHandshakes.remove(clientId);
+    mHeartbeat.remove(device);
+    mMux.remove(device);
+    mQueue.remove(device);
+    mDecoder.clear(clientId);
+    mDeltaDecoders.remove(clientId);
+    mTopics.removeClient(clientId);
+    Common::resetBuffer(device);
+}
+
+/*!
+  Forgets all the clients.
+*/
+void ServerProtocol::clear()
+{
+    mClients.clear();
+    mDevices.clear();
+    mClientIds.clear();
+    mHandshakes.clear();
+    mHeartbeat.clear();
+    mMux.clear();
+    mDeltaDecoders.clear();
+    mTopics = TopicIndex();
+    mQueue.clear();
+    mDecoder.clear();
+}
+
+/*!
+  Sends a heartbeat to a client after \a interval milliseconds without other
+  traffic and drops a client that hasn't sent anything in \a timeout
+  milliseconds. 0 \a interval disables the heartbeats.
+*/
+void ServerProtocol::setHeartbeat(int interval, int timeout)
+{
+    mHeartbeat.setInterval(interval);
+    mHeartbeat.setTimeout(timeout);
+}
+
+/*!
+  Sets the preset \a dictionary used for uncompressing the received messages.
+*/
+void ServerProtocol::setCompressionDictionary(const CompressionDictionary &dictionary)
+{
+    mDecoder.setDictionary(dictionary);
+}
+
+/*!
+  Sets the \a mode of the send queue, see SendQueue.
+*/
+void ServerProtocol::setQueueMode(int mode)
+{
+    mQueue.setMode(static_cast<SendQueue::Mode>(mode));
+}
+
+/*!
+  Sets the \a router deciding which clients the messages from a client are
+  forwarded to.
+*/
+void ServerProtocol::setRelayRouter(const RelayRouter &router)
+{
+    mRelayRouter = router;
+}
+
+/*!
+  Writes \a data to all the clients with \a priority. With a send queue
+  the message is queued and dropped if not sent by \a expires, in
+  milliseconds since epoch, 0 meaning never. A message with \a key
+  replaces the one with the same key still queued for the client, and
+  with \a delta is sent as a delta, see SendQueue::write(). Returns
+  the number of last bytes written or queued, or -1 if failed to write any data.
+*/
+qint64 ServerProtocol::write(const QByteArray &data, int priority, qint64 expires,
+                             const QString &key, bool delta)
+{
+    qint64 bytes = -1;
+
+    foreach (int clientId, mClients) {
+        QIODevice *device = mDevices.value(clientId);
+
+        if ((bytes = mQueue.write(device, data, priority, expires, key, delta)) < 0) {
+            return -1;
+        }
+
+        mHeartbeat.sent(device);
+    }
+
+    return bytes;
+}
+
+/*!
+  Writes \a data only to the client with \a clientId. Returns the number of
+  bytes written or -1 if the client wasn't found or writing failed.
+*/
+qint64 ServerProtocol::write(int clientId, const QByteArray &data)
+{
+    QIODevice *device = mDevices.value(clientId);
+
+    if (!device) {
+        qDebug() << "ServerProtocol::write(): No client with id" << clientId;
+        return -1;
+    }
+
+    mHeartbeat.sent(device);
+    return mQueue.write(device, data);
+}
+
+/*!
+  Writes \a message on \a channel to all the clients, compressed as a whole
+  if \a compressed is set. The message is queued and interleaved with the
+  other channels, see ChannelMux. Clients that don't support channels get
+  it as an ordinary message. Returns the size of \a message or -1 if
+  writing failed.
+*/
+qint64 ServerProtocol::write(const ChannelInfo &channel, const QByteArray &message,
+                             bool compressed)
+{
+    QByteArray plain;
+
+    foreach (int clientId, mClients) {
+        QIODevice *device = mDevices.value(clientId);
+        mHeartbeat.sent(device);
+
+        if (mMux.contains(device)) {
+            mMux.send(device, channel, message, compressed);
+            continue;
+        }
+
+        if (plain.isEmpty()) {
+            plain = compressed ? Common::toCompressedMessage(message) : Common::toMessage(message);
+        }
+
+        //Behind the messages already queued for the client
+        if (mQueue.write(device, plain) < 0) {
+            return -1;
+        }
+    }
+
+    return message.size();
+}
+
+/*!
+  Writes \a data, a message published on \a topic, to the clients
+  subscribed to \a topic other than \a fromClientId, see TopicIndex.
+  Returns the number of clients it was written to.
+*/
+int ServerProtocol::publish(const QByteArray &data, const QString &topic, int fromClientId)
+{
+    int clients = 0;
+
+    foreach (int clientId, mTopics.subscribers(topic)) {
+        if (clientId != fromClientId && write(clientId, data) >= 0) {
+            ++clients;
+        }
+    }
+
+    return clients;
+}
+
+/*!
+  Writes \a data, an object frame, to the clients that agreed on objects
+  in the handshake. Returns the number of last bytes written or -1 if
+  failed to write any data.
+*/
+qint64 ServerProtocol::writeObject(const QByteArray &data)
+{
+    qint64 bytes = 0;
+
+    foreach (int clientId, mClients) {
+        if (mHandshakes.value(clientId).hasFeature(Handshake::ObjectsFeature)
+            && (bytes = write(clientId, data)) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return bytes;
+}
+
+/*!
+  Reads the frames received from the client \a clientId, forwards them to
+  the other clients if relaying and emits the messages for the application.
+*/
+void ServerProtocol::receive(int clientId)
+{
+    QIODevice *device = mDevices.value(clientId);
+
+    if (!device) {
+        return;
+    }
+
+    mHeartbeat.received(device);
+
+    foreach (const Common::Frame &frame,
+             Common::readFrames(device, "ServerProtocol::receive():")) {
+        if (frame.control) {
+            QByteArray control = frame.message();
+
+            if (Handshake::isHello(control)) {
+                completeHandshake(clientId, control);
+            } else if (ChannelMux::isAnnouncement(control)) {
+                mMux.announced(device, control);
+            } else if (DeltaCodec::isResync(control)) {
+                mQueue.resync(device, DeltaCodec::resyncKey(control));
+            } else if (TopicIndex::isSubscribe(control)) {
+                mTopics.setSubscriptions(clientId, TopicIndex::fromSubscribe(control));
+            }
+
+            continue;
+        }
+
+        //Deltas are made against the messages the client sent to us, so
+        //they are decoded before being relayed
+        if (frame.delta) {
+            readDelta(clientId, frame);
+            continue;
+        }
+
+        //Calls are answered by whoever receives them, so they aren't relayed
+        if (frame.rpc) {
+            emit rpcRead(frame.payload(), clientId);
+            continue;
+        }
+
+        //Messages on topics go to the subscribed clients whatever the relay mode
+        if (!frame.topic.isEmpty()) {
+            QByteArray recompressed;
+
+            foreach (int target, mTopics.subscribers(frame.topic)) {
+                if (target != clientId) {
+                    forward(target, frame, &recompressed);
+                }
+            }
+
+            mDecoder.submit(clientId, frame.payload(),
+                            frame.compressed ? CompressionPool::Uncompress
+                                             : CompressionPool::Pass,
+                            QVariantList() << frame.topic);
+            continue;
+        }
+
+        //Channel ids are chosen by the sender, so fragments aren't relayed
+        if (frame.channel >= 0) {
+            QString channel;
+            QByteArray message;
+
+            if (mMux.receive(device, frame, &channel, &message)) {
+                mDecoder.submit(clientId, message,
+                                frame.compressed ? CompressionPool::Uncompress
+                                                 : CompressionPool::Pass, channel);
+            }
+
+            continue;
+        }
+
+        if (mRelayRouter.isEnabled()) {
+            relay(clientId, frame);
+
+            if (!mRelayRouter.localDelivery()) {
+                continue;
+            }
+        }
+
+        if (frame.object) {
+            //The route tells onDecoded() that the message is an object
+            mDecoder.submit(clientId, frame.payload(), CompressionPool::Pass, QVariant(true));
+        } else {
+            mDecoder.decode(clientId, frame);
+        }
+    }
+}
+
+/*!
+  Forwards \a frame, received from the client \a clientId, to the clients
+  the relay router chooses. Frames are forwarded as they were received,
+  without decoding, see forward().
+*/
+void ServerProtocol::relay(int clientId, const Common::Frame &frame)
+{
+    QByteArray recompressed;
+
+    foreach (int target, mRelayRouter.targets(clientId, mClients)) {
+        //Older clients would take an object for an ordinary message
+        if (frame.object && !mHandshakes.value(target).hasFeature(Handshake::ObjectsFeature)) {
+            continue;
+        }
+
+        forward(target, frame, &recompressed);
+    }
+}
+
+/*!
+  Writes \a frame, received from another client, to the client \a target.
+  A frame compressed with a preset dictionary the target didn't agree on
+  is recompressed with plain zlib, only once for all the targets into
+  \a recompressed. Returns false if the frame was not written.
+*/
+bool ServerProtocol::forward(int target, const Common::Frame &frame, QByteArray *recompressed)
+{
+    Handshake handshake = mHandshakes.value(target);
+    quint32 dictionaryId = frame.compressed
+        ? CompressionDictionary::dictionaryId(frame.payload()) : 0;
+    QByteArray data = frame.data;
+
+    if (dictionaryId != 0 && !handshake.hasCodec(Handshake::dictionaryCodec(dictionaryId))) {
+        if (recompressed->isEmpty()) {
+            *recompressed = recompress(frame);
+        }
+
+        if (recompressed->isEmpty()) {
+            qDebug() << "ServerProtocol::forward(): Unknown dictionary, not forwarded to"
+                     << target;
+            return false;
+        }
+
+        data = *recompressed;
+    }
+
+    //Nor may a frame be larger than the target agreed to accept. The
+    //recompressed frame has the same header, topic included, as the original.
+    if (data.size() - frame.offset > handshake.maxFrameSize()) {
+        return false;
+    }
+
+    return write(target, data) >= 0;
+}
+
+/*!
+  Returns \a frame, compressed with our preset dictionary, compressed with
+  plain zlib instead, or an empty array if the frame was compressed with
+  another dictionary.
+*/
+QByteArray ServerProtocol::recompress(const Common::Frame &frame) const
+{
+    QByteArray payload = frame.payload();
+    CompressionDictionary dictionary = mDecoder.dictionary();
+
+    if (dictionary.isEmpty()
+        || CompressionDictionary::dictionaryId(payload) != dictionary.id())
+    {
+        return QByteArray();
+    }
+
+    QByteArray message = dictionary.uncompress(payload);
+
+    if (message.isEmpty()) {
+        return QByteArray();
+    }
+
+    QByteArray compressed = qCompress(message);
+
+    if (!frame.topic.isEmpty()) {
+        return Common::toTopicMessage(frame.topic, compressed, true);
+    }
+
+    return Common::toCompressedMessage(compressed);
+}
+
+/*!
+  A client hasn't sent anything, not even heartbeats, in time and is
+  considered gone.
+*/
+void ServerProtocol::onHeartbeatTimeout(QIODevice *device)
+{
+    if (mClientIds.contains(device)) {
+        emit timedOut(mClientIds.value(device));
+    }
+}
+
+/*!
+  A message from the client \a clientId has been decoded. \a channel is the
+  name of the channel the message was sent on, if any.
+*/
+void ServerProtocol::onDecoded(int clientId, const QByteArray &message, const QVariant &channel)
+{
+    if (channel.type() == QVariant::Bool) {
+        emit objectRead(message, clientId);
+    } else if (channel.type() == QVariant::List) {
+        emit topicRead(channel.toList().value(0).toString(), message, clientId);
+    } else if (channel.isValid()) {
+        emit channelRead(channel.toString(), message, clientId);
+    } else {
+        emit read(message, clientId);
+    }
+}
+
+/*!
+  Agrees on the protocol settings with the client \a clientId that sent
+  the \a hello control message, and answers with our HELLO.
+*/
+void ServerProtocol::completeHandshake(int clientId, const QByteArray &hello)
+{
+    Handshake local = Handshake::local(mDecoder.dictionary(), mHeartbeat.interval() > 0);
+    Handshake agreed = local.agree(Handshake::fromControl(hello));
+
+    if (!agreed.isValid()) {
+        qDebug() << "ServerProtocol::completeHandshake(): Invalid HELLO from" << clientId;
+        return;
+    }
+
+    qDebug() << "ServerProtocol::completeHandshake(): Client" << clientId << agreed.toControl();
+    mHandshakes.insert(clientId, agreed);
+
+    QIODevice *device = mDevices.value(clientId);
+
+    if (agreed.hasFeature(Handshake::HeartbeatFeature)) {
+        mHeartbeat.add(device);
+    }
+
+    //Only a client that sent a HELLO understands ours
+    device->write(Common::toControlMessage(local.toControl()));
+    mHeartbeat.sent(device);
+
+    if (agreed.hasFeature(Handshake::ChannelsFeature)) {
+        mMux.add(device, agreed.maxFrameSize());
+    }
+
+    mQueue.setDeltaEncoding(device, agreed.hasFeature(Handshake::DeltaFeature));
+    emit handshakeCompleted(clientId, agreed.toVariantMap());
+}
+
+/*!
+  Decodes the delta \a frame received from the client \a clientId and
+  relays the message like the other messages. The message is sent on as
+  a delta against the previous one with the same key sent to each target.
+  If the message the delta was made against is missing, the client is
+  asked for a snapshot.
+*/
+void ServerProtocol::readDelta(int clientId, const Common::Frame &frame)
+{
+    QString key;
+    QByteArray message;
+
+    switch (mDeltaDecoders[clientId].decode(frame, &key, &message)) {
+    case DeltaCodec::Decoded:
+        if (mRelayRouter.isEnabled()) {
+            foreach (int target, mRelayRouter.targets(clientId, mClients)) {
+                QIODevice *device = mDevices.value(target);
+
+                if (message.size() <= mHandshakes.value(target).maxFrameSize()
+                    && mQueue.write(device, message, SendQueue::NormalPriority, 0, key, true) >= 0)
+                {
+                    mHeartbeat.sent(device);
+                }
+            }
+
+            if (!mRelayRouter.localDelivery()) {
+                break;
+            }
+        }
+
+        mDecoder.submit(clientId, message, CompressionPool::Pass, QVariant());
+        break;
+    case DeltaCodec::Gap:
+        mDevices.value(clientId)->write(Common::toControlMessage(DeltaCodec::toResync(key)));
+        break;
+    default:
+        break;
+    }
+}
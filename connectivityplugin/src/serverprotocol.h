@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef SERVERPROTOCOL_H
+#define SERVERPROTOCOL_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QVariant>
+
+#include "channelmux.h"
+#include "compressionpool.h"
+#include "deltacodec.h"
+#include "handshake.h"
+#include "heartbeat.h"
+#include "relayrouter.h"
+#include "sendqueue.h"
+#include "topicindex.h"
+
+//Forward declarations
+class QIODevice;
+
+class ServerProtocol : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ServerProtocol(QObject *parent = 0);
+
+    QList<int> clientIds() const { return mClients; }
+    Handshake handshake(int clientId) const;
+    qint64 bytesQueued() const;
+    QList<SendQueue::Statistics> queueStatistics() const;
+
+    void addClient(int clientId, QIODevice *device);
+    void removeClient(int clientId);
+    void clear();
+
+    void setHeartbeat(int interval, int timeout);
+    void setCompressionDictionary(const CompressionDictionary &dictionary);
+    void setQueueMode(int mode);
+    void setRelayRouter(const RelayRouter &router);
+
+    qint64 write(const QByteArray &data, int priority, qint64 expires,
+                 const QString &key = QString(), bool delta = false);
+    qint64 write(int clientId, const QByteArray &data);
+    qint64 write(const ChannelInfo &channel, const QByteArray &message, bool compressed);
+    int publish(const QByteArray &data, const QString &topic, int fromClientId = 0);
+    qint64 writeObject(const QByteArray &data);
+
+    void receive(int clientId);
+
+private slots:
+    void onHeartbeatTimeout(QIODevice *device);
+    void onDecoded(int clientId, const QByteArray &message, const QVariant &channel);
+
+private:
+    void completeHandshake(int clientId, const QByteArray &hello);
+    void readDelta(int clientId, const Common::Frame &frame);
+    void relay(int clientId, const Common::Frame &frame);
+    bool forward(int target, const Common::Frame &frame, QByteArray *recompressed);
+    QByteArray recompress(const Common::Frame &frame) const;
+
+signals:
+    void read(const QByteArray &data, int clientId);
+    void channelRead(const QString &channel, const QByteArray &data, int clientId);
+    void rpcRead(const QByteArray &data, int clientId);
+    void topicRead(const QString &topic, const QByteArray &data, int clientId);
+    void objectRead(const QByteArray &data, int clientId);
+    void handshakeCompleted(int clientId, const QVariantMap &protocol);
+    void timedOut(int clientId);
+
+private: //Data
+    QList<int> mClients; //In the order they were added
+    QHash<int, QIODevice*> mDevices; //Not owned
+    QHash<QIODevice*, int> mClientIds;
+    QHash<int, Handshake> mHandshakes; //Agreed with the clients that sent a HELLO
+    QHash<int, DeltaCodec> mDeltaDecoders;
+    Heartbeat mHeartbeat;
+    CompressionPool mDecoder;
+    SendQueue mQueue;
+    ChannelMux mMux;
+    RelayRouter mRelayRouter;
+    TopicIndex mTopics; //Subscriptions of the clients
+};
+
+#endif // SERVERPROTOCOL_H
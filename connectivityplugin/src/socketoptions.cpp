@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "socketoptions.h"
+
+#include <QAbstractSocket>
+#include <QDebug>
+
+#if defined(Q_OS_WIN)
+#include <winsock2.h>
+#elif defined(Q_OS_UNIX) && !defined(Q_OS_SYMBIAN)
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+//Constants
+const int BulkBufferSize(256 * 1024);
+const qint64 BulkReadBufferSize(1024 * 1024);
+
+namespace
+{
+
+/*!
+  Sets the kernel send buffer, or the receive buffer if \a send is false,
+  of \a descriptor to \a size bytes.
+*/
+void setBufferSize(int descriptor, bool send, int size)
+{
+#if defined(Q_OS_WIN) || (defined(Q_OS_UNIX) && !defined(Q_OS_SYMBIAN))
+    int option = send ? SO_SNDBUF : SO_RCVBUF;
+
+    if (::setsockopt(descriptor, SOL_SOCKET, option,
+                     reinterpret_cast<const char*>(&size), sizeof(size)) != 0) {
+        qDebug() << "SocketOptions::setBufferSize(): Failed to set"
+                 << (send ? "send" : "receive") << "buffer to" << size;
+    }
+#else
+    Q_UNUSED(descriptor);
+    Q_UNUSED(send);
+    Q_UNUSED(size);
+    qDebug() << "SocketOptions::setBufferSize(): Not supported on this platform";
+#endif
+}
+
+} //anonymous namespace
+
+/*!
+  \class SocketOptions
+  \brief Options applied to every socket the plugin creates.
+
+  \a SystemDefault leaves the sockets as Qt and the system set them up.
+  \a Interactive disables Nagle's algorithm so that small messages are sent
+  right away. \a Bulk keeps the batching and uses larger kernel buffers for
+  throughput. \a Custom is set up option by option.
+*/
+
+/*!
+  Constructor. Uses the options of \a profile.
+*/
+SocketOptions::SocketOptions(Profile profile)
+{
+    setProfile(profile);
+}
+
+/*!
+  Sets the options of \a profile. \a Custom keeps the current options.
+*/
+void SocketOptions::setProfile(Profile profile)
+{
+    mProfile = profile;
+
+    switch (profile) {
+    case SystemDefault:
+        mLowDelay = false;
+        mKeepAlive = false;
+        mSendBufferSize = 0;
+        mReceiveBufferSize = 0;
+        mReadBufferSize = 0;
+        break;
+    case Interactive:
+        mLowDelay = true;
+        mKeepAlive = true;
+        mSendBufferSize = 0;
+        mReceiveBufferSize = 0;
+        mReadBufferSize = 0;
+        break;
+    case Bulk:
+        mLowDelay = false;
+        mKeepAlive = true;
+        mSendBufferSize = BulkBufferSize;
+        mReceiveBufferSize = BulkBufferSize;
+        mReadBufferSize = BulkReadBufferSize;
+        break;
+    case Custom:
+        break;
+    }
+}
+
+void SocketOptions::setLowDelay(bool enabled)
+{
+    mProfile = Custom;
+    mLowDelay = enabled;
+}
+
+void SocketOptions::setKeepAlive(bool enabled)
+{
+    mProfile = Custom;
+    mKeepAlive = enabled;
+}
+
+void SocketOptions::setSendBufferSize(int size)
+{
+    mProfile = Custom;
+    mSendBufferSize = qMax(0, size);
+}
+
+void SocketOptions::setReceiveBufferSize(int size)
+{
+    mProfile = Custom;
+    mReceiveBufferSize = qMax(0, size);
+}
+
+void SocketOptions::setReadBufferSize(qint64 size)
+{
+    mProfile = Custom;
+    mReadBufferSize = qMax(qint64(0), size);
+}
+
+/*!
+  Returns the options as a map with keys \c lowDelay, \c keepAlive,
+  \c sendBufferSize, \c receiveBufferSize and \c readBufferSize.
+*/
+QVariantMap SocketOptions::toVariantMap() const
+{
+    QVariantMap options;
+    options.insert("lowDelay", mLowDelay);
+    options.insert("keepAlive", mKeepAlive);
+    options.insert("sendBufferSize", mSendBufferSize);
+    options.insert("receiveBufferSize", mReceiveBufferSize);
+    options.insert("readBufferSize", mReadBufferSize);
+    return options;
+}
+
+/*!
+  Sets the options found in \a options, see toVariantMap() for the keys.
+  The other options are left as they are.
+*/
+void SocketOptions::setVariantMap(const QVariantMap &options)
+{
+    if (options.contains("lowDelay")) {
+        setLowDelay(options.value("lowDelay").toBool());
+    }
+
+    if (options.contains("keepAlive")) {
+        setKeepAlive(options.value("keepAlive").toBool());
+    }
+
+    if (options.contains("sendBufferSize")) {
+        setSendBufferSize(options.value("sendBufferSize").toInt());
+    }
+
+    if (options.contains("receiveBufferSize")) {
+        setReceiveBufferSize(options.value("receiveBufferSize").toInt());
+    }
+
+    if (options.contains("readBufferSize")) {
+        setReadBufferSize(options.value("readBufferSize").toLongLong());
+    }
+}
+
+/*!
+  Applies the options to \a socket. Must be called after the socket has been
+  connected since the options need the native socket. \a SystemDefault
+  leaves the socket untouched.
+*/
+void SocketOptions::apply(QAbstractSocket *socket) const
+{
+    if (!socket || mProfile == SystemDefault) {
+        return;
+    }
+
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, mLowDelay ? 1 : 0);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, mKeepAlive ? 1 : 0);
+    socket->setReadBufferSize(mReadBufferSize);
+    applyToDescriptor(socket->socketDescriptor());
+}
+
+/*!
+  Applies the kernel buffer sizes to the native socket \a descriptor.
+  Used for sockets that don't have a QAbstractSocket interface.
+*/
+void SocketOptions::applyToDescriptor(int descriptor) const
+{
+    if (descriptor == -1 || mProfile == SystemDefault) {
+        return;
+    }
+
+    if (mSendBufferSize > 0) {
+        ::setBufferSize(descriptor, true, mSendBufferSize);
+    }
+
+    if (mReceiveBufferSize > 0) {
+        ::setBufferSize(descriptor, false, mReceiveBufferSize);
+    }
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef SOCKETOPTIONS_H
+#define SOCKETOPTIONS_H
+
+#include <QVariantMap>
+
+class QAbstractSocket;
+
+class SocketOptions
+{
+public:
+    enum Profile {
+        SystemDefault = 0,
+        Interactive,
+        Bulk,
+        Custom
+    };
+
+public:
+    explicit SocketOptions(Profile profile = SystemDefault);
+
+    Profile profile() const { return mProfile; }
+    bool lowDelay() const { return mLowDelay; }
+    bool keepAlive() const { return mKeepAlive; }
+    int sendBufferSize() const { return mSendBufferSize; }
+    int receiveBufferSize() const { return mReceiveBufferSize; }
+    qint64 readBufferSize() const { return mReadBufferSize; }
+
+    void setProfile(Profile profile);
+    void setLowDelay(bool enabled);
+    void setKeepAlive(bool enabled);
+    void setSendBufferSize(int size);
+    void setReceiveBufferSize(int size);
+    void setReadBufferSize(qint64 size);
+
+    QVariantMap toVariantMap() const;
+    void setVariantMap(const QVariantMap &options);
+
+    void apply(QAbstractSocket *socket) const;
+    void applyToDescriptor(int descriptor) const;
+
+private:
+    Profile mProfile;
+    bool mLowDelay; // Disables Nagle's algorithm
+    bool mKeepAlive;
+    int mSendBufferSize; // Bytes, 0 means the system default
+    int mReceiveBufferSize; // Bytes, 0 means the system default
+    qint64 mReadBufferSize; // Bytes, 0 means unlimited
+};
+
+#endif // SOCKETOPTIONS_H
@@ -0,0 +1,206 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#include "topicindex.h"
+
+//Constants
+const int MaxTopicSize(255); //Bytes of UTF-8
+const QChar Wildcard('*');
+const QByteArray SubscribeTag("SUBSCRIBE");
+
+/*!
+  \class TopicIndex
+  \brief Finds the clients subscribed to the topic of a published message.
+
+  A subscription is either a topic, e.g. \c scores/game1, matching only
+  that topic, or a prefix ending with \c *, e.g. \c scores/*, matching
+  every topic that starts with it. A lone \c * matches every topic.
+
+  Exact topics are looked up directly. Prefixes are looked up by cutting
+  the topic to the length of each prefix subscribed to, so that finding
+  the subscribers takes as many lookups as there are distinct prefix
+  lengths, however many clients and subscriptions there are.
+
+  Clients send the whole set of their subscriptions in a SUBSCRIBE control
+  message whenever it changes and after each handshake, so the server
+  needs no state to survive a reconnection.
+*/
+
+/*!
+  Constructor.
+*/
+TopicIndex::TopicIndex()
+{
+}
+
+/*!
+  Returns the subscriptions of \a clientId.
+*/
+QStringList TopicIndex::subscriptions(int clientId) const
+{
+    return mClients.value(clientId);
+}
+
+/*!
+  Replaces the subscriptions of \a clientId with \a subscriptions. The
+  invalid ones are ignored.
+*/
+void TopicIndex::setSubscriptions(int clientId, const QStringList &subscriptions)
+{
+    removeClient(clientId);
+
+    QStringList valid;
+
+    foreach (const QString &subscription, subscriptions) {
+        if (!isValidTopic(subscription) || valid.contains(subscription)) {
+            continue;
+        }
+
+        valid.append(subscription);
+        add(clientId, subscription);
+    }
+
+    if (!valid.isEmpty()) {
+        mClients.insert(clientId, valid);
+    }
+}
+
+/*!
+  Removes the subscriptions of \a clientId, e.g. when it disconnects.
+*/
+void TopicIndex::removeClient(int clientId)
+{
+    foreach (const QString &subscription, mClients.take(clientId)) {
+        remove(clientId, subscription);
+    }
+}
+
+/*!
+  Returns true if \a clientId is subscribed to \a topic.
+*/
+bool TopicIndex::isSubscribed(int clientId, const QString &topic) const
+{
+    return subscribers(topic).contains(clientId);
+}
+
+/*!
+  Returns the clients subscribed to \a topic.
+*/
+QList<int> TopicIndex::subscribers(const QString &topic) const
+{
+    QSet<int> clients = mTopics.value(topic);
+    QMap<int, int>::const_iterator it = mPrefixSizes.constBegin();
+
+    for (; it != mPrefixSizes.constEnd() && it.key() <= topic.size(); ++it) {
+        QHash<QString, QSet<int> >::const_iterator prefix =
+            mPrefixes.constFind(topic.left(it.key()));
+
+        if (prefix != mPrefixes.constEnd()) {
+            clients.unite(*prefix);
+        }
+    }
+
+    return clients.toList();
+}
+
+/*!
+  Returns true if \a topic can be published on or subscribed to: it is
+  not empty, fits in a frame and is a single line.
+*/
+bool TopicIndex::isValidTopic(const QString &topic)
+{
+    return !topic.isEmpty() && !topic.contains('\n') && topic.toUtf8().size() <= MaxTopicSize;
+}
+
+/*!
+  Returns the control message subscribing the sender to \a subscriptions,
+  replacing the ones it sent before.
+*/
+QByteArray TopicIndex::toSubscribe(const QStringList &subscriptions)
+{
+    QByteArray control = SubscribeTag;
+
+    foreach (const QString &subscription, subscriptions) {
+        control += '\n' + subscription.toUtf8();
+    }
+
+    return control;
+}
+
+/*!
+  Returns true if \a control carries the subscriptions of the sender.
+*/
+bool TopicIndex::isSubscribe(const QByteArray &control)
+{
+    return control == SubscribeTag || control.startsWith(SubscribeTag + '\n');
+}
+
+/*!
+  Returns the subscriptions carried by \a control.
+*/
+QStringList TopicIndex::fromSubscribe(const QByteArray &control)
+{
+    QStringList subscriptions;
+
+    foreach (const QByteArray &subscription, control.mid(SubscribeTag.size()).split('\n')) {
+        if (!subscription.isEmpty()) {
+            subscriptions.append(QString::fromUtf8(subscription));
+        }
+    }
+
+    return subscriptions;
+}
+
+/*!
+  Adds \a subscription of \a clientId to the lookup tables.
+*/
+void TopicIndex::add(int clientId, const QString &subscription)
+{
+    if (!subscription.endsWith(Wildcard)) {
+        mTopics[subscription].insert(clientId);
+        return;
+    }
+
+    QString prefix = subscription.left(subscription.size() - 1);
+    QSet<int> &clients = mPrefixes[prefix];
+
+    if (clients.isEmpty()) {
+        mPrefixSizes[prefix.size()]++;
+    }
+
+    clients.insert(clientId);
+}
+
+/*!
+  Removes \a subscription of \a clientId from the lookup tables.
+*/
+void TopicIndex::remove(int clientId, const QString &subscription)
+{
+    if (!subscription.endsWith(Wildcard)) {
+        QHash<QString, QSet<int> >::iterator it = mTopics.find(subscription);
+
+        if (it != mTopics.end() && it->remove(clientId) && it->isEmpty()) {
+            mTopics.erase(it);
+        }
+
+        return;
+    }
+
+    QString prefix = subscription.left(subscription.size() - 1);
+    QHash<QString, QSet<int> >::iterator it = mPrefixes.find(prefix);
+
+    if (it == mPrefixes.end() || !it->remove(clientId) || !it->isEmpty()) {
+        return;
+    }
+
+    mPrefixes.erase(it);
+
+    if (--mPrefixSizes[prefix.size()] <= 0) {
+        mPrefixSizes.remove(prefix.size());
+    }
+}
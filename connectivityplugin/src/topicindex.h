@@ -0,0 +1,49 @@
+/**
+ * Copyright (c) 2012-2014 Microsoft Mobile.
+ * All rights reserved.
+ *
+ * For the applicable distribution terms see the license text file included in
+ * the distribution.
+ */
+
+#ifndef TOPICINDEX_H
+#define TOPICINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+class TopicIndex
+{
+public:
+    TopicIndex();
+
+    bool isEmpty() const { return mClients.isEmpty(); }
+    QStringList subscriptions(int clientId) const;
+    void setSubscriptions(int clientId, const QStringList &subscriptions);
+    void removeClient(int clientId);
+
+    bool isSubscribed(int clientId, const QString &topic) const;
+    QList<int> subscribers(const QString &topic) const;
+
+    static bool isValidTopic(const QString &topic);
+    static QByteArray toSubscribe(const QStringList &subscriptions);
+    static bool isSubscribe(const QByteArray &control);
+    static QStringList fromSubscribe(const QByteArray &control);
+
+private:
+    void add(int clientId, const QString &subscription);
+    void remove(int clientId, const QString &subscription);
+
+private:
+    QHash<int, QStringList> mClients; //Subscriptions of each client
+    QHash<QString, QSet<int> > mTopics; //Exact topics to the clients subscribed to them
+    QHash<QString, QSet<int> > mPrefixes; //Prefixes, without the '*', to the clients
+    QMap<int, int> mPrefixSizes; //Lengths of the prefixes to how many there are of each
+};
+
+#endif // TOPICINDEX_H
@@ -16,12 +16,24 @@
 #include "common.h"
 
 //Constants
-const int NumberOfRetries(3);
-const int RetryInterval(500); //Milliseconds
+const int DefaultRaceStagger(250); //Milliseconds
+const int HelloTimeout(2000); //Milliseconds, an older server is admitted after it
 
 /*!
   \class WlanClient
-  \brief TODO
+  \brief Implements WLAN client that connects to a server.
+
+  The client can be given several candidate servers, for example the servers
+  found by discovery or all the addresses of a host. Connection attempts to
+  the candidates are started one after another, \c raceStagger milliseconds
+  apart, and the first one to connect is kept while the rest are cancelled.
+
+  With the handshake the client is connected only once the server has
+  admitted it by answering its HELLO. A server that is too busy sends BUSY
+  instead, which fails the attempt and is retried like a refused
+  connection. Older servers that don't answer are admitted with their
+  first message, or if they stay silent for a while. Without the
+  handshake the client is connected as soon as the socket is.
 */
 
 /*!
@@ -30,10 +42,33 @@ const int RetryInterval(500); //Milliseconds
 WlanClient::WlanClient(QObject *parent) :
     QObject(parent),
     mSocket(0),
-    mRetries(0),
+    mRetryTimer(this),
+    mStaggerTimer(this),
+    mHelloTimer(this),
+    mHeartbeat(this),
+    mDecoder(this),
+    mQueue(this),
+    mMux(this),
+    mRaceStagger(DefaultRaceStagger),
+    mNextServer(0),
+    mAttempts(0),
+    mRetry(true),
     mClientStarted(false),
+    mConnected(false),
+    mHello(false),
     mLastErrorString("")
 {
+    mRetryTimer.setSingleShot(true);
+    connect(&mRetryTimer, SIGNAL(timeout()), this, SLOT(connectToServer()));
+
+    mStaggerTimer.setSingleShot(true);
+    connect(&mStaggerTimer, SIGNAL(timeout()), this, SLOT(connectToNextServer()));
+
+    mHelloTimer.setSingleShot(true);
+    connect(&mHelloTimer, SIGNAL(timeout()), this, SLOT(onHelloTimeout()));
+
+    connect(&mHeartbeat, SIGNAL(timedOut(QIODevice*)), this, SLOT(onHeartbeatTimeout(QIODevice*)));
+    connect(&mDecoder, SIGNAL(finished(int,QByteArray,QVariant)), this, SLOT(onDecoded(int,QByteArray,QVariant)));
 }
 
 /*!
@@ -49,34 +84,113 @@ QString WlanClient::errorString() const
     return mLastErrorString;
 }
 
+/*!
+  Sets the \a policy used for retrying and reconnecting.
+*/
+void WlanClient::setReconnectPolicy(const ReconnectPolicy &policy)
+{
+    mPolicy = policy;
+}
+
+/*!
+  Sets the \a options applied to the connected socket.
+*/
+void WlanClient::setSocketOptions(const SocketOptions &options)
+{
+    mSocketOptions = options;
+
+    if (mSocket && mConnected) {
+        mSocketOptions.apply(mSocket);
+    }
+}
+
+/*!
+  Sends a heartbeat after \a interval milliseconds without other traffic and
+  drops the connection if nothing is received from the server in \a timeout
+  milliseconds. 0 \a interval disables the heartbeats.
+*/
+void WlanClient::setHeartbeat(int interval, int timeout)
+{
+    mHeartbeat.setInterval(interval);
+    mHeartbeat.setTimeout(timeout);
+}
+
+/*!
+  Sets whether a HELLO is sent to the server when connected to \a enabled.
+  Servers from before the handshake don't understand it.
+*/
+void WlanClient::setHandshake(bool enabled)
+{
+    mHello = enabled;
+}
+
+/*!
+  Sets the preset \a dictionary used for uncompressing the received messages.
+*/
+void WlanClient::setCompressionDictionary(const CompressionDictionary &dictionary)
+{
+    mDecoder.setDictionary(dictionary);
+}
+
+/*!
+  Sets the delay between starting connection attempts to the next candidate
+  server to \a stagger milliseconds.
+*/
+void WlanClient::setRaceStagger(int stagger)
+{
+    mRaceStagger = qMax(0, stagger);
+}
+
+/*!
+  Returns the server the client is connected to, or the first candidate if
+  not connected.
+*/
+NetworkServerInfo WlanClient::serverInfo() const
+{
+    return mServerInfo;
+}
+
 /*!
   Initializes the client and connects to server given in \a serverInfo.
 */
 void WlanClient::startClient(const NetworkServerInfo &serverInfo)
 {
-    if (mSocket || mRetries) {
+    startClient(QList<NetworkServerInfo>() << serverInfo);
+}
+
+/*!
+  Initializes the client and races connection attempts to \a servers in the
+  given order. The first server to accept the connection is used.
+  If \a retry is false the servers are tried only once and the reconnect
+  policy applies only after a connection has been established.
+*/
+void WlanClient::startClient(const QList<NetworkServerInfo> &servers, bool retry)
+{
+    if (mClientStarted) {
         qDebug() << "WlanClient::startClient(): Already running!";
         return;
     }
 
-    mServerInfo = serverInfo;
-    mRetries = NumberOfRetries;
+    if (servers.isEmpty()) {
+        qDebug() << "WlanClient::startClient(): No servers given!";
+        return;
+    }
+
+    mServers = servers;
+    mServerInfo = servers.first();
+    mAttempts = 0;
+    mRetry = retry;
     mClientStarted = true;
+    mConnected = false;
     mLastErrorString = "";
 
-    Common::resetBuffer();
-
-    qDebug() << "WlanClient::startClient(): Network address:" << mServerInfo.address().toString()
-             << "port:" << mServerInfo.port();
-
-
-    mSocket = new QTcpSocket(this);
-    connect(mSocket, SIGNAL(connected()), this, SLOT(onConnected()));
-    connect(mSocket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
-    connect(mSocket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
-    connect(mSocket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(onSocketError(QAbstractSocket::SocketError)));
+    foreach (NetworkServerInfo server, mServers) {
+        qDebug() << "WlanClient::startClient(): Network address:" << server.address().toString()
+                 << "port:" << server.port();
+    }
 
-    QTimer::singleShot(RetryInterval, this, SLOT(connectToServer()));
+    //Connecting is asynchronous so there's no need to delay the first attempt
+    mRetryTimer.start(0);
 }
 
 /*!
@@ -84,12 +198,25 @@ void WlanClient::startClient(const NetworkServerInfo &serverInfo)
 */
 void WlanClient::stopClient()
 {
+    mRetryTimer.stop();
+    mStaggerTimer.stop();
+    mHelloTimer.stop();
+    mClientStarted = false;
+
+    abortPending();
+
     if (mSocket) {
         qDebug() << "WlanClient::stopClient(): Disconnecting...";
+        mHeartbeat.remove(mSocket);
+        mMux.remove(mSocket);
+        mQueue.remove(mSocket);
+        mDecoder.clear();
+        mDeltaDecoder.clear();
         mSocket->disconnectFromHost();
+        Common::resetBuffer(mSocket);
         delete mSocket;
         mSocket = 0;
-        mClientStarted = false;
+        mConnected = false;
     } else {
         qDebug() << "WlanClient::stopClient(): Not connected!";
     }
@@ -101,7 +228,100 @@ void WlanClient::stopClient()
 */
 qint64 WlanClient::write(const QByteArray &data)
 {
-    return mSocket ? mSocket->write(data) : -1;
+    return write(data, SendQueue::NormalPriority, 0);
+}
+
+/*!
+  Writes \a data with \a priority. With a send queue the message is queued
+  and dropped if not sent by \a expires, in milliseconds since epoch, 0
+  meaning never. A message with \a key replaces the one with the same key
+  still queued, and with \a delta is sent as a delta to the previous one,
+  see SendQueue::write(). Returns the number of bytes written or queued, or
+  -1 if failed to write any data.
+*/
+qint64 WlanClient::write(const QByteArray &data, int priority, qint64 expires,
+                          const QString &key, bool delta)
+{
+    if (!mSocket) {
+        return -1;
+    }
+
+    mHeartbeat.sent(mSocket);
+    return mQueue.write(mSocket, data, priority, expires, key, delta);
+}
+
+/*!
+  Writes \a message on \a channel, compressed as a whole if \a compressed
+  is set. The message is queued and interleaved with the other channels,
+  see ChannelMux. A server that doesn't support channels gets it as an
+  ordinary message. Returns the size of \a message or -1 if not connected.
+*/
+qint64 WlanClient::write(const ChannelInfo &channel, const QByteArray &message, bool compressed)
+{
+    if (!mSocket) {
+        return -1;
+    }
+
+    mHeartbeat.sent(mSocket);
+
+    //Behind the messages already queued for the server
+    if (!mMux.contains(mSocket)) {
+        return mQueue.write(mSocket, compressed ? Common::toCompressedMessage(message)
+                                                : Common::toMessage(message));
+    }
+
+    mMux.send(mSocket, channel, message, compressed);
+    return message.size();
+}
+
+/*!
+  Returns the number of bytes waiting to be written to the server,
+  including the messages queued on channels.
+*/
+qint64 WlanClient::bytesToWrite() const
+{
+    return mSocket ? mSocket->bytesToWrite() + mMux.bytesQueued(mSocket)
+                     + mQueue.bytesQueued(mSocket) : 0;
+}
+
+/*!
+  Sets the \a mode of the send queue, see SendQueue.
+*/
+void WlanClient::setQueueMode(int mode)
+{
+    mQueue.setMode(static_cast<SendQueue::Mode>(mode));
+}
+
+/*!
+  Subscribes to the messages published on \a subscriptions, replacing the
+  earlier ones, see TopicIndex. They are sent to the server if it supports
+  topics, now and after each reconnection.
+*/
+void WlanClient::setSubscriptions(const QStringList &subscriptions)
+{
+    mSubscriptions = subscriptions;
+
+    if (mSocket && mHandshake.hasFeature(Handshake::TopicsFeature)) {
+        write(Common::toControlMessage(TopicIndex::toSubscribe(mSubscriptions)));
+    }
+}
+
+/*!
+  Returns the statistics of the send queue per priority class.
+*/
+QList<SendQueue::Statistics> WlanClient::queueStatistics() const
+{
+    return mQueue.statistics();
+}
+
+/*!
+  Returns the protocol settings agreed with the server. The handshake is
+  invalid until the server has sent a HELLO, and stays invalid with older
+  servers.
+*/
+Handshake WlanClient::handshake() const
+{
+    return mHandshake;
 }
 
 bool WlanClient::clientStarted() const
@@ -109,6 +329,11 @@ bool WlanClient::clientStarted() const
     return mClientStarted;
 }
 
+bool WlanClient::isConnected() const
+{
+    return mConnected;
+}
+
 /*!
   Reads the data sent by the server.
 */
@@ -121,62 +346,479 @@ void WlanClient::onReadyRead()
 
     qDebug() << "WlanClient::onReadyRead(): =>";
 
-    Common::readFromSocket(mSocket, this, "read", "WlanClient::onReadyRead():");
+    mHeartbeat.received(mSocket);
+
+    foreach (const Common::Frame &frame,
+             Common::readFrames(mSocket, "WlanClient::onReadyRead():")) {
+        if (frame.control) {
+            QList<QByteArray> fields = frame.message().split(' ');
+
+            if (fields.first() == "BUSY") {
+                serverBusy(fields.value(1).toInt());
+                break;
+            }
+        }
+
+        if (!mConnected) {
+            admitted();
+        }
+
+        if (frame.control) {
+            if (Handshake::isHello(frame.message())) {
+                completeHandshake(frame.message());
+            } else if (ChannelMux::isAnnouncement(frame.message())) {
+                mMux.announced(mSocket, frame.message());
+            } else if (DeltaCodec::isResync(frame.message())) {
+                mQueue.resync(mSocket, DeltaCodec::resyncKey(frame.message()));
+            }
+
+            continue;
+        }
+
+        if (frame.delta) {
+            readDelta(frame);
+            continue;
+        }
+
+        if (frame.rpc) {
+            emit rpcRead(frame.payload());
+            continue;
+        }
+
+        if (!frame.topic.isEmpty()) {
+            mDecoder.submit(0, frame.payload(), frame.compressed ? CompressionPool::Uncompress
+                                                                 : CompressionPool::Pass,
+                            QVariantList() << frame.topic);
+            continue;
+        }
+
+        if (frame.channel >= 0) {
+            QString channel;
+            QByteArray message;
+
+            if (mMux.receive(mSocket, frame, &channel, &message)) {
+                mDecoder.submit(0, message, frame.compressed ? CompressionPool::Uncompress
+                                                             : CompressionPool::Pass, channel);
+            }
+
+            continue;
+        }
+
+        if (frame.object) {
+            //The route tells onDecoded() that the message is an object
+            mDecoder.submit(0, frame.payload(), CompressionPool::Pass, QVariant(true));
+            continue;
+        }
+
+        mDecoder.decode(0, frame);
+    }
 
     qDebug() << "WlanClient::onReadyRead(): <=";
 }
 
 /*!
-  This slot is called after a connection has been established succesfully.
+  The server turned the connection away because it is busy and asked us to
+  wait \a delay milliseconds before trying again. The wait is honoured even
+  if the policy would retry sooner.
+*/
+void WlanClient::serverBusy(int delay)
+{
+    qDebug() << "WlanClient::serverBusy(): Server is busy, retry after"
+             << delay << "ms";
+
+    mHelloTimer.stop();
+    mHeartbeat.remove(mSocket);
+    mMux.remove(mSocket);
+    mQueue.remove(mSocket);
+    mDecoder.clear();
+    mDeltaDecoder.clear();
+    mSocket->disconnect(this);
+    mSocket->abort();
+    mSocket->deleteLater();
+    Common::resetBuffer(mSocket);
+    mSocket = 0;
+
+    bool wasConnected = mConnected;
+    mConnected = false;
+
+    if (mClientStarted && canRetry()) {
+        scheduleRetry(delay);
+    } else if (wasConnected) {
+        emit disconnectedFromServer();
+    } else {
+        mLastErrorString = "Server is busy";
+        emit socketError((int) QAbstractSocket::ConnectionRefusedError);
+    }
+}
+
+/*!
+  Agrees on the protocol settings with the server that sent the \a hello
+  control message.
+*/
+void WlanClient::completeHandshake(const QByteArray &hello)
+{
+    Handshake local = Handshake::local(mDecoder.dictionary(), mHeartbeat.interval() > 0);
+    Handshake agreed = local.agree(Handshake::fromControl(hello));
+
+    if (!agreed.isValid()) {
+        qDebug() << "WlanClient::completeHandshake(): Invalid HELLO";
+        return;
+    }
+
+    qDebug() << "WlanClient::completeHandshake():" << agreed.toControl();
+    mHandshake = agreed;
+
+    if (mHandshake.hasFeature(Handshake::HeartbeatFeature)) {
+        mHeartbeat.add(mSocket);
+    }
+
+    if (mHandshake.hasFeature(Handshake::ChannelsFeature)) {
+        mMux.add(mSocket, mHandshake.maxFrameSize());
+    }
+
+    mQueue.setDeltaEncoding(mSocket, mHandshake.hasFeature(Handshake::DeltaFeature));
+
+    if (mHandshake.hasFeature(Handshake::TopicsFeature) && !mSubscriptions.isEmpty()) {
+        write(Common::toControlMessage(TopicIndex::toSubscribe(mSubscriptions)));
+    }
+
+    emit handshakeCompleted(mHandshake.toVariantMap());
+}
+
+/*!
+  Decodes the delta \a frame received from the server. If the message it
+  was made against is missing, the server is asked for a snapshot.
+*/
+void WlanClient::readDelta(const Common::Frame &frame)
+{
+    QString key;
+    QByteArray message;
+
+    switch (mDeltaDecoder.decode(frame, &key, &message)) {
+    case DeltaCodec::Decoded:
+        mDecoder.submit(0, message, CompressionPool::Pass, QVariant());
+        break;
+    case DeltaCodec::Gap:
+        write(Common::toControlMessage(DeltaCodec::toResync(key)));
+        break;
+    default:
+        break;
+    }
+}
+
+/*!
+  This slot is called after one of the pending connection attempts has been
+  established succesfully. The other attempts are cancelled.
 */
 void WlanClient::onConnected()
 {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+
+    if (!socket || !mPendingSockets.contains(socket)) {
+        return;
+    }
+
+    mServerInfo = mPendingServers.value(socket);
+    mPendingSockets.removeOne(socket);
+    mPendingServers.remove(socket);
+
+    mStaggerTimer.stop();
+    abortPending();
+
     qDebug() << "WlanClient::onConnected(): Connected to"
              << mServerInfo.hostName() << "at"
              << (mServerInfo.address().toString() + ":" + QString::number(mServerInfo.port()));
-    mRetries = 0;
+
+    mSocket = socket;
+    mSocketOptions.apply(mSocket);
+    connect(mSocket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+    connect(mSocket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+
+    mHandshake = Handshake();
+
+    if (mHello) {
+        Handshake hello = Handshake::local(mDecoder.dictionary(), mHeartbeat.interval() > 0);
+        write(Common::toControlMessage(hello.toControl()));
+    }
+
+    //The winner is tried first when reconnecting
+    mServers.removeAll(mServerInfo);
+    mServers.prepend(mServerInfo);
+
+    //Without a HELLO there's no answer to wait for. A busy server still
+    //turns us away, like it would drop an established connection.
+    if (!mHello) {
+        admitted();
+        return;
+    }
+
+    //Connected once the server admits us
+    mHelloTimer.start(HelloTimeout);
+}
+
+/*!
+  The server has admitted the connection, by sending its HELLO or any
+  other message. Only now the client is connected.
+*/
+void WlanClient::admitted()
+{
+    mHelloTimer.stop();
+
+    if (!mSocket || mConnected) {
+        return;
+    }
+
+    qDebug() << "WlanClient::admitted(): Admitted by" << mServerInfo.hostName();
+
+    mAttempts = 0;
+    mRetry = true;
+    mConnected = true;
     emit connectedToServer(mSocket->peerName());
 }
 
+/*!
+  The server hasn't sent a HELLO in time. It's an older version that
+  doesn't send one, so the connection is taken as admitted.
+*/
+void WlanClient::onHelloTimeout()
+{
+    qDebug() << "WlanClient::onHelloTimeout(): No HELLO, an older server";
+    admitted();
+}
+
 
 /*!
-  Disconnected from the server.
+  Disconnected from the server. If the policy allows it we'll reconnect to the
+  same server by ourselves.
 */
 void WlanClient::onDisconnected()
 {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+
+    if (!socket || socket != mSocket) {
+        return;
+    }
+
     qDebug() << "WlanClient::onDisconnected():" << mSocket->state();
+    connectionLost();
+}
 
-    if (!mRetries) {
+/*!
+  The server hasn't sent anything, not even heartbeats, in time. The
+  connection is considered lost.
+*/
+void WlanClient::onHeartbeatTimeout(QIODevice *device)
+{
+    if (!mSocket || device != mSocket) {
+        return;
+    }
+
+    qDebug() << "WlanClient::onHeartbeatTimeout(): Server is not responding";
+
+    mSocket->blockSignals(true);
+    mSocket->abort();
+    mSocket->blockSignals(false);
+
+    connectionLost();
+}
+
+/*!
+  A message from the server has been decoded. \a channel is the name of the
+  channel the message was sent on, if any.
+*/
+void WlanClient::onDecoded(int stream, const QByteArray &message, const QVariant &channel)
+{
+    Q_UNUSED(stream);
+
+    if (channel.type() == QVariant::Bool) {
+        emit objectRead(message);
+    } else if (channel.type() == QVariant::List) {
+        emit topicRead(channel.toList().value(0).toString(), message);
+    } else if (channel.isValid()) {
+        emit channelRead(channel.toString(), message);
+    } else {
+        emit read(message);
+    }
+}
+
+/*!
+  Handles the lost connection to the server.
+*/
+void WlanClient::connectionLost()
+{
+    mHelloTimer.stop();
+    mHeartbeat.remove(mSocket);
+    mMux.remove(mSocket);
+    mQueue.remove(mSocket);
+    mDeltaDecoder.clear();
+
+    bool wasConnected = mConnected;
+    mConnected = false;
+
+    //Lost before the server admitted it, the attempt failed
+    if (!wasConnected && mClientStarted) {
+        mSocket->disconnect(this);
+        mSocket->deleteLater();
+        Common::resetBuffer(mSocket);
+        mSocket = 0;
+
+        if (canRetry()) {
+            scheduleRetry();
+        } else {
+            emit socketError((int) QAbstractSocket::RemoteHostClosedError);
+        }
+
+        return;
+    }
+
+    if (wasConnected && mClientStarted && mPolicy.autoReconnect() && canRetry())
+    {
+        mSocket->disconnect(this);
+        mSocket->deleteLater();
+        Common::resetBuffer(mSocket);
+        mSocket = 0;
+
+        scheduleRetry();
+        return;
+    }
+
+    if (!mRetryTimer.isActive()) {
         emit disconnectedFromServer();
     }
 }
 
 /*!
-  Trying to connect to a server.
+  Starts a new round of connection attempts to the candidate servers.
 */
 void WlanClient::connectToServer()
 {
-    qDebug() << "WlanClient::connectToServer(): Trying to connect to server"
-             << mServerInfo.hostName() << "at"
-             << (mServerInfo.address().toString() + ":" + QString::number(mServerInfo.port()));
-    mSocket->connectToHost(mServerInfo.address(), mServerInfo.port());
+    if (!mClientStarted || mSocket) {
+        return;
+    }
+
+    abortPending();
+
+    mNextServer = 0;
+    connectToNextServer();
 }
 
 /*!
-  On error we'll try reconnecting while we have retries left.
+  Starts a connection attempt to the next candidate server and schedules
+  the one after it.
+*/
+void WlanClient::connectToNextServer()
+{
+    if (!mClientStarted || mSocket || mNextServer >= mServers.size()) {
+        return;
+    }
+
+    NetworkServerInfo server = mServers.at(mNextServer++);
+
+    qDebug() << "WlanClient::connectToNextServer(): Trying to connect to server"
+             << server.hostName() << "at"
+             << (server.address().toString() + ":" + QString::number(server.port()));
+
+    QTcpSocket *socket = new QTcpSocket(this);
+    connect(socket, SIGNAL(connected()), this, SLOT(onConnected()));
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(onSocketError(QAbstractSocket::SocketError)));
+
+    mPendingSockets.append(socket);
+    mPendingServers.insert(socket, server);
+
+    if (mNextServer < mServers.size()) {
+        mStaggerTimer.start(mRaceStagger);
+    }
+
+    socket->connectToHost(server.address(), server.port());
+}
+
+/*!
+  On error of the established connection the error is reported. If a pending
+  attempt fails the next candidate is tried right away and, once all of them
+  have failed, we'll retry while the policy allows it.
 */
 void WlanClient::onSocketError(QAbstractSocket::SocketError error)
 {
     qDebug() << "WlanClient::onSocketError():" << error;
 
-    if (mRetries > 0) {
-        --mRetries;
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+
+    if (!socket) {
+        return;
+    }
+
+    mLastErrorString = socket->errorString();
+
+    if (socket == mSocket) {
+        //A dropped connection is handled in onDisconnected(), as is one
+        //lost before the server admitted it
+        if (mConnected && !mPolicy.autoReconnect()) {
+            emit socketError((int) error);
+        }
+        return;
+    }
+
+    if (!mPendingSockets.removeOne(socket)) {
+        return;
+    }
 
-        qDebug() << "WlanClient::onSocketError(): Will try" << mRetries
-                 << "more time(s).";
-        QTimer::singleShot(RetryInterval, this, SLOT(connectToServer()));
+    mPendingServers.remove(socket);
+    socket->disconnect(this);
+    socket->deleteLater();
+
+    if (mNextServer < mServers.size()) {
+        mStaggerTimer.stop();
+        connectToNextServer();
+        return;
+    }
+
+    if (!mPendingSockets.isEmpty() || mRetryTimer.isActive()) {
+        return;
+    }
+
+    if (canRetry()) {
+        scheduleRetry();
     } else {
-        mLastErrorString = mSocket->errorString();
         emit socketError((int) error);
     }
 }
+
+/*!
+  Returns true if the policy allows one more connection attempt.
+*/
+bool WlanClient::canRetry() const
+{
+    return mRetry && mPolicy.canRetry(mAttempts);
+}
+
+/*!
+  Schedules the next connection attempt according to the reconnect policy,
+  but not sooner than \a minDelay milliseconds.
+*/
+void WlanClient::scheduleRetry(int minDelay)
+{
+    int delay = qMax(minDelay, mPolicy.delay(mAttempts));
+    ++mAttempts;
+
+    qDebug() << "WlanClient::scheduleRetry(): Attempt" << mAttempts
+             << "in" << delay << "ms";
+
+    mRetryTimer.start(delay);
+    emit reconnecting(mAttempts, delay);
+}
+
+/*!
+  Cancels the connection attempts still in progress.
+*/
+void WlanClient::abortPending()
+{
+    foreach (QTcpSocket *socket, mPendingSockets) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+    }
+
+    mPendingSockets.clear();
+    mPendingServers.clear();
+}
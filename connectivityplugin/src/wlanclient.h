@@ -11,8 +11,20 @@
 
 #include <QObject>
 #include <QAbstractSocket>
+#include <QHash>
+#include <QList>
+#include <QTimer>
 
+#include "channelmux.h"
+#include "compressionpool.h"
+#include "deltacodec.h"
+#include "handshake.h"
+#include "heartbeat.h"
 #include "networkserverinfo.h"
+#include "reconnectpolicy.h"
+#include "sendqueue.h"
+#include "socketoptions.h"
+#include "topicindex.h"
 
 class QTcpSocket;
 
@@ -24,31 +36,88 @@ public:
     ~WlanClient();
 
     QString errorString() const;
-    
+    qint64 bytesToWrite() const;
+    Handshake handshake() const;
+    QList<SendQueue::Statistics> queueStatistics() const;
+    void setReconnectPolicy(const ReconnectPolicy &policy);
+    void setRaceStagger(int stagger);
+    void setSocketOptions(const SocketOptions &options);
+    void setHeartbeat(int interval, int timeout);
+    void setHandshake(bool enabled);
+    void setCompressionDictionary(const CompressionDictionary &dictionary);
+    void setQueueMode(int mode);
+    void setSubscriptions(const QStringList &subscriptions);
+    NetworkServerInfo serverInfo() const;
+
 public slots:
     void startClient(const NetworkServerInfo &serverInfo);
+    void startClient(const QList<NetworkServerInfo> &servers, bool retry = true);
     void stopClient();
     qint64 write(const QByteArray &data);
+    qint64 write(const QByteArray &data, int priority, qint64 expires,
+                 const QString &key = QString(), bool delta = false);
+    qint64 write(const ChannelInfo &channel, const QByteArray &message, bool compressed);
     bool clientStarted() const;
+    bool isConnected() const;
 
 private slots:
     void onReadyRead();
     void onConnected();
     void onDisconnected();
     void connectToServer();
+    void connectToNextServer();
     void onSocketError(QAbstractSocket::SocketError error);
+    void onHeartbeatTimeout(QIODevice *device);
+    void onHelloTimeout();
+    void onDecoded(int stream, const QByteArray &message, const QVariant &channel);
+
+private:
+    void admitted();
+    void connectionLost();
+    void serverBusy(int delay);
+    void completeHandshake(const QByteArray &hello);
+    void readDelta(const Common::Frame &frame);
+    bool canRetry() const;
+    void scheduleRetry(int minDelay = 0);
+    void abortPending();
 
 signals:
     void read(const QByteArray &data);
+    void channelRead(const QString &channel, const QByteArray &data);
+    void rpcRead(const QByteArray &data);
+    void topicRead(const QString &topic, const QByteArray &data);
+    void objectRead(const QByteArray &data);
     void connectedToServer(const QString &name);
     void disconnectedFromServer();
     void socketError(int error);
+    void reconnecting(int attempt, int delay);
+    void handshakeCompleted(const QVariantMap &protocol);
 
 private: //Data
     QTcpSocket *mSocket; //Owned
+    QList<QTcpSocket*> mPendingSockets; //Owned
+    QHash<QTcpSocket*, NetworkServerInfo> mPendingServers;
+    QList<NetworkServerInfo> mServers;
     NetworkServerInfo mServerInfo;
-    int mRetries;
+    ReconnectPolicy mPolicy;
+    SocketOptions mSocketOptions;
+    Handshake mHandshake; //Agreed with the server, invalid until it sends a HELLO
+    QTimer mRetryTimer;
+    QTimer mStaggerTimer;
+    QTimer mHelloTimer; //Older servers never send a HELLO
+    Heartbeat mHeartbeat;
+    CompressionPool mDecoder;
+    SendQueue mQueue;
+    ChannelMux mMux;
+    DeltaCodec mDeltaDecoder;
+    QStringList mSubscriptions; //Sent to the server after each handshake
+    int mRaceStagger; //Milliseconds
+    int mNextServer;
+    int mAttempts;
+    bool mRetry;
     bool mClientStarted;
+    bool mConnected;
+    bool mHello; //Send a HELLO when connected
     QString mLastErrorString;
 };
 
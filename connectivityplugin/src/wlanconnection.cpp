@@ -12,8 +12,10 @@
 #include "wlanserver.h"
 #include "wlandiscoverymgr.h"
 #include "wlannetworkmgr.h"
+#include "sendqueue.h"
 
 #include <QDebug>
+#include <QMetaObject>
 
 /*!
   \class WlanConnection
@@ -27,6 +29,10 @@ WlanConnection::WlanConnection(QObject *parent)
     : ConnectionIf(parent),
       mServerPort(13001),
       mBroadcastPort(13002),
+      mRaceCount(1),
+      mRaceStagger(250),
+      mFastReconnect(false),
+      mFastConnecting(false),
       mServer(0),
       mClient(0),
       mDiscoveryMgr(0)
@@ -50,8 +56,9 @@ WlanConnection::~WlanConnection()
 {
     disconnect();
 
+    //The network manager stays in the application thread even if we don't
     WlanNetworkMgr& mgr = Network::networkManager();
-    mgr.disconnect();
+    QMetaObject::invokeMethod(&mgr, "disconnect");
 }
 
 
@@ -107,6 +114,36 @@ int WlanConnection::broadcastPort() const
     return mBroadcastPort;
 }
 
+int WlanConnection::raceCount() const
+{
+    return mRaceCount;
+}
+
+int WlanConnection::raceStagger() const
+{
+    return mRaceStagger;
+}
+
+bool WlanConnection::fastReconnect() const
+{
+    return mFastReconnect;
+}
+
+int WlanConnection::serverCacheSize() const
+{
+    return mServerCache.size();
+}
+
+QString WlanConnection::serverCacheFile() const
+{
+    return mServerCache.fileName();
+}
+
+AdmissionControl WlanConnection::admissionControl() const
+{
+    return mAdmission;
+}
+
 void WlanConnection::setMaxConnections(int max)
 {
     ConnectionIf::setMaxConnections(max);
@@ -117,6 +154,177 @@ void WlanConnection::setMaxConnections(int max)
     }
 }
 
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setDuplicatePolicy(DuplicatePolicy policy)
+{
+    ConnectionIf::setDuplicatePolicy(policy);
+
+    if (mServer) {
+        mServer->setDuplicatePolicy(policy);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setReconnectPolicy(const ReconnectPolicy &policy)
+{
+    ConnectionIf::setReconnectPolicy(policy);
+
+    if (mClient) {
+        mClient->setReconnectPolicy(policy);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setHeartbeat(int interval, int timeout)
+{
+    ConnectionIf::setHeartbeat(interval, timeout);
+
+    if (mServer) {
+        mServer->setHeartbeat(interval, timeout);
+    }
+
+    if (mClient) {
+        mClient->setHeartbeat(interval, timeout);
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        client->setHeartbeat(interval, timeout);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setHandshake(bool enabled)
+{
+    ConnectionIf::setHandshake(enabled);
+
+    if (mClient) {
+        mClient->setHandshake(enabled);
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        client->setHandshake(enabled);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setCompressionDictionary(const CompressionDictionary &dictionary)
+{
+    ConnectionIf::setCompressionDictionary(dictionary);
+
+    if (mServer) {
+        mServer->setCompressionDictionary(dictionary);
+    }
+
+    if (mClient) {
+        mClient->setCompressionDictionary(dictionary);
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        client->setCompressionDictionary(dictionary);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setQueueMode(int mode)
+{
+    ConnectionIf::setQueueMode(mode);
+
+    if (mServer) {
+        mServer->setQueueMode(mode);
+    }
+
+    if (mClient) {
+        mClient->setQueueMode(mode);
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        client->setQueueMode(mode);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setSubscriptions(const QStringList &subscriptions)
+{
+    ConnectionIf::setSubscriptions(subscriptions);
+
+    if (mClient) {
+        mClient->setSubscriptions(subscriptions);
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        client->setSubscriptions(subscriptions);
+    }
+}
+
+/*!
+  Returns the statistics of the send queues of the server and the clients
+  added up, see SendQueue::toVariantList().
+*/
+QVariantList WlanConnection::queueStatistics() const
+{
+    QList<SendQueue::Statistics> statistics;
+
+    if (mServer) {
+        SendQueue::addStatistics(statistics, mServer->queueStatistics());
+    }
+
+    if (mClient) {
+        SendQueue::addStatistics(statistics, mClient->queueStatistics());
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        SendQueue::addStatistics(statistics, client->queueStatistics());
+    }
+
+    return SendQueue::toVariantList(statistics);
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setRelayRouter(const RelayRouter &router)
+{
+    ConnectionIf::setRelayRouter(router);
+
+    if (mServer) {
+        mServer->setRelayRouter(router);
+    }
+}
+
+/*!
+  From ConnectionIf.
+*/
+void WlanConnection::setSocketOptions(const SocketOptions &options)
+{
+    ConnectionIf::setSocketOptions(options);
+
+    if (mServer) {
+        mServer->setSocketOptions(options);
+    }
+
+    if (mClient) {
+        mClient->setSocketOptions(options);
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        client->setSocketOptions(options);
+    }
+}
+
 /*!
   Starts connection.
 */
@@ -127,6 +335,13 @@ bool WlanConnection::connect()
     if (mServer) {
         WlanNetworkMgr& mgr = Network::networkManager();
         mServer->setMaxConnections(mMaxConnections);
+        mServer->setDuplicatePolicy(mDuplicatePolicy);
+        mServer->setSocketOptions(mSocketOptions);
+        mServer->setHeartbeat(mHeartbeatInterval, mHeartbeatTimeout);
+        mServer->setCompressionDictionary(mCompressionDictionary);
+        mServer->setQueueMode(mQueueMode);
+        mServer->setRelayRouter(mRelayRouter);
+        mServer->setAdmissionControl(mAdmission);
         mServer->setState(mgr.state());
         mServer->setIp(mgr.ip());
     }
@@ -139,6 +354,7 @@ bool WlanConnection::connect()
     } else if (mConnectAs == Client && mDiscoveryMgr && mClient) {
         if (mDiscoveryMgr->startDiscovery(mBroadcastPort)) {
             setStatus(Discovering);
+            connectToCachedServers();
             return true;
         }
     } else if (mConnectAs == DontCare && mDiscoveryMgr && mClient && mServer) {
@@ -147,6 +363,7 @@ bool WlanConnection::connect()
 
         if (serverOk && discoveryOk) {
             setStatus(Connecting);
+            connectToCachedServers();
             return true;
         }
 
@@ -164,20 +381,19 @@ bool WlanConnection::connectToServer(const QString &info)
     if ((mConnectAs == Client || mConnectAs == DontCare) &&
          mDiscoveryMgr && mClient)
     {
-        NetworkServerInfo serverInfo = mDiscoveryMgr->server(NetworkServerInfo(info));
-        //If server hasn't been discovered, try to see if info contains valid server info
-        if (!serverInfo.isValid()) {
-            serverInfo = NetworkServerInfo(info);
-            //If no port has been given, try using the default serverport
-            if (serverInfo.port() == -1) {
-                serverInfo.setPort(mServerPort);
-            }
-        }
+        bool discovered = false;
+        NetworkServerInfo serverInfo = this->serverInfo(info, &discovered);
         qDebug() << "WlanConnection::connectToServer():"
                  << serverInfo.toString();
 
         if (serverInfo.isValid()) {
-            mClient->startClient(serverInfo);
+            //The user's choice overrides the connection attempt to the cached servers
+            if (mFastConnecting) {
+                mFastConnecting = false;
+                mClient->stopClient();
+            }
+
+            mClient->startClient(raceCandidates(serverInfo, discovered));
             setStatus(Connecting);
             return true;
         }
@@ -187,6 +403,100 @@ bool WlanConnection::connectToServer(const QString &info)
 }
 
 
+/*!
+  Connects to server given in \a info in addition to the servers we are
+  already connected to. Can be used only as a \a Client. Messages received
+  from every server are tagged with the server they came from.
+  Returns true if the connection was started, false otherwise.
+*/
+bool WlanConnection::addServer(const QString &info)
+{
+    if (mConnectAs != Client) {
+        qDebug() << "WlanConnection::addServer(): Only clients can add servers!";
+        return false;
+    }
+
+    NetworkServerInfo server = serverInfo(info);
+
+    if (!server.isValid()) {
+        qDebug() << "WlanConnection::addServer(): Invalid server" << info;
+        return false;
+    }
+
+    if (client(server.toString())) {
+        qDebug() << "WlanConnection::addServer(): Already connected to" << server.toString();
+        return false;
+    }
+
+    qDebug() << "WlanConnection::addServer():" << server.toString();
+
+    WlanClient *client = new WlanClient(this);
+    client->setReconnectPolicy(mReconnectPolicy);
+    client->setSocketOptions(mSocketOptions);
+    client->setHeartbeat(mHeartbeatInterval, mHeartbeatTimeout);
+    client->setHandshake(mHandshake);
+    client->setCompressionDictionary(mCompressionDictionary);
+    client->setQueueMode(mQueueMode);
+    client->setSubscriptions(mSubscriptions);
+    QObject::connect(client, SIGNAL(read(QByteArray)), this, SLOT(onServerRead(QByteArray)));
+    QObject::connect(client, SIGNAL(channelRead(QString,QByteArray)),
+                     this, SLOT(onChannelRead(QString,QByteArray)));
+    QObject::connect(client, SIGNAL(topicRead(QString,QByteArray)),
+                     this, SLOT(onTopicRead(QString,QByteArray)));
+    QObject::connect(client, SIGNAL(rpcRead(QByteArray)), this, SLOT(onRpcRead(QByteArray)));
+    QObject::connect(client, SIGNAL(objectRead(QByteArray)), this, SLOT(onObjectRead(QByteArray)));
+    QObject::connect(client, SIGNAL(handshakeCompleted(QVariantMap)),
+                     this, SLOT(onServerHandshake(QVariantMap)));
+    QObject::connect(client, SIGNAL(connectedToServer(QString)), this, SLOT(onServerConnected(QString)));
+    QObject::connect(client, SIGNAL(disconnectedFromServer()), this, SLOT(onServerDisconnected()));
+    QObject::connect(client, SIGNAL(socketError(int)), this, SLOT(onServerDisconnected()));
+
+    mServerClients.append(client);
+    client->startClient(server);
+    return true;
+}
+
+/*!
+  Disconnects from the additional \a server.
+  Returns true if the server was found, false otherwise.
+*/
+bool WlanConnection::removeServer(const QString &server)
+{
+    WlanClient *client = this->client(server);
+
+    if (!client || client == mClient) {
+        return false;
+    }
+
+    mServerClients.removeOne(client);
+    client->disconnect(this);
+    client->stopClient();
+    client->deleteLater();
+
+    emit serversChanged(servers());
+    return true;
+}
+
+/*!
+  Returns the servers we are connected to as a client.
+*/
+QStringList WlanConnection::servers() const
+{
+    QStringList servers;
+
+    if (mClient && mStatus == Connected && mConnectAs != Server && mClient->clientStarted()) {
+        servers.append(mClient->serverInfo().toString());
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        if (client->isConnected()) {
+            servers.append(client->serverInfo().toString());
+        }
+    }
+
+    return servers;
+}
+
 /*!
   Disconnects.
 */
@@ -194,6 +504,19 @@ void WlanConnection::disconnect()
 {
     qDebug() << "WlanConnection::disconnect(): =>";
 
+    mFastConnecting = false;
+
+    if (!mServerClients.isEmpty()) {
+        foreach (WlanClient *client, mServerClients) {
+            client->disconnect(this);
+            client->stopClient();
+            client->deleteLater();
+        }
+
+        mServerClients.clear();
+        emit serversChanged(servers());
+    }
+
     if (mClient) {
         mClient->stopClient();
     }
@@ -213,13 +536,67 @@ void WlanConnection::disconnect()
 }
 
 
+/*!
+  Returns the ids of the clients connected to the server.
+*/
+QList<int> WlanConnection::clients() const
+{
+    return mServer ? mServer->clientIds() : QList<int>();
+}
+
+/*!
+  Returns the name of the client with \a clientId.
+*/
+QString WlanConnection::clientName(int clientId) const
+{
+    return mServer ? mServer->peerName(clientId) : QString();
+}
+
+/*!
+  Returns the number of bytes waiting to be written to the peers.
+*/
+qint64 WlanConnection::bytesToWrite() const
+{
+    qint64 bytes = mServer ? mServer->bytesToWrite() : 0;
+
+    if (mClient) {
+        bytes += mClient->bytesToWrite();
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        bytes += client->bytesToWrite();
+    }
+
+    return bytes;
+}
+
+/*!
+  Sends \a message only to the client with \a clientId.
+  Returns true if successful, false otherwise.
+*/
+bool WlanConnection::sendTo(int clientId, const QByteArray &message)
+{
+    if (mServer && mConnectAs != Client) {
+        return mServer->write(clientId, message) > 0;
+    }
+
+    return false;
+}
+
 /*!
   Sends \a message. Returns true if successful, false otherwise.
 */
 bool WlanConnection::send(const QByteArray &message)
 {
     if (mConnectAs == Client && mClient) {
-        return mClient->write(message) > 0;
+        bool ok = mClient->write(message) > 0;
+
+        //Additional servers get every message as well
+        foreach (WlanClient *client, mServerClients) {
+            ok = (client->write(message) > 0) || ok;
+        }
+
+        return ok;
     }
 
     if (mConnectAs == Server && mServer) {
@@ -234,6 +611,171 @@ bool WlanConnection::send(const QByteArray &message)
     return false;
 }
 
+/*!
+  Sends \a message to the same peers as send() with \a priority, dropping
+  it if it is still queued at \a expires, in milliseconds since epoch.
+  Returns true if successful, false otherwise.
+*/
+bool WlanConnection::sendWithPriority(const QByteArray &message, int priority, qint64 expires)
+{
+    return sendQueued(message, priority, expires, QString());
+}
+
+/*!
+  Sends \a message to the same peers as send() with \a priority, replacing
+  the message with the same \a key still queued for a peer. Returns true
+  if successful, false otherwise.
+*/
+bool WlanConnection::sendLatest(const QByteArray &message, const QString &key, int priority)
+{
+    return sendQueued(message, priority, 0, key);
+}
+
+/*!
+  Sends \a message, not yet framed, to the same peers as send() with \a priority as the latest
+  value of \a key like sendLatest(), and as a delta to the previous
+  message with \a key for the peers that agreed on deltas. Returns true if
+  successful, false otherwise.
+*/
+bool WlanConnection::sendDelta(const QByteArray &message, const QString &key, int priority)
+{
+    return sendQueued(message, priority, 0, key, true);
+}
+
+/*!
+  Publishes \a message, a frame made with Common::toTopicMessage(), on
+  \a topic. A server sends it to the clients subscribed to \a topic, a
+  client to the servers that support topics, which pass it on to their
+  subscribers. Returns true if successful, false otherwise.
+*/
+bool WlanConnection::publish(const QByteArray &message, const QString &topic)
+{
+    bool ok = false;
+
+    if (mConnectAs != Server) {
+        QList<WlanClient*> clients = mServerClients;
+
+        if (mClient) {
+            clients.prepend(mClient);
+        }
+
+        //Older servers would take the frame for an ordinary message
+        foreach (WlanClient *client, clients) {
+            if (client->handshake().hasFeature(Handshake::TopicsFeature)) {
+                ok = (client->write(message) > 0) || ok;
+            }
+        }
+    }
+
+    if (mConnectAs != Client && mServer) {
+        mServer->publish(message, topic);
+        ok = true;
+    }
+
+    return ok;
+}
+
+/*!
+  Sends \a message, a frame made with Common::toObjectMessage(), to the
+  same peers as send() that agreed on objects in the handshake. Returns
+  true if successful, false otherwise.
+*/
+bool WlanConnection::sendObject(const QByteArray &message)
+{
+    bool ok = false;
+
+    if (mConnectAs != Server) {
+        QList<WlanClient*> clients = mServerClients;
+
+        if (mClient) {
+            clients.prepend(mClient);
+        }
+
+        //Older servers would take the frame for an ordinary message
+        foreach (WlanClient *client, clients) {
+            if (client->handshake().hasFeature(Handshake::ObjectsFeature)) {
+                ok = (client->write(message) > 0) || ok;
+            }
+        }
+    }
+
+    if (mConnectAs != Client && mServer) {
+        ok = (mServer->writeObject(message) >= 0) || ok;
+    }
+
+    return ok;
+}
+
+/*!
+  Queues \a message for the same peers as send() with \a priority,
+  \a expires, \a key and \a delta as in SendQueue::write().
+*/
+bool WlanConnection::sendQueued(const QByteArray &message, int priority, qint64 expires,
+                                const QString &key, bool delta)
+{
+    if (mConnectAs == Client && mClient) {
+        bool ok = mClient->write(message, priority, expires, key, delta) > 0;
+
+        foreach (WlanClient *client, mServerClients) {
+            ok = (client->write(message, priority, expires, key, delta) > 0) || ok;
+        }
+
+        return ok;
+    }
+
+    if (mConnectAs == Server && mServer) {
+        return mServer->write(message, priority, expires, key, delta) > 0;
+    }
+
+    if (mConnectAs == DontCare) {
+        return (mClient ? mClient->write(message, priority, expires, key, delta) > 0 : false) ||
+               (mServer ? mServer->write(message, priority, expires, key, delta) > 0 : false);
+    }
+
+    return false;
+}
+
+/*!
+  Sends \a message on \a channel, compressed as a whole if \a compressed
+  is set, to the same peers as send(). Returns true if successful, false
+  otherwise.
+*/
+bool WlanConnection::sendOnChannel(const ChannelInfo &channel, const QByteArray &message,
+                                   bool compressed)
+{
+    if (mConnectAs == Client && mClient) {
+        bool ok = mClient->write(channel, message, compressed) >= 0;
+
+        foreach (WlanClient *client, mServerClients) {
+            ok = (client->write(channel, message, compressed) >= 0) || ok;
+        }
+
+        return ok;
+    }
+
+    if (mConnectAs == Server && mServer) {
+        return mServer->write(channel, message, compressed) >= 0;
+    }
+
+    if (mConnectAs == DontCare) {
+        return (mClient ? mClient->write(channel, message, compressed) >= 0 : false) ||
+               (mServer ? mServer->write(channel, message, compressed) >= 0 : false);
+    }
+
+    return false;
+}
+
+/*!
+  Sends \a message only to \a server, or only to the server connected to
+  with connect() if \a server is empty. Returns true if successful, false
+  otherwise.
+*/
+bool WlanConnection::sendToServer(const QString &server, const QByteArray &message)
+{
+    WlanClient *client = server.isEmpty() ? mClient : this->client(server);
+    return client ? client->write(message) > 0 : false;
+}
+
 /*!
   Sets the serverport to \a port.
 */
@@ -252,6 +794,174 @@ void WlanConnection::setBroadcastPort(int port)
     mBroadcastPort = port;
 }
 
+/*!
+  Sets the number of servers to race connection attempts to to \a count.
+  1 means connecting only to the server that was asked for.
+*/
+void WlanConnection::setRaceCount(int count)
+{
+    qDebug() << "WlanConnection::setRaceCount():" << count;
+    mRaceCount = qMax(1, count);
+}
+
+/*!
+  Sets the delay between starting the raced connection attempts to \a stagger milliseconds.
+*/
+void WlanConnection::setRaceStagger(int stagger)
+{
+    qDebug() << "WlanConnection::setRaceStagger():" << stagger;
+    mRaceStagger = stagger;
+
+    if (mClient) {
+        mClient->setRaceStagger(mRaceStagger);
+    }
+}
+
+/*!
+  Sets the \a admission limits the server uses for accepting new connections.
+*/
+void WlanConnection::setAdmissionControl(const AdmissionControl &admission)
+{
+    mAdmission = admission;
+
+    if (mServer) {
+        mServer->setAdmissionControl(mAdmission);
+    }
+}
+
+/*!
+  Enables or disables connecting directly to the cached servers while the
+  discovery is running.
+*/
+void WlanConnection::setFastReconnect(bool enabled)
+{
+    qDebug() << "WlanConnection::setFastReconnect():" << enabled;
+    mFastReconnect = enabled;
+}
+
+/*!
+  Sets the number of most recently used servers to remember to \a size.
+*/
+void WlanConnection::setServerCacheSize(int size)
+{
+    mServerCache.setSize(size);
+}
+
+/*!
+  Sets the file the servers are remembered in to \a fileName.
+*/
+void WlanConnection::setServerCacheFile(const QString &fileName)
+{
+    mServerCache.setFileName(fileName);
+}
+
+/*!
+  If fast reconnect is enabled, starts connecting to the servers we were
+  connected to last time. Discovery keeps running in parallel, and if none of
+  the cached servers answers we just carry on discovering.
+*/
+void WlanConnection::connectToCachedServers()
+{
+    if (!mFastReconnect || !mClient || mClient->clientStarted()) {
+        return;
+    }
+
+    QList<NetworkServerInfo> servers = mServerCache.servers();
+
+    if (servers.isEmpty()) {
+        return;
+    }
+
+    qDebug() << "WlanConnection::connectToCachedServers(): Trying"
+             << servers.size() << "cached server(s)";
+
+    mFastConnecting = true;
+    mClient->startClient(servers, false);
+}
+
+/*!
+  Returns the server information for \a info. Discovered servers are
+  preferred, otherwise \a info is parsed and the default server port is used
+  if none was given. \a discovered is set to true if the server was discovered.
+*/
+NetworkServerInfo WlanConnection::serverInfo(const QString &info, bool *discovered) const
+{
+    NetworkServerInfo serverInfo;
+
+    if (mDiscoveryMgr) {
+        serverInfo = mDiscoveryMgr->server(NetworkServerInfo(info));
+    }
+
+    if (discovered) {
+        *discovered = serverInfo.isValid();
+    }
+
+    //If server hasn't been discovered, try to see if info contains valid server info
+    if (!serverInfo.isValid()) {
+        serverInfo = NetworkServerInfo(info);
+        //If no port has been given, try using the default serverport
+        if (serverInfo.port() == -1) {
+            serverInfo.setPort(mServerPort);
+        }
+    }
+
+    return serverInfo;
+}
+
+/*!
+  Returns the client connected or connecting to \a server, or 0 if not found.
+*/
+WlanClient *WlanConnection::client(const QString &server) const
+{
+    if (mClient && mClient->clientStarted() && mClient->serverInfo().toString() == server) {
+        return mClient;
+    }
+
+    foreach (WlanClient *client, mServerClients) {
+        if (client->serverInfo().toString() == server) {
+            return client;
+        }
+    }
+
+    return 0;
+}
+
+/*!
+  Returns the servers to race the connection attempts to. \a server is always
+  tried first. If it was given by the host name rest of the host's addresses
+  follow, and then the other discovered servers. At most \c raceCount servers
+  are returned.
+*/
+QList<NetworkServerInfo> WlanConnection::raceCandidates(const NetworkServerInfo &server,
+                                                        bool discovered) const
+{
+    QList<NetworkServerInfo> servers;
+    servers.append(server);
+
+    if (mRaceCount <= 1) {
+        return servers;
+    }
+
+    if (!discovered) {
+        foreach (QHostAddress address, server.hostAddresses()) {
+            NetworkServerInfo candidate(server.hostName(), address, server.port());
+            if (!servers.contains(candidate)) {
+                servers.append(candidate);
+            }
+        }
+    }
+
+    if (mDiscoveryMgr) {
+        foreach (NetworkServerInfo candidate, mDiscoveryMgr->servers()) {
+            if (!servers.contains(candidate)) {
+                servers.append(candidate);
+            }
+        }
+    }
+
+    return servers.mid(0, mRaceCount);
+}
+
 /*!
 */
 void WlanConnection::onServerFound(NetworkServerInfo info)
@@ -295,7 +1005,124 @@ void WlanConnection::onServerRemoved(int index)
 void WlanConnection::onRead(const QByteArray &data)
 {
     qDebug() << "WlanConnection::onRead():" << data.size() << "bytes";
-    emit received(QString(data));
+    QString origin;
+
+    if (mClient && sender() == mClient) {
+        origin = mClient->serverInfo().toString();
+    }
+
+    emit received(QString(data), 0, origin);
+}
+
+/*!
+  Forwards the data read from the client with \a clientId.
+*/
+void WlanConnection::onClientRead(const QByteArray &data, int clientId)
+{
+    qDebug() << "WlanConnection::onClientRead():" << data.size() << "bytes from" << clientId;
+    emit received(QString(data), clientId, QString());
+}
+
+/*!
+  Forwards the message read from the server on \a channel. The server is
+  reported as client 0.
+*/
+void WlanConnection::onChannelRead(const QString &channel, const QByteArray &data)
+{
+    qDebug() << "WlanConnection::onChannelRead():" << data.size() << "bytes on" << channel;
+    emit receivedOnChannel(channel, QString(data), 0);
+}
+
+/*!
+  Forwards the message read on \a channel from the client with \a clientId.
+*/
+void WlanConnection::onClientChannelRead(const QString &channel, const QByteArray &data,
+                                         int clientId)
+{
+    qDebug() << "WlanConnection::onClientChannelRead():" << data.size() << "bytes on" << channel
+             << "from" << clientId;
+    emit receivedOnChannel(channel, QString(data), clientId);
+}
+
+/*!
+  Forwards the remote procedure call or reply read from the server, or
+  from one of the additional servers with the name of the server.
+*/
+void WlanConnection::onRpcRead(const QByteArray &data)
+{
+    WlanClient *client = qobject_cast<WlanClient*>(sender());
+
+    if (client && client != mClient) {
+        emit receivedServerRpc(client->serverInfo().toString(), data);
+        return;
+    }
+
+    emit receivedRpc(data, 0);
+}
+
+/*!
+  Forwards the message published on \a topic read from a server.
+*/
+void WlanConnection::onTopicRead(const QString &topic, const QByteArray &data)
+{
+    qDebug() << "WlanConnection::onTopicRead():" << data.size() << "bytes on" << topic;
+    emit receivedOnTopic(topic, QString(data), 0);
+}
+
+/*!
+  Forwards the message published on \a topic by the client with \a clientId.
+*/
+void WlanConnection::onClientTopicRead(const QString &topic, const QByteArray &data,
+                                       int clientId)
+{
+    qDebug() << "WlanConnection::onClientTopicRead():" << data.size() << "bytes on" << topic
+             << "from" << clientId;
+    emit receivedOnTopic(topic, QString(data), clientId);
+}
+
+/*!
+  Forwards the object read from a server.
+*/
+void WlanConnection::onObjectRead(const QByteArray &data)
+{
+    emit receivedObject(data, 0);
+}
+
+/*!
+  Forwards the data read from one of the additional servers.
+*/
+void WlanConnection::onServerRead(const QByteArray &data)
+{
+    WlanClient *client = qobject_cast<WlanClient*>(sender());
+
+    if (!client) {
+        return;
+    }
+
+    qDebug() << "WlanConnection::onServerRead():" << data.size() << "bytes";
+    emit received(QString(data), 0, client->serverInfo().toString());
+}
+
+/*!
+  Called when connected to one of the additional servers.
+*/
+void WlanConnection::onServerConnected(const QString &peer)
+{
+    qDebug() << "WlanConnection::onServerConnected():" << peer;
+    emit serversChanged(servers());
+}
+
+/*!
+  Called when the connection to one of the additional servers is lost
+  or can't be established. The connection is removed.
+*/
+void WlanConnection::onServerDisconnected()
+{
+    WlanClient *client = qobject_cast<WlanClient*>(sender());
+
+    if (client && mServerClients.contains(client)) {
+        removeServer(client->serverInfo().toString());
+    }
 }
 
 /*!
@@ -312,8 +1139,15 @@ void WlanConnection::onConnected(const QString &peer)
         mDiscoveryMgr->stopDiscovery();
     }
 
+    mFastConnecting = false;
+
+    if (mFastReconnect && mClient) {
+        mServerCache.add(mClient->serverInfo());
+    }
+
     mConnectedTo = peer;
     setStatus(Connected);
+    emit serversChanged(servers());
 }
 
 /*!
@@ -323,6 +1157,7 @@ void WlanConnection::onClientConnected(const QString &peer)
     //If we dont care wheter or not we are client or server and we get a client connected
     //We'll stop looking for servers and stay as a server until all clients have disconnected
     if (mConnectAs == DontCare) {
+        mFastConnecting = false;
         mDiscoveryMgr->stopDiscovery();
         mClient->stopClient();
     }
@@ -372,6 +1207,8 @@ void WlanConnection::onDisconnected()
     if (mConnectAs != DontCare) {
         setStatus(NotConnected);
     }
+
+    emit serversChanged(servers());
     qDebug() << "WlanConnection::onDisconnected(): <=";
 }
 
@@ -384,7 +1221,7 @@ void WlanConnection::onReconnect()
     if (mgr.state() != QNetworkSession::Connected &&
         mgr.state() != QNetworkSession::Connecting)
     {
-        mgr.connectToNetwork();
+        QMetaObject::invokeMethod(&mgr, "connectToNetwork");
     }
     qDebug() << "WlanConnection::onReconnect(): <=" << mgr.state();
 }
@@ -396,6 +1233,14 @@ void WlanConnection::onIpChanged(QString ip)
 
 void WlanConnection::onSocketError(int error)
 {
+    //None of the cached servers answered, discovery is still running
+    if (mFastConnecting && sender() == mClient) {
+        qDebug() << "WlanConnection::onSocketError(): Cached servers unavailable.";
+        mFastConnecting = false;
+        mClient->stopClient();
+        return;
+    }
+
     mError = error;
 
     mErrorString = "";
@@ -411,6 +1256,39 @@ void WlanConnection::onSocketError(int error)
     emit errorOccured(error);
 }
 
+/*!
+  Called when the client is about to retry connecting to the server,
+  either after a failed attempt or after the connection was dropped.
+*/
+void WlanConnection::onReconnecting(int attempt, int delay)
+{
+    qDebug() << "WlanConnection::onReconnecting(): Attempt" << attempt << "in" << delay << "ms";
+
+    if (mStatus == Connected) {
+        mConnectedTo = "";
+        setStatus(Connecting);
+    }
+
+    emit reconnecting(attempt, delay);
+}
+
+/*!
+  The protocol settings have been agreed with a server. The server
+  connected to first is reported as client 0, the additional servers by
+  their server information.
+*/
+void WlanConnection::onServerHandshake(const QVariantMap &protocol)
+{
+    WlanClient *client = qobject_cast<WlanClient*>(sender());
+
+    if (client && client != mClient) {
+        emit serverHandshakeCompleted(client->serverInfo().toString(), protocol);
+        return;
+    }
+
+    emit handshakeCompleted(0, protocol);
+}
+
 /*!
   Creates and connects server and its signals
 */
@@ -419,8 +1297,22 @@ void WlanConnection::startServer()
     if (!mServer) {
         mServer = new WlanServer(this);
 
-        QObject::connect(mServer, SIGNAL(read(QByteArray)),
-                         this, SLOT(onRead(QByteArray)));
+        QObject::connect(mServer, SIGNAL(read(QByteArray,int)),
+                         this, SLOT(onClientRead(QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(channelRead(QString,QByteArray,int)),
+                         this, SLOT(onClientChannelRead(QString,QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(rpcRead(QByteArray,int)),
+                         this, SIGNAL(receivedRpc(QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(topicRead(QString,QByteArray,int)),
+                         this, SLOT(onClientTopicRead(QString,QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(objectRead(QByteArray,int)),
+                         this, SIGNAL(receivedObject(QByteArray,int)));
+        QObject::connect(mServer, SIGNAL(clientAdded(int,QString)),
+                         this, SIGNAL(clientConnected(int,QString)));
+        QObject::connect(mServer, SIGNAL(clientRemoved(int)),
+                         this, SIGNAL(clientDisconnected(int)));
+        QObject::connect(mServer, SIGNAL(handshakeCompleted(int,QVariantMap)),
+                         this, SIGNAL(handshakeCompleted(int,QVariantMap)));
         QObject::connect(mServer, SIGNAL(clientConnected(QString)),
                          this, SLOT(onClientConnected(QString)));
         QObject::connect(mServer, SIGNAL(clientDisconnected(int)),
@@ -446,11 +1338,30 @@ void WlanConnection::startClient()
 {
     if (!mClient) {
         mClient = new WlanClient(this);
+        mClient->setReconnectPolicy(mReconnectPolicy);
+        mClient->setSocketOptions(mSocketOptions);
+        mClient->setHeartbeat(mHeartbeatInterval, mHeartbeatTimeout);
+        mClient->setHandshake(mHandshake);
+        mClient->setCompressionDictionary(mCompressionDictionary);
+        mClient->setQueueMode(mQueueMode);
+        mClient->setSubscriptions(mSubscriptions);
+        mClient->setRaceStagger(mRaceStagger);
         QObject::connect(mClient, SIGNAL(read(QByteArray)), this, SLOT(onRead(QByteArray)));
+        QObject::connect(mClient, SIGNAL(channelRead(QString,QByteArray)),
+                         this, SLOT(onChannelRead(QString,QByteArray)));
+        QObject::connect(mClient, SIGNAL(rpcRead(QByteArray)), this, SLOT(onRpcRead(QByteArray)));
+        QObject::connect(mClient, SIGNAL(topicRead(QString,QByteArray)),
+                         this, SLOT(onTopicRead(QString,QByteArray)));
+        QObject::connect(mClient, SIGNAL(objectRead(QByteArray)),
+                         this, SLOT(onObjectRead(QByteArray)));
         QObject::connect(mClient, SIGNAL(connectedToServer(QString)), this, SLOT(onConnected(QString)));
         QObject::connect(mClient, SIGNAL(disconnectedFromServer()), this, SLOT(onDisconnected()));
         QObject::connect(mClient, SIGNAL(socketError(int)),
                          this, SLOT(onSocketError(int)));
+        QObject::connect(mClient, SIGNAL(reconnecting(int,int)),
+                         this, SLOT(onReconnecting(int,int)));
+        QObject::connect(mClient, SIGNAL(handshakeCompleted(QVariantMap)),
+                         this, SLOT(onServerHandshake(QVariantMap)));
     }
 }
 
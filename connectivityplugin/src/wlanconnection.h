@@ -11,10 +11,14 @@
 
 #include "connectionif.h"
 #include <QObject>
+#include <QList>
 #include <QNetworkSession>
+#include <QStringList>
 
 
+#include "admissioncontrol.h"
 #include "networkserverinfo.h"
+#include "servercache.h"
 
 class WlanServer;
 class WlanClient;
@@ -31,23 +35,69 @@ public:
 public:
     void setConnectAs(ConnectAs connectAs);
     ConnectionType type() const;
-    int serverPort() const;
-    int broadcastPort() const;
+    Q_INVOKABLE int serverPort() const;
+    Q_INVOKABLE int broadcastPort() const;
+    int raceCount() const;
+    int raceStagger() const;
+    bool fastReconnect() const;
+    int serverCacheSize() const;
+    QString serverCacheFile() const;
+    AdmissionControl admissionControl() const;
+    Q_INVOKABLE QStringList servers() const;
     void setMaxConnections(int max);
+    void setDuplicatePolicy(DuplicatePolicy policy);
+    void setReconnectPolicy(const ReconnectPolicy &policy);
+    void setSocketOptions(const SocketOptions &options);
+    void setHeartbeat(int interval, int timeout);
+    void setHandshake(bool enabled);
+    void setRelayRouter(const RelayRouter &router);
+    void setCompressionDictionary(const CompressionDictionary &dictionary);
+    void setQueueMode(int mode);
+    void setSubscriptions(const QStringList &subscriptions);
+    QVariantList queueStatistics() const;
+    Q_INVOKABLE void setAdmissionControl(const AdmissionControl &admission);
+    QList<int> clients() const;
+    QString clientName(int clientId) const;
+    qint64 bytesToWrite() const;
 
 public slots:
     bool connect();
     bool connectToServer(const QString& info);
+    bool addServer(const QString &info);
+    bool removeServer(const QString &server);
     void disconnect();
     bool send(const QByteArray &message);
+    bool sendTo(int clientId, const QByteArray &message);
+    bool sendToServer(const QString &server, const QByteArray &message);
+    bool sendOnChannel(const ChannelInfo &channel, const QByteArray &message, bool compressed);
+    bool sendWithPriority(const QByteArray &message, int priority, qint64 expires);
+    bool sendLatest(const QByteArray &message, const QString &key, int priority);
+    bool sendDelta(const QByteArray &message, const QString &key, int priority);
+    bool publish(const QByteArray &message, const QString &topic);
+    bool sendObject(const QByteArray &message);
     void setServerPort(int port);
     void setBroadcastPort(int port);
+    void setRaceCount(int count);
+    void setRaceStagger(int stagger);
+    void setFastReconnect(bool enabled);
+    void setServerCacheSize(int size);
+    void setServerCacheFile(const QString &fileName);
 
 private slots:
     void onServerFound(NetworkServerInfo info);
     void onServerExists(NetworkServerInfo info);
     void onServerRemoved(int index);
     void onRead(const QByteArray &data);
+    void onClientRead(const QByteArray &data, int clientId);
+    void onServerRead(const QByteArray &data);
+    void onChannelRead(const QString &channel, const QByteArray &data);
+    void onClientChannelRead(const QString &channel, const QByteArray &data, int clientId);
+    void onRpcRead(const QByteArray &data);
+    void onTopicRead(const QString &topic, const QByteArray &data);
+    void onClientTopicRead(const QString &topic, const QByteArray &data, int clientId);
+    void onObjectRead(const QByteArray &data);
+    void onServerConnected(const QString &peer);
+    void onServerDisconnected();
     void onConnected(const QString &peer);
     void onClientConnected(const QString &peer);
     void onClientDisconnected(int remainingClients);
@@ -55,6 +105,8 @@ private slots:
     void onReconnect();
     void onIpChanged(QString ip);
     void onSocketError(int error);
+    void onReconnecting(int attempt, int delay);
+    void onServerHandshake(const QVariantMap &protocol);
 
     void startServer();
     void startClient();
@@ -62,16 +114,35 @@ private slots:
 
     void onNetworkStateChanged(QNetworkSession::State state);
 
+private:
+    bool sendQueued(const QByteArray &message, int priority, qint64 expires,
+                    const QString &key, bool delta = false);
+    NetworkServerInfo serverInfo(const QString &info, bool *discovered = 0) const;
+    WlanClient *client(const QString &server) const;
+    void connectToCachedServers();
+    QList<NetworkServerInfo> raceCandidates(const NetworkServerInfo &server,
+                                            bool discovered) const;
+
 signals:
     void discovered(const QString &hostName);
     void removed(int index);
+    void serversChanged(const QStringList &servers);
+    void serverHandshakeCompleted(const QString &server, const QVariantMap &protocol);
+    void receivedServerRpc(const QString &server, const QByteArray &message);
 
 private: // Data
     int mServerPort;
     int mBroadcastPort;
+    int mRaceCount;
+    int mRaceStagger; //Milliseconds
+    bool mFastReconnect;
+    bool mFastConnecting;
+    ServerCache mServerCache;
+    AdmissionControl mAdmission;
 
     WlanServer *mServer; //Owned
     WlanClient *mClient; //Owned
+    QList<WlanClient*> mServerClients; //Owned, connections to additional servers
     WlanDiscoveryMgr *mDiscoveryMgr; //Owned
 };
 
@@ -27,6 +27,7 @@ const int TryInterval(20000); //Milliseconds
 */
 WlanDiscoveryMgr::WlanDiscoveryMgr(QObject *parent) :
     QObject(parent),
+    mServerCheckTimer(this),
     mDiscoverySocket(0),
     mBroadcastTitle("CONNPLUGIN"),
     mBroadcastPort(0)
@@ -133,6 +134,14 @@ NetworkServerInfo WlanDiscoveryMgr::server(const int &port) const
     return foundInfo;
 }
 
+/*!
+  Returns the currently known servers in the order they were discovered.
+*/
+QList<NetworkServerInfo> WlanDiscoveryMgr::servers() const
+{
+    return mDiscoveredServers;
+}
+
 /*!
   Starts the discovery of servers by listening to broadcasts on \a port.
   Returns true if the discovery wes started successfully, false otherwise.
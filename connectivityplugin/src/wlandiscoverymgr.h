@@ -29,6 +29,7 @@ public:
     Q_INVOKABLE NetworkServerInfo server(const QString &hostName) const;
     Q_INVOKABLE NetworkServerInfo server(const QHostAddress &address) const;
     Q_INVOKABLE NetworkServerInfo server(const int &port) const;
+    QList<NetworkServerInfo> servers() const;
 
 public slots:
     bool startDiscovery(int port);
@@ -15,6 +15,7 @@
 #include <QHostInfo>
 #include <QStringList>
 
+#include "connectionif.h"
 #include "wlannetworkmgr.h"
 #include "common.h"
 
@@ -36,6 +37,11 @@ WlanServer::WlanServer(QObject *parent) :
     mDiscoveryServer(0),
     mTcpServer(0),
     mBroadcastSocket(0),
+    mDuplicatePolicy(ConnectionIf::RejectDuplicates),
+    mNextClientId(1),
+    mBroadcastTimer(this),
+    mAdmissionTimer(this),
+    mProtocol(this),
     mBroadcastPort(0),
     mState(QNetworkSession::Disconnected),
     mMaxConnections(0),
@@ -55,6 +61,22 @@ WlanServer::WlanServer(QObject *parent) :
     connect(&mBroadcastTimer, SIGNAL(timeout()),
             this, SLOT(broadcastServerInfo()));
 
+    connect(&mProtocol, SIGNAL(read(QByteArray,int)), this, SIGNAL(read(QByteArray,int)));
+    connect(&mProtocol, SIGNAL(channelRead(QString,QByteArray,int)),
+            this, SIGNAL(channelRead(QString,QByteArray,int)));
+    connect(&mProtocol, SIGNAL(rpcRead(QByteArray,int)), this, SIGNAL(rpcRead(QByteArray,int)));
+    connect(&mProtocol, SIGNAL(topicRead(QString,QByteArray,int)),
+            this, SIGNAL(topicRead(QString,QByteArray,int)));
+    connect(&mProtocol, SIGNAL(objectRead(QByteArray,int)),
+            this, SIGNAL(objectRead(QByteArray,int)));
+    connect(&mProtocol, SIGNAL(handshakeCompleted(int,QVariantMap)),
+            this, SIGNAL(handshakeCompleted(int,QVariantMap)));
+    connect(&mProtocol, SIGNAL(timedOut(int)), this, SLOT(onTimedOut(int)));
+
+    mAdmissionTimer.setSingleShot(true);
+    connect(&mAdmissionTimer, SIGNAL(timeout()),
+            this, SLOT(processAdmissionQueue()));
+
     mServerInfo.setHostname(serverName);
 }
 
@@ -75,6 +97,29 @@ QString WlanServer::clientName(int index) const
     return "";
 }
 
+/*!
+  Returns the address of the client with \a clientId.
+*/
+QString WlanServer::peerName(int clientId) const
+{
+    QTcpSocket *socket = mClientSockets.value(clientId);
+    return socket ? socket->peerAddress().toString() : QString();
+}
+
+/*!
+  Returns the ids of the connected clients in the order they connected.
+*/
+QList<int> WlanServer::clientIds() const
+{
+    QList<int> ids;
+
+    foreach (QTcpSocket *socket, mSockets) {
+        ids.append(mClientIds.value(socket));
+    }
+
+    return ids;
+}
+
 QString WlanServer::errorString() const
 {
     return mLastErrorString;
@@ -91,8 +136,6 @@ bool WlanServer::startServer(int port, int bdport)
     mBroadcastPort = bdport;
     mServerInfo.setPort(port);
 
-    Common::resetBuffer();
-
     qDebug() << "WlanServer::startServer(): Serverport:" << mServerInfo.port()
              << "Broadcastport:" << mBroadcastPort;
     if (mTcpServer && mTcpServer->isListening()) {
@@ -158,10 +201,21 @@ void WlanServer::stopServer()
 
     foreach (QTcpSocket* socket, mSockets) {       
         socket->disconnectFromHost();
+        Common::resetBuffer(socket);
         delete socket;
         socket = 0;
     }
 
+    mSockets.clear();
+    qDeleteAll(mAdmissionQueue);
+    mAdmissionQueue.clear();
+    mAdmissionTimer.stop();
+    mClientIds.clear();
+    mClientSockets.clear();
+    mPeers.clear();
+    mPeerKeys.clear();
+    mProtocol.clear();
+
     //Delete server after all the sockets have been disconnected.
     if (mTcpServer) {
         mTcpServer->close();
@@ -192,13 +246,102 @@ void WlanServer::stopServer()
 */
 qint64 WlanServer::write(const QByteArray &data)
 {
-    qint64 bytes = -1;
-    foreach (QTcpSocket* socket, mSockets) {
-        if ((bytes = socket->write(data)) < 0) {
-            return -1;
-        }
+    return write(data, SendQueue::NormalPriority, 0);
+}
+
+/*!
+  Writes \a data to all the clients with \a priority. With a send queue
+  the message is queued and dropped if not sent by \a expires, in
+  milliseconds since epoch, 0 meaning never. A message with \a key
+  replaces the one with the same key still queued for the client, and
+  with \a delta is sent as a delta, see SendQueue::write(). Returns
+  the number of last bytes written or queued, or -1 if failed to write any data.
+*/
+qint64 WlanServer::write(const QByteArray &data, int priority, qint64 expires,
+                          const QString &key, bool delta)
+{
+    return mProtocol.write(data, priority, expires, key, delta);
+}
+
+/*!
+  Returns the number of bytes waiting to be written to the clients.
+*/
+qint64 WlanServer::bytesToWrite() const
+{
+    qint64 bytes = 0;
+
+    foreach (QTcpSocket *socket, mSockets) {
+        bytes += socket->bytesToWrite();
     }
-    return bytes;
+
+    return bytes + mProtocol.bytesQueued();
+}
+
+/*!
+  Sets the \a mode of the send queue, see SendQueue.
+*/
+void WlanServer::setQueueMode(int mode)
+{
+    mProtocol.setQueueMode(mode);
+}
+
+/*!
+  Returns the statistics of the send queue per priority class.
+*/
+QList<SendQueue::Statistics> WlanServer::queueStatistics() const
+{
+    return mProtocol.queueStatistics();
+}
+
+/*!
+  Returns the protocol settings agreed with the client \a clientId. The
+  handshake is invalid if the client hasn't sent a HELLO, i.e. it's an
+  older version.
+*/
+Handshake WlanServer::handshake(int clientId) const
+{
+    return mProtocol.handshake(clientId);
+}
+
+/*!
+  Writes \a data only to the client with \a clientId. Returns the number of
+  bytes written or -1 if the client wasn't found or writing failed.
+*/
+qint64 WlanServer::write(int clientId, const QByteArray &data)
+{
+    return mProtocol.write(clientId, data);
+}
+
+/*!
+  Writes \a message on \a channel to all the clients, compressed as a whole
+  if \a compressed is set. The message is queued and interleaved with the
+  other channels, see ChannelMux. Clients that don't support channels get
+  it as an ordinary message. Returns the size of \a message or -1 if
+  writing failed.
+*/
+qint64 WlanServer::write(const ChannelInfo &channel, const QByteArray &message, bool compressed)
+{
+    return mProtocol.write(channel, message, compressed);
+}
+
+/*!
+  Writes \a data, a message published on \a topic, to the clients
+  subscribed to \a topic other than \a fromClientId, see TopicIndex.
+  Returns the number of clients it was written to.
+*/
+int WlanServer::publish(const QByteArray &data, const QString &topic, int fromClientId)
+{
+    return mProtocol.publish(data, topic, fromClientId);
+}
+
+/*!
+  Writes \a data, an object frame, to the clients that agreed on objects
+  in the handshake. Returns the number of last bytes written or -1 if
+  failed to write any data.
+*/
+qint64 WlanServer::writeObject(const QByteArray &data)
+{
+    return mProtocol.writeObject(data);
 }
 
 
@@ -258,6 +401,66 @@ void WlanServer::setMaxConnections(int max)
     mMaxConnections = max;
 }
 
+/*!
+  Sets the \a options applied to the sockets of the connected clients.
+*/
+void WlanServer::setSocketOptions(const SocketOptions &options)
+{
+    mSocketOptions = options;
+
+    foreach (QTcpSocket *socket, mSockets) {
+        mSocketOptions.apply(socket);
+    }
+}
+
+/*!
+  Sets the \a router deciding which clients the messages from a client are
+  forwarded to.
+*/
+void WlanServer::setRelayRouter(const RelayRouter &router)
+{
+    mProtocol.setRelayRouter(router);
+}
+
+/*!
+  Sets the \a admission limits for accepting new connections.
+*/
+void WlanServer::setAdmissionControl(const AdmissionControl &admission)
+{
+    qDebug() << "WlanServer::setAdmissionControl(): Rate:" << admission.rate()
+             << "burst:" << admission.burst() << "backlog:" << admission.backlog();
+    mAdmission = admission;
+    processAdmissionQueue();
+}
+
+/*!
+  Sends a heartbeat to a client after \a interval milliseconds without other
+  traffic and drops a client that hasn't sent anything in \a timeout
+  milliseconds. 0 \a interval disables the heartbeats.
+*/
+void WlanServer::setHeartbeat(int interval, int timeout)
+{
+    mProtocol.setHeartbeat(interval, timeout);
+}
+
+/*!
+  Sets the preset \a dictionary used for uncompressing the received messages.
+*/
+void WlanServer::setCompressionDictionary(const CompressionDictionary &dictionary)
+{
+    mProtocol.setCompressionDictionary(dictionary);
+}
+
+/*!
+  Sets how a second connection from an already connected peer address is
+  handled to \a policy, see ConnectionIf::DuplicatePolicy.
+*/
+void WlanServer::setDuplicatePolicy(int policy)
+{
+    qDebug() << "WlanServer::setDuplicatePolicy():" << policy;
+    mDuplicatePolicy = policy;
+}
+
 void WlanServer::setState(QNetworkSession::State state)
 {
     qDebug() << "WlanServer::setState():" << state;
@@ -271,44 +474,139 @@ void WlanServer::setIp(const QString &ip)
 }
 
 /*!
-  Handles the incoming connection from the client. Connects required signals
-  and slots of the new connection in order to receive data from the client.
+  Handles the incoming connections. A connection is accepted right away if
+  the admission control allows it, otherwise it waits in the admission queue
+  or, if the queue is full, the client is told to retry later.
 */
 void WlanServer::onNewConnection()
 {
     qDebug() << "WlanServer::onNewConnection()";
 
-    QTcpSocket *socket = mTcpServer->nextPendingConnection();
+    QTcpSocket *socket = 0;
+
+    while ((socket = mTcpServer->nextPendingConnection())) {
+        if (mAdmissionQueue.isEmpty() && mAdmission.tryAcquire()) {
+            accept(socket);
+        } else if (mAdmissionQueue.size() < mAdmission.backlog()) {
+            qDebug() << "WlanServer::onNewConnection(): Waiting for admission:"
+                     << socket->peerAddress().toString();
+            mAdmissionQueue.append(socket);
+        } else {
+            rejectBusy(socket);
+        }
+    }
+
+    if (!mAdmissionQueue.isEmpty() && !mAdmissionTimer.isActive()) {
+        mAdmissionTimer.start(mAdmission.nextTokenIn());
+    }
+}
+
+/*!
+  Accepts the waiting connections as the admission control allows.
+  Connections closed by the client while waiting are dropped.
+*/
+void WlanServer::processAdmissionQueue()
+{
+    while (!mAdmissionQueue.isEmpty()) {
+        QTcpSocket *socket = mAdmissionQueue.first();
 
-    bool roomForMore = mMaxConnections > 0 && mSockets.size() < mMaxConnections;
-    bool maxOk = mMaxConnections <= 0;
-    bool hasPeer = hasPeerAddress(socket->peerAddress());
+        if (socket->state() != QAbstractSocket::ConnectedState) {
+            mAdmissionQueue.removeFirst();
+            socket->deleteLater();
+            continue;
+        }
+
+        if (!mAdmission.tryAcquire()) {
+            mAdmissionTimer.start(mAdmission.nextTokenIn());
+            return;
+        }
+
+        mAdmissionQueue.removeFirst();
+        accept(socket);
+    }
+}
 
-    if (!hasPeer && (maxOk || roomForMore)) {
-        connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
-        connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+/*!
+  Turns the connection \a socket away with a busy control frame telling the
+  client how long to wait before trying again.
+*/
+void WlanServer::rejectBusy(QTcpSocket *socket)
+{
+    int delay = mAdmission.retryAfter(mAdmissionQueue.size());
 
-        mSockets.append(socket);
+    qDebug() << "WlanServer::rejectBusy(): Too many connections, retry after"
+             << delay << "ms:" << socket->peerAddress().toString();
 
-        qDebug() << "WlanServer::onNewConnection(): Peer address:"
-                 << socket->peerAddress().toString();
+    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    socket->write(Common::toControlMessage("BUSY " + QByteArray::number(delay)));
+    socket->disconnectFromHost();
+}
 
-        //On connection, we'll start broadcasting less often
-        mBroadcastTimer.setInterval(BroadCastIntervalAfterFirstConnection);
+/*!
+  Accepts the connection \a socket from the client. Connects required signals
+  and slots of the new connection in order to receive data from the client.
+*/
+void WlanServer::accept(QTcpSocket *socket)
+{
+    QString peerKey = socket->peerAddress().toString();
+    QList<QTcpSocket*> duplicates = mPeers.values(peerKey);
 
-        emit clientConnected(socket->peerAddress().toString());
+    if (!duplicates.isEmpty() && mDuplicatePolicy == ConnectionIf::RejectDuplicates) {
+        qDebug() << "WlanServer::accept():"
+                 << "Client already connected!";
+        socket->close();
         return;
     }
 
-    if (!roomForMore) {
-        qDebug() << "WlanServer::onNewConnection(): Server is full.";
-    } else if (hasPeer) {
-        qDebug() << "WlanServer::onNewConnection():"
-                 << "Client already connected!";
+    if (mDuplicatePolicy != ConnectionIf::ReplaceDuplicates) {
+        duplicates.clear();
+    }
+
+    //Replaced connections make room for the new one
+    int clients = mSockets.size() - duplicates.size();
+
+    if (mMaxConnections > 0 && clients >= mMaxConnections) {
+        qDebug() << "WlanServer::accept(): Server is full.";
+        socket->close();
+        return;
+    }
 
+    mSocketOptions.apply(socket);
+    connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+
+    int clientId = mNextClientId++;
+    mSockets.append(socket);
+    mClientIds.insert(socket, clientId);
+    mClientSockets.insert(clientId, socket);
+    mPeers.insert(peerKey, socket);
+    mPeerKeys.insert(socket, peerKey);
+    mProtocol.addClient(clientId, socket);
+
+    qDebug() << "WlanServer::accept(): Peer address:"
+             << peerKey << "id:" << clientId;
+
+    //On connection, we'll start broadcasting less often
+    mBroadcastTimer.setInterval(BroadCastIntervalAfterFirstConnection);
+
+    emit clientAdded(clientId, peerKey);
+    emit clientConnected(peerKey);
+
+    //The old connections are closed only after the new one has been accepted
+    //so that the server never appears to have lost all of its clients
+    foreach (QTcpSocket *duplicate, duplicates) {
+        qDebug() << "WlanServer::accept(): Replacing the old connection"
+                 << mClientIds.value(duplicate);
+        duplicate->blockSignals(true);
+        duplicate->abort();
+        duplicate->blockSignals(false);
+        removeSocket(duplicate);
     }
 
-    socket->close();
+    //Data may have arrived while the connection was waiting for admission
+    if (socket->bytesAvailable() > 0) {
+        mProtocol.receive(clientId);
+    }
 }
 
 /*!
@@ -324,7 +622,43 @@ void WlanServer::onDisconnected()
         return;
     }
 
+    removeSocket(socket);
+
+    qDebug() << "WlanServer::onDisconnected(): <=";
+}
+
+/*!
+  A client hasn't sent anything, not even heartbeats, in time and is
+  considered gone.
+*/
+void WlanServer::onTimedOut(int clientId)
+{
+    QTcpSocket *socket = mClientSockets.value(clientId);
+
+    if (!socket) {
+        return;
+    }
+
+    qDebug() << "WlanServer::onTimedOut(): Client is not responding:"
+             << socket->peerAddress().toString();
+
+    socket->blockSignals(true);
+    socket->abort();
+    socket->blockSignals(false);
+
+    removeSocket(socket);
+}
+
+/*!
+  Removes the disconnected client \a socket.
+*/
+void WlanServer::removeSocket(QTcpSocket *socket)
+{
+    int clientId = mClientIds.take(socket);
+    mClientSockets.remove(clientId);
+    mPeers.remove(mPeerKeys.take(socket), socket);
     mSockets.removeOne(socket);
+    mProtocol.removeClient(clientId);
     socket->deleteLater();
 
     //If all clients have disconnected we'll start broadcasting more frequently
@@ -332,9 +666,8 @@ void WlanServer::onDisconnected()
         mBroadcastTimer.setInterval(BroadCastInterval);
     }
 
+    emit clientRemoved(clientId);
     emit clientDisconnected(mSockets.size());
-
-    qDebug() << "WlanServer::onDisconnected(): <=";
 }
 
 
@@ -356,7 +689,7 @@ void WlanServer::onReadyRead()
         return;
     }
 
-    Common::readFromSocket(socket, this, "read", "WlanServer::onReadyRead():");
+    mProtocol.receive(mClientIds.value(socket));
 
     qDebug() << "WlanServer::onReadyRead(): <=";
 }
@@ -404,13 +737,7 @@ void WlanServer::broadcastServerInfo()
 
 bool WlanServer::hasPeerAddress(const QHostAddress &address)
 {
-    foreach (QTcpSocket *socket, mSockets) {
-        if (socket->peerAddress().toString() == address.toString()) {
-            return true;
-        }
-    }
-
-    return false;
+    return mPeers.contains(address.toString());
 }
 
 void WlanServer::onNewDiscoveryConnection()
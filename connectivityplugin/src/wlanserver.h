@@ -10,13 +10,17 @@
 #define WLANSERVER_H
 
 #include <QObject>
+#include <QHash>
 #include <QList>
 #include <QHostAddress>
 #include <QDebug>
 #include <QTimer>
 #include <QNetworkSession>
 
+#include "admissioncontrol.h"
 #include "networkserverinfo.h"
+#include "serverprotocol.h"
+#include "socketoptions.h"
 
 //Forward declarations
 class QTcpServer;
@@ -31,12 +35,23 @@ public:
     ~WlanServer();
 
     QString clientName(int index) const;
+    QString peerName(int clientId) const;
+    QList<int> clientIds() const;
     QString errorString() const;
+    qint64 bytesToWrite() const;
+    Handshake handshake(int clientId) const;
+    QList<SendQueue::Statistics> queueStatistics() const;
 
 public slots:
     bool startServer(int port, int bdport);
     void stopServer();
     qint64 write(const QByteArray &data);
+    qint64 write(const QByteArray &data, int priority, qint64 expires,
+                 const QString &key = QString(), bool delta = false);
+    qint64 write(int clientId, const QByteArray &data);
+    qint64 write(const ChannelInfo &channel, const QByteArray &message, bool compressed);
+    int publish(const QByteArray &data, const QString &topic, int fromClientId = 0);
+    qint64 writeObject(const QByteArray &data);
     void onIpChanged(QString ip);
     void onServerNameChanged(QString serverName);
     void onNetworkStateChanged(QNetworkSession::State state);
@@ -44,6 +59,13 @@ public slots:
     void onServerPortChanged(int port);
     void onBroadcastPortChanged(int port);
     void setMaxConnections(int max);
+    void setDuplicatePolicy(int policy);
+    void setSocketOptions(const SocketOptions &options);
+    void setHeartbeat(int interval, int timeout);
+    void setCompressionDictionary(const CompressionDictionary &dictionary);
+    void setQueueMode(int mode);
+    void setRelayRouter(const RelayRouter &router);
+    void setAdmissionControl(const AdmissionControl &admission);
     void setState(QNetworkSession::State state);
     void setIp(const QString &ip);
 
@@ -51,15 +73,29 @@ private slots:
     void onNewConnection();
     void onDisconnected();
     void onReadyRead();
+    void processAdmissionQueue();
     void broadcastServerInfo();
     bool hasPeerAddress(const QHostAddress &address);
 
     void onNewDiscoveryConnection();
+    void onTimedOut(int clientId);
+
+private:
+    void accept(QTcpSocket *socket);
+    void rejectBusy(QTcpSocket *socket);
+    void removeSocket(QTcpSocket *socket);
 
 signals:
-    void read(const QByteArray &data);
+    void read(const QByteArray &data, int clientId);
+    void channelRead(const QString &channel, const QByteArray &data, int clientId);
+    void rpcRead(const QByteArray &data, int clientId);
+    void topicRead(const QString &topic, const QByteArray &data, int clientId);
+    void objectRead(const QByteArray &data, int clientId);
     void clientDisconnected(int remainingClients);
     void clientConnected(const QString &peerName);
+    void clientAdded(int clientId, const QString &peerName);
+    void clientRemoved(int clientId);
+    void handshakeCompleted(int clientId, const QVariantMap &protocol);
     void reconnectToNetwork();
     void serverStopped();
     void socketError(int error);
@@ -69,11 +105,22 @@ private: //Data
     QTcpServer *mTcpServer; //Owned
     QUdpSocket *mBroadcastSocket; //Owned
     QList<QTcpSocket*> mSockets; //Owned
+    QList<QTcpSocket*> mAdmissionQueue; //Owned, waiting to be accepted
+    QHash<QTcpSocket*, int> mClientIds; //Stable ids of the connected clients
+    QHash<int, QTcpSocket*> mClientSockets;
+    QMultiHash<QString, QTcpSocket*> mPeers; //Connected clients by peer address
+    QHash<QTcpSocket*, QString> mPeerKeys;
+    int mDuplicatePolicy;
+    int mNextClientId;
     QTimer mBroadcastTimer;
+    QTimer mAdmissionTimer;
+    AdmissionControl mAdmission;
+    ServerProtocol mProtocol;
     int mBroadcastPort;
     QNetworkSession::State mState;
     NetworkServerInfo mServerInfo;
     int mMaxConnections;
+    SocketOptions mSocketOptions;
     QString mLastErrorString;
 };
 